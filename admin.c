@@ -0,0 +1,223 @@
+/**
+ * @file admin.c
+ * @brief Implements the admin HTTP listener helpers and the Prometheus text exposition writer.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "admin.h"
+#include "utils.h"
+
+/**
+ * @brief Histogram bucket bounds in nanoseconds (1 us to 10 s).
+ */
+static const uint64_t bucket_bounds_ns[] = {
+    1000ULL, 5000ULL, 10000ULL, 50000ULL, 100000ULL, 500000ULL,
+    1000000ULL, 5000000ULL, 10000000ULL, 50000000ULL, 100000000ULL, 500000000ULL,
+    1000000000ULL, 10000000000ULL
+};
+
+#define BUCKET_BOUND_COUNT (sizeof(bucket_bounds_ns) / sizeof(bucket_bounds_ns[0]))
+
+// Bucket bounds for histograms of counts, such as events per wakeup
+static const uint64_t count_bounds[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+
+#define COUNT_BOUND_COUNT (sizeof(count_bounds) / sizeof(count_bounds[0]))
+
+/**
+ * @brief Opens a non-blocking admin listener on the loopback interface.
+ *
+ * @param port The TCP port.
+ * @return int The listening socket, or -1 on error.
+ */
+int admin_listen(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("admin socket");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, ADMIN_MAX_CONNS) < 0) {
+        perror("admin bind");
+        close(fd);
+        return -1;
+    }
+    set_non_blocking(fd);
+    return fd;
+}
+
+/**
+ * @brief Returns whether a request has been received completely.
+ *
+ * @param request The bytes received so far.
+ * @param len The number of bytes.
+ * @return int 1 if the request is complete, 0 otherwise.
+ */
+int admin_request_complete(const char *request, size_t len) {
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (request[i] == '\n' && (request[i + 1] == '\n' ||
+                                   (request[i + 1] == '\r' && i + 2 < len && request[i + 2] == '\n'))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Determines what an HTTP request line asks for.
+ *
+ * @param request The request bytes.
+ * @param len The number of bytes.
+ * @return admin_route_t The route.
+ */
+admin_route_t admin_route(const char *request, size_t len) {
+    const char *line_end = memchr(request, '\n', len);
+    const char *space = memchr(request, ' ', len);
+    if (line_end == NULL || space == NULL || space > line_end) {
+        return ADMIN_ROUTE_BAD_REQUEST;
+    }
+    if (space - request != 3 || memcmp(request, "GET", 3) != 0) {
+        return ADMIN_ROUTE_BAD_METHOD;
+    }
+    const char *path = space + 1;
+    size_t path_len = 0;
+    while (path + path_len < line_end && path[path_len] != ' ' && path[path_len] != '?' && path[path_len] != '\r') {
+        path_len++;
+    }
+    if (path_len == 8 && memcmp(path, "/metrics", 8) == 0) {
+        return ADMIN_ROUTE_METRICS;
+    }
+    return ADMIN_ROUTE_NOT_FOUND;
+}
+
+/**
+ * @brief Builds a complete HTTP response with the given status and body.
+ *
+ * @param status The status line after "HTTP/1.0 ", e.g. "200 OK".
+ * @param body The response body.
+ * @param body_len The body length.
+ * @param out Receives a malloc'd response.
+ * @param out_len Receives the response length.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int admin_build_response(const char *status, const char *body, size_t body_len, char **out, size_t *out_len) {
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              status, ADMIN_CONTENT_TYPE, body_len);
+    if (header_len < 0 || (size_t)header_len >= sizeof(header)) {
+        return -1;
+    }
+    char *response = malloc((size_t)header_len + body_len);
+    if (response == NULL) {
+        perror("malloc admin response");
+        return -1;
+    }
+    memcpy(response, header, (size_t)header_len);
+    memcpy(response + header_len, body, body_len);
+    *out = response;
+    *out_len = (size_t)header_len + body_len;
+    return 0;
+}
+
+/**
+ * @brief Writes the HELP and TYPE lines that introduce a metric family.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param type "counter", "gauge" or "histogram".
+ * @param help One-line description.
+ */
+void admin_metric_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Writes one sample, optionally with a single label.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param label The label name, or NULL for an unlabelled sample.
+ * @param label_value The label value (ignored if `label` is NULL).
+ * @param value The sample value.
+ */
+void admin_metric_value(FILE *out, const char *name, const char *label, const char *label_value, uint64_t value) {
+    if (label != NULL) {
+        fprintf(out, "%s{%s=\"%s\"} %llu\n", name, label, label_value, (unsigned long long)value);
+    } else {
+        fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+    }
+}
+
+/**
+ * @brief Writes a complete histogram family from a nanosecond histogram, in seconds.
+ *
+ * @param out The stream.
+ * @param name The metric name (should end in "_seconds").
+ * @param help One-line description.
+ * @param h The histogram of nanosecond values.
+ */
+void admin_metric_histogram(FILE *out, const char *name, const char *help, const histogram_t *h) {
+    admin_metric_header(out, name, "histogram", help);
+    admin_metric_histogram_samples(out, name, NULL, NULL, h);
+}
+
+/**
+ * @brief Writes the samples of one nanosecond histogram, in seconds, optionally with a label.
+ *
+ * @param out The stream.
+ * @param name The metric name (should end in "_seconds").
+ * @param label The label name, or NULL for unlabelled samples.
+ * @param label_value The label value (ignored if `label` is NULL).
+ * @param h The histogram of nanosecond values.
+ */
+void admin_metric_histogram_samples(FILE *out, const char *name, const char *label, const char *label_value,
+                                    const histogram_t *h) {
+    char labels[128] = "";
+    char series[128] = "";
+    if (label != NULL) {
+        snprintf(labels, sizeof(labels), "%s=\"%s\",", label, label_value);
+        snprintf(series, sizeof(series), "{%s=\"%s\"}", label, label_value);
+    }
+    for (size_t i = 0; i < BUCKET_BOUND_COUNT; i++) {
+        fprintf(out, "%s_bucket{%sle=\"%g\"} %llu\n", name, labels, (double)bucket_bounds_ns[i] / 1e9,
+                (unsigned long long)histogram_count_le(h, bucket_bounds_ns[i]));
+    }
+    fprintf(out, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, labels, (unsigned long long)h->total);
+    fprintf(out, "%s_sum%s %.9f\n", name, series, h->sum / 1e9);
+    fprintf(out, "%s_count%s %llu\n", name, series, (unsigned long long)h->total);
+}
+
+/**
+ * @brief Writes a complete histogram family from a histogram of counts.
+ * Buckets are cumulative over powers of two from 1 to 1024.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param help One-line description.
+ * @param h The histogram of counts.
+ */
+void admin_metric_count_histogram(FILE *out, const char *name, const char *help, const histogram_t *h) {
+    admin_metric_header(out, name, "histogram", help);
+    for (size_t i = 0; i < COUNT_BOUND_COUNT; i++) {
+        fprintf(out, "%s_bucket{le=\"%llu\"} %llu\n", name, (unsigned long long)count_bounds[i],
+                (unsigned long long)histogram_count_le(h, count_bounds[i]));
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->total);
+    fprintf(out, "%s_sum %.0f\n", name, h->sum);
+    fprintf(out, "%s_count %llu\n", name, (unsigned long long)h->total);
+}
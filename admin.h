@@ -0,0 +1,139 @@
+/**
+ * @file admin.h
+ * @brief Declares the admin HTTP listener helpers and the Prometheus text exposition writer.
+ * @author Mohammed Uddin
+ *
+ * The admin listener speaks just enough HTTP/1.0 for a metrics scraper: one GET request
+ * per connection, answered with Connection: close. Connections are driven by the
+ * broker's own poll loop, so they never block message traffic.
+ */
+
+#ifndef LITEMQ_ADMIN_H
+#define LITEMQ_ADMIN_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "histogram.h"
+
+#define ADMIN_MAX_CONNS 4
+#define ADMIN_MAX_REQUEST 4096
+#define ADMIN_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+/**
+ * @brief What an admin request asks for.
+ */
+typedef enum {
+    ADMIN_ROUTE_METRICS,    ///< GET /metrics.
+    ADMIN_ROUTE_NOT_FOUND,  ///< GET of any other path.
+    ADMIN_ROUTE_BAD_METHOD, ///< Any method other than GET.
+    ADMIN_ROUTE_BAD_REQUEST ///< Not an HTTP request line.
+} admin_route_t;
+
+/**
+ * @brief State of one admin connection.
+ */
+typedef struct {
+    int fd;                          ///< The connection socket (-1 if the slot is free).
+    char request[ADMIN_MAX_REQUEST]; ///< Request bytes received so far.
+    size_t request_len;              ///< Number of request bytes received.
+    char *response;                  ///< Complete response, once built.
+    size_t response_len;             ///< Length of the response.
+    size_t response_off;             ///< Bytes of the response already sent.
+} admin_conn_t;
+
+/**
+ * @brief Opens a non-blocking admin listener on the loopback interface.
+ *
+ * @param port The TCP port.
+ * @return int The listening socket, or -1 on error.
+ */
+int admin_listen(int port);
+
+/**
+ * @brief Returns whether a request has been received completely (headers end with a blank line).
+ *
+ * @param request The bytes received so far.
+ * @param len The number of bytes.
+ * @return int 1 if the request is complete, 0 otherwise.
+ */
+int admin_request_complete(const char *request, size_t len);
+
+/**
+ * @brief Determines what an HTTP request line asks for.
+ *
+ * @param request The request bytes.
+ * @param len The number of bytes.
+ * @return admin_route_t The route.
+ */
+admin_route_t admin_route(const char *request, size_t len);
+
+/**
+ * @brief Builds a complete HTTP response with the given status and body.
+ *
+ * @param status The status line after "HTTP/1.0 ", e.g. "200 OK".
+ * @param body The response body.
+ * @param body_len The body length.
+ * @param out Receives a malloc'd response.
+ * @param out_len Receives the response length.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int admin_build_response(const char *status, const char *body, size_t body_len, char **out, size_t *out_len);
+
+/**
+ * @brief Writes the HELP and TYPE lines that introduce a metric family.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param type "counter", "gauge" or "histogram".
+ * @param help One-line description.
+ */
+void admin_metric_header(FILE *out, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Writes one sample, optionally with a single label.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param label The label name, or NULL for an unlabelled sample.
+ * @param label_value The label value (ignored if `label` is NULL).
+ * @param value The sample value.
+ */
+void admin_metric_value(FILE *out, const char *name, const char *label, const char *label_value, uint64_t value);
+
+/**
+ * @brief Writes a complete histogram family from a nanosecond histogram, in seconds.
+ * Buckets are cumulative over a fixed set of bounds from 1 us to 10 s.
+ *
+ * @param out The stream.
+ * @param name The metric name (should end in "_seconds").
+ * @param help One-line description.
+ * @param h The histogram of nanosecond values.
+ */
+void admin_metric_histogram(FILE *out, const char *name, const char *help, const histogram_t *h);
+
+/**
+ * @brief Writes the samples of one nanosecond histogram, in seconds, optionally with a label.
+ * Used after admin_metric_header() to put several labelled histograms in one family.
+ *
+ * @param out The stream.
+ * @param name The metric name (should end in "_seconds").
+ * @param label The label name, or NULL for unlabelled samples.
+ * @param label_value The label value (ignored if `label` is NULL).
+ * @param h The histogram of nanosecond values.
+ */
+void admin_metric_histogram_samples(FILE *out, const char *name, const char *label, const char *label_value,
+                                    const histogram_t *h);
+
+/**
+ * @brief Writes a complete histogram family from a histogram of counts.
+ * Buckets are cumulative over powers of two from 1 to 1024.
+ *
+ * @param out The stream.
+ * @param name The metric name.
+ * @param help One-line description.
+ * @param h The histogram of counts.
+ */
+void admin_metric_count_histogram(FILE *out, const char *name, const char *help, const histogram_t *h);
+
+#endif // LITEMQ_ADMIN_H
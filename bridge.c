@@ -0,0 +1,261 @@
+/**
+ * @file bridge.c
+ * @brief Implements the bookkeeping of broker-to-broker bridges.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bridge.h"
+#include "log.h"
+
+/**
+ * @brief Initialises the bridge state: no bridges, no upstream broker.
+ *
+ * @param s The state.
+ * @param id This broker's id, non-zero.
+ */
+void bridge_init(bridge_t *s, uint64_t id) {
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+}
+
+/**
+ * @brief Frees the bridge state.
+ *
+ * @param s The state.
+ */
+void bridge_free(bridge_t *s) {
+    for (int i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        free(s->peers[i].from.items);
+    }
+    free(s->positions.items);
+    free(s->unsaved.items);
+    bridge_init(s, s->id);
+}
+
+/**
+ * @brief Makes up a broker id from the time, the process id and the port.
+ *
+ * @param port The client port.
+ * @return uint64_t The id, never 0.
+ */
+uint64_t bridge_new_id(int port) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t seed[3] = { (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec, (uint64_t)getpid(), (uint64_t)port };
+    return frame_key_hash(seed, sizeof(seed));
+}
+
+/**
+ * @brief Matches a topic against a pattern in which '*' matches any run of characters.
+ * Backtracks to the last '*' only, so it runs in O(pattern * topic) at worst.
+ *
+ * @param pattern The pattern.
+ * @param topic The topic.
+ * @return int 1 if the topic matches, 0 otherwise.
+ */
+int bridge_match(const char *pattern, const char *topic) {
+    const char *star = NULL;
+    const char *resume = NULL;
+    while (*topic != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = topic;
+        } else if (*pattern == *topic) {
+            pattern++;
+            topic++;
+        } else if (star != NULL) {
+            pattern = star + 1;
+            topic = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/**
+ * @brief Adds a pattern to a filter. A pattern added again keeps the earlier start of the two.
+ *
+ * @param f The filter.
+ * @param pattern The pattern.
+ * @param from_seq Start of matching topics without a position, 0 for the next message.
+ * @return int 0 on success, -1 if the pattern is invalid or the filter is full.
+ */
+int bridge_filter_add(bridge_filter_t *f, const char *pattern, uint64_t from_seq) {
+    if (!is_valid_pattern(pattern, strlen(pattern))) {
+        return -1;
+    }
+    for (size_t i = 0; i < f->count; i++) {
+        bridge_pattern_t *p = &f->items[i];
+        if (strcmp(p->pattern, pattern) == 0) {
+            if (from_seq != 0 && (p->from_seq == 0 || from_seq < p->from_seq)) {
+                p->from_seq = from_seq;
+            }
+            return 0;
+        }
+    }
+    if (f->count == BRIDGE_MAX_PATTERNS) {
+        return -1;
+    }
+    bridge_pattern_t *p = &f->items[f->count++];
+    snprintf(p->pattern, sizeof(p->pattern), "%s", pattern);
+    p->from_seq = from_seq;
+    return 0;
+}
+
+/**
+ * @brief Adds the patterns of a comma-separated list to a filter.
+ *
+ * @param f The filter.
+ * @param list The list, e.g. "orders.*,metrics".
+ * @return int 0 on success, -1 if a pattern is invalid or the filter is full.
+ */
+int bridge_filter_parse(bridge_filter_t *f, const char *list) {
+    const char *start = list;
+    for (;;) {
+        const char *comma = strchr(start, ',');
+        size_t len = comma != NULL ? (size_t)(comma - start) : strlen(start);
+        char pattern[MAX_TOPIC_LEN];
+        if (len == 0 || len >= sizeof(pattern)) {
+            return -1;
+        }
+        memcpy(pattern, start, len);
+        pattern[len] = '\0';
+        if (bridge_filter_add(f, pattern, 0) < 0) {
+            return -1;
+        }
+        if (comma == NULL) {
+            return 0;
+        }
+        start = comma + 1;
+    }
+}
+
+/**
+ * @brief Checks a topic against a filter.
+ *
+ * @param f The filter.
+ * @param topic The topic.
+ * @param from_seq Receives the earliest start of the matching patterns (0 if all start
+ * with the next message), or NULL.
+ * @return int 1 if a pattern matches, 0 otherwise.
+ */
+int bridge_filter_match(const bridge_filter_t *f, const char *topic, uint64_t *from_seq) {
+    int matched = 0;
+    uint64_t from = 0;
+    for (size_t i = 0; i < f->count; i++) {
+        const bridge_pattern_t *p = &f->items[i];
+        if (!bridge_match(p->pattern, topic)) {
+            continue;
+        }
+        if (from_seq == NULL) {
+            return 1;
+        }
+        matched = 1;
+        if (p->from_seq != 0 && (from == 0 || p->from_seq < from)) {
+            from = p->from_seq;
+        }
+    }
+    if (from_seq != NULL) {
+        *from_seq = from;
+    }
+    return matched;
+}
+
+/**
+ * @brief Returns the bridge on a connection.
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return bridge_peer_t* The bridge, or NULL if the connection is not one.
+ */
+bridge_peer_t *bridge_find_peer(bridge_t *s, int slot, uint32_t conn_id) {
+    for (int i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        if (s->peers[i].slot == slot && s->peers[i].conn_id == conn_id && slot != 0) {
+            return &s->peers[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Registers a connection as a bridge.
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return bridge_peer_t* The bridge, or NULL if BRIDGE_MAX_PEERS are connected.
+ */
+bridge_peer_t *bridge_add_peer(bridge_t *s, int slot, uint32_t conn_id) {
+    for (int i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        bridge_peer_t *p = &s->peers[i];
+        if (p->slot == 0) {
+            p->slot = slot;
+            p->conn_id = conn_id;
+            p->origin = 0;
+            p->live = 0;
+            p->filter.count = 0;
+            p->from.count = 0;
+            s->peer_count++;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Forgets a bridge. Its position list stays allocated for the next one.
+ *
+ * @param s The state.
+ * @param p The bridge.
+ */
+void bridge_remove_peer(bridge_t *s, bridge_peer_t *p) {
+    p->slot = 0;
+    p->conn_id = 0;
+    p->live = 0;
+    p->filter.count = 0;
+    p->from.count = 0;
+    s->peer_count--;
+}
+
+/**
+ * @brief Returns this broker's position in a topic bridged from the upstream broker.
+ *
+ * @param s The state.
+ * @param topic The topic.
+ * @return uint64_t The next sequence number expected, 0 if unknown.
+ */
+uint64_t bridge_position(const bridge_t *s, const char *topic) {
+    const repl_pos_t *pos = repl_pos_find(&s->positions, topic);
+    return pos != NULL ? pos->seq : 0;
+}
+
+/**
+ * @brief Moves this broker's position in a topic bridged from the upstream broker forward.
+ *
+ * @param s The state.
+ * @param topic The topic.
+ * @param next_seq The next sequence number expected.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int bridge_advance(bridge_t *s, const char *topic, uint64_t next_seq) {
+    repl_pos_t *pos = repl_pos_upsert(&s->positions, topic);
+    if (pos == NULL) {
+        return -1;
+    }
+    if (next_seq > pos->seq) {
+        pos->seq = next_seq;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file bridge.h
+ * @brief Declares the bookkeeping of broker-to-broker bridges.
+ * @author Mohammed Uddin
+ *
+ * A bridge copies selected topics from an upstream broker into this one. The
+ * downstream broker opens one connection to the upstream broker's client port and
+ * announces the topic patterns it wants, then its position in each topic it has
+ * already received something from:
+ *
+ *     BRIDGE orders.* origin=41 from=1\n
+ *     BRIDGE metrics origin=41\n
+ *     BRIDGE orders.eu from=8\n
+ *     BRIDGE\n
+ *
+ * A pattern line carries the downstream broker's id in "origin". '*' in a pattern
+ * matches any run of characters. "from" on a pattern line is where topics without an
+ * announced position start; without it they start with the next message. A position
+ * line names one topic and its next sequence number. The bare BRIDGE ends the list.
+ *
+ * The upstream broker then sends, for every persisted topic matching a pattern, the
+ * records from the announced position as MSG frames with "seq" and "origin", tells
+ * the bridge where each topic it starts live begins ("BRIDGE <topic> from=<n>"), and
+ * answers with a bare BRIDGE. From then on it sends every matching message as it is
+ * published. Messages queued for bridges during one read are sent together.
+ *
+ * The downstream broker publishes each message locally, so its subscribers receive
+ * it without further traffic on the link, and advances its position in the topic.
+ * After a lost connection it reconnects, announces its positions and "from=1" on its
+ * patterns, and so receives what it missed exactly once: a record below its position
+ * is dropped as a duplicate.
+ *
+ * Loops are prevented with the "origin" field: it names the broker a message was first
+ * published on and is kept when a bridged message is published again. A broker does
+ * not send a bridge the messages that originated on the bridge's broker, live or from
+ * its log, and does not republish a message that originated on itself. The origin of
+ * a bridged record is stored in its log record, and the downstream broker saves its
+ * position in each topic next to the topic's log (see persistence.h), so both survive
+ * a restart of either broker.
+ *
+ * This module keeps both sides' state: the bridges this broker serves and their
+ * patterns, and the upstream connection with its patterns and positions. The broker
+ * core (broker.c) moves the frames.
+ */
+
+#ifndef LITEMQ_BRIDGE_H
+#define LITEMQ_BRIDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "replication.h"
+
+#define BRIDGE_MAX_PEERS 8
+#define BRIDGE_MAX_PATTERNS 16
+
+/**
+ * @brief A topic pattern of a bridge.
+ */
+typedef struct {
+    char pattern[MAX_TOPIC_LEN]; ///< The pattern.
+    uint64_t from_seq;           ///< Start of matching topics without a position, 0 for the next message.
+} bridge_pattern_t;
+
+/**
+ * @brief The topic patterns of a bridge.
+ */
+typedef struct {
+    bridge_pattern_t items[BRIDGE_MAX_PATTERNS]; ///< The patterns.
+    size_t count;                                ///< Number of patterns.
+} bridge_filter_t;
+
+/**
+ * @brief A downstream broker bridging topics from this one.
+ */
+typedef struct {
+    int slot;               ///< The bridge's client slot, 0 if the entry is free.
+    uint32_t conn_id;       ///< Its connection number.
+    uint64_t origin;        ///< Id of the downstream broker.
+    int live;               ///< Whether it has caught up and receives new messages.
+    bridge_filter_t filter; ///< Patterns it asked for.
+    repl_pos_list_t from;   ///< Positions it announced, until it has caught up.
+} bridge_peer_t;
+
+/**
+ * @brief Bridge state of one broker core.
+ */
+typedef struct {
+    uint64_t id;                             ///< This broker's id, sent as "origin" (never 0).
+    bridge_peer_t peers[BRIDGE_MAX_PEERS];   ///< Bridges served by this broker.
+    size_t peer_count;                       ///< Bridges in use.
+    int unflushed;                           ///< Whether messages are queued for bridges but not sent yet.
+    bridge_filter_t imports;                 ///< Patterns this broker bridges from its upstream (--bridge-topics).
+    int bridging;                            ///< Whether this broker bridges from an upstream broker.
+    int resuming;                            ///< Whether a handshake with the upstream broker completed before.
+    int upstream_slot;                       ///< Client slot of the connection to the upstream broker, 0 if none.
+    uint32_t upstream_conn;                  ///< Its connection number.
+    repl_pos_list_t positions;               ///< Next upstream sequence number, per bridged topic.
+    repl_pos_list_t unsaved;                 ///< Positions moved since they were last saved.
+    uint64_t catchups;                       ///< Bridges caught up from the logs.
+    uint64_t records_sent;                   ///< Records sent to bridges from the logs.
+    uint64_t exported;                       ///< Messages sent to bridges as they were published.
+    uint64_t suppressed;                     ///< Messages not sent to a bridge because they originated there.
+    uint64_t imported;                       ///< Messages received from the upstream broker and published.
+    uint64_t duplicates;                     ///< Messages received from the upstream broker below the position.
+    uint64_t looped;                         ///< Messages received from the upstream broker that originated here.
+} bridge_t;
+
+/**
+ * @brief Initialises the bridge state: no bridges, no upstream broker.
+ *
+ * @param s The state.
+ * @param id This broker's id, non-zero.
+ */
+void bridge_init(bridge_t *s, uint64_t id);
+
+/**
+ * @brief Frees the bridge state.
+ *
+ * @param s The state.
+ */
+void bridge_free(bridge_t *s);
+
+/**
+ * @brief Makes up a broker id from the time, the process id and the port.
+ *
+ * @param port The client port.
+ * @return uint64_t The id, never 0.
+ */
+uint64_t bridge_new_id(int port);
+
+/**
+ * @brief Matches a topic against a pattern in which '*' matches any run of characters.
+ *
+ * @param pattern The pattern.
+ * @param topic The topic.
+ * @return int 1 if the topic matches, 0 otherwise.
+ */
+int bridge_match(const char *pattern, const char *topic);
+
+/**
+ * @brief Adds a pattern to a filter. A pattern added again keeps the earlier start of the two.
+ *
+ * @param f The filter.
+ * @param pattern The pattern.
+ * @param from_seq Start of matching topics without a position, 0 for the next message.
+ * @return int 0 on success, -1 if the pattern is invalid or the filter is full.
+ */
+int bridge_filter_add(bridge_filter_t *f, const char *pattern, uint64_t from_seq);
+
+/**
+ * @brief Adds the patterns of a comma-separated list to a filter.
+ *
+ * @param f The filter.
+ * @param list The list, e.g. "orders.*,metrics".
+ * @return int 0 on success, -1 if a pattern is invalid or the filter is full.
+ */
+int bridge_filter_parse(bridge_filter_t *f, const char *list);
+
+/**
+ * @brief Checks a topic against a filter.
+ *
+ * @param f The filter.
+ * @param topic The topic.
+ * @param from_seq Receives the earliest start of the matching patterns (0 if all start
+ * with the next message), or NULL.
+ * @return int 1 if a pattern matches, 0 otherwise.
+ */
+int bridge_filter_match(const bridge_filter_t *f, const char *topic, uint64_t *from_seq);
+
+/**
+ * @brief Returns the bridge on a connection.
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return bridge_peer_t* The bridge, or NULL if the connection is not one.
+ */
+bridge_peer_t *bridge_find_peer(bridge_t *s, int slot, uint32_t conn_id);
+
+/**
+ * @brief Registers a connection as a bridge.
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return bridge_peer_t* The bridge, or NULL if BRIDGE_MAX_PEERS are connected.
+ */
+bridge_peer_t *bridge_add_peer(bridge_t *s, int slot, uint32_t conn_id);
+
+/**
+ * @brief Forgets a bridge.
+ *
+ * @param s The state.
+ * @param p The bridge.
+ */
+void bridge_remove_peer(bridge_t *s, bridge_peer_t *p);
+
+/**
+ * @brief Returns this broker's position in a topic bridged from the upstream broker.
+ *
+ * @param s The state.
+ * @param topic The topic.
+ * @return uint64_t The next sequence number expected, 0 if unknown.
+ */
+uint64_t bridge_position(const bridge_t *s, const char *topic);
+
+/**
+ * @brief Moves this broker's position in a topic bridged from the upstream broker forward.
+ *
+ * @param s The state.
+ * @param topic The topic.
+ * @param next_seq The next sequence number expected.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int bridge_advance(bridge_t *s, const char *topic, uint64_t next_seq);
+
+#endif // LITEMQ_BRIDGE_H
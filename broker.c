@@ -0,0 +1,2327 @@
+/**
+ * @file broker.c
+ * @brief Implements the broker core: client connections, frame handling, routing and fan-out.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <time.h>
+#include "broker.h"
+#include "utils.h"
+#include "log.h"
+#include "probes.h"
+#include "prof.h"
+
+// Kernel receive timestamps measure how long data waited in the socket buffer
+#ifdef SO_TIMESTAMPNS
+#define BROKER_HAVE_RX_TIMESTAMP 1
+#ifndef SCM_TIMESTAMPNS
+#define SCM_TIMESTAMPNS SO_TIMESTAMPNS
+#endif
+#endif
+
+static void close_client(broker_t *b, struct pollfd *pfd, client_t *client);
+static void save_upstream_positions(broker_t *b);
+
+/**
+ * @brief Results of one lane of a pool fan-out, merged by the core's thread afterwards.
+ */
+struct fanout_lane {
+    uint64_t deliveries;     ///< Subscribers the message was queued for.
+    uint64_t bytes_written;  ///< Bytes sent right away.
+    uint64_t failures;       ///< Subscribers left for the core's thread to close.
+    histogram_t queue_delay; ///< Queueing delay of stamped frames sent right away.
+};
+
+/**
+ * @brief Initialises a broker over caller-provided slot arrays, all slots free.
+ *
+ * @param b The broker.
+ * @param fds Array of at least max_clients + 1 pollfd structures.
+ * @param clients Array of at least max_clients + 1 client_t structures.
+ * @param max_clients The number of client slots.
+ */
+void broker_init(broker_t *b, struct pollfd *fds, client_t *clients, int max_clients) {
+    memset(b, 0, sizeof(*b));
+    b->fds = fds;
+    b->clients = clients;
+    b->max_clients = max_clients;
+    b->p_mode = PERSIST_NONE;
+    memset(clients, 0, ((size_t)max_clients + 1) * sizeof(client_t));
+    for (int i = 0; i <= max_clients; i++) {
+        fds[i].fd = -1;
+        fds[i].events = 0;
+        fds[i].revents = 0;
+        clients[i].fd = -1;
+        clients[i].type = CLIENT_TYPE_UNKNOWN;
+    }
+    histogram_init(&b->queue_delay);
+    stats_shard_init(&b->stats);
+    subtable_init(&b->subs);
+    repl_init(&b->repl);
+    partition_state_init(&b->parts, NULL);
+    bridge_init(&b->bridge, bridge_new_id(0));
+}
+
+/**
+ * @brief Closes every open client slot and frees the broker's buffers.
+ *
+ * @param b The broker.
+ */
+void broker_free(broker_t *b) {
+    for (int i = 1; i <= b->max_clients; i++) {
+        if (b->fds[i].fd != -1) {
+            close_client(b, &b->fds[i], &b->clients[i]);
+        }
+        free(b->clients[i].in_buf);
+        outq_free(&b->clients[i].out);
+        free(b->clients[i].marks);
+    }
+    if (b->splice_min > 0) {
+        splice_fanout_free(&b->fanout);
+    }
+    stats_shard_free(&b->stats);
+    subtable_free(&b->subs);
+    repl_free(&b->repl);
+    partition_state_free(&b->parts);
+    bridge_free(&b->bridge);
+    free(b->lanes);
+    b->lanes = NULL;
+}
+
+/**
+ * @brief Fans out messages with at least `min_subscribers` subscribers on a thread pool.
+ *
+ * @param b The broker.
+ * @param pool The pool, started with the broker's subscription index; owned by the caller.
+ * @param min_subscribers Smallest subscriber count worth splitting.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int broker_set_fanout_pool(broker_t *b, fanpool_t *pool, size_t min_subscribers) {
+    struct fanout_lane *lanes = malloc(((size_t)pool->threads + 1) * sizeof(*lanes));
+    if (lanes == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc fan-out lanes: %s", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i <= pool->threads; i++) {
+        histogram_init(&lanes[i].queue_delay);
+    }
+    free(b->lanes);
+    b->lanes = lanes;
+    b->pool = pool;
+    b->parallel_min = min_subscribers > 0 ? min_subscribers : 1;
+    return 0;
+}
+
+/**
+ * @brief Returns the name of a client type as used in reports.
+ *
+ * @param type The client type.
+ * @return const char* The name.
+ */
+const char *broker_client_type_name(client_type_t type) {
+    switch (type) {
+    case CLIENT_TYPE_PUBLISHER:
+        return "publisher";
+    case CLIENT_TYPE_SUBSCRIBER:
+        return "subscriber";
+    case CLIENT_TYPE_FOLLOWER:
+        return "follower";
+    case CLIENT_TYPE_LEADER:
+        return "leader";
+    case CLIENT_TYPE_BRIDGE:
+        return "bridge";
+    case CLIENT_TYPE_UPSTREAM:
+        return "upstream";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @brief Merges the broker's counters into one shard for a report.
+ * Each topic's subscribers are counted, and topics with subscribers but no traffic yet
+ * are added so they are reported too.
+ *
+ * @param b The broker.
+ * @return stats_shard_t* The merged counters (free with stats_shard_free() and free()), or NULL.
+ */
+stats_shard_t *broker_collect_stats(const broker_t *b) {
+    // Heap-allocated: a shard holds several histograms
+    stats_shard_t *total = malloc(sizeof(*total));
+    if (total == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc stats: %s", strerror(errno));
+        return NULL;
+    }
+    stats_shard_init(total);
+    stats_merge(total, &b->stats);
+    for (int i = 1; i <= b->max_clients; i++) {
+        if (b->fds[i].fd != -1 && b->clients[i].type == CLIENT_TYPE_SUBSCRIBER) {
+            topic_stats_t *ts = stats_topic(total, b->clients[i].topic);
+            if (ts != NULL) {
+                ts->subscribers++;
+            }
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Returns the subscribers of a topic, publishing pending subscription changes first.
+ *
+ * @param b The broker.
+ * @param topic The topic.
+ * @return const subtable_topic_t* The topic's subscribers, or NULL if it has none.
+ */
+static const subtable_topic_t *subscribers_of(broker_t *b, const char *topic) {
+    if (subtable_publish(&b->subs) < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Subscription changes not yet applied: out of memory");
+    }
+    return subtable_lookup(subtable_current(&b->subs), topic);
+}
+
+/**
+ * @brief Resolves an index entry to its subscriber.
+ *
+ * @param b The broker.
+ * @param entry The index entry.
+ * @return client_t* The subscriber, or NULL if the connection is gone and the slot free or reused.
+ */
+static client_t *subscriber_at(broker_t *b, const subtable_entry_t *entry) {
+    client_t *client = &b->clients[entry->slot];
+    if (b->fds[entry->slot].fd == -1 || client->conn_id != entry->conn_id || client->type != CLIENT_TYPE_SUBSCRIBER) {
+        return NULL;
+    }
+    return client;
+}
+
+/**
+ * @brief Counts the live subscribers of a topic, or of all topics.
+ * Counting one topic applies pending subscription changes, so only the core's own
+ * thread may pass a topic.
+ *
+ * @param b The broker.
+ * @param topic The topic, or NULL to count every subscriber.
+ * @return size_t The number of subscribers.
+ */
+size_t broker_count_subscribers(broker_t *b, const char *topic) {
+    size_t count = 0;
+    if (topic != NULL) {
+        const subtable_topic_t *subs = subscribers_of(b, topic);
+        for (size_t i = 0; subs != NULL && i < subs->count; i++) {
+            if (subscriber_at(b, &subs->entries[i]) != NULL) {
+                count++;
+            }
+        }
+        return count;
+    }
+    for (int i = 1; i <= b->max_clients; i++) {
+        if (b->fds[i].fd != -1 && b->clients[i].type == CLIENT_TYPE_SUBSCRIBER) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Registers a connected, non-blocking socket in a free client slot.
+ *
+ * @param b The broker.
+ * @param fd The socket.
+ * @return int The slot index, or -1 if every slot is in use.
+ */
+int broker_add_client(broker_t *b, int fd) {
+    for (int i = 1; i <= b->max_clients; i++) {
+        if (b->fds[i].fd == -1) {
+            client_t *client = &b->clients[i];
+            b->fds[i].fd = fd;
+            b->fds[i].events = POLLIN;
+            client->fd = fd;
+            client->type = CLIENT_TYPE_UNKNOWN;
+            client->in_len = 0;
+            client->out_queued = 0;
+            client->out_sent = 0;
+            client->backlog_since = 0;
+            client->marks_head = 0;
+            client->marks_len = 0;
+            client->sub_pending = 0;
+            b->stats.connections_accepted++;
+            client->conn_id = (uint32_t)b->stats.connections_accepted;
+#ifdef BROKER_HAVE_RX_TIMESTAMP
+            if (b->timing_enabled) {
+                int one = 1;
+                setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+            }
+#endif
+            PROBE_CONN_ACCEPT(fd);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Accepts a connection from a listening socket into a free client slot.
+ *
+ * @param b The broker.
+ * @param listen_fd The listening socket.
+ */
+void broker_accept(broker_t *b, int listen_fd) {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    int new_socket = accept(listen_fd, (struct sockaddr *)&address, &addrlen);
+    if (new_socket < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "accept: %s", strerror(errno));
+        return;
+    }
+
+    set_non_blocking(new_socket);
+    if (broker_add_client(b, new_socket) < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Max clients reached. Rejecting new connection.");
+        close(new_socket);
+        return;
+    }
+    log_info(LOG_MODULE_BROKER, "New connection on fd %d", new_socket);
+}
+
+/**
+ * @brief Closes a client connection and resets its slot for reuse.
+ * The slot keeps its buffers allocated so a later connection can reuse them.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ */
+static void close_client(broker_t *b, struct pollfd *pfd, client_t *client) {
+    PROBE_CONN_CLOSE(pfd->fd, (int)client->type);
+    // A stale entry is skipped by fan-out anyway, so a failed removal only costs a lookup
+    int slot = (int)(client - b->clients);
+    if (client->type == CLIENT_TYPE_SUBSCRIBER) {
+        subtable_remove(&b->subs, slot, client->conn_id);
+        if (b->parts.group_count > 0) {
+            partition_group_leave(&b->parts, slot, client->conn_id);
+        }
+    } else if (client->type == CLIENT_TYPE_FOLLOWER) {
+        repl_follower_t *follower = repl_find_follower(&b->repl, slot, client->conn_id);
+        if (follower != NULL) {
+            repl_remove_follower(&b->repl, follower);
+        }
+        log_info(LOG_MODULE_BROKER, "Follower on fd %d disconnected", pfd->fd);
+    } else if (client->type == CLIENT_TYPE_LEADER && b->repl.upstream_slot == slot) {
+        b->repl.upstream_slot = 0;
+        b->repl.upstream_conn = 0;
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Lost the connection to the leader");
+    } else if (client->type == CLIENT_TYPE_BRIDGE) {
+        bridge_peer_t *peer = bridge_find_peer(&b->bridge, slot, client->conn_id);
+        if (peer != NULL) {
+            bridge_remove_peer(&b->bridge, peer);
+        }
+        log_info(LOG_MODULE_BROKER, "Bridge on fd %d disconnected", pfd->fd);
+    } else if (client->type == CLIENT_TYPE_UPSTREAM && b->bridge.upstream_slot == slot) {
+        save_upstream_positions(b);
+        b->bridge.upstream_slot = 0;
+        b->bridge.upstream_conn = 0;
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Lost the connection to the upstream broker");
+    }
+    close(pfd->fd);
+    pfd->fd = -1;
+    pfd->events = 0;
+    client->fd = -1;
+    client->type = CLIENT_TYPE_UNKNOWN;
+    memset(client->topic, 0, MAX_TOPIC_LEN);
+    client->in_len = 0;
+    outq_clear(&client->out);
+    client->backlog_since = 0;
+    client->marks_head = 0;
+    client->marks_len = 0;
+    client->sub_pending = 0;
+}
+
+/**
+ * @brief Closes a client connection and resets its slot for reuse.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ */
+void broker_close_client(broker_t *b, int slot) {
+    close_client(b, &b->fds[slot], &b->clients[slot]);
+}
+
+/**
+ * @brief Ensures a buffer can hold `needed` bytes, growing it geometrically.
+ *
+ * @param buf Pointer to the buffer pointer.
+ * @param cap Pointer to the buffer capacity.
+ * @param needed The required capacity.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int reserve_buffer(char **buf, size_t *cap, size_t needed) {
+    if (needed <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : BROKER_READ_CHUNK;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char *grown = realloc(*buf, new_cap);
+    if (grown == NULL) {
+        log_error(LOG_MODULE_BROKER, "realloc client buffer: %s", strerror(errno));
+        return -1;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Remembers the end of a stamped frame just queued for a client.
+ *
+ * @param client Pointer to the client_t structure for the client.
+ * @param ingress_ns The ingress timestamp of the message.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int push_delay_mark(client_t *client, uint64_t ingress_ns) {
+    if (client->marks_len == client->marks_cap) {
+        if (client->marks_head > 0) {
+            memmove(client->marks, client->marks + client->marks_head,
+                    (client->marks_len - client->marks_head) * sizeof(delay_mark_t));
+            client->marks_len -= client->marks_head;
+            client->marks_head = 0;
+        } else {
+            size_t new_cap = client->marks_cap ? client->marks_cap * 2 : 256;
+            delay_mark_t *grown = realloc(client->marks, new_cap * sizeof(delay_mark_t));
+            if (grown == NULL) {
+                log_error(LOG_MODULE_BROKER, "realloc delay marks: %s", strerror(errno));
+                return -1;
+            }
+            client->marks = grown;
+            client->marks_cap = new_cap;
+        }
+    }
+    client->marks[client->marks_len].end = client->out_queued;
+    client->marks[client->marks_len].ingress_ns = ingress_ns;
+    client->marks_len++;
+    return 0;
+}
+
+/**
+ * @brief Records the queueing delay of every stamped frame that has been fully written.
+ *
+ * @param queue_delay The histogram to record into.
+ * @param client Pointer to the client_t structure for the client.
+ */
+static void record_sent_marks(histogram_t *queue_delay, client_t *client) {
+    if (client->marks_head == client->marks_len) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    while (client->marks_head < client->marks_len && client->marks[client->marks_head].end <= client->out_sent) {
+        uint64_t ingress = client->marks[client->marks_head].ingress_ns;
+        histogram_record(queue_delay, now > ingress ? now - ingress : 0);
+        client->marks_head++;
+    }
+    if (client->marks_head == client->marks_len) {
+        client->marks_head = 0;
+        client->marks_len = 0;
+    }
+}
+
+/**
+ * @brief Sends as much of a client's queued output as the socket accepts.
+ * Keeps POLLOUT armed while output remains queued. Touches only the client, so fan-out
+ * pool threads can call it for different clients at once.
+ *
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @param queue_delay Histogram for the queueing delay of stamped frames sent now.
+ * @return ssize_t Bytes written, or -1 if the connection failed (errno is set).
+ */
+static ssize_t send_queued(struct pollfd *pfd, client_t *client, histogram_t *queue_delay) {
+    ssize_t n = outq_send(&client->out, client->fd);
+    if (n < 0) {
+        return -1;
+    }
+    client->out_sent += (uint64_t)n;
+    record_sent_marks(queue_delay, client);
+    if (client->out.pending == 0) {
+        client->backlog_since = 0;
+        pfd->events = POLLIN;
+    } else {
+        if (client->backlog_since == 0) {
+            client->backlog_since = monotonic_ns();
+        }
+        pfd->events = POLLIN | POLLOUT;
+    }
+    return n;
+}
+
+/**
+ * @brief Sends as much of a client's queued output as the socket accepts, closing it on failure.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @return int 0 on success, -1 if the connection failed and was closed.
+ */
+static int flush_client(broker_t *b, struct pollfd *pfd, client_t *client) {
+    ssize_t n = send_queued(pfd, client, &b->queue_delay);
+    if (n < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "write to subscriber fd %d failed: %s", client->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    b->stats.bytes_written += (uint64_t)n;
+    return 0;
+}
+
+/**
+ * @brief Sends a frame whose payload is loaded in the splice fan-out engine.
+ * The header is sent directly and the payload spliced from the engine's pipe; whatever
+ * the socket does not take right away is queued from the shared payload instead.
+ * Only used while nothing else is queued for the client, so frames stay in order.
+ *
+ * @param b The broker.
+ * @param client Pointer to the client_t structure for the client.
+ * @param header The formatted frame header.
+ * @param header_len The header length in bytes.
+ * @param shared The shared payload loaded in the engine.
+ * @param zerocopy Whether a queued remainder should be sent with MSG_ZEROCOPY.
+ * @return int 0 on success, -1 if the connection failed or allocation failed.
+ */
+static int splice_frame(broker_t *b, client_t *client, const char *header, size_t header_len, payload_t *shared, int zerocopy) {
+    ssize_t n;
+    do {
+        n = send(client->fd, header, header_len, MSG_NOSIGNAL | MSG_MORE);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+    }
+    size_t header_sent = n > 0 ? (size_t)n : 0;
+    size_t payload_sent = 0;
+    if (header_sent == header_len) {
+        ssize_t spliced = splice_fanout_send(&b->fanout, client->fd);
+        if (spliced < 0) {
+            return -1;
+        }
+        payload_sent = (size_t)spliced;
+        b->splice_deliveries++;
+    }
+    client->out_sent += header_sent + payload_sent;
+    b->stats.bytes_written += header_sent + payload_sent;
+    if (outq_append_bytes(&client->out, header + header_sent, header_len - header_sent) < 0 ||
+        outq_append_payload_range(&client->out, shared, payload_sent, shared->len - payload_sent, zerocopy) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues a MSG frame for a client and tries to send it immediately.
+ * Subscribers whose backlog exceeds BROKER_MAX_CLIENT_BACKLOG are disconnected. A shared
+ * payload is referenced rather than copied, and is sent with MSG_ZEROCOPY when
+ * zero-copy is enabled and the payload is at least --zerocopy bytes. A payload loaded
+ * into the splice fan-out engine is spliced to an idle client directly.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param shared The payload as a shared payload_t, or NULL to copy `payload`.
+ * @param fields Optional header fields (timestamps), or NULL.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+static int queue_frame(broker_t *b, struct pollfd *pfd, client_t *client, const char *topic, const char *payload, size_t len, payload_t *shared, const frame_fields_t *fields) {
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_MSG, topic, len, fields);
+    if (header_len < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Error formatting message for subscriber fd %d", client->fd);
+        return 0;
+    }
+
+    size_t pending = client->out.pending;
+    if (pending + header_len + len > BROKER_MAX_CLIENT_BACKLOG) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Subscriber fd %d is too slow (%zu bytes queued), disconnecting.", client->fd, pending);
+        b->stats.slow_disconnects++;
+        PROBE_QUEUE_OVERFLOW(client->fd, pending, (size_t)header_len + len);
+        close_client(b, pfd, client);
+        return -1;
+    }
+    int queued;
+    int zerocopy = b->zerocopy_min > 0 && len >= b->zerocopy_min;
+    if (shared != NULL && shared == b->fanout_payload && pending == 0) {
+        queued = splice_frame(b, client, header, (size_t)header_len, shared, zerocopy) == 0;
+    } else if (shared != NULL) {
+        queued = outq_append_bytes(&client->out, header, (size_t)header_len) == 0 &&
+                 outq_append_payload(&client->out, shared, zerocopy) == 0;
+    } else {
+        queued = outq_append_bytes(&client->out, header, (size_t)header_len) == 0 &&
+                 outq_append_bytes(&client->out, payload, len) == 0;
+    }
+    if (!queued) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "queue frame for subscriber fd %d: %s", client->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    client->out_queued += header_len + len;
+    if (fields != NULL && fields->ingress_ns != 0 && push_delay_mark(client, fields->ingress_ns) < 0) {
+        close_client(b, pfd, client);
+        return -1;
+    }
+
+    // Only write now if nothing was already waiting; otherwise POLLOUT drains in order
+    if (pending == 0) {
+        return flush_client(b, pfd, client);
+    }
+    return 0;
+}
+
+/**
+ * @brief Context for replaying persisted messages into a client's output queue.
+ */
+typedef struct {
+    broker_t *broker;   ///< The broker.
+    struct pollfd *pfd; ///< The subscriber's pollfd.
+    client_t *client;   ///< The subscriber.
+    topic_stats_t *ts;  ///< Counters of the replayed topic (may be NULL).
+    uint64_t replayed;  ///< Messages queued so far.
+} replay_ctx_t;
+
+/**
+ * @brief Replay sink that queues each persisted message for the subscriber.
+ *
+ * @param topic The topic being replayed.
+ * @param message The message content.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the message.
+ * @param origin The broker the record originated on (unused).
+ * @param ctx Pointer to a replay_ctx_t.
+ */
+static void queue_replay_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                              void *ctx) {
+    (void)origin;
+    replay_ctx_t *replay = ctx;
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, 0 };
+    if (replay->client->fd != -1 &&
+        queue_frame(replay->broker, replay->pfd, replay->client, topic, message, len, NULL, &fields) == 0) {
+        replay->broker->stats.messages_out++;
+        replay->replayed++;
+        if (replay->ts != NULL) {
+            replay->ts->msgs_out++;
+            replay->ts->bytes_out += len;
+        }
+    }
+}
+
+/**
+ * @brief Queues a frame without payload (ACK, REPL, BRIDGE) for a client.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @param type The frame command.
+ * @param topic The topic, or NULL for a bare REPL or BRIDGE.
+ * @param fields Header fields, or NULL.
+ * @param flush Whether to try sending right away; otherwise the caller flushes.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+static int queue_control(broker_t *b, struct pollfd *pfd, client_t *client, frame_type_t type, const char *topic,
+                         const frame_fields_t *fields, int flush) {
+    char header[FRAME_MAX_HEADER];
+    int header_len = topic != NULL          ? format_frame_header_fields(header, sizeof(header), type, topic, 0, fields)
+                     : type == FRAME_BRIDGE ? format_bridge_start(header, sizeof(header))
+                                            : format_repl_start(header, sizeof(header));
+    if (header_len < 0 || outq_append_bytes(&client->out, header, (size_t)header_len) < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "queue control frame for fd %d: %s", client->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    client->out_queued += (uint64_t)header_len;
+    return flush ? flush_client(b, pfd, client) : 0;
+}
+
+/**
+ * @brief Drains a writable client's output queue.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ */
+void broker_handle_writable(broker_t *b, int slot) {
+    PROF_START(mark);
+    flush_client(b, &b->fds[slot], &b->clients[slot]);
+    PROF_LAP(&b->stats.prof, PROF_SEND, mark);
+}
+
+/**
+ * @brief Releases the payloads of a subscriber's completed zero-copy sends.
+ * Reports when the kernel turns out to copy the data anyway, which switches
+ * the subscriber back to regular sends.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ * @return int The number of completion notifications processed (0 on error).
+ */
+int broker_reap_zerocopy(broker_t *b, int slot) {
+    client_t *client = &b->clients[slot];
+    int was_enabled = client->out.zerocopy;
+    int reaped = outq_reap_zerocopy(&client->out, client->fd);
+    if (reaped < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "read zero-copy completions: %s", strerror(errno));
+        return 0;
+    }
+    if (was_enabled && !client->out.zerocopy) {
+        log_info(LOG_MODULE_BROKER, "fd %d: kernel copied zero-copy sends, using regular sends", client->fd);
+    }
+    return reaped;
+}
+
+/**
+ * @brief Why a pool fan-out could not queue a message for a client.
+ */
+typedef enum {
+    FANOUT_OK,           ///< The message was queued.
+    FANOUT_TOO_SLOW,     ///< The client's backlog would exceed BROKER_MAX_CLIENT_BACKLOG.
+    FANOUT_QUEUE_FAILED, ///< Queueing ran out of memory.
+    FANOUT_SEND_FAILED   ///< The connection failed while sending.
+} fanout_failure_t;
+
+/**
+ * @brief One message being fanned out on the pool.
+ */
+typedef struct {
+    broker_t *broker;              ///< The broker.
+    const subtable_topic_t *subs;  ///< The topic's subscribers.
+    const char *header;            ///< The MSG frame header, the same for every subscriber.
+    size_t header_len;             ///< Header length in bytes.
+    const char *payload;           ///< The payload.
+    size_t len;                    ///< Payload length in bytes.
+    payload_t *shared;             ///< The payload as a shared payload_t, or NULL to copy it.
+    int zerocopy;                  ///< Whether to send the shared payload with MSG_ZEROCOPY.
+    uint64_t ingress_ns;           ///< Ingress time of a stamped message, or 0.
+} pool_fanout_t;
+
+/**
+ * @brief Queues a message for a chunk of subscribers; runs on any lane of the pool.
+ * Only the chunk's clients and the lane's results are written. Clients that have to be
+ * closed are marked and closed later by the core's thread, which owns the broker's
+ * counters, logs and the subscription index.
+ *
+ * @param ctx The pool_fanout_t.
+ * @param begin First subscriber entry.
+ * @param end One past the last subscriber entry.
+ * @param lane_index The running lane.
+ */
+static void fan_out_chunk(void *ctx, size_t begin, size_t end, int lane_index) {
+    pool_fanout_t *job = ctx;
+    broker_t *b = job->broker;
+    struct fanout_lane *lane = &b->lanes[lane_index];
+    size_t frame_len = job->header_len + job->len;
+    for (size_t i = begin; i < end; i++) {
+        int slot = job->subs->entries[i].slot;
+        client_t *client = subscriber_at(b, &job->subs->entries[i]);
+        if (client == NULL || client->sub_pending) {
+            continue;
+        }
+        size_t pending = client->out.pending;
+        fanout_failure_t failure = FANOUT_OK;
+        if (pending + frame_len > BROKER_MAX_CLIENT_BACKLOG) {
+            failure = FANOUT_TOO_SLOW;
+        } else if (outq_append_bytes(&client->out, job->header, job->header_len) < 0 ||
+                   (job->shared != NULL ? outq_append_payload(&client->out, job->shared, job->zerocopy)
+                                        : outq_append_bytes(&client->out, job->payload, job->len)) < 0) {
+            failure = FANOUT_QUEUE_FAILED;
+        } else {
+            client->out_queued += frame_len;
+            if (job->ingress_ns != 0 && push_delay_mark(client, job->ingress_ns) < 0) {
+                failure = FANOUT_QUEUE_FAILED;
+            } else if (pending == 0) {
+                ssize_t n = send_queued(&b->fds[slot], client, &lane->queue_delay);
+                if (n < 0) {
+                    failure = FANOUT_SEND_FAILED;
+                } else {
+                    lane->bytes_written += (uint64_t)n;
+                }
+            }
+        }
+        if (failure != FANOUT_OK) {
+            client->fanout_failure = (int)failure;
+            client->fanout_errno = errno;
+            lane->failures++;
+        } else {
+            lane->deliveries++;
+        }
+    }
+}
+
+/**
+ * @brief Closes a client a pool fan-out could not queue a message for.
+ *
+ * @param b The broker.
+ * @param slot The client's slot.
+ * @param frame_len Length of the frame that was not queued.
+ */
+static void close_failed_client(broker_t *b, int slot, size_t frame_len) {
+    client_t *client = &b->clients[slot];
+    switch ((fanout_failure_t)client->fanout_failure) {
+    case FANOUT_TOO_SLOW:
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Subscriber fd %d is too slow (%zu bytes queued), disconnecting.", client->fd, client->out.pending);
+        b->stats.slow_disconnects++;
+        PROBE_QUEUE_OVERFLOW(client->fd, client->out.pending, frame_len);
+        break;
+    case FANOUT_QUEUE_FAILED:
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "queue frame for subscriber fd %d: %s", client->fd, strerror(client->fanout_errno));
+        break;
+    default:
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "write to subscriber fd %d failed: %s", client->fd, strerror(client->fanout_errno));
+        break;
+    }
+    client->fanout_failure = FANOUT_OK;
+    close_client(b, &b->fds[slot], client);
+}
+
+/**
+ * @brief Queues a message for a topic's subscribers on the fan-out pool and waits for it.
+ *
+ * @param b The broker.
+ * @param subs The topic's subscribers.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param shared The payload as a shared payload_t, or NULL to copy it.
+ * @param fields Header fields of the forwarded frames, or NULL.
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+static uint64_t fan_out_pool(broker_t *b, const subtable_topic_t *subs, const char *topic, const char *payload,
+                             size_t len, payload_t *shared, const frame_fields_t *fields) {
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_MSG, topic, len, fields);
+    if (header_len < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Error formatting message for topic '%s'", topic);
+        return 0;
+    }
+    pool_fanout_t job = { b, subs, header, (size_t)header_len, payload, len, shared,
+                          b->zerocopy_min > 0 && len >= b->zerocopy_min, fields != NULL ? fields->ingress_ns : 0 };
+    int lanes = b->pool->threads + 1;
+    for (int i = 0; i < lanes; i++) {
+        b->lanes[i].deliveries = 0;
+        b->lanes[i].bytes_written = 0;
+        b->lanes[i].failures = 0;
+    }
+    b->stats.fanout_steals += fanpool_run(b->pool, subs->count, BROKER_FANOUT_CHUNK, fan_out_chunk, &job);
+    b->stats.parallel_fanouts++;
+
+    uint64_t deliveries = 0;
+    uint64_t failures = 0;
+    for (int i = 0; i < lanes; i++) {
+        struct fanout_lane *lane = &b->lanes[i];
+        deliveries += lane->deliveries;
+        failures += lane->failures;
+        b->stats.bytes_written += lane->bytes_written;
+        if (lane->queue_delay.total > 0) {
+            histogram_merge(&b->queue_delay, &lane->queue_delay);
+            histogram_init(&lane->queue_delay);
+        }
+    }
+    for (size_t i = 0; failures > 0 && i < subs->count; i++) {
+        client_t *client = subscriber_at(b, &subs->entries[i]);
+        if (client != NULL && client->fanout_failure != FANOUT_OK) {
+            close_failed_client(b, subs->entries[i].slot, (size_t)header_len + len);
+            failures--;
+        }
+    }
+    return deliveries;
+}
+
+/**
+ * @brief Returns the connection a consumer group member is on.
+ *
+ * @param b The broker.
+ * @param member The member.
+ * @return client_t* The member's client, or NULL if the connection is gone.
+ */
+static client_t *member_at(broker_t *b, const partition_member_t *member) {
+    subtable_entry_t entry = { member->slot, member->conn_id };
+    return subscriber_at(b, &entry);
+}
+
+/**
+ * @brief Context for replaying a partition to the group member taking it over.
+ */
+typedef struct {
+    replay_ctx_t replay; ///< The member and its counters.
+    uint64_t *next_seq;  ///< The group's position in the partition.
+} handover_ctx_t;
+
+/**
+ * @brief Replay sink that queues a persisted message for a group member and advances the group.
+ *
+ * @param topic The partition being replayed.
+ * @param message The message content.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the message.
+ * @param origin The broker the record originated on (unused).
+ * @param ctx Pointer to a handover_ctx_t.
+ */
+static void handover_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                          void *ctx) {
+    handover_ctx_t *handover = ctx;
+    uint64_t replayed = handover->replay.replayed;
+    queue_replay_sink(topic, message, len, seq, origin, &handover->replay);
+    if (handover->replay.replayed > replayed && seq >= *handover->next_seq) {
+        *handover->next_seq = seq + 1;
+    }
+}
+
+/**
+ * @brief Sends the members that took over partitions the persisted messages their group
+ * has not been given yet.
+ *
+ * @param b The broker.
+ * @param g The group.
+ * @param moved Per partition, 1 if it changed hands.
+ */
+static void hand_over(broker_t *b, partition_group_t *g, const unsigned char *moved) {
+    if (b->p_mode == PERSIST_NONE) {
+        return;
+    }
+    for (unsigned p = 0; p < g->spec->count; p++) {
+        const partition_member_t *member = partition_group_owner(g, p);
+        client_t *client = member != NULL && moved[p] && g->next_seq[p] != 0 ? member_at(b, member) : NULL;
+        if (client == NULL) {
+            continue;
+        }
+        char topic[MAX_TOPIC_LEN];
+        partition_name(topic, sizeof(topic), g->spec, p);
+        handover_ctx_t handover = { { b, &b->fds[member->slot], client, stats_topic(&b->stats, topic), 0 },
+                                    &g->next_seq[p] };
+        replay_persisted_messages(topic, b->p_mode, b->p_duration, g->next_seq[p], handover_sink, &handover);
+    }
+}
+
+/**
+ * @brief Queues a message of a partition for the member each consumer group has dealt it to.
+ * Groups a member has left are dealt out again first. A message the new member was
+ * already sent while taking over the partition is not sent twice.
+ *
+ * @param b The broker.
+ * @param topic The partition.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields Header fields of the forwarded frames, or NULL.
+ * @return uint64_t The number of members the message was queued for.
+ */
+static uint64_t deliver_to_groups(broker_t *b, const char *topic, const char *payload, size_t len,
+                                  const frame_fields_t *fields) {
+    unsigned index;
+    const partition_spec_t *spec = partition_of(b->parts.table, topic, &index);
+    if (spec == NULL) {
+        return 0;
+    }
+    partition_group_prune(&b->parts);
+    uint64_t seq = fields != NULL ? fields->seq : 0;
+    uint64_t deliveries = 0;
+    for (size_t i = 0; i < b->parts.group_count; i++) {
+        partition_group_t *g = &b->parts.groups[i];
+        unsigned char moved[PARTITION_MAX];
+        if (g->spec != spec) {
+            continue;
+        }
+        if (partition_group_rebalance(g, moved)) {
+            hand_over(b, g, moved);
+        }
+        const partition_member_t *member = partition_group_owner(g, index);
+        client_t *client = member != NULL ? member_at(b, member) : NULL;
+        if (client == NULL || (seq != 0 && seq < g->next_seq[index])) {
+            continue;
+        }
+        if (queue_frame(b, &b->fds[member->slot], client, topic, payload, len, NULL, fields) == 0) {
+            deliveries++;
+            if (seq != 0) {
+                g->next_seq[index] = seq + 1;
+            }
+        }
+    }
+    return deliveries;
+}
+
+/**
+ * @brief Queues a message for every confirmed subscriber of its topic.
+ * Consumer group members are included. Payloads of BROKER_SHARED_PAYLOAD_MIN bytes or
+ * more are copied once into a shared payload that every subscriber's queue references.
+ * With --splice, large payloads are also loaded into the tee/splice fan-out engine.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields Header fields of the forwarded frames, or NULL.
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+static uint64_t fan_out(broker_t *b, const char *topic, const char *payload, size_t len, const frame_fields_t *fields) {
+    uint64_t deliveries = b->parts.group_count > 0 ? deliver_to_groups(b, topic, payload, len, fields) : 0;
+    payload_t *shared = NULL;
+    const subtable_topic_t *subs = subscribers_of(b, topic);
+    // The splice engine has one pipe pair, so spliced payloads stay on this thread
+    if (subs != NULL && b->pool != NULL && subs->count >= b->parallel_min && !(b->splice_min > 0 && len >= b->splice_min)) {
+        if (len >= BROKER_SHARED_PAYLOAD_MIN) {
+            shared = payload_create(payload, len);
+        }
+        deliveries += fan_out_pool(b, subs, topic, payload, len, shared, fields);
+        payload_release(shared);
+        return deliveries;
+    }
+    for (size_t i = 0; subs != NULL && i < subs->count; i++) {
+        int j = subs->entries[i].slot;
+        client_t *client = subscriber_at(b, &subs->entries[i]);
+        if (client != NULL && !client->sub_pending) {
+            if (shared == NULL && (len >= BROKER_SHARED_PAYLOAD_MIN || (b->splice_min > 0 && len >= b->splice_min))) {
+                shared = payload_create(payload, len);
+                if (shared != NULL && b->splice_min > 0 && len >= b->splice_min && len <= b->fanout.capacity &&
+                    splice_fanout_load(&b->fanout, payload, len) == 0) {
+                    b->fanout_payload = shared;
+                    b->splice_loads++;
+                }
+            }
+            if (queue_frame(b, &b->fds[j], client, topic, payload, len, shared, fields) == 0) {
+                deliveries++;
+            }
+        }
+    }
+    // Queues that still reference the payload hold their own references
+    b->fanout_payload = NULL;
+    payload_release(shared);
+    return deliveries;
+}
+
+/**
+ * @brief Sends a persisted message to every follower that has caught up.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq The message's sequence number.
+ */
+static void replicate(broker_t *b, const char *topic, const char *payload, size_t len, uint64_t seq) {
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        repl_follower_t *follower = &b->repl.followers[i];
+        if (follower->slot != 0 && follower->live && b->clients[follower->slot].conn_id == follower->conn_id &&
+            queue_frame(b, &b->fds[follower->slot], &b->clients[follower->slot], topic, payload, len, NULL, &fields) == 0) {
+            b->repl.records_sent++;
+        }
+    }
+}
+
+/**
+ * @brief Queues a MSG frame for a bridge without sending it yet. flush_bridges() sends
+ * everything queued for bridges during one read together.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the bridge.
+ * @param client Pointer to the client_t structure for the bridge.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields Header fields of the frame.
+ * @return int 0 on success, -1 if the bridge was closed.
+ */
+static int queue_batched(broker_t *b, struct pollfd *pfd, client_t *client, const char *topic, const char *payload,
+                         size_t len, const frame_fields_t *fields) {
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_MSG, topic, len, fields);
+    if (header_len < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Error formatting message for bridge fd %d", client->fd);
+        return 0;
+    }
+    if (client->out.pending + (size_t)header_len + len > BROKER_MAX_CLIENT_BACKLOG) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Bridge fd %d is too slow (%zu bytes queued), disconnecting.",
+                        client->fd, client->out.pending);
+        b->stats.slow_disconnects++;
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (outq_append_bytes(&client->out, header, (size_t)header_len) < 0 ||
+        outq_append_bytes(&client->out, payload, len) < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "queue frame for bridge fd %d: %s", client->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    client->out_queued += (uint64_t)header_len + len;
+    b->bridge.unflushed = 1;
+    return 0;
+}
+
+/**
+ * @brief Sends the messages queued for bridges since the last flush.
+ *
+ * @param b The broker.
+ */
+static void flush_bridges(broker_t *b) {
+    if (!b->bridge.unflushed) {
+        return;
+    }
+    b->bridge.unflushed = 0;
+    for (int i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        int slot = b->bridge.peers[i].slot;
+        if (slot != 0 && b->clients[slot].conn_id == b->bridge.peers[i].conn_id && b->clients[slot].out.pending > 0) {
+            flush_client(b, &b->fds[slot], &b->clients[slot]);
+        }
+    }
+}
+
+/**
+ * @brief Queues a message for every bridge whose patterns match its topic, except
+ * bridges from the broker the message originated on.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq The message's sequence number, 0 if it was not persisted.
+ * @param origin The broker the message originated on, 0 for this one.
+ */
+static void export_bridged(broker_t *b, const char *topic, const char *payload, size_t len, uint64_t seq,
+                           uint64_t origin) {
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, origin != 0 ? origin : b->bridge.id };
+    for (int i = 0; i < BRIDGE_MAX_PEERS; i++) {
+        bridge_peer_t *peer = &b->bridge.peers[i];
+        if (peer->slot == 0 || !peer->live || b->clients[peer->slot].conn_id != peer->conn_id ||
+            !bridge_filter_match(&peer->filter, topic, NULL)) {
+            continue;
+        }
+        if (peer->origin == fields.origin) {
+            b->bridge.suppressed++;
+        } else if (queue_batched(b, &b->fds[peer->slot], &b->clients[peer->slot], topic, payload, len, &fields) == 0) {
+            b->bridge.exported++;
+        }
+    }
+}
+
+/**
+ * @brief Persists a message and forwards it to every subscriber, follower and bridge.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param ingress_ns Time the message was read from the publisher (0 when not stamping).
+ * @param origin The broker a bridged message originated on, 0 for a message published here.
+ * @param seq Receives the message's sequence number, 0 if it was not persisted.
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+static uint64_t publish_local(broker_t *b, const char *topic, const char *payload, size_t len, uint64_t ingress_ns,
+                              uint64_t origin, uint64_t *seq) {
+    uint64_t start = b->timing_enabled ? monotonic_ns() : 0;
+    PROF_START(mark);
+    frame_fields_t fields = { ingress_ns, 0, 0, 0, 0, 0, 0, 0 };
+    fields.seq = persist_message_origin(topic, payload, len, b->p_mode, origin);
+    if (b->p_mode != PERSIST_NONE) {
+        PROF_LAP(&b->stats.prof, PROF_PERSIST, mark);
+    }
+    uint64_t persisted = b->timing_enabled ? monotonic_ns() : 0;
+    if (ingress_ns != 0 && b->p_mode != PERSIST_NONE) {
+        fields.persist_ns = monotonic_ns();
+    }
+
+    uint64_t deliveries = fan_out(b, topic, payload, len, &fields);
+    PROF_LAP(&b->stats.prof, PROF_FANOUT, mark);
+    uint64_t fanned = b->timing_enabled ? monotonic_ns() : 0;
+
+    int forwarded = 0;
+    if (fields.seq != 0 && b->repl.follower_count > 0) {
+        replicate(b, topic, payload, len, fields.seq);
+        forwarded = 1;
+    }
+    if (b->bridge.peer_count > 0) {
+        export_bridged(b, topic, payload, len, fields.seq, origin);
+        forwarded = 1;
+    }
+    if (b->router != NULL && b->router->published != NULL) {
+        b->router->published(b->router_ctx, topic, payload, len, &fields);
+        forwarded = 1;
+    }
+    if (forwarded) {
+        PROF_LAP(&b->stats.prof, PROF_FORWARD, mark);
+    }
+    PROBE_PUBLISH_ROUTED(topic, len, (int)deliveries);
+
+    if (b->timing_enabled) {
+        uint64_t done = monotonic_ns();
+        if (b->p_mode != PERSIST_NONE) {
+            histogram_record(&b->stats.persist_ns, persisted - start);
+        }
+        histogram_record(&b->stats.fanout_ns, fanned - persisted);
+        histogram_record(&b->stats.publish_ns, done - start);
+    }
+
+    b->stats.messages_in++;
+    b->stats.messages_out += deliveries;
+    topic_stats_t *ts = stats_topic(&b->stats, topic);
+    if (ts != NULL) {
+        ts->msgs_in++;
+        ts->bytes_in += len;
+        ts->msgs_out += deliveries;
+        ts->bytes_out += deliveries * len;
+        if (fields.seq != 0) {
+            ts->persist_bytes += len;
+        }
+    }
+    *seq = fields.seq;
+    return deliveries;
+}
+
+/**
+ * @brief Persists a message and forwards it to every subscriber of its topic.
+ * Persisted messages are forwarded with their sequence number, also to followers and
+ * bridges. With --timestamps, the forwarded frames also carry the ingress time and, if
+ * the message was persisted, the time persistence completed. With a router, the message
+ * is then handed to the router for the subscribers of other cores.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param ingress_ns Time the message was read from the publisher (0 when not stamping).
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+uint64_t broker_publish(broker_t *b, const char *topic, const char *payload, size_t len, uint64_t ingress_ns) {
+    uint64_t seq;
+    uint64_t deliveries = publish_local(b, topic, payload, len, ingress_ns, 0, &seq);
+    flush_bridges(b);
+    return deliveries;
+}
+
+/**
+ * @brief Forwards a message persisted by another core to this core's confirmed subscribers.
+ *
+ * @param b The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields The header fields stamped by the owner (sequence number, timestamps), or NULL.
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+uint64_t broker_deliver(broker_t *b, const char *topic, const char *payload, size_t len,
+                        const frame_fields_t *fields) {
+    uint64_t start = b->timing_enabled ? monotonic_ns() : 0;
+    PROF_START(mark);
+    uint64_t deliveries = fan_out(b, topic, payload, len, fields);
+    PROF_LAP(&b->stats.prof, PROF_FANOUT, mark);
+    if (b->timing_enabled) {
+        histogram_record(&b->stats.fanout_ns, monotonic_ns() - start);
+    }
+    if (deliveries > 0) {
+        b->stats.messages_out += deliveries;
+        topic_stats_t *ts = stats_topic(&b->stats, topic);
+        if (ts != NULL) {
+            ts->msgs_out += deliveries;
+            ts->bytes_out += deliveries * len;
+        }
+    }
+    return deliveries;
+}
+
+/**
+ * @brief Finds the subscriber a message from a topic's owner is addressed to.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ * @param conn_id The connection number the subscription was made from.
+ * @return client_t* The subscriber, or NULL if the slot now holds another connection or none.
+ */
+static client_t *pending_subscriber(broker_t *b, int slot, uint32_t conn_id) {
+    if (slot < 1 || slot > b->max_clients || b->fds[slot].fd == -1) {
+        return NULL;
+    }
+    client_t *client = &b->clients[slot];
+    if (client->conn_id != conn_id || client->type != CLIENT_TYPE_SUBSCRIBER || !client->sub_pending) {
+        return NULL;
+    }
+    return client;
+}
+
+/**
+ * @brief Queues a message replayed by a topic's owner for one subscriber still awaiting confirmation.
+ *
+ * @param b The broker.
+ * @param slot The subscriber's client slot.
+ * @param conn_id The connection number the subscription was made from.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq The sequence number of the message.
+ * @return int 0 if the message was queued, -1 if the connection is gone or was closed.
+ */
+int broker_deliver_to(broker_t *b, int slot, uint32_t conn_id, const char *topic, const char *payload,
+                      size_t len, uint64_t seq) {
+    client_t *client = pending_subscriber(b, slot, conn_id);
+    if (client == NULL) {
+        return -1;
+    }
+    replay_ctx_t replay = { b, &b->fds[slot], client, stats_topic(&b->stats, topic), 0 };
+    queue_replay_sink(topic, payload, len, seq, 0, &replay);
+    return client->fd == -1 ? -1 : 0;
+}
+
+/**
+ * @brief Starts live delivery to a subscriber once the topic's owner has replayed its log.
+ *
+ * @param b The broker.
+ * @param slot The subscriber's client slot.
+ * @param conn_id The connection number the subscription was made from.
+ * @return int 0 on success, -1 if the connection is gone.
+ */
+int broker_confirm_subscription(broker_t *b, int slot, uint32_t conn_id) {
+    client_t *client = pending_subscriber(b, slot, conn_id);
+    if (client == NULL) {
+        return -1;
+    }
+    client->sub_pending = 0;
+    log_debug(LOG_MODULE_BROKER, "fd %d: subscription to '%s' confirmed by its owner", client->fd, client->topic);
+    return 0;
+}
+
+/**
+ * @brief Sends a publisher the ACK for a stored message.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the publisher.
+ * @param client Pointer to the client_t structure for the publisher.
+ * @param topic The topic of the message.
+ * @param seq The message's sequence number, or 0 if it was not persisted.
+ * @return int 0 on success, -1 if the publisher was closed.
+ */
+static int confirm_publish(broker_t *b, struct pollfd *pfd, client_t *client, const char *topic, uint64_t seq) {
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, 0 };
+    b->repl.confirms++;
+    return queue_control(b, pfd, client, FRAME_ACK, topic, &fields, 1);
+}
+
+/**
+ * @brief Sends every held confirmation whose message a follower has acknowledged.
+ * Confirmations of publishers that have disconnected since are dropped.
+ *
+ * @param b The broker.
+ */
+static void release_confirms(broker_t *b) {
+    repl_confirm_t confirm;
+    while (repl_next_confirm(&b->repl, &confirm)) {
+        client_t *client = &b->clients[confirm.slot];
+        if (b->fds[confirm.slot].fd != -1 && client->conn_id == confirm.conn_id) {
+            confirm_publish(b, &b->fds[confirm.slot], client, confirm.topic, confirm.seq);
+        }
+    }
+}
+
+/**
+ * @brief Publishes a message here, unless the router hands it to the core owning its topic.
+ * A message for a partitioned topic goes to the partition its key selects, or to the
+ * next one round-robin. A publisher that asked for an ACK gets it, naming the partition,
+ * once the message is stored; with synchronous replication, once a follower has stored
+ * it too. Messages routed to another core, and messages of a broker without
+ * persistence, are confirmed without a sequence number.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the publisher.
+ * @param client Pointer to the client_t structure for the publisher.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param ingress_ns Time the message was read from the publisher (0 when not stamping).
+ * @param fields The fields of the PUB frame ("ack", "key").
+ * @return int 0 on success, -1 if the publisher was closed.
+ */
+static int route_publish(broker_t *b, struct pollfd *pfd, client_t *client, const char *topic, const char *payload,
+                         size_t len, uint64_t ingress_ns, const frame_fields_t *fields) {
+    char partition[MAX_TOPIC_LEN];
+    const partition_spec_t *spec = partition_find(b->parts.table, topic);
+    if (spec != NULL) {
+        partition_name(partition, sizeof(partition), spec, partition_pick(&b->parts, spec, fields->key));
+        topic = partition;
+    }
+    int ack = fields->ack != 0;
+    uint64_t seq = 0;
+    if (b->router == NULL || b->router->publish == NULL ||
+        !b->router->publish(b->router_ctx, topic, payload, len, ingress_ns)) {
+        publish_local(b, topic, payload, len, ingress_ns, 0, &seq);
+        if (ack && seq == 0 && b->p_mode != PERSIST_NONE) {
+            log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Could not store a confirmed message for topic '%s', disconnecting fd %d",
+                            topic, pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+    }
+    if (!ack) {
+        return 0;
+    }
+    if (seq != 0 && b->repl.ack_mode == REPL_ACK_SYNC) {
+        if (repl_hold_confirm(&b->repl, (int)(client - b->clients), client->conn_id, topic, seq) < 0) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Too many unreplicated confirmations, disconnecting fd %d", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        return 0;
+    }
+    return confirm_publish(b, pfd, client, topic, seq);
+}
+
+/**
+ * @brief Publishes every PUB frame enclosed in a BATCH frame.
+ * The batch is validated completely before any message is published, so a malformed
+ * batch is rejected as a whole.
+ *
+ * @param b The broker.
+ * @param batch The parsed BATCH frame.
+ * @param pfd Pointer to the pollfd structure for the publisher.
+ * @param client Pointer to the client_t structure for the publisher.
+ * @param ingress_ns Time the batch was read from the publisher (0 when not stamping).
+ * @return int 0 on success (check whether the publisher was closed), -1 if the batch is malformed.
+ */
+static int publish_batch(broker_t *b, const frame_t *batch, struct pollfd *pfd, client_t *client, uint64_t ingress_ns) {
+    frame_t inner;
+    size_t consumed;
+    size_t offset = 0;
+    size_t count = 0;
+
+    while (offset < batch->payload_len) {
+        if (parse_frame(batch->payload + offset, batch->payload_len - offset, &inner, &consumed) != FRAME_OK ||
+            inner.type != FRAME_PUB) {
+            return -1;
+        }
+        offset += consumed;
+        count++;
+    }
+    if (count != batch->count) {
+        return -1;
+    }
+
+    for (offset = 0; offset < batch->payload_len; offset += consumed) {
+        parse_frame(batch->payload + offset, batch->payload_len - offset, &inner, &consumed);
+        if (route_publish(b, pfd, client, inner.topic, inner.payload, inner.payload_len, ingress_ns, &inner.fields) < 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Context for sending a follower the records it is missing.
+ */
+typedef struct {
+    broker_t *broker;          ///< The broker.
+    struct pollfd *pfd;        ///< The follower's pollfd.
+    client_t *client;          ///< The follower.
+    repl_follower_t *follower; ///< Its positions.
+    uint64_t sent;             ///< Records queued so far.
+} catch_up_ctx_t;
+
+/**
+ * @brief Replay sink that queues each persisted record for the follower.
+ *
+ * @param topic The topic being replayed.
+ * @param message The record content.
+ * @param len The length of the record in bytes.
+ * @param seq The sequence number of the record.
+ * @param origin The broker the record originated on (unused).
+ * @param ctx Pointer to a catch_up_ctx_t.
+ */
+static void catch_up_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                          void *ctx) {
+    (void)origin;
+    catch_up_ctx_t *catch_up = ctx;
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, 0 };
+    if (catch_up->client->fd != -1 &&
+        queue_frame(catch_up->broker, catch_up->pfd, catch_up->client, topic, message, len, NULL, &fields) == 0) {
+        catch_up->sent++;
+    }
+}
+
+/**
+ * @brief Queues the records of one topic the follower is missing.
+ *
+ * @param topic The topic.
+ * @param ctx Pointer to a catch_up_ctx_t.
+ */
+static void catch_up_topic(const char *topic, void *ctx) {
+    catch_up_ctx_t *catch_up = ctx;
+    if (catch_up->client->fd == -1) {
+        return;
+    }
+    broker_t *b = catch_up->broker;
+    replay_persisted_messages(topic, b->p_mode, b->p_duration, repl_position(catch_up->follower, topic),
+                              catch_up_sink, catch_up);
+}
+
+/**
+ * @brief Handles a REPL frame: a follower's position in a topic, or the end of its handshake.
+ * The first REPL turns the connection into a follower. The bare REPL ending the handshake
+ * queues every record the follower is missing, after which it receives each message
+ * this broker persists.
+ *
+ * @param b The broker.
+ * @param frame The parsed frame.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @return int 0 to keep processing, -1 if the client was closed.
+ */
+static int handle_repl(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client) {
+    int slot = (int)(client - b->clients);
+    repl_follower_t *follower = NULL;
+    if (client->type == CLIENT_TYPE_UNKNOWN) {
+        if (b->p_mode == PERSIST_NONE || b->router != NULL) {
+            log_warn(LOG_MODULE_BROKER, "fd %d wants to replicate, but replication needs persistence and a single worker", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        follower = repl_add_follower(&b->repl, slot, client->conn_id);
+        if (follower == NULL) {
+            log_warn(LOG_MODULE_BROKER, "Max followers reached. Rejecting follower on fd %d.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        client->type = CLIENT_TYPE_FOLLOWER;
+        log_info(LOG_MODULE_BROKER, "fd %d is a follower", pfd->fd);
+    } else if (client->type == CLIENT_TYPE_FOLLOWER) {
+        follower = repl_find_follower(&b->repl, slot, client->conn_id);
+    }
+    if (follower == NULL || follower->live) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent REPL out of order, disconnecting.", pfd->fd);
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (frame->topic[0] != '\0') {
+        if (repl_set_position(follower, frame->topic, frame->fields.from_seq) < 0) {
+            close_client(b, pfd, client);
+            return -1;
+        }
+        return 0;
+    }
+
+    catch_up_ctx_t catch_up = { b, pfd, client, follower, 0 };
+    uint64_t start = b->timing_enabled ? monotonic_ns() : 0;
+    if (persist_list_topics(catch_up_topic, &catch_up) < 0) {
+        log_error(LOG_MODULE_BROKER, "list topic logs for follower fd %d: %s", pfd->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (client->fd == -1) {
+        return -1;
+    }
+    if (b->timing_enabled) {
+        histogram_record(&b->stats.replay_ns, monotonic_ns() - start);
+    }
+    follower->live = 1;
+    b->repl.catchups++;
+    b->repl.records_sent += catch_up.sent;
+    log_info(LOG_MODULE_BROKER, "fd %d: follower caught up with %llu records", pfd->fd, (unsigned long long)catch_up.sent);
+    return 0;
+}
+
+/**
+ * @brief Handles an ACK frame from a follower and releases the confirmations it completes.
+ *
+ * @param b The broker.
+ * @param frame The parsed frame.
+ * @param pfd Pointer to the pollfd structure for the follower.
+ * @param client Pointer to the client_t structure for the follower.
+ * @return int 0 to keep processing, -1 if the follower was closed.
+ */
+static int handle_follower_ack(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client) {
+    if (repl_acknowledge(&b->repl, frame->topic, frame->fields.seq) < 0) {
+        close_client(b, pfd, client);
+        return -1;
+    }
+    release_confirms(b);
+    return 0;
+}
+
+/**
+ * @brief Writes a record received from the leader under the leader's sequence number.
+ * The record is fanned out to local subscribers and followers like a published message,
+ * and acknowledged to the leader. A record the local log already holds is only
+ * acknowledged. The ACKs are sent once the whole read has been processed.
+ *
+ * @param b The broker.
+ * @param frame The parsed MSG frame.
+ * @param pfd Pointer to the pollfd structure for the leader connection.
+ * @param client Pointer to the client_t structure for the leader connection.
+ * @param ingress_ns Time the frame was read (0 when not stamping).
+ * @return int 0 to keep processing, -1 if the connection was closed.
+ */
+static int apply_replicated(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client, uint64_t ingress_ns) {
+    uint64_t seq = frame->fields.seq;
+    uint64_t next = persist_next_seq(frame->topic);
+    if (seq == 0 || next == 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Cannot apply a record for topic '%s' from the leader", frame->topic);
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (seq < next) {
+        b->repl.duplicates++;
+    } else {
+        int diverged = seq > next && persist_skip_to(frame->topic, seq) < 0;
+        uint64_t written;
+        publish_local(b, frame->topic, frame->payload, frame->payload_len, ingress_ns, 0, &written);
+        if (written == 0) {
+            // The leader sends the record again after the reconnect
+            log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "Could not store record %llu of topic '%s' from the leader",
+                            (unsigned long long)seq, frame->topic);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        if (diverged || written != seq) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Topic '%s': leader record %llu stored as %llu",
+                            frame->topic, (unsigned long long)seq, (unsigned long long)written);
+            b->repl.diverged++;
+        }
+        b->repl.records_applied++;
+    }
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, 0 };
+    return queue_control(b, pfd, client, FRAME_ACK, frame->topic, &fields, 0);
+}
+
+/**
+ * @brief Queues the follower's position in one local topic for the leader.
+ *
+ * @param topic The topic.
+ * @param ctx Pointer to a catch_up_ctx_t for the leader connection.
+ */
+static void announce_position(const char *topic, void *ctx) {
+    catch_up_ctx_t *handshake = ctx;
+    uint64_t next = persist_next_seq(topic);
+    if (handshake->client->fd == -1 || next == 0) {
+        return;
+    }
+    frame_fields_t fields = { 0, 0, 0, next, 0, 0, 0, 0 };
+    if (queue_control(handshake->broker, handshake->pfd, handshake->client, FRAME_REPL, topic, &fields, 0) == 0) {
+        handshake->sent++;
+    }
+}
+
+/**
+ * @brief Starts following a leader over a connected or connecting socket.
+ *
+ * @param b The broker, which must persist messages.
+ * @param fd The socket, non-blocking; closed on failure.
+ * @return int The slot index, or -1 if no slot is free or the handshake could not be queued.
+ */
+int broker_follow(broker_t *b, int fd) {
+    int slot = broker_add_client(b, fd);
+    if (slot < 0) {
+        close(fd);
+        return -1;
+    }
+    struct pollfd *pfd = &b->fds[slot];
+    client_t *client = &b->clients[slot];
+    client->type = CLIENT_TYPE_LEADER;
+    b->repl.following = 1;
+    b->repl.upstream_slot = slot;
+    b->repl.upstream_conn = client->conn_id;
+
+    catch_up_ctx_t handshake = { b, pfd, client, NULL, 0 };
+    if (persist_list_topics(announce_position, &handshake) < 0) {
+        log_error(LOG_MODULE_BROKER, "list topic logs: %s", strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (client->fd == -1 || queue_control(b, pfd, client, FRAME_REPL, NULL, NULL, 0) < 0) {
+        return -1;
+    }
+    // Sent once the connection is established
+    pfd->events = POLLIN | POLLOUT;
+    log_debug(LOG_MODULE_BROKER, "Following the leader on fd %d with %llu local topics", fd,
+             (unsigned long long)handshake.sent);
+    return slot;
+}
+
+/**
+ * @brief Moves this broker's position in a topic bridged from the upstream broker
+ * forward and, with persistence on, marks it to be saved by save_upstream_positions().
+ *
+ * @param b The broker.
+ * @param topic The topic.
+ * @param next_seq The next upstream sequence number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int advance_upstream(broker_t *b, const char *topic, uint64_t next_seq) {
+    if (bridge_advance(&b->bridge, topic, next_seq) < 0) {
+        return -1;
+    }
+    if (b->p_mode != PERSIST_NONE) {
+        repl_pos_t *unsaved = repl_pos_upsert(&b->bridge.unsaved, topic);
+        if (unsaved == NULL) {
+            return -1;
+        }
+        unsaved->seq = bridge_position(&b->bridge, topic);
+    }
+    return 0;
+}
+
+/**
+ * @brief Saves the positions moved since the last call, once per topic, so that a
+ * restart resumes there.
+ *
+ * @param b The broker.
+ */
+static void save_upstream_positions(broker_t *b) {
+    for (size_t i = 0; i < b->bridge.unsaved.count; i++) {
+        // A failed write only costs duplicates after a restart; it is logged there
+        persist_save_bridge_position(b->bridge.unsaved.items[i].topic, b->bridge.unsaved.items[i].seq);
+    }
+    b->bridge.unsaved.count = 0;
+}
+
+/**
+ * @brief Loads the positions a bridging broker saved before a restart.
+ *
+ * @param topic A topic with a saved position.
+ * @param next_seq The position.
+ * @param ctx The broker.
+ */
+static void load_upstream_position(const char *topic, uint64_t next_seq, void *ctx) {
+    broker_t *b = ctx;
+    if (bridge_filter_match(&b->bridge.imports, topic, NULL) && bridge_advance(&b->bridge, topic, next_seq) == 0) {
+        b->bridge.resuming = 1;
+    }
+}
+
+/**
+ * @brief Context for sending a bridge the records it is missing.
+ */
+typedef struct {
+    broker_t *broker;    ///< The broker.
+    struct pollfd *pfd;  ///< The bridge's pollfd.
+    client_t *client;    ///< The bridge.
+    bridge_peer_t *peer; ///< Its patterns and positions.
+    uint64_t sent;       ///< Records queued so far.
+} bridge_catch_up_ctx_t;
+
+/**
+ * @brief Replay sink that queues each persisted record for a bridge, except records
+ * that originated on the bridge's broker.
+ *
+ * @param topic The topic being replayed.
+ * @param message The record content.
+ * @param len The length of the record in bytes.
+ * @param seq The sequence number of the record.
+ * @param origin The broker the record originated on, 0 for this one.
+ * @param ctx Pointer to a bridge_catch_up_ctx_t.
+ */
+static void bridge_catch_up_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                                 void *ctx) {
+    bridge_catch_up_ctx_t *catch_up = ctx;
+    broker_t *b = catch_up->broker;
+    frame_fields_t fields = { 0, 0, seq, 0, 0, 0, 0, origin != 0 ? origin : b->bridge.id };
+    if (catch_up->client->fd == -1) {
+        return;
+    }
+    if (fields.origin == catch_up->peer->origin) {
+        b->bridge.suppressed++;
+    } else if (queue_frame(b, catch_up->pfd, catch_up->client, topic, message, len, NULL, &fields) == 0) {
+        catch_up->sent++;
+    }
+}
+
+/**
+ * @brief Queues the records of one topic a bridge is missing, or tells it where the
+ * topic starts if it only wants new messages.
+ *
+ * @param topic The topic.
+ * @param ctx Pointer to a bridge_catch_up_ctx_t.
+ */
+static void bridge_catch_up_topic(const char *topic, void *ctx) {
+    bridge_catch_up_ctx_t *catch_up = ctx;
+    broker_t *b = catch_up->broker;
+    uint64_t from;
+    if (catch_up->client->fd == -1 || !bridge_filter_match(&catch_up->peer->filter, topic, &from)) {
+        return;
+    }
+    const repl_pos_t *pos = repl_pos_find(&catch_up->peer->from, topic);
+    if (pos != NULL && pos->seq > 0) {
+        from = pos->seq;
+    }
+    if (from > 0) {
+        replay_persisted_messages(topic, b->p_mode, b->p_duration, from, bridge_catch_up_sink, catch_up);
+        return;
+    }
+    // A reconnecting bridge resumes from here
+    frame_fields_t fields = { 0, 0, 0, persist_next_seq(topic), 0, 0, 0, 0 };
+    if (fields.from_seq != 0) {
+        queue_control(b, catch_up->pfd, catch_up->client, FRAME_BRIDGE, topic, &fields, 0);
+    }
+}
+
+/**
+ * @brief Handles a BRIDGE frame. From a downstream broker it is a topic pattern, a
+ * position or the end of its handshake: the first one turns the connection into a
+ * bridge, and the bare BRIDGE queues every record the bridge is missing, after which
+ * it receives each matching message as it is published. From the upstream broker it
+ * is the position of a topic the bridge starts receiving live, or the end of the catch-up.
+ *
+ * @param b The broker.
+ * @param frame The parsed frame.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @return int 0 to keep processing, -1 if the client was closed.
+ */
+static int handle_bridge(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client) {
+    if (client->type == CLIENT_TYPE_UPSTREAM) {
+        if (frame->topic[0] == '\0') {
+            b->bridge.resuming = 1;
+            log_info(LOG_MODULE_BROKER, "Bridge caught up with the upstream broker on fd %d", pfd->fd);
+            return 0;
+        }
+        if (!is_valid_topic(frame->topic, strlen(frame->topic)) ||
+            advance_upstream(b, frame->topic, frame->fields.from_seq) < 0) {
+            close_client(b, pfd, client);
+            return -1;
+        }
+        return 0;
+    }
+
+    int slot = (int)(client - b->clients);
+    bridge_peer_t *peer = NULL;
+    if (client->type == CLIENT_TYPE_UNKNOWN) {
+        if (b->router != NULL) {
+            log_warn(LOG_MODULE_BROKER, "fd %d wants to bridge topics, but serving bridges needs a single worker", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        peer = bridge_add_peer(&b->bridge, slot, client->conn_id);
+        if (peer == NULL) {
+            log_warn(LOG_MODULE_BROKER, "Max bridges reached. Rejecting bridge on fd %d.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        client->type = CLIENT_TYPE_BRIDGE;
+        log_info(LOG_MODULE_BROKER, "fd %d is a bridge", pfd->fd);
+    } else if (client->type == CLIENT_TYPE_BRIDGE) {
+        peer = bridge_find_peer(&b->bridge, slot, client->conn_id);
+    }
+    if (peer == NULL || peer->live) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent BRIDGE out of order, disconnecting.", pfd->fd);
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (frame->topic[0] != '\0') {
+        int rc;
+        if (frame->fields.origin != 0) {
+            peer->origin = frame->fields.origin;
+            rc = bridge_filter_add(&peer->filter, frame->topic, frame->fields.from_seq);
+        } else {
+            repl_pos_t *pos = is_valid_topic(frame->topic, strlen(frame->topic)) ? repl_pos_upsert(&peer->from, frame->topic)
+                                                                                  : NULL;
+            if (pos != NULL) {
+                pos->seq = frame->fields.from_seq;
+            }
+            rc = pos != NULL ? 0 : -1;
+        }
+        if (rc < 0) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent a bad BRIDGE line, disconnecting.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (peer->filter.count == 0 || peer->origin == b->bridge.id) {
+        log_warn(LOG_MODULE_BROKER, "fd %d: bridge %s, disconnecting", pfd->fd,
+                 peer->filter.count == 0 ? "asked for no topics" : "has this broker's own id");
+        close_client(b, pfd, client);
+        return -1;
+    }
+    bridge_catch_up_ctx_t catch_up = { b, pfd, client, peer, 0 };
+    uint64_t start = b->timing_enabled ? monotonic_ns() : 0;
+    if (b->p_mode != PERSIST_NONE && persist_list_topics(bridge_catch_up_topic, &catch_up) < 0) {
+        log_error(LOG_MODULE_BROKER, "list topic logs for bridge fd %d: %s", pfd->fd, strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    if (client->fd == -1 || queue_control(b, pfd, client, FRAME_BRIDGE, NULL, NULL, 1) < 0) {
+        return -1;
+    }
+    if (b->timing_enabled) {
+        histogram_record(&b->stats.replay_ns, monotonic_ns() - start);
+    }
+    peer->live = 1;
+    b->bridge.catchups++;
+    b->bridge.records_sent += catch_up.sent;
+    log_info(LOG_MODULE_BROKER, "fd %d: bridge caught up with %llu records", pfd->fd, (unsigned long long)catch_up.sent);
+    return 0;
+}
+
+/**
+ * @brief Publishes a message received from the upstream broker locally, keeping its origin.
+ * A message below this broker's position in its topic was received before and is
+ * dropped; so is a message that originated on this broker and came back around.
+ *
+ * @param b The broker.
+ * @param frame The parsed MSG frame.
+ * @param pfd Pointer to the pollfd structure for the upstream connection.
+ * @param client Pointer to the client_t structure for the upstream connection.
+ * @param ingress_ns Time the frame was read (0 when not stamping).
+ * @return int 0 to keep processing, -1 if the connection was closed.
+ */
+static int apply_bridged(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client, uint64_t ingress_ns) {
+    uint64_t seq = frame->fields.seq;
+    if (!bridge_filter_match(&b->bridge.imports, frame->topic, NULL)) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "The upstream broker sent topic '%s', which is not bridged",
+                        frame->topic);
+        return 0;
+    }
+    if (seq != 0 && seq < bridge_position(&b->bridge, frame->topic)) {
+        b->bridge.duplicates++;
+        return 0;
+    }
+    if (frame->fields.origin == b->bridge.id) {
+        b->bridge.looped++;
+    } else {
+        uint64_t written;
+        publish_local(b, frame->topic, frame->payload, frame->payload_len, ingress_ns, frame->fields.origin, &written);
+        b->bridge.imported++;
+    }
+    if (seq != 0 && advance_upstream(b, frame->topic, seq + 1) < 0) {
+        close_client(b, pfd, client);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts bridging topics from an upstream broker over a connected or connecting socket.
+ *
+ * @param b The broker.
+ * @param fd The socket, non-blocking; closed on failure.
+ * @return int The slot index, or -1 if no slot is free or the handshake could not be queued.
+ */
+int broker_bridge(broker_t *b, int fd) {
+    int slot = broker_add_client(b, fd);
+    if (slot < 0) {
+        close(fd);
+        return -1;
+    }
+    struct pollfd *pfd = &b->fds[slot];
+    client_t *client = &b->clients[slot];
+    client->type = CLIENT_TYPE_UPSTREAM;
+    b->bridge.bridging = 1;
+    b->bridge.upstream_slot = slot;
+    b->bridge.upstream_conn = client->conn_id;
+    if (!b->bridge.resuming && b->p_mode != PERSIST_NONE &&
+        persist_load_bridge_positions(load_upstream_position, b) < 0) {
+        log_error(LOG_MODULE_BROKER, "load bridge positions: %s", strerror(errno));
+    }
+
+    // After a lost connection, topics that appeared meanwhile are sent from their start
+    for (size_t i = 0; i < b->bridge.imports.count; i++) {
+        frame_fields_t fields = { 0, 0, 0, b->bridge.resuming ? 1 : 0, 0, 0, 0, b->bridge.id };
+        if (queue_control(b, pfd, client, FRAME_BRIDGE, b->bridge.imports.items[i].pattern, &fields, 0) < 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < b->bridge.positions.count; i++) {
+        const repl_pos_t *pos = &b->bridge.positions.items[i];
+        frame_fields_t fields = { 0, 0, 0, pos->seq, 0, 0, 0, 0 };
+        if (pos->seq > 0 && queue_control(b, pfd, client, FRAME_BRIDGE, pos->topic, &fields, 0) < 0) {
+            return -1;
+        }
+    }
+    if (queue_control(b, pfd, client, FRAME_BRIDGE, NULL, NULL, 0) < 0) {
+        return -1;
+    }
+    // Sent once the connection is established
+    pfd->events = POLLIN | POLLOUT;
+    log_debug(LOG_MODULE_BROKER, "Bridging from the upstream broker on fd %d with %zu positions", fd,
+              b->bridge.positions.count);
+    return slot;
+}
+
+/**
+ * @brief Subscribes a client to a partitioned topic by adding it to a consumer group.
+ * A new group starts at the "from" sequence number in every partition if one is given.
+ * Otherwise a named group starts with the next message and the group of a plain
+ * subscription with the persisted messages, like a subscription to any other topic.
+ *
+ * @param b The broker.
+ * @param frame The SUB frame.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @param spec The partitioned topic.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+static int join_group(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client,
+                      const partition_spec_t *spec) {
+    if (b->router != NULL) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d subscribed to partitioned topic '%s', which needs a "
+                        "single worker; subscribe to its partitions by name", pfd->fd, frame->topic);
+        close_client(b, pfd, client);
+        return -1;
+    }
+    uint64_t next_seq[PARTITION_MAX];
+    for (unsigned p = 0; p < spec->count; p++) {
+        char topic[MAX_TOPIC_LEN];
+        partition_name(topic, sizeof(topic), spec, p);
+        if (b->p_mode == PERSIST_NONE) {
+            next_seq[p] = 0;
+        } else if (frame->fields.from_seq > 0 || frame->fields.group == 0) {
+            next_seq[p] = frame->fields.from_seq > 0 ? frame->fields.from_seq : 1;
+        } else {
+            next_seq[p] = persist_next_seq(topic);
+        }
+    }
+    unsigned char moved[PARTITION_MAX];
+    partition_group_prune(&b->parts);
+    partition_group_t *g = partition_group_join(&b->parts, spec, frame->fields.group, (int)(client - b->clients),
+                                                client->conn_id, next_seq, moved);
+    if (g == NULL) {
+        close_client(b, pfd, client);
+        return -1;
+    }
+    client->type = CLIENT_TYPE_SUBSCRIBER;
+    strcpy(client->topic, frame->topic);
+    if (g->id != 0) {
+        log_info(LOG_MODULE_BROKER, "fd %d joined consumer group %llu of topic '%s' (%zu members, %u partitions)",
+                 pfd->fd, (unsigned long long)g->id, client->topic, g->member_count, spec->count);
+    } else {
+        log_info(LOG_MODULE_BROKER, "fd %d subscribed to the %u partitions of topic '%s'", pfd->fd, spec->count,
+                 client->topic);
+    }
+    hand_over(b, g, moved);
+    return client->fd == -1 ? -1 : 0;
+}
+
+/**
+ * @brief Replies to a STATS request with the current statistics report.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+static int send_stats(broker_t *b, struct pollfd *pfd, client_t *client) {
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *out = open_memstream(&report, &report_len);
+    if (out == NULL) {
+        log_error(LOG_MODULE_BROKER, "open_memstream: %s", strerror(errno));
+        return 0;
+    }
+    if (b->report != NULL) {
+        b->report(out, b);
+    }
+    fclose(out);
+
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_stats_header(header, sizeof(header), report_len);
+    int queued = header_len > 0 && outq_append_bytes(&client->out, header, (size_t)header_len) == 0 &&
+                 outq_append_bytes(&client->out, report, report_len) == 0;
+    free(report);
+    if (!queued) {
+        log_error(LOG_MODULE_BROKER, "queue stats report: %s", strerror(errno));
+        close_client(b, pfd, client);
+        return -1;
+    }
+    client->out_queued += (uint64_t)header_len + report_len;
+    return flush_client(b, pfd, client);
+}
+
+/**
+ * @brief Executes one parsed frame received from a client.
+ *
+ * @param b The broker.
+ * @param frame The parsed frame.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @param ingress_ns Time the frame was read (0 when not stamping).
+ * @return int 0 to keep processing, -1 if the client was closed.
+ */
+static int dispatch_frame(broker_t *b, const frame_t *frame, struct pollfd *pfd, client_t *client, uint64_t ingress_ns) {
+    switch (frame->type) {
+    case FRAME_SUB:
+        if (client->type == CLIENT_TYPE_SUBSCRIBER) {
+            log_warn(LOG_MODULE_BROKER, "fd %d is already subscribed to '%s'", pfd->fd, client->topic);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        // Followers and bridges keep per-connection state that a subscriber would leave behind
+        if (client->type != CLIENT_TYPE_UNKNOWN && client->type != CLIENT_TYPE_PUBLISHER) {
+            log_warn(LOG_MODULE_BROKER, "fd %d is a %s and cannot subscribe", pfd->fd, broker_client_type_name(client->type));
+            close_client(b, pfd, client);
+            return -1;
+        }
+        const partition_spec_t *spec = partition_find(b->parts.table, frame->topic);
+        if (spec != NULL) {
+            return join_group(b, frame, pfd, client, spec);
+        }
+        if (subtable_add(&b->subs, frame->topic, (int)(client - b->clients), client->conn_id) < 0) {
+            close_client(b, pfd, client);
+            return -1;
+        }
+        client->type = CLIENT_TYPE_SUBSCRIBER;
+        strcpy(client->topic, frame->topic);
+        if (b->zerocopy_min > 0 && outq_enable_zerocopy(&client->out, pfd->fd) < 0) {
+            log_warn(LOG_MODULE_BROKER, "enable zero-copy sends on fd %d: %s", pfd->fd, strerror(errno));
+        }
+        if (frame->fields.from_seq > 0) {
+            log_info(LOG_MODULE_BROKER, "fd %d subscribed to topic '%s' from sequence %llu", pfd->fd, client->topic,
+                     (unsigned long long)frame->fields.from_seq);
+        } else {
+            log_info(LOG_MODULE_BROKER, "fd %d subscribed to topic '%s'", pfd->fd, client->topic);
+        }
+        // Another core's topic: its owner replays the log and then confirms the subscription
+        if (b->router != NULL && b->router->subscribe != NULL &&
+            b->router->subscribe(b->router_ctx, (int)(client - b->clients), client->conn_id, client->topic,
+                                 frame->fields.from_seq)) {
+            client->sub_pending = 1;
+            return 0;
+        }
+        {
+            replay_ctx_t replay = { b, pfd, client, stats_topic(&b->stats, client->topic), 0 };
+            uint64_t start = b->timing_enabled ? monotonic_ns() : 0;
+            int fd = pfd->fd;
+            // A client closed during the replay loses its topic, so the probes share a copy
+            char topic[MAX_TOPIC_LEN];
+            snprintf(topic, sizeof(topic), "%s", client->topic);
+            PROBE_REPLAY_START(fd, topic, frame->fields.from_seq);
+            replay_persisted_messages(topic, b->p_mode, b->p_duration, frame->fields.from_seq, queue_replay_sink, &replay);
+            PROBE_REPLAY_END(fd, topic, replay.replayed);
+            if (b->timing_enabled && b->p_mode != PERSIST_NONE) {
+                histogram_record(&b->stats.replay_ns, monotonic_ns() - start);
+            }
+        }
+        return client->fd == -1 ? -1 : 0;
+
+    case FRAME_PUB:
+        if (b->repl.following) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d published to a follower, disconnecting.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        if (client->type == CLIENT_TYPE_UNKNOWN) {
+            client->type = CLIENT_TYPE_PUBLISHER;
+        }
+        log_debug(LOG_MODULE_BROKER, "Received message for topic '%s' from fd %d", frame->topic, pfd->fd);
+        return route_publish(b, pfd, client, frame->topic, frame->payload, frame->payload_len, ingress_ns, &frame->fields);
+
+    case FRAME_BATCH:
+        if (b->repl.following) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d published to a follower, disconnecting.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        if (client->type == CLIENT_TYPE_UNKNOWN) {
+            client->type = CLIENT_TYPE_PUBLISHER;
+        }
+        if (publish_batch(b, frame, pfd, client, ingress_ns) < 0) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent a malformed BATCH frame, disconnecting.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        log_debug(LOG_MODULE_BROKER, "Received batch of %zu messages from fd %d", frame->count, pfd->fd);
+        return client->fd == -1 ? -1 : 0;
+
+    case FRAME_STATS:
+        if (frame->payload == NULL) {
+            return send_stats(b, pfd, client);
+        }
+        // A STATS frame with a report is only valid from the server
+        break;
+
+    case FRAME_REPL:
+        return handle_repl(b, frame, pfd, client);
+
+    case FRAME_ACK:
+        if (client->type == CLIENT_TYPE_FOLLOWER) {
+            return handle_follower_ack(b, frame, pfd, client);
+        }
+        break;
+
+    case FRAME_BRIDGE:
+        return handle_bridge(b, frame, pfd, client);
+
+    case FRAME_MSG:
+        if (client->type == CLIENT_TYPE_LEADER) {
+            return apply_replicated(b, frame, pfd, client, ingress_ns);
+        }
+        if (client->type == CLIENT_TYPE_UPSTREAM) {
+            return apply_bridged(b, frame, pfd, client, ingress_ns);
+        }
+        break;
+
+    default:
+        break;
+    }
+    log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent a frame that is only valid from the server", pfd->fd);
+    close_client(b, pfd, client);
+    return -1;
+}
+
+/**
+ * @brief Executes every complete frame buffered for a client.
+ * Partial frames stay buffered until the rest arrives.
+ *
+ * @param b The broker.
+ * @param pfd Pointer to the pollfd structure for the client.
+ * @param client Pointer to the client_t structure for the client.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+static int process_input(broker_t *b, struct pollfd *pfd, client_t *client) {
+    PROF_START(mark);
+    uint64_t now = b->stamp_messages || b->capture != NULL ? monotonic_ns() : 0;
+    uint64_t ingress_ns = b->stamp_messages ? now : 0;
+
+    size_t offset = 0;
+    while (offset < client->in_len) {
+        frame_t frame;
+        size_t consumed;
+        frame_status_t status = parse_frame(client->in_buf + offset, client->in_len - offset, &frame, &consumed);
+        PROF_LAP(&b->stats.prof, PROF_PARSE, mark);
+        if (status == FRAME_INCOMPLETE) {
+            break;
+        }
+        if (status == FRAME_ERROR) {
+            log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "fd %d sent a malformed frame, disconnecting.", pfd->fd);
+            close_client(b, pfd, client);
+            return -1;
+        }
+        b->stats.frames_in++;
+        PROBE_FRAME_PARSED(pfd->fd, (int)frame.type, frame.payload_len);
+        if (b->capture != NULL && (frame.type == FRAME_PUB || frame.type == FRAME_BATCH)) {
+            capture_record(b->capture, now, client->conn_id, client->in_buf + offset, consumed);
+        }
+        if (dispatch_frame(b, &frame, pfd, client, ingress_ns) < 0) {
+            return -1;
+        }
+        // Persistence and fan-out are charged inside dispatch; parsing restarts here
+        PROF_RESTART(mark);
+        offset += consumed;
+    }
+
+    // Keep any partial frame at the start of the buffer
+    if (offset > 0) {
+        memmove(client->in_buf, client->in_buf + offset, client->in_len - offset);
+        client->in_len -= offset;
+    }
+    // Messages for bridges are sent, and positions in bridged topics saved, once per read
+    flush_bridges(b);
+    if (client->type == CLIENT_TYPE_UPSTREAM) {
+        save_upstream_positions(b);
+    }
+    // Records from the leader are acknowledged once per read
+    if (client->type == CLIENT_TYPE_LEADER && client->out.pending > 0) {
+        return flush_client(b, pfd, client);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads from a client socket, recording the read lag when timing is on.
+ * The lag is the time since the kernel stamped the received data. For TCP the stamp
+ * belongs to the last segment read, so the value is a lower bound for the batch.
+ *
+ * @param b The broker.
+ * @param fd The client socket.
+ * @param buf Destination buffer.
+ * @param len Size of the buffer.
+ * @return ssize_t The number of bytes read, 0 at end of stream, or -1 on error.
+ */
+static ssize_t read_client(broker_t *b, int fd, char *buf, size_t len) {
+#ifdef BROKER_HAVE_RX_TIMESTAMP
+    if (b->timing_enabled) {
+        union {
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(fd, &msg, 0);
+        if (n <= 0) {
+            return n;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec stamp, now;
+                memcpy(&stamp, CMSG_DATA(cm), sizeof(stamp));
+                clock_gettime(CLOCK_REALTIME, &now);
+                int64_t lag = (int64_t)(now.tv_sec - stamp.tv_sec) * 1000000000LL + (now.tv_nsec - stamp.tv_nsec);
+                if (lag > 0) {
+                    histogram_record(&b->stats.read_lag_ns, (uint64_t)lag);
+                }
+            }
+        }
+        return n;
+    }
+#endif
+    return read(fd, buf, len);
+}
+
+/**
+ * @brief Reads from a readable client and executes every complete frame received.
+ * Reassembles complete frames (SUB/PUB/BATCH/STATS) and dispatches them.
+ * Partial frames stay buffered until the rest arrives.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ */
+void broker_handle_readable(broker_t *b, int slot) {
+    struct pollfd *pfd = &b->fds[slot];
+    client_t *client = &b->clients[slot];
+    PROF_START(mark);
+    if (reserve_buffer(&client->in_buf, &client->in_cap, client->in_len + BROKER_READ_CHUNK) < 0) {
+        close_client(b, pfd, client);
+        return;
+    }
+
+    ssize_t valread = read_client(b, pfd->fd, client->in_buf + client->in_len, client->in_cap - client->in_len);
+    if (valread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (valread <= 0) {
+        log_info(LOG_MODULE_BROKER, "Client on fd %d disconnected.", pfd->fd);
+        close_client(b, pfd, client);
+        return;
+    }
+    client->in_len += (size_t)valread;
+    b->stats.bytes_read += (uint64_t)valread;
+    PROF_LAP(&b->stats.prof, PROF_READ, mark);
+    process_input(b, pfd, client);
+}
+
+/**
+ * @brief Executes bytes as if they had been read from a client's socket.
+ * The bytes are appended to the client's input, so frames may be split across calls.
+ *
+ * @param b The broker.
+ * @param slot The client slot.
+ * @param data The received bytes.
+ * @param len The number of bytes.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+int broker_handle_input(broker_t *b, int slot, const char *data, size_t len) {
+    struct pollfd *pfd = &b->fds[slot];
+    client_t *client = &b->clients[slot];
+    if (reserve_buffer(&client->in_buf, &client->in_cap, client->in_len + len) < 0) {
+        close_client(b, pfd, client);
+        return -1;
+    }
+    memcpy(client->in_buf + client->in_len, data, len);
+    client->in_len += len;
+    b->stats.bytes_read += len;
+    return process_input(b, pfd, client);
+}
@@ -0,0 +1,360 @@
+/**
+ * @file broker.h
+ * @brief Declares the broker core: client connections, frame handling, routing and fan-out.
+ * @author Mohammed Uddin
+ *
+ * The core owns no event loop. The caller polls the descriptors in `fds` and calls
+ * broker_handle_readable() and broker_handle_writable() for ready client slots, so
+ * the same core runs inside the server, the microbenchmarks and the tests. Slot 0
+ * of `fds` and `clients` is reserved for the listening socket; slots 1 to
+ * `max_clients` hold client connections.
+ *
+ * Several cores can share the work of one broker, each on its own thread. A core then
+ * gets a broker_router_t (see shard.h) that sends publishes and subscriptions for
+ * topics owned by another core to that core, and receives the owner's deliveries
+ * through broker_deliver(), broker_deliver_to() and broker_confirm_subscription().
+ *
+ * A core that persists messages can also serve follower brokers that replicate its
+ * logs, and can itself follow a leader through broker_follow() (see replication.h).
+ *
+ * Topics listed in the core's partition table are split into partitions, and their
+ * subscribers form consumer groups that share the partitions (see partition.h).
+ *
+ * Topics can be bridged between brokers: a core serves downstream brokers that bridge
+ * topics from it, and can itself bridge topics from an upstream broker through
+ * broker_bridge() (see bridge.h).
+ */
+
+#ifndef LITEMQ_BROKER_H
+#define LITEMQ_BROKER_H
+
+#include <poll.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "persistence.h"
+#include "histogram.h"
+#include "outqueue.h"
+#include "splicefan.h"
+#include "stats.h"
+#include "capture.h"
+#include "subtable.h"
+#include "fanpool.h"
+#include "replication.h"
+#include "partition.h"
+#include "bridge.h"
+
+#define BROKER_READ_CHUNK (64 * 1024)
+#define BROKER_MAX_CLIENT_BACKLOG (64 * 1024 * 1024)
+#define BROKER_SHARED_PAYLOAD_MIN (16 * 1024)
+#define BROKER_SPLICE_MAX_PAYLOAD (1024 * 1024)
+#define BROKER_FANOUT_CHUNK 256
+#define BROKER_DEFAULT_PARALLEL_MIN 4096
+
+/**
+ * @brief Defines the type of client connected to the server.
+ */
+typedef enum {
+    CLIENT_TYPE_UNKNOWN,    ///< Client type is not yet determined.
+    CLIENT_TYPE_PUBLISHER,  ///< Client has published but not subscribed.
+    CLIENT_TYPE_SUBSCRIBER, ///< Client is a subscriber.
+    CLIENT_TYPE_FOLLOWER,   ///< Client is a broker replicating this broker's logs.
+    CLIENT_TYPE_LEADER,     ///< Connection to the broker whose logs this broker replicates.
+    CLIENT_TYPE_BRIDGE,     ///< Client is a broker bridging topics from this broker.
+    CLIENT_TYPE_UPSTREAM    ///< Connection to the broker this broker bridges topics from.
+} client_type_t;
+
+/**
+ * @brief Marks the end of a queued MSG frame so its queueing delay can be recorded once sent.
+ */
+typedef struct {
+    uint64_t end;        ///< Value of out_queued just after the frame was queued.
+    uint64_t ingress_ns; ///< Ingress timestamp of the message.
+} delay_mark_t;
+
+/**
+ * @brief Structure to hold information about each connected client.
+ */
+typedef struct {
+    int fd;                 ///< File descriptor of the client socket.
+    client_type_t type;     ///< Type of the client (publisher or subscriber).
+    char topic[MAX_TOPIC_LEN]; ///< The topic the client is subscribed to (if applicable).
+    char *in_buf;           ///< Received bytes not yet parsed into frames.
+    size_t in_len;          ///< Number of bytes held in in_buf.
+    size_t in_cap;          ///< Allocated size of in_buf.
+    out_queue_t out;        ///< Frames queued for sending.
+    uint64_t out_queued;    ///< Total bytes ever queued for this connection.
+    uint64_t out_sent;      ///< Total bytes ever written to this connection.
+    uint64_t backlog_since; ///< When queued output last started waiting for the socket (0 if none is waiting).
+    delay_mark_t *marks;    ///< Stamped frames queued but not yet written (FIFO).
+    size_t marks_head;      ///< Index of the oldest mark.
+    size_t marks_len;       ///< End of the marks in use.
+    size_t marks_cap;       ///< Allocated number of marks.
+    uint32_t conn_id;       ///< Connection number, identifying the client in captures and to other cores.
+    int sub_pending;        ///< Subscribed, but the topic's owner has not replayed and confirmed it yet.
+    int fanout_failure;     ///< Why the last pool fan-out could not queue for this client (0 if it could).
+    int fanout_errno;       ///< errno of that failure.
+} client_t;
+
+typedef struct broker broker_t;
+
+/**
+ * @brief Writes the statistics report sent in reply to a STATS frame.
+ *
+ * @param out The stream to write to.
+ * @param broker The broker.
+ */
+typedef void (*broker_report_t)(FILE *out, const broker_t *broker);
+
+/**
+ * @brief Hooks that hand topics owned by another core to that core. Every hook is optional.
+ */
+typedef struct {
+    /**
+     * @brief Offers a published message to the router before it is published locally.
+     * @return int 1 if the router took the message, 0 to persist and fan it out here.
+     */
+    int (*publish)(void *ctx, const char *topic, const char *payload, size_t len, uint64_t ingress_ns);
+    /**
+     * @brief Offers a new subscription to the router before its log is replayed locally.
+     * @return int 1 if the owner replays and confirms it later, 0 to replay it here now.
+     */
+    int (*subscribe)(void *ctx, int slot, uint32_t conn_id, const char *topic, uint64_t from_seq);
+    /**
+     * @brief Reports a message this core has just persisted and fanned out to its own subscribers.
+     */
+    void (*published)(void *ctx, const char *topic, const char *payload, size_t len, const frame_fields_t *fields);
+} broker_router_t;
+
+/**
+ * @brief State of one broker core.
+ */
+struct broker {
+    struct pollfd *fds;               ///< Poll slots 0..max_clients (slot 0: listener).
+    client_t *clients;                ///< Client slots, parallel to fds.
+    int max_clients;                  ///< Number of client slots.
+    persistence_mode_t p_mode;        ///< Persistence mode.
+    int p_duration;                   ///< Retention in seconds for PERSIST_TIMED.
+    int stamp_messages;               ///< Whether messages carry ingress/persist times (--timestamps).
+    int timing_enabled;               ///< Whether publish, fan-out, persistence, replay and read lag are timed.
+    size_t zerocopy_min;              ///< Smallest payload sent with MSG_ZEROCOPY, or 0 if off.
+    size_t splice_min;                ///< Smallest payload fanned out with tee/splice, or 0 if off.
+    splice_fanout_t fanout;           ///< The tee/splice fan-out engine, used when splice_min is set.
+    const payload_t *fanout_payload;  ///< The shared payload currently loaded into the engine, if any.
+    uint64_t splice_loads;            ///< Messages loaded into the fan-out engine.
+    uint64_t splice_deliveries;       ///< Deliveries spliced from the fan-out engine.
+    histogram_t queue_delay;          ///< Time from ingress until a stamped message was written.
+    stats_shard_t stats;              ///< Counters of the thread running this core.
+    subtable_t subs;                  ///< Subscribers by topic, read by fan-out (see subtable.h).
+    broker_report_t report;           ///< Writes STATS replies (NULL: empty report).
+    capture_t *capture;               ///< Records published frames (--capture), or NULL.
+    const broker_router_t *router;    ///< Routes topics owned by other cores, or NULL when this core owns all.
+    void *router_ctx;                 ///< Context passed to the router's hooks.
+    fanpool_t *pool;                  ///< Threads splitting large fan-outs, or NULL.
+    size_t parallel_min;              ///< Smallest subscriber count fanned out on the pool.
+    struct fanout_lane *lanes;        ///< Per-lane results of a pool fan-out.
+    repl_t repl;                      ///< Followers, held publisher confirmations and the leader connection.
+    partition_state_t parts;          ///< Partitioned topics and their consumer groups.
+    bridge_t bridge;                  ///< Bridges served, and the upstream connection of this core's own bridge.
+};
+
+/**
+ * @brief Initialises a broker over caller-provided slot arrays, all slots free.
+ *
+ * @param broker The broker.
+ * @param fds Array of at least max_clients + 1 pollfd structures.
+ * @param clients Array of at least max_clients + 1 client_t structures.
+ * @param max_clients The number of client slots.
+ */
+void broker_init(broker_t *broker, struct pollfd *fds, client_t *clients, int max_clients);
+
+/**
+ * @brief Closes every open client slot and frees the broker's buffers.
+ *
+ * @param broker The broker.
+ */
+void broker_free(broker_t *broker);
+
+/**
+ * @brief Fans out messages with at least `min_subscribers` subscribers on a thread pool.
+ * The calling thread takes part in each fan-out and waits for it, so subscribers keep
+ * receiving messages in publish order. Payloads handled by the splice engine stay on
+ * the core's thread.
+ *
+ * @param broker The broker.
+ * @param pool The pool, started with the broker's subscription index; owned by the caller.
+ * @param min_subscribers Smallest subscriber count worth splitting.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int broker_set_fanout_pool(broker_t *broker, fanpool_t *pool, size_t min_subscribers);
+
+/**
+ * @brief Accepts a connection from a listening socket into a free client slot.
+ *
+ * @param broker The broker.
+ * @param listen_fd The listening socket.
+ */
+void broker_accept(broker_t *broker, int listen_fd);
+
+/**
+ * @brief Registers a connected, non-blocking socket in a free client slot.
+ *
+ * @param broker The broker.
+ * @param fd The socket.
+ * @return int The slot index, or -1 if every slot is in use.
+ */
+int broker_add_client(broker_t *broker, int fd);
+
+/**
+ * @brief Closes a client connection and resets its slot for reuse.
+ *
+ * @param broker The broker.
+ * @param slot The client slot.
+ */
+void broker_close_client(broker_t *broker, int slot);
+
+/**
+ * @brief Reads from a readable client and executes every complete frame received.
+ *
+ * @param broker The broker.
+ * @param slot The client slot.
+ */
+void broker_handle_readable(broker_t *broker, int slot);
+
+/**
+ * @brief Executes bytes as if they had been read from a client's socket.
+ * Lets tests and benchmarks drive the core without a network round trip; the slot's
+ * socket is only written to. Frames may be split across calls.
+ *
+ * @param broker The broker.
+ * @param slot The client slot.
+ * @param data The received bytes.
+ * @param len The number of bytes.
+ * @return int 0 on success, -1 if the client was closed.
+ */
+int broker_handle_input(broker_t *broker, int slot, const char *data, size_t len);
+
+/**
+ * @brief Drains a writable client's output queue.
+ *
+ * @param broker The broker.
+ * @param slot The client slot.
+ */
+void broker_handle_writable(broker_t *broker, int slot);
+
+/**
+ * @brief Releases the payloads of a subscriber's completed zero-copy sends.
+ *
+ * @param broker The broker.
+ * @param slot The client slot.
+ * @return int The number of completion notifications processed (0 on error).
+ */
+int broker_reap_zerocopy(broker_t *broker, int slot);
+
+/**
+ * @brief Persists a message and forwards it to every subscriber of its topic.
+ *
+ * @param broker The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param ingress_ns Time the message was received (0 when not stamping).
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+uint64_t broker_publish(broker_t *broker, const char *topic, const char *payload, size_t len, uint64_t ingress_ns);
+
+/**
+ * @brief Starts following a leader over a connected or connecting socket.
+ * The socket takes a client slot. The handshake announcing the position of every local
+ * log is queued and sent once the connection is writable; from then on the records
+ * the leader sends are written to the local logs under the leader's sequence numbers,
+ * fanned out to local subscribers and acknowledged. Closing the slot ends following.
+ *
+ * @param broker The broker, which must persist messages.
+ * @param fd The socket, non-blocking; closed on failure.
+ * @return int The slot index, or -1 if no slot is free or the handshake could not be queued.
+ */
+int broker_follow(broker_t *broker, int fd);
+
+/**
+ * @brief Starts bridging topics from an upstream broker over a connected or connecting socket.
+ * The socket takes a client slot. The handshake announcing the patterns in
+ * `broker->bridge.imports` and the position in every topic bridged so far is queued
+ * and sent once the connection is writable; from then on the messages the upstream
+ * broker sends are published locally. Closing the slot ends bridging until the next call.
+ *
+ * @param broker The broker.
+ * @param fd The socket, non-blocking; closed on failure.
+ * @return int The slot index, or -1 if no slot is free or the handshake could not be queued.
+ */
+int broker_bridge(broker_t *broker, int fd);
+
+/**
+ * @brief Forwards a message persisted by another core to this core's confirmed subscribers.
+ *
+ * @param broker The broker.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields The header fields stamped by the owner (sequence number, timestamps), or NULL.
+ * @return uint64_t The number of subscribers the message was queued for.
+ */
+uint64_t broker_deliver(broker_t *broker, const char *topic, const char *payload, size_t len,
+                        const frame_fields_t *fields);
+
+/**
+ * @brief Queues a message replayed by a topic's owner for one subscriber still awaiting confirmation.
+ *
+ * @param broker The broker.
+ * @param slot The subscriber's client slot.
+ * @param conn_id The connection number the subscription was made from.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq The sequence number of the message.
+ * @return int 0 if the message was queued, -1 if the connection is gone or was closed.
+ */
+int broker_deliver_to(broker_t *broker, int slot, uint32_t conn_id, const char *topic, const char *payload,
+                      size_t len, uint64_t seq);
+
+/**
+ * @brief Starts live delivery to a subscriber once the topic's owner has replayed its log.
+ *
+ * @param broker The broker.
+ * @param slot The subscriber's client slot.
+ * @param conn_id The connection number the subscription was made from.
+ * @return int 0 on success, -1 if the connection is gone.
+ */
+int broker_confirm_subscription(broker_t *broker, int slot, uint32_t conn_id);
+
+/**
+ * @brief Counts the live subscribers of a topic, or of all topics.
+ * Counting one topic applies pending subscription changes, so only the core's own
+ * thread may pass a topic.
+ *
+ * @param broker The broker.
+ * @param topic The topic, or NULL to count every subscriber.
+ * @return size_t The number of subscribers.
+ */
+size_t broker_count_subscribers(broker_t *broker, const char *topic);
+
+/**
+ * @brief Merges the broker's counters into one shard for a report.
+ * Each topic's subscribers are counted, and topics with subscribers but no traffic yet
+ * are added so they are reported too.
+ *
+ * @param broker The broker.
+ * @return stats_shard_t* The merged counters (free with stats_shard_free() and free()), or NULL.
+ */
+stats_shard_t *broker_collect_stats(const broker_t *broker);
+
+/**
+ * @brief Returns the name of a client type as used in reports.
+ *
+ * @param type The client type.
+ * @return const char* The name.
+ */
+const char *broker_client_type_name(client_type_t type);
+
+#endif // LITEMQ_BROKER_H
@@ -0,0 +1,200 @@
+/**
+ * @file capture.c
+ * @brief Implements the ingress capture file.
+ * @author Mohammed Uddin
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "capture.h"
+
+/**
+ * @brief Encodes an unsigned LEB128 varint.
+ *
+ * @param out Destination of at least 10 bytes.
+ * @param value The value.
+ * @return size_t The number of bytes written.
+ */
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/**
+ * @brief Decodes an unsigned LEB128 varint from a stream.
+ *
+ * @param file The stream.
+ * @param value Receives the value.
+ * @return int 1 on success, 0 at a clean end of file, -1 if the varint is truncated or too long.
+ */
+static int get_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int ch = getc(file);
+        if (ch == EOF) {
+            return shift == 0 ? 0 : -1;
+        }
+        *value |= (uint64_t)(ch & 0x7f) << shift;
+        if ((ch & 0x80) == 0) {
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Creates a capture file and writes its header.
+ *
+ * @param c The capture.
+ * @param path Path of the file (truncated if it exists).
+ * @param now_ns Current monotonic time, the start of the capture.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int capture_open(capture_t *c, const char *path, uint64_t now_ns) {
+    memset(c, 0, sizeof(*c));
+    c->file = fopen(path, "wb");
+    if (c->file == NULL) {
+        return -1;
+    }
+    c->buffer = malloc(CAPTURE_BUFFER);
+    if (c->buffer != NULL) {
+        setvbuf(c->file, c->buffer, _IOFBF, CAPTURE_BUFFER);
+    }
+    if (fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, c->file) != CAPTURE_MAGIC_LEN) {
+        int saved = errno;
+        fclose(c->file);
+        free(c->buffer);
+        c->file = NULL;
+        errno = saved;
+        return -1;
+    }
+    c->start_ns = now_ns;
+    c->last_ns = now_ns;
+    c->bytes = CAPTURE_MAGIC_LEN;
+    return 0;
+}
+
+/**
+ * @brief Appends one frame to a capture.
+ *
+ * @param c The capture.
+ * @param now_ns Time the frame was received.
+ * @param conn Connection number of the sender.
+ * @param frame The frame bytes.
+ * @param len The frame length.
+ */
+void capture_record(capture_t *c, uint64_t now_ns, uint32_t conn, const char *frame, size_t len) {
+    if (c->failed) {
+        return;
+    }
+    unsigned char header[30];
+    size_t n = put_varint(header, now_ns > c->last_ns ? now_ns - c->last_ns : 0);
+    n += put_varint(header + n, conn);
+    n += put_varint(header + n, len);
+    if (fwrite(header, 1, n, c->file) != n || fwrite(frame, 1, len, c->file) != len) {
+        c->failed = 1;
+        return;
+    }
+    if (now_ns > c->last_ns) {
+        c->last_ns = now_ns;
+    }
+    c->frames++;
+    c->bytes += n + len;
+}
+
+/**
+ * @brief Flushes and closes a capture.
+ *
+ * @param c The capture.
+ * @return int 0 if every record was written, -1 otherwise.
+ */
+int capture_close(capture_t *c) {
+    if (c->file == NULL) {
+        return -1;
+    }
+    int rc = fclose(c->file) == 0 && !c->failed ? 0 : -1;
+    free(c->buffer);
+    c->file = NULL;
+    c->buffer = NULL;
+    return rc;
+}
+
+/**
+ * @brief Opens a capture for reading and checks its header.
+ *
+ * @param r The reader.
+ * @param path Path of the capture.
+ * @return int 0 on success, -1 if the file cannot be opened or is not a capture.
+ */
+int capture_reader_open(capture_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->file = fopen(path, "rb");
+    if (r->file == NULL) {
+        return -1;
+    }
+    char magic[CAPTURE_MAGIC_LEN];
+    if (fread(magic, 1, sizeof(magic), r->file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fclose(r->file);
+        r->file = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the next record of a capture.
+ *
+ * @param r The reader.
+ * @param rec Receives the record.
+ * @return int 1 if a record was read, 0 at the end of the capture, -1 if it is truncated or corrupt.
+ */
+int capture_next(capture_reader_t *r, capture_record_t *rec) {
+    uint64_t delta, conn, len;
+    int rc = get_varint(r->file, &delta);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (get_varint(r->file, &conn) != 1 || get_varint(r->file, &len) != 1 || conn > UINT32_MAX ||
+        len > CAPTURE_MAX_FRAME) {
+        return -1;
+    }
+    if (len > r->cap) {
+        char *grown = realloc(r->data, len);
+        if (grown == NULL) {
+            return -1;
+        }
+        r->data = grown;
+        r->cap = len;
+    }
+    if (fread(r->data, 1, len, r->file) != len) {
+        return -1;
+    }
+    r->offset_ns += delta;
+    rec->offset_ns = r->offset_ns;
+    rec->conn = (uint32_t)conn;
+    rec->data = r->data;
+    rec->len = len;
+    return 1;
+}
+
+/**
+ * @brief Closes a capture reader and frees its buffer.
+ *
+ * @param r The reader.
+ */
+void capture_reader_close(capture_reader_t *r) {
+    if (r->file != NULL) {
+        fclose(r->file);
+    }
+    free(r->data);
+    r->file = NULL;
+    r->data = NULL;
+    r->cap = 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file capture.h
+ * @brief Declares the ingress capture file written by the server and read by litemq-replay.
+ * @author Mohammed Uddin
+ *
+ * A capture starts with the 8-byte magic CAPTURE_MAGIC, followed by one record per
+ * captured frame. A record is three unsigned LEB128 varints, then the frame bytes
+ * exactly as the publisher sent them:
+ *
+ *     delta_ns  time since the previous record (since the capture started for the first)
+ *     conn      connection number, the same for every frame of one publisher connection
+ *     len       frame length in bytes
+ *
+ * Typical records carry 4 to 6 bytes of overhead. The file is written through a large
+ * stdio buffer, so capturing costs the event loop one memcpy per frame.
+ */
+
+#ifndef LITEMQ_CAPTURE_H
+#define LITEMQ_CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "LMQCAP1\n"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_BUFFER (1024 * 1024)
+#define CAPTURE_MAX_FRAME (256 * 1024 * 1024)
+
+/**
+ * @brief A capture file being written.
+ */
+typedef struct {
+    FILE *file;        ///< The capture file.
+    char *buffer;      ///< stdio buffer of CAPTURE_BUFFER bytes.
+    uint64_t start_ns; ///< Time the capture started.
+    uint64_t last_ns;  ///< Time of the previous record.
+    uint64_t frames;   ///< Records written.
+    uint64_t bytes;    ///< Bytes written, including record headers.
+    int failed;        ///< Set once a write fails; later records are dropped.
+} capture_t;
+
+/**
+ * @brief One record read back from a capture.
+ */
+typedef struct {
+    uint64_t offset_ns; ///< Time since the capture started.
+    uint32_t conn;      ///< Connection number.
+    char *data;         ///< Frame bytes (owned by the reader, valid until the next read).
+    size_t len;         ///< Frame length.
+} capture_record_t;
+
+/**
+ * @brief A capture file being read.
+ */
+typedef struct {
+    FILE *file;         ///< The capture file.
+    uint64_t offset_ns; ///< Time of the last record read.
+    char *data;         ///< Buffer holding the last frame read.
+    size_t cap;         ///< Allocated size of data.
+} capture_reader_t;
+
+/**
+ * @brief Creates a capture file and writes its header.
+ *
+ * @param c The capture.
+ * @param path Path of the file (truncated if it exists).
+ * @param now_ns Current monotonic time, the start of the capture.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int capture_open(capture_t *c, const char *path, uint64_t now_ns);
+
+/**
+ * @brief Appends one frame to a capture.
+ *
+ * @param c The capture.
+ * @param now_ns Time the frame was received.
+ * @param conn Connection number of the sender.
+ * @param frame The frame bytes.
+ * @param len The frame length.
+ */
+void capture_record(capture_t *c, uint64_t now_ns, uint32_t conn, const char *frame, size_t len);
+
+/**
+ * @brief Flushes and closes a capture.
+ *
+ * @param c The capture.
+ * @return int 0 if every record was written, -1 otherwise.
+ */
+int capture_close(capture_t *c);
+
+/**
+ * @brief Opens a capture for reading and checks its header.
+ *
+ * @param r The reader.
+ * @param path Path of the capture.
+ * @return int 0 on success, -1 if the file cannot be opened or is not a capture.
+ */
+int capture_reader_open(capture_reader_t *r, const char *path);
+
+/**
+ * @brief Reads the next record of a capture.
+ *
+ * @param r The reader.
+ * @param rec Receives the record.
+ * @return int 1 if a record was read, 0 at the end of the capture, -1 if it is truncated or corrupt.
+ */
+int capture_next(capture_reader_t *r, capture_record_t *rec);
+
+/**
+ * @brief Closes a capture reader and frees its buffer.
+ *
+ * @param r The reader.
+ */
+void capture_reader_close(capture_reader_t *r);
+
+#endif // LITEMQ_CAPTURE_H
@@ -0,0 +1,267 @@
+/**
+ * @file fanpool.c
+ * @brief Implements the work-stealing fan-out thread pool.
+ * @author Mohammed Uddin
+ *
+ * A lane's run of chunks is one 64-bit word holding its front and back index. The
+ * lane takes from the front and thieves from the back, both with a compare-and-swap
+ * on the whole word, so a chunk is handed out exactly once without locks.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fanpool.h"
+
+/**
+ * @brief Start argument of a pool thread.
+ */
+struct fanpool_thread {
+    fanpool_t *pool;           ///< The pool.
+    int lane;                  ///< The thread's lane (1 to threads).
+    subtable_reader_t *reader; ///< Its registration with the subscription index, or NULL.
+};
+
+/**
+ * @brief Takes a chunk from a lane's run.
+ *
+ * @param lane The lane.
+ * @param steal Whether to take from the back (another lane's run) rather than the front.
+ * @param chunk Receives the chunk index.
+ * @return int 1 if a chunk was taken, 0 if the run is empty.
+ */
+static int take_chunk(fanpool_lane_t *lane, int steal, uint32_t *chunk) {
+    uint64_t range = __atomic_load_n(&lane->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t front = (uint32_t)(range >> 32);
+        uint32_t back = (uint32_t)range;
+        if (front >= back) {
+            return 0;
+        }
+        uint64_t next;
+        if (steal) {
+            *chunk = back - 1;
+            next = ((uint64_t)front << 32) | (back - 1);
+        } else {
+            *chunk = front;
+            next = ((uint64_t)(front + 1) << 32) | back;
+        }
+        if (__atomic_compare_exchange_n(&lane->range, &range, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Runs chunks of the current job, first from the own lane, then stolen, until none are left.
+ *
+ * @param pool The pool.
+ * @param lane The running lane.
+ * @param fn The job.
+ * @param ctx Its context.
+ * @param items Its number of items.
+ * @param chunk Items per chunk.
+ */
+static void work(fanpool_t *pool, int lane, fanpool_fn_t fn, void *ctx, size_t items, size_t chunk) {
+    int lanes = pool->threads + 1;
+    for (;;) {
+        uint32_t c;
+        int stolen = 0;
+        if (!take_chunk(&pool->lanes[lane], 0, &c)) {
+            for (int i = 1; i < lanes && !stolen; i++) {
+                stolen = take_chunk(&pool->lanes[(lane + i) % lanes], 1, &c);
+            }
+            if (!stolen) {
+                return;
+            }
+            __atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+        }
+        size_t begin = (size_t)c * chunk;
+        size_t end = begin + chunk < items ? begin + chunk : items;
+        fn(ctx, begin, end, lane);
+        // Publishes the chunk's writes to the submitting thread
+        __atomic_sub_fetch(&pool->remaining, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Entry point of a pool thread: sleeps until a job is posted, joins it, repeats.
+ *
+ * @param arg The thread's struct fanpool_thread.
+ * @return void* NULL.
+ */
+static void *pool_main(void *arg) {
+    struct fanpool_thread *self = arg;
+    fanpool_t *pool = self->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && (pool->generation == seen || !pool->open)) {
+            // A job that closed before this thread woke up is skipped
+            seen = pool->generation;
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        fanpool_fn_t fn = pool->fn;
+        void *ctx = pool->ctx;
+        size_t items = pool->items;
+        size_t chunk = pool->chunk;
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (self->reader != NULL) {
+            subtable_online(pool->subs, self->reader);
+        }
+        work(pool, self->lane, fn, ctx, items, chunk);
+        if (self->reader != NULL) {
+            subtable_offline(self->reader);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts a pool.
+ *
+ * @param pool The pool.
+ * @param threads Number of pool threads, 1 to FANPOOL_MAX_THREADS.
+ * @param subs Subscription index the threads read during jobs, or NULL. Call from its writer's thread.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int fanpool_init(fanpool_t *pool, int threads, subtable_t *subs) {
+    memset(pool, 0, sizeof(*pool));
+    if (threads < 1 || threads > FANPOOL_MAX_THREADS) {
+        errno = EINVAL;
+        return -1;
+    }
+    pool->subs = subs;
+    pool->tids = calloc((size_t)threads, sizeof(*pool->tids));
+    pool->args = calloc((size_t)threads, sizeof(*pool->args));
+    pool->lanes = calloc((size_t)threads + 1, sizeof(*pool->lanes));
+    if (pool->tids == NULL || pool->args == NULL || pool->lanes == NULL) {
+        fanpool_free(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < threads; i++) {
+        struct fanpool_thread *arg = &pool->args[i];
+        arg->pool = pool;
+        arg->lane = i + 1;
+        if (subs != NULL) {
+            arg->reader = subtable_register_reader(subs);
+            if (arg->reader == NULL) {
+                fanpool_free(pool);
+                errno = EBUSY;
+                return -1;
+            }
+            subtable_offline(arg->reader);
+        }
+        int err = pthread_create(&pool->tids[i], NULL, pool_main, arg);
+        if (err != 0) {
+            if (arg->reader != NULL) {
+                subtable_unregister_reader(arg->reader);
+                arg->reader = NULL;
+            }
+            fanpool_free(pool);
+            errno = err;
+            return -1;
+        }
+        pool->threads++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the pool threads and frees the pool.
+ *
+ * @param pool The pool.
+ */
+void fanpool_free(fanpool_t *pool) {
+    if (pool->tids != NULL && pool->args != NULL && pool->lanes != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < pool->threads; i++) {
+            pthread_join(pool->tids[i], NULL);
+            if (pool->args[i].reader != NULL) {
+                subtable_unregister_reader(pool->args[i].reader);
+            }
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        pthread_cond_destroy(&pool->done);
+    }
+    free(pool->tids);
+    free(pool->args);
+    free(pool->lanes);
+    pool->tids = NULL;
+    pool->args = NULL;
+    pool->lanes = NULL;
+    pool->threads = 0;
+}
+
+/**
+ * @brief Runs a job over `items` items on the calling thread and every pool thread, and waits for it.
+ * Only one thread may submit jobs to a pool.
+ *
+ * @param pool The pool.
+ * @param items Number of items.
+ * @param chunk Items per chunk (at least 1).
+ * @param fn Processes one chunk.
+ * @param ctx Passed to fn.
+ * @return uint64_t Number of chunks stolen from another lane.
+ */
+uint64_t fanpool_run(fanpool_t *pool, size_t items, size_t chunk, fanpool_fn_t fn, void *ctx) {
+    if (items == 0) {
+        return 0;
+    }
+    size_t chunks = (items + chunk - 1) / chunk;
+    int lanes = pool->threads + 1;
+    for (int i = 0; i < lanes; i++) {
+        uint64_t front = chunks * (size_t)i / (size_t)lanes;
+        uint64_t back = chunks * (size_t)(i + 1) / (size_t)lanes;
+        __atomic_store_n(&pool->lanes[i].range, (front << 32) | back, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&pool->remaining, chunks, __ATOMIC_RELAXED);
+    uint64_t steals = __atomic_load_n(&pool->steals, __ATOMIC_RELAXED);
+
+    // The mutex publishes the lanes and the job to the threads it wakes
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->items = items;
+    pool->chunk = chunk;
+    pool->open = 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, 0, fn, ctx, items, chunk);
+    while (__atomic_load_n(&pool->remaining, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+
+    // Threads still inside the job find no chunks and leave; later ones skip it
+    pthread_mutex_lock(&pool->lock);
+    pool->open = 0;
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return __atomic_load_n(&pool->steals, __ATOMIC_RELAXED) - steals;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file fanpool.h
+ * @brief Declares the work-stealing thread pool that splits very large fan-outs.
+ * @author Mohammed Uddin
+ *
+ * Queueing one message for tens of thousands of subscribers keeps an event loop busy
+ * for milliseconds. fanpool_run() cuts such a job into chunks, deals an equal run of
+ * chunks to every lane (the calling thread and each pool thread), and lets a lane that
+ * runs out steal chunks from the far end of another lane's run. Lanes take their own
+ * chunks from the front, so a thief and the owner rarely compete for the same chunk.
+ *
+ * A run returns only once every chunk is done. Each subscriber appears in one chunk
+ * per message, and the next message is not started before the previous run has
+ * finished, so every subscriber still receives messages in publish order.
+ *
+ * Pool threads read the core's subscription index while they work, so they register
+ * with it as readers (see subtable.h) and are offline while they sleep.
+ */
+
+#ifndef LITEMQ_FANPOOL_H
+#define LITEMQ_FANPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "subtable.h"
+
+#define FANPOOL_MAX_THREADS 63
+
+/**
+ * @brief Processes the items [begin, end) of a job.
+ *
+ * @param ctx The job's context.
+ * @param begin First item.
+ * @param end One past the last item.
+ * @param lane The running lane: 0 for the calling thread, 1 to threads for pool threads.
+ */
+typedef void (*fanpool_fn_t)(void *ctx, size_t begin, size_t end, int lane);
+
+/**
+ * @brief The chunks still queued on one lane, packed so one compare-and-swap updates both ends.
+ */
+typedef struct {
+    uint64_t range; ///< Next chunk to take from the front (high 32 bits) and end of the run (low 32 bits).
+    char pad[56];   ///< Keeps every lane's range on its own cache line.
+} fanpool_lane_t;
+
+/**
+ * @brief A pool of fan-out threads.
+ */
+typedef struct {
+    int threads;                      ///< Pool threads (lanes minus one).
+    pthread_t *tids;                  ///< The pool threads.
+    struct fanpool_thread *args;      ///< Start arguments of the pool threads.
+    fanpool_lane_t *lanes;            ///< Queued chunks per lane.
+    subtable_t *subs;                 ///< The index the threads read, or NULL.
+    pthread_mutex_t lock;             ///< Guards the job description and the thread counts.
+    pthread_cond_t wake;              ///< Signals a new job or shutdown.
+    pthread_cond_t done;              ///< Signals that the last pool thread has left a job.
+    uint64_t generation;              ///< Incremented for every job.
+    int open;                         ///< Whether the current job still accepts threads.
+    int stop;                         ///< Set to shut the threads down.
+    fanpool_fn_t fn;                  ///< The current job.
+    void *ctx;                        ///< Its context.
+    size_t items;                     ///< Its number of items.
+    size_t chunk;                     ///< Items per chunk.
+    size_t remaining;                 ///< Chunks not yet finished.
+    int active;                       ///< Pool threads working on the current job.
+    uint64_t steals;                  ///< Chunks run by a lane other than the one they were dealt to.
+} fanpool_t;
+
+/**
+ * @brief Starts a pool.
+ *
+ * @param pool The pool.
+ * @param threads Number of pool threads, 1 to FANPOOL_MAX_THREADS.
+ * @param subs Subscription index the threads read during jobs, or NULL. Call from its writer's thread.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int fanpool_init(fanpool_t *pool, int threads, subtable_t *subs);
+
+/**
+ * @brief Stops the pool threads and frees the pool.
+ *
+ * @param pool The pool.
+ */
+void fanpool_free(fanpool_t *pool);
+
+/**
+ * @brief Runs a job over `items` items on the calling thread and every pool thread, and waits for it.
+ * Only one thread may submit jobs to a pool.
+ *
+ * @param pool The pool.
+ * @param items Number of items.
+ * @param chunk Items per chunk (at least 1).
+ * @param fn Processes one chunk.
+ * @param ctx Passed to fn.
+ * @return uint64_t Number of chunks stolen from another lane.
+ */
+uint64_t fanpool_run(fanpool_t *pool, size_t items, size_t chunk, fanpool_fn_t fn, void *ctx);
+
+#endif // LITEMQ_FANPOOL_H
@@ -0,0 +1,159 @@
+/**
+ * @file histogram.c
+ * @brief Implements a fixed-size log-linear histogram for latency measurements.
+ * @author Mohammed Uddin
+ */
+
+#include <string.h>
+#include "histogram.h"
+
+/**
+ * @brief Resets a histogram to empty.
+ *
+ * @param h The histogram.
+ */
+void histogram_init(histogram_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+/**
+ * @brief Returns the position of the most significant set bit.
+ *
+ * @param value A non-zero value.
+ * @return int The bit position (0 for 1).
+ */
+static int most_significant_bit(uint64_t value) {
+    return 63 - __builtin_clzll(value);
+}
+
+/**
+ * @brief Returns the bucket index a value is counted in.
+ *
+ * @param value The value.
+ * @return int The bucket index.
+ */
+int histogram_bucket_index(uint64_t value) {
+    if (value < 2 * HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int shift = most_significant_bit(value) - HIST_SUB_BITS;
+    int index = (shift + 1) * HIST_SUB_BUCKETS + (int)((value >> shift) - HIST_SUB_BUCKETS);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Returns the largest value counted in a bucket.
+ *
+ * @param index The bucket index.
+ * @return uint64_t The bucket's inclusive upper bound.
+ */
+uint64_t histogram_bucket_upper(int index) {
+    if (index < 2 * HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    if (index >= HIST_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(HIST_SUB_BUCKETS + index % HIST_SUB_BUCKETS) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ * @brief Records one value.
+ *
+ * @param h The histogram.
+ * @param value The value to record.
+ */
+void histogram_record(histogram_t *h, uint64_t value) {
+    h->counts[histogram_bucket_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * @brief Adds all values recorded in `src` to `dst`.
+ *
+ * @param dst The histogram to add to.
+ * @param src The histogram to add.
+ */
+void histogram_merge(histogram_t *dst, const histogram_t *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * @brief Returns the value below which the given percentage of recorded values fall.
+ *
+ * @param h The histogram.
+ * @param percentile The percentile, from 0 to 100.
+ * @return uint64_t The percentile value, or 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(const histogram_t *h, double percentile) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > h->total) {
+        rank = h->total;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t upper = histogram_bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Returns how many recorded values are known to be at most `value`.
+ *
+ * @param h The histogram.
+ * @param value The inclusive bound.
+ * @return uint64_t The number of values counted.
+ */
+uint64_t histogram_count_le(const histogram_t *h, uint64_t value) {
+    if (h->total == 0 || value < h->min) {
+        return 0;
+    }
+    if (value >= h->max) {
+        return h->total;
+    }
+    uint64_t count = 0;
+    for (int i = 0; i < HIST_BUCKETS && histogram_bucket_upper(i) <= value; i++) {
+        count += h->counts[i];
+    }
+    return count;
+}
+
+/**
+ * @brief Returns the mean of the recorded values.
+ *
+ * @param h The histogram.
+ * @return double The mean, or 0 for an empty histogram.
+ */
+double histogram_mean(const histogram_t *h) {
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file histogram.h
+ * @brief Declares a fixed-size log-linear histogram for latency measurements.
+ * @author Mohammed Uddin
+ *
+ * Values are grouped HdrHistogram-style: exact below 2 * HIST_SUB_BUCKETS, then each
+ * power of two is split into HIST_SUB_BUCKETS equal sub-buckets, which bounds the
+ * relative error of any reported percentile to 1 / HIST_SUB_BUCKETS (under 1%).
+ * Recording is a handful of integer operations and never allocates.
+ */
+
+#ifndef LITEMQ_HISTOGRAM_H
+#define LITEMQ_HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/**
+ * @brief A histogram of unsigned 64-bit values (typically nanoseconds).
+ * Values of 2^HIST_MAX_BITS and above are counted in the last bucket.
+ */
+typedef struct {
+    uint64_t counts[HIST_BUCKETS]; ///< Count per bucket.
+    uint64_t total;                ///< Number of recorded values.
+    uint64_t min;                  ///< Smallest recorded value.
+    uint64_t max;                  ///< Largest recorded value.
+    double sum;                    ///< Sum of recorded values, for the mean.
+} histogram_t;
+
+/**
+ * @brief Resets a histogram to empty.
+ *
+ * @param h The histogram.
+ */
+void histogram_init(histogram_t *h);
+
+/**
+ * @brief Records one value.
+ *
+ * @param h The histogram.
+ * @param value The value to record.
+ */
+void histogram_record(histogram_t *h, uint64_t value);
+
+/**
+ * @brief Adds all values recorded in `src` to `dst`.
+ *
+ * @param dst The histogram to add to.
+ * @param src The histogram to add.
+ */
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+/**
+ * @brief Returns the value below which the given percentage of recorded values fall.
+ * The result is the upper bound of the bucket holding that rank, capped at the maximum.
+ *
+ * @param h The histogram.
+ * @param percentile The percentile, from 0 to 100.
+ * @return uint64_t The percentile value, or 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(const histogram_t *h, double percentile);
+
+/**
+ * @brief Returns how many recorded values are known to be at most `value`.
+ * Counts every bucket whose upper bound does not exceed `value`, so a bucket that
+ * straddles the bound is left out and the result errs low by less than 1%.
+ *
+ * @param h The histogram.
+ * @param value The inclusive bound.
+ * @return uint64_t The number of values counted.
+ */
+uint64_t histogram_count_le(const histogram_t *h, uint64_t value);
+
+/**
+ * @brief Returns the mean of the recorded values.
+ *
+ * @param h The histogram.
+ * @return double The mean, or 0 for an empty histogram.
+ */
+double histogram_mean(const histogram_t *h);
+
+/**
+ * @brief Returns the bucket index a value is counted in.
+ *
+ * @param value The value.
+ * @return int The bucket index.
+ */
+int histogram_bucket_index(uint64_t value);
+
+/**
+ * @brief Returns the largest value counted in a bucket.
+ *
+ * @param index The bucket index.
+ * @return uint64_t The bucket's inclusive upper bound.
+ */
+uint64_t histogram_bucket_upper(int index);
+
+#endif // LITEMQ_HISTOGRAM_H
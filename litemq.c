@@ -0,0 +1,1100 @@
+/**
+ * @file litemq.c
+ * @brief Implements the liteMQ client library (liblitemq).
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "litemq.h"
+#include "protocol.h"
+
+#define LMQ_READ_CHUNK (64 * 1024)
+#define LMQ_DEFAULT_SEND_BUFFER (4 * 1024 * 1024)
+#define LMQ_DEFAULT_BATCH_BYTES (64 * 1024)
+#define LMQ_DEFAULT_BATCH_MESSAGES 1000
+#define LMQ_RECONNECT_INITIAL_MS 50
+
+/**
+ * @brief State of one broker connection.
+ */
+struct lmq_client {
+    int fd;                         ///< Connected socket (non-blocking), or -1 while reconnecting.
+    int closed;                     ///< Set once the broker has closed the connection.
+    char *host;                     ///< Broker host, kept for reconnecting.
+    int port;                       ///< Broker port.
+    int reconnect_max_ms;           ///< Upper bound of the reconnect backoff; 0 disables reconnecting.
+    int backoff_ms;                 ///< Current reconnect backoff.
+    long long reconnect_at;         ///< now_ms() time of the next reconnect attempt.
+    char *out_buf;                  ///< Encoded frames waiting to be sent.
+    size_t out_off;                 ///< Offset of the first unsent byte.
+    size_t out_len;                 ///< End of the queued bytes.
+    size_t out_cap;                 ///< Allocated size of out_buf.
+    size_t max_send;                ///< Limit on queued bytes before publish would block.
+    char *batch_buf;                ///< PUB frames collected for the next BATCH frame.
+    size_t batch_len;               ///< Bytes held in batch_buf.
+    size_t batch_cap;               ///< Allocated size of batch_buf.
+    size_t batch_count;             ///< Number of frames held in batch_buf.
+    long long batch_deadline;       ///< now_ms() time at which the open batch must be sent.
+    int linger_ms;                  ///< Linger time; 0 disables batching.
+    size_t batch_max_bytes;         ///< Size threshold for sending a batch.
+    size_t batch_max_messages;      ///< Count threshold for sending a batch.
+    char *in_buf;                   ///< Received bytes not yet handed to the application.
+    size_t in_off;                  ///< Offset of the first unparsed byte.
+    size_t in_len;                  ///< End of the received bytes.
+    size_t in_cap;                  ///< Allocated size of in_buf.
+    int subscribed;                 ///< Whether a SUB has been sent.
+    char topic[MAX_TOPIC_LEN];      ///< The subscribed topic, resent after reconnecting.
+    uint64_t from_seq;              ///< Resume point requested by the application.
+    uint64_t last_seq;              ///< Sequence number of the last message handed to the application.
+    uint64_t group;                 ///< Consumer group of the subscription, 0 if none.
+    size_t acks_outstanding;        ///< Confirmed publishes whose ACK has not been read yet.
+    lmq_message_cb cb;              ///< Delivery callback for lmq_poll().
+    void *cb_arg;                   ///< Argument passed to cb.
+    frame_t frame;                  ///< Last parsed frame; backs the returned lmq_message_t.
+};
+
+/**
+ * @brief Fills an options structure with default values.
+ *
+ * @param opts The options to initialise.
+ */
+void lmq_options_init(lmq_options_t *opts) {
+    opts->host = LMQ_DEFAULT_HOST;
+    opts->port = LMQ_DEFAULT_PORT;
+    opts->max_send_buffer = LMQ_DEFAULT_SEND_BUFFER;
+    opts->linger_ms = 0;
+    opts->batch_max_bytes = LMQ_DEFAULT_BATCH_BYTES;
+    opts->batch_max_messages = LMQ_DEFAULT_BATCH_MESSAGES;
+    opts->reconnect_max_ms = 0;
+}
+
+/**
+ * @brief Returns the current monotonic time in milliseconds.
+ *
+ * @return long long Milliseconds since an arbitrary epoch.
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Computes the time left until a deadline.
+ *
+ * @param deadline Absolute deadline from now_ms(), or -1 for none.
+ * @return int Milliseconds remaining (0 when expired), or -1 for no deadline.
+ */
+static int remaining_ms(long long deadline) {
+    if (deadline < 0) {
+        return -1;
+    }
+    long long left = deadline - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/**
+ * @brief Ensures a buffer can hold `needed` bytes, growing it geometrically.
+ *
+ * @param buf Pointer to the buffer pointer.
+ * @param cap Pointer to the buffer capacity.
+ * @param needed The required capacity.
+ * @return int LMQ_OK, or LMQ_ERR_SYSTEM if allocation failed.
+ */
+static int reserve(char **buf, size_t *cap, size_t needed) {
+    if (needed <= *cap) {
+        return LMQ_OK;
+    }
+    size_t new_cap = *cap ? *cap : LMQ_READ_CHUNK;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char *grown = realloc(*buf, new_cap);
+    if (grown == NULL) {
+        return LMQ_ERR_SYSTEM;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return LMQ_OK;
+}
+
+/**
+ * @brief Appends bytes to the send buffer, compacting already-sent data first.
+ *
+ * @param client The client.
+ * @param data The bytes to append.
+ * @param len The number of bytes.
+ * @return int LMQ_OK, or LMQ_ERR_SYSTEM if allocation failed.
+ */
+static int append_output(lmq_client_t *client, const char *data, size_t len) {
+    if (client->out_off > 0) {
+        memmove(client->out_buf, client->out_buf + client->out_off, client->out_len - client->out_off);
+        client->out_len -= client->out_off;
+        client->out_off = 0;
+    }
+    if (reserve(&client->out_buf, &client->out_cap, client->out_len + len) < 0) {
+        return LMQ_ERR_SYSTEM;
+    }
+    memcpy(client->out_buf + client->out_len, data, len);
+    client->out_len += len;
+    return LMQ_OK;
+}
+
+/**
+ * @brief Maps a failed socket call to a status code.
+ *
+ * @return int LMQ_ERR_CLOSED for a lost connection, LMQ_ERR_SYSTEM otherwise.
+ */
+static int socket_error(void) {
+    if (errno == EPIPE || errno == ECONNRESET || errno == ECONNABORTED || errno == ETIMEDOUT || errno == ENOTCONN) {
+        return LMQ_ERR_CLOSED;
+    }
+    return LMQ_ERR_SYSTEM;
+}
+
+/**
+ * @brief Drops a trailing partial frame from the receive buffer.
+ * Complete frames are kept so they can still be delivered.
+ *
+ * @param client The client.
+ */
+static void trim_partial_input(lmq_client_t *client) {
+    size_t off = client->in_off;
+    frame_t frame;
+    size_t consumed;
+    while (off < client->in_len &&
+           parse_frame(client->in_buf + off, client->in_len - off, &frame, &consumed) == FRAME_OK) {
+        off += consumed;
+    }
+    client->in_len = off;
+}
+
+/**
+ * @brief Handles a lost connection.
+ *
+ * Without reconnecting, the client is marked closed and the error is returned. With
+ * reconnecting, the socket is closed and a reconnect is scheduled; output that was
+ * queued but not yet sent is discarded, because a frame may have been cut off.
+ *
+ * @param client The client.
+ * @param rc The error that was detected.
+ * @return int LMQ_OK when a reconnect was scheduled, otherwise rc.
+ */
+static int connection_lost(lmq_client_t *client, int rc) {
+    if (rc != LMQ_ERR_CLOSED) {
+        return rc;
+    }
+    if (client->reconnect_max_ms <= 0) {
+        client->closed = 1;
+        return rc;
+    }
+    close(client->fd);
+    client->fd = -1;
+    client->out_off = 0;
+    client->out_len = 0;
+    trim_partial_input(client);
+    // ACKs still owed on the old connection never arrive
+    client->acks_outstanding = 0;
+    client->backoff_ms = LMQ_RECONNECT_INITIAL_MS;
+    client->reconnect_at = now_ms();
+    return LMQ_OK;
+}
+
+/**
+ * @brief Writes as much queued output as the socket accepts without blocking.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+static int send_pending(lmq_client_t *client) {
+    if (client->fd < 0) {
+        return LMQ_OK;
+    }
+    while (client->out_off < client->out_len) {
+        ssize_t n = send(client->fd, client->out_buf + client->out_off,
+                         client->out_len - client->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return LMQ_OK;
+            }
+            return connection_lost(client, socket_error());
+        }
+        client->out_off += (size_t)n;
+    }
+    client->out_off = 0;
+    client->out_len = 0;
+    return LMQ_OK;
+}
+
+/**
+ * @brief Reads whatever the socket has available into the receive buffer.
+ *
+ * @param client The client.
+ * @return int The number of bytes read (0 if none were available), or an error.
+ */
+static int read_available(lmq_client_t *client) {
+    if (client->fd < 0) {
+        return 0;
+    }
+    if (client->in_off > 0) {
+        memmove(client->in_buf, client->in_buf + client->in_off, client->in_len - client->in_off);
+        client->in_len -= client->in_off;
+        client->in_off = 0;
+    }
+    if (reserve(&client->in_buf, &client->in_cap, client->in_len + LMQ_READ_CHUNK) < 0) {
+        return LMQ_ERR_SYSTEM;
+    }
+    for (;;) {
+        ssize_t n = recv(client->fd, client->in_buf + client->in_len, client->in_cap - client->in_len, 0);
+        if (n > 0) {
+            client->in_len += (size_t)n;
+            return (int)n;
+        }
+        if (n == 0) {
+            return connection_lost(client, LMQ_ERR_CLOSED);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return connection_lost(client, socket_error());
+    }
+}
+
+/**
+ * @brief Parses the next complete MSG frame out of the receive buffer.
+ *
+ * @param client The client.
+ * @param msg Receives the message.
+ * @return int 1 if a message was parsed, 0 if more data is needed, or LMQ_ERR_PROTOCOL.
+ */
+static int parse_next(lmq_client_t *client, lmq_message_t *msg) {
+    size_t consumed;
+    frame_status_t status = parse_frame(client->in_buf + client->in_off, client->in_len - client->in_off,
+                                        &client->frame, &consumed);
+    if (status == FRAME_INCOMPLETE) {
+        return 0;
+    }
+    if (status == FRAME_ERROR || client->frame.type != FRAME_MSG) {
+        return LMQ_ERR_PROTOCOL;
+    }
+    client->in_off += consumed;
+    msg->topic = client->frame.topic;
+    msg->payload = client->frame.payload;
+    msg->len = client->frame.payload_len;
+    msg->ingress_ns = client->frame.fields.ingress_ns;
+    msg->persist_ns = client->frame.fields.persist_ns;
+    msg->seq = client->frame.fields.seq;
+    // Partitions of a subscribed topic number their messages separately
+    if (msg->seq != 0 && strcmp(msg->topic, client->topic) == 0) {
+        client->last_seq = msg->seq;
+    }
+    return 1;
+}
+
+/**
+ * @brief Opens a non-blocking TCP connection to the broker.
+ *
+ * @param host Broker host name or address.
+ * @param port Broker port.
+ * @return int The connected socket, or -1 on failure (errno is set).
+ */
+static int open_socket(const char *host, int port) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * @brief Queues the SUB frame for the subscription, resuming after the last received message.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+static int send_subscribe(lmq_client_t *client) {
+    char header[FRAME_MAX_HEADER];
+    frame_fields_t fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.from_seq = client->last_seq != 0 ? client->last_seq + 1 : client->from_seq;
+    fields.group = client->group;
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_SUB, client->topic, 0, &fields);
+    if (header_len < 0) {
+        return LMQ_ERR_INVALID;
+    }
+    int rc = append_output(client, header, (size_t)header_len);
+    if (rc < 0) {
+        return rc;
+    }
+    return send_pending(client);
+}
+
+/**
+ * @brief Attempts to reconnect if a reconnect is due.
+ * On failure the next attempt is scheduled with exponential backoff and some jitter,
+ * so that many clients of a restarted broker do not reconnect in lockstep.
+ *
+ * @param client The client.
+ * @return int LMQ_OK (whether or not the attempt succeeded) or an error.
+ */
+static int try_reconnect(lmq_client_t *client) {
+    long long now = now_ms();
+    if (client->fd >= 0 || now < client->reconnect_at) {
+        return LMQ_OK;
+    }
+    int fd = open_socket(client->host, client->port);
+    if (fd < 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int half = client->backoff_ms / 2;
+        client->reconnect_at = now + half + ts.tv_nsec % (half + 1);
+        client->backoff_ms = client->backoff_ms * 2 < client->reconnect_max_ms ? client->backoff_ms * 2 : client->reconnect_max_ms;
+        return LMQ_OK;
+    }
+    client->fd = fd;
+    if (client->subscribed) {
+        return send_subscribe(client);
+    }
+    return send_pending(client);
+}
+
+/**
+ * @brief Waits until the socket is readable, or writable while output is pending.
+ * While disconnected, waits for the next reconnect attempt instead.
+ *
+ * @param client The client.
+ * @param timeout_ms Maximum wait in milliseconds (-1 for no limit).
+ * @return int 1 if the socket is ready, 0 on timeout, or an error.
+ */
+static int wait_io(lmq_client_t *client, int timeout_ms) {
+    if (client->fd < 0) {
+        int left = remaining_ms(client->reconnect_at);
+        if (timeout_ms >= 0 && timeout_ms < left) {
+            left = timeout_ms;
+        }
+        if (left > 0) {
+            poll(NULL, 0, left);
+        }
+        int rc = try_reconnect(client);
+        if (rc < 0) {
+            return rc;
+        }
+        return client->fd >= 0;
+    }
+    struct pollfd pfd;
+    pfd.fd = client->fd;
+    pfd.events = POLLIN;
+    if (client->out_off < client->out_len) {
+        pfd.events |= POLLOUT;
+    }
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        return errno == EINTR ? 0 : LMQ_ERR_SYSTEM;
+    }
+    return ret > 0;
+}
+
+/**
+ * @brief Connects to a broker.
+ *
+ * @param opts Connection options, or NULL for the defaults.
+ * @return lmq_client_t* The new client, or NULL on failure (errno is set).
+ */
+lmq_client_t *lmq_connect(const lmq_options_t *opts) {
+    lmq_options_t defaults;
+    if (opts == NULL) {
+        lmq_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    int fd = open_socket(opts->host, opts->port);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    lmq_client_t *client = calloc(1, sizeof(*client));
+    if (client == NULL || (client->host = strdup(opts->host)) == NULL) {
+        free(client);
+        close(fd);
+        return NULL;
+    }
+    client->fd = fd;
+    client->port = opts->port;
+    client->reconnect_max_ms = opts->reconnect_max_ms;
+    client->max_send = opts->max_send_buffer;
+    client->linger_ms = opts->linger_ms;
+    client->batch_max_bytes = opts->batch_max_bytes;
+    client->batch_max_messages = opts->batch_max_messages;
+    return client;
+}
+
+/**
+ * @brief Closes the connection and frees the client.
+ *
+ * @param client The client to close (may be NULL).
+ */
+void lmq_close(lmq_client_t *client) {
+    if (client == NULL) {
+        return;
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    free(client->host);
+    free(client->out_buf);
+    free(client->batch_buf);
+    free(client->in_buf);
+    free(client);
+}
+
+/**
+ * @brief Returns the socket descriptor.
+ *
+ * @param client The client.
+ * @return int The socket file descriptor, or -1 while reconnecting.
+ */
+int lmq_fd(const lmq_client_t *client) {
+    return client->fd;
+}
+
+/**
+ * @brief Returns whether the client currently has a connection to the broker.
+ *
+ * @param client The client.
+ * @return int 1 if connected, 0 while waiting to reconnect or after the broker closed the connection.
+ */
+int lmq_is_connected(const lmq_client_t *client) {
+    return client->fd >= 0 && !client->closed;
+}
+
+/**
+ * @brief Returns the sequence number of the last message delivered to the application.
+ *
+ * @param client The client.
+ * @return uint64_t The sequence number, or 0 if no sequenced message was received yet.
+ */
+uint64_t lmq_last_seq(const lmq_client_t *client) {
+    return client->last_seq;
+}
+
+/**
+ * @brief Returns whether the client has queued output waiting for the socket.
+ *
+ * @param client The client.
+ * @return int 1 if output is pending, 0 otherwise.
+ */
+int lmq_wants_write(const lmq_client_t *client) {
+    return client->out_off < client->out_len;
+}
+
+/**
+ * @brief Sends a header and body, queueing whatever the socket does not accept.
+ *
+ * When nothing is queued the frame is written straight from the caller's buffers;
+ * only the part the socket does not accept is copied into the send buffer.
+ *
+ * @param client The client.
+ * @param header The frame header.
+ * @param header_len The header length.
+ * @param body The frame body.
+ * @param body_len The body length.
+ * @return int LMQ_OK or an error.
+ */
+static int send_or_queue(lmq_client_t *client, const char *header, size_t header_len, const char *body, size_t body_len) {
+    size_t sent = 0;
+    if (client->fd >= 0 && client->out_off == client->out_len) {
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)header;
+        iov[0].iov_len = header_len;
+        iov[1].iov_base = (void *)body;
+        iov[1].iov_len = body_len;
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 2;
+        ssize_t n = sendmsg(client->fd, &mh, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            int rc = connection_lost(client, socket_error());
+            if (rc < 0) {
+                return rc;
+            }
+        }
+        sent = n > 0 ? (size_t)n : 0;
+    }
+
+    int rc = LMQ_OK;
+    if (sent < header_len) {
+        rc = append_output(client, header + sent, header_len - sent);
+        sent = header_len;
+    }
+    if (rc == LMQ_OK && sent - header_len < body_len) {
+        rc = append_output(client, body + (sent - header_len), body_len - (sent - header_len));
+    }
+    return rc;
+}
+
+/**
+ * @brief Moves the open batch to the send path as one BATCH frame.
+ * A batch holding a single message is sent as a plain PUB frame.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+static int seal_batch(lmq_client_t *client) {
+    if (client->batch_count == 0) {
+        return LMQ_OK;
+    }
+    char header[FRAME_MAX_HEADER];
+    int header_len = 0;
+    if (client->batch_count > 1) {
+        header_len = format_batch_header(header, sizeof(header), client->batch_count, client->batch_len);
+        if (header_len < 0) {
+            return LMQ_ERR_INVALID;
+        }
+    }
+    int rc = send_or_queue(client, header, (size_t)header_len, client->batch_buf, client->batch_len);
+    client->batch_len = 0;
+    client->batch_count = 0;
+    return rc;
+}
+
+/**
+ * @brief Sends the open batch if its linger time has expired.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+static int seal_expired_batch(lmq_client_t *client) {
+    if (client->batch_count > 0 && now_ms() >= client->batch_deadline) {
+        return seal_batch(client);
+    }
+    return LMQ_OK;
+}
+
+/**
+ * @brief Limits a poll timeout so that an open batch is sent when its linger time expires.
+ *
+ * @param client The client.
+ * @param timeout_ms The caller's timeout (-1 for none).
+ * @return int The timeout to pass to poll().
+ */
+static int linger_timeout(const lmq_client_t *client, int timeout_ms) {
+    if (client->batch_count == 0) {
+        return timeout_ms;
+    }
+    int left = remaining_ms(client->batch_deadline);
+    return (timeout_ms < 0 || left < timeout_ms) ? left : timeout_ms;
+}
+
+/**
+ * @brief Queues a PUB frame for publication without blocking.
+ *
+ * With batching enabled the frame is added to the open batch, which is sent once it
+ * reaches batch_max_bytes or batch_max_messages, or when its linger time expires.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param fields Header fields of the PUB frame, or NULL.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the send buffer is full, or another error.
+ */
+static int publish_frame(lmq_client_t *client, const char *topic, const frame_fields_t *fields, const void *payload,
+                         size_t len) {
+    if (topic == NULL || !is_valid_topic(topic, strlen(topic)) || len > FRAME_MAX_PAYLOAD) {
+        return LMQ_ERR_INVALID;
+    }
+    if (client->closed) {
+        return LMQ_ERR_CLOSED;
+    }
+
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_PUB, topic, len, fields);
+    if (header_len < 0) {
+        return LMQ_ERR_INVALID;
+    }
+
+    size_t pending = client->out_len - client->out_off + client->batch_len;
+    if (pending > 0 && pending + header_len + len > client->max_send) {
+        int rc = send_pending(client);
+        if (rc < 0) {
+            return rc;
+        }
+        pending = client->out_len - client->out_off + client->batch_len;
+        if (pending > 0 && pending + header_len + len > client->max_send) {
+            return LMQ_ERR_WOULDBLOCK;
+        }
+    }
+
+    if (client->linger_ms <= 0) {
+        return send_or_queue(client, header, (size_t)header_len, payload, len);
+    }
+
+    if (client->batch_count > 0 && client->batch_len + header_len + len > FRAME_MAX_PAYLOAD) {
+        int rc = seal_batch(client);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    if (reserve(&client->batch_buf, &client->batch_cap, client->batch_len + header_len + len) < 0) {
+        return LMQ_ERR_SYSTEM;
+    }
+    memcpy(client->batch_buf + client->batch_len, header, (size_t)header_len);
+    memcpy(client->batch_buf + client->batch_len + header_len, payload, len);
+    client->batch_len += (size_t)header_len + len;
+    if (client->batch_count++ == 0) {
+        client->batch_deadline = now_ms() + client->linger_ms;
+    }
+
+    if (client->batch_len >= client->batch_max_bytes || client->batch_count >= client->batch_max_messages) {
+        return seal_batch(client);
+    }
+    return seal_expired_batch(client);
+}
+
+/**
+ * @brief Queues a message for publication without blocking.
+ *
+ * With batching enabled the frame is added to the open batch, which is sent once it
+ * reaches batch_max_bytes or batch_max_messages, or when its linger time expires.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the send buffer is full, or another error.
+ */
+int lmq_publish(lmq_client_t *client, const char *topic, const void *payload, size_t len) {
+    return publish_frame(client, topic, NULL, payload, len);
+}
+
+/**
+ * @brief Queues a message with a key for publication without blocking.
+ * The key travels as its hash (frame_key_hash()), so the broker can place the message
+ * without seeing the key itself.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param key The message key.
+ * @param key_len The key length in bytes.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the send buffer is full, or another error.
+ */
+int lmq_publish_keyed(lmq_client_t *client, const char *topic, const void *key, size_t key_len, const void *payload,
+                      size_t len) {
+    frame_fields_t fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.key = frame_key_hash(key, key_len);
+    return publish_frame(client, topic, &fields, payload, len);
+}
+
+/**
+ * @brief Sends the current batch now instead of waiting for the linger time.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_flush_batch(lmq_client_t *client) {
+    int rc = seal_batch(client);
+    if (rc < 0) {
+        return rc;
+    }
+    return send_pending(client);
+}
+
+/**
+ * @brief Reads the ACKs owed to confirmed publishes out of the receive buffer.
+ *
+ * @param client The client.
+ * @param seq Receives the sequence number of each ACK read.
+ * @return int LMQ_OK, or LMQ_ERR_PROTOCOL if the broker sent something else.
+ */
+static int read_acks(lmq_client_t *client, uint64_t *seq) {
+    while (client->acks_outstanding > 0) {
+        size_t consumed;
+        frame_status_t status = parse_frame(client->in_buf + client->in_off, client->in_len - client->in_off,
+                                            &client->frame, &consumed);
+        if (status == FRAME_INCOMPLETE) {
+            return LMQ_OK;
+        }
+        if (status == FRAME_ERROR || client->frame.type != FRAME_ACK) {
+            return LMQ_ERR_PROTOCOL;
+        }
+        client->in_off += consumed;
+        client->acks_outstanding--;
+        *seq = client->frame.fields.seq;
+    }
+    return LMQ_OK;
+}
+
+/**
+ * @brief Publishes a message and waits until the broker confirms that it is stored.
+ *
+ * The open batch is sent first, then the message as a PUB frame asking for an ACK.
+ * ACKs arrive in publish order, so the call returns once every ACK owed on the
+ * connection has been read, the last being this message's.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq Receives the message's sequence number (0 if the broker does not persist it), or NULL.
+ * @param timeout_ms Maximum time to wait for the ACK (-1 waits indefinitely).
+ * @return int LMQ_OK, LMQ_ERR_TIMEOUT, LMQ_ERR_CLOSED if the connection was lost before the ACK, or another error.
+ */
+int lmq_publish_confirmed(lmq_client_t *client, const char *topic, const void *payload, size_t len, uint64_t *seq,
+                          int timeout_ms) {
+    if (topic == NULL || !is_valid_topic(topic, strlen(topic)) || len > FRAME_MAX_PAYLOAD || client->subscribed) {
+        return LMQ_ERR_INVALID;
+    }
+    if (client->closed) {
+        return LMQ_ERR_CLOSED;
+    }
+    long long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    while (client->fd < 0) {
+        int left = remaining_ms(deadline);
+        if (left == 0) {
+            return LMQ_ERR_TIMEOUT;
+        }
+        int rc = wait_io(client, left);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    frame_fields_t fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.ack = 1;
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header_fields(header, sizeof(header), FRAME_PUB, topic, len, &fields);
+    if (header_len < 0) {
+        return LMQ_ERR_INVALID;
+    }
+    int rc = seal_batch(client);
+    if (rc == LMQ_OK) {
+        rc = send_or_queue(client, header, (size_t)header_len, payload, len);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+    if (client->fd < 0) {
+        return LMQ_ERR_CLOSED;
+    }
+    client->acks_outstanding++;
+
+    uint64_t acked = 0;
+    for (;;) {
+        rc = read_acks(client, &acked);
+        if (rc < 0) {
+            return rc;
+        }
+        if (client->acks_outstanding == 0) {
+            if (seq != NULL) {
+                *seq = acked;
+            }
+            return LMQ_OK;
+        }
+        rc = send_pending(client);
+        if (rc < 0) {
+            return rc;
+        }
+        rc = client->fd >= 0 ? read_available(client) : LMQ_ERR_CLOSED;
+        if (rc < 0) {
+            return rc;
+        }
+        if (client->fd < 0) {
+            return LMQ_ERR_CLOSED;
+        }
+        if (rc > 0) {
+            continue;
+        }
+        int left = remaining_ms(deadline);
+        if (left == 0) {
+            return LMQ_ERR_TIMEOUT;
+        }
+        rc = wait_io(client, left);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+}
+
+/**
+ * @brief Subscribes the connection to a topic.
+ *
+ * @param client The client.
+ * @param topic The topic to subscribe to.
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe(lmq_client_t *client, const char *topic, lmq_message_cb cb, void *arg) {
+    return lmq_subscribe_from(client, topic, 0, cb, arg);
+}
+
+/**
+ * @brief Subscribes the connection to a topic, replaying persisted messages from a sequence number.
+ *
+ * @param client The client.
+ * @param topic The topic to subscribe to.
+ * @param from_seq First sequence number to replay (0 replays all persisted messages).
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe_from(lmq_client_t *client, const char *topic, uint64_t from_seq, lmq_message_cb cb, void *arg) {
+    if (topic == NULL || !is_valid_topic(topic, strlen(topic)) || client->subscribed || client->acks_outstanding > 0) {
+        return LMQ_ERR_INVALID;
+    }
+    strcpy(client->topic, topic);
+    client->from_seq = from_seq;
+    client->subscribed = 1;
+    client->cb = cb;
+    client->cb_arg = arg;
+    return send_subscribe(client);
+}
+
+/**
+ * @brief Joins a consumer group of a partitioned topic.
+ * The broker keeps the group's position, so a reconnect rejoins without a sequence number.
+ *
+ * @param client The client.
+ * @param topic The partitioned topic.
+ * @param group The group number (not 0).
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe_group(lmq_client_t *client, const char *topic, uint64_t group, lmq_message_cb cb, void *arg) {
+    if (group == 0 || client->subscribed) {
+        return LMQ_ERR_INVALID;
+    }
+    client->group = group;
+    int rc = lmq_subscribe_from(client, topic, 0, cb, arg);
+    if (rc == LMQ_ERR_INVALID) {
+        client->group = 0;
+    }
+    return rc;
+}
+
+/**
+ * @brief Delivers every complete message in the receive buffer to the callback.
+ *
+ * @param client The client.
+ * @return int The number of messages delivered, or an error.
+ */
+static int dispatch_buffered(lmq_client_t *client) {
+    int delivered = 0;
+    lmq_message_t msg;
+    int rc;
+    while ((rc = parse_next(client, &msg)) == 1) {
+        client->cb(&msg, client->cb_arg);
+        delivered++;
+    }
+    return rc < 0 ? rc : delivered;
+}
+
+/**
+ * @brief Performs pending I/O and delivers received messages to the subscription callback.
+ *
+ * Without a callback, received bytes are only buffered for lmq_next_message().
+ *
+ * @param client The client.
+ * @param timeout_ms Maximum time to wait for data (-1 waits indefinitely, 0 does not wait).
+ * @return int The number of messages delivered, or an error.
+ */
+int lmq_poll(lmq_client_t *client, int timeout_ms) {
+    int rc = seal_expired_batch(client);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = send_pending(client);
+    if (rc < 0) {
+        return rc;
+    }
+    if (client->cb != NULL) {
+        rc = dispatch_buffered(client);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    if (client->closed) {
+        return LMQ_ERR_CLOSED;
+    }
+
+    rc = wait_io(client, linger_timeout(client, timeout_ms));
+    if (rc < 0) {
+        return rc;
+    }
+    rc = seal_expired_batch(client);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = send_pending(client);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = read_available(client);
+    if (rc < 0 && rc != LMQ_ERR_CLOSED) {
+        return rc;
+    }
+    if (client->cb != NULL) {
+        int delivered = dispatch_buffered(client);
+        if (delivered != 0) {
+            return delivered;
+        }
+    }
+    return client->closed ? LMQ_ERR_CLOSED : 0;
+}
+
+/**
+ * @brief Waits for the next message on the connection.
+ *
+ * @param client The client.
+ * @param msg Receives the message; valid until the next call for this client.
+ * @param timeout_ms Maximum time to wait (-1 waits indefinitely).
+ * @return int 1 if a message was received, 0 on timeout, or an error.
+ */
+int lmq_next_message(lmq_client_t *client, lmq_message_t *msg, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    for (;;) {
+        int rc = parse_next(client, msg);
+        if (rc != 0) {
+            return rc;
+        }
+        if (client->closed) {
+            return LMQ_ERR_CLOSED;
+        }
+        rc = seal_expired_batch(client);
+        if (rc < 0) {
+            return rc;
+        }
+        rc = send_pending(client);
+        if (rc < 0) {
+            return rc;
+        }
+        rc = read_available(client);
+        if (rc > 0 || rc == LMQ_ERR_CLOSED) {
+            continue;
+        }
+        if (rc < 0) {
+            return rc;
+        }
+        int left = remaining_ms(deadline);
+        if (left == 0) {
+            return 0;
+        }
+        rc = wait_io(client, linger_timeout(client, left));
+        if (rc < 0) {
+            return rc;
+        }
+    }
+}
+
+/**
+ * @brief Blocks until all queued output has been written to the socket.
+ *
+ * @param client The client.
+ * @param timeout_ms Maximum time to wait (-1 waits indefinitely).
+ * @return int LMQ_OK, LMQ_ERR_TIMEOUT, or another error.
+ */
+int lmq_flush(lmq_client_t *client, int timeout_ms) {
+    long long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+    int rc = seal_batch(client);
+    if (rc < 0) {
+        return rc;
+    }
+    for (;;) {
+        rc = send_pending(client);
+        if (rc < 0) {
+            return rc;
+        }
+        if (client->out_off == client->out_len) {
+            return LMQ_OK;
+        }
+        int left = remaining_ms(deadline);
+        if (left == 0) {
+            return LMQ_ERR_TIMEOUT;
+        }
+        if (client->fd < 0) {
+            rc = wait_io(client, left);
+            if (rc < 0) {
+                return rc;
+            }
+            continue;
+        }
+        struct pollfd pfd;
+        pfd.fd = client->fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, left) < 0 && errno != EINTR) {
+            return LMQ_ERR_SYSTEM;
+        }
+    }
+}
+
+/**
+ * @brief Returns a human-readable description of a status code.
+ *
+ * @param status A value of lmq_status_t.
+ * @return const char* A static description string.
+ */
+const char *lmq_strerror(int status) {
+    switch (status) {
+    case LMQ_OK: return "success";
+    case LMQ_ERR_SYSTEM: return strerror(errno);
+    case LMQ_ERR_WOULDBLOCK: return "send buffer full";
+    case LMQ_ERR_CLOSED: return "connection closed by broker";
+    case LMQ_ERR_PROTOCOL: return "malformed frame from broker";
+    case LMQ_ERR_INVALID: return "invalid argument";
+    case LMQ_ERR_TIMEOUT: return "timed out";
+    default: return "unknown error";
+    }
+}
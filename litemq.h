@@ -0,0 +1,264 @@
+/**
+ * @file litemq.h
+ * @brief Declares the liteMQ client library (liblitemq).
+ * @author Mohammed Uddin
+ *
+ * A client keeps one persistent connection to the broker. Publishing is non-blocking:
+ * frames are appended to an internal send buffer and written as the socket accepts them.
+ * With a non-zero linger time, published messages are first collected in a batch buffer
+ * and sent as one BATCH frame when the batch fills up or the linger time expires.
+ * Messages for a subscription are delivered either through a callback driven by
+ * lmq_poll(), or pulled one at a time with lmq_next_message().
+ *
+ * With a non-zero reconnect_max_ms, a lost connection is re-established in the
+ * background of lmq_poll(), lmq_next_message() and lmq_flush(), with exponential
+ * backoff. A subscription is renewed from the sequence number after the last message
+ * received, so a broker restart causes a pause rather than a full replay or a gap.
+ * Output queued but not yet sent when the connection drops is discarded.
+ */
+
+#ifndef LITEMQ_LITEMQ_H
+#define LITEMQ_LITEMQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Opaque handle for a connection to a liteMQ broker.
+ */
+typedef struct lmq_client lmq_client_t;
+
+/**
+ * @brief Status codes returned by the library. Negative values are errors.
+ */
+typedef enum {
+    LMQ_OK = 0,               ///< The operation succeeded.
+    LMQ_ERR_SYSTEM = -1,      ///< A system call failed; errno holds the cause.
+    LMQ_ERR_WOULDBLOCK = -2,  ///< The send buffer is full; poll or flush and retry.
+    LMQ_ERR_CLOSED = -3,      ///< The broker closed the connection.
+    LMQ_ERR_PROTOCOL = -4,    ///< The broker sent a malformed frame.
+    LMQ_ERR_INVALID = -5,     ///< An argument was invalid.
+    LMQ_ERR_TIMEOUT = -6      ///< The operation did not complete in time.
+} lmq_status_t;
+
+/**
+ * @brief A message delivered to a subscriber.
+ * The pointers stay valid until the next call into the library for the same client.
+ * Timestamps are only present when the broker runs with --timestamps; they use the
+ * broker host's monotonic clock, so they are comparable with clock_gettime(CLOCK_MONOTONIC)
+ * only on the same host.
+ */
+typedef struct {
+    const char *topic;   ///< NUL-terminated topic name.
+    const char *payload; ///< Message payload (not NUL-terminated).
+    size_t len;          ///< Payload length in bytes.
+    uint64_t ingress_ns; ///< CLOCK_MONOTONIC time the broker received the message, or 0 if not stamped.
+    uint64_t persist_ns; ///< CLOCK_MONOTONIC time the broker finished persisting it, or 0 if not stamped.
+    uint64_t seq;        ///< Per-topic sequence number, or 0 if the broker does not persist the topic.
+} lmq_message_t;
+
+/**
+ * @brief Callback invoked by lmq_poll() for each received message.
+ *
+ * @param msg The received message.
+ * @param arg The pointer passed to lmq_subscribe().
+ */
+typedef void (*lmq_message_cb)(const lmq_message_t *msg, void *arg);
+
+/**
+ * @brief Connection options. Initialise with lmq_options_init() before changing fields.
+ */
+typedef struct {
+    const char *host;       ///< Broker host name or address (default "127.0.0.1").
+    int port;               ///< Broker port (default 8080).
+    size_t max_send_buffer; ///< Bytes that may be queued before publish reports LMQ_ERR_WOULDBLOCK.
+    int linger_ms;          ///< How long a batch may wait for more messages (0 disables batching).
+    size_t batch_max_bytes; ///< Batch size in bytes that triggers an immediate send.
+    size_t batch_max_messages; ///< Message count that triggers an immediate send.
+    int reconnect_max_ms;   ///< Longest delay between reconnect attempts (0 disables reconnecting).
+} lmq_options_t;
+
+/**
+ * @brief Fills an options structure with default values.
+ *
+ * @param opts The options to initialise.
+ */
+void lmq_options_init(lmq_options_t *opts);
+
+/**
+ * @brief Connects to a broker.
+ *
+ * @param opts Connection options, or NULL for the defaults.
+ * @return lmq_client_t* The new client, or NULL on failure (errno is set).
+ */
+lmq_client_t *lmq_connect(const lmq_options_t *opts);
+
+/**
+ * @brief Closes the connection and frees the client. Unsent data is discarded;
+ * call lmq_flush() first to deliver it.
+ *
+ * @param client The client to close (may be NULL).
+ */
+void lmq_close(lmq_client_t *client);
+
+/**
+ * @brief Returns the socket descriptor, for integration with an external event loop.
+ * The descriptor changes after a reconnect, so fetch it again before every poll.
+ *
+ * @param client The client.
+ * @return int The socket file descriptor, or -1 while reconnecting.
+ */
+int lmq_fd(const lmq_client_t *client);
+
+/**
+ * @brief Returns whether the client currently has a connection to the broker.
+ *
+ * @param client The client.
+ * @return int 1 if connected, 0 while waiting to reconnect or after the broker closed the connection.
+ */
+int lmq_is_connected(const lmq_client_t *client);
+
+/**
+ * @brief Returns the sequence number of the last message delivered to the application.
+ * Passing this value plus one to lmq_subscribe_from() resumes a subscription after a restart.
+ *
+ * @param client The client.
+ * @return uint64_t The sequence number, or 0 if no sequenced message was received yet.
+ */
+uint64_t lmq_last_seq(const lmq_client_t *client);
+
+/**
+ * @brief Returns whether the client has queued output waiting for the socket.
+ *
+ * @param client The client.
+ * @return int 1 if output is pending, 0 otherwise.
+ */
+int lmq_wants_write(const lmq_client_t *client);
+
+/**
+ * @brief Queues a message for publication without blocking.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the send buffer is full, or another error.
+ */
+int lmq_publish(lmq_client_t *client, const char *topic, const void *payload, size_t len);
+
+/**
+ * @brief Queues a message with a key for publication without blocking.
+ * On a partitioned topic, messages with the same key go to the same partition and so
+ * keep their order. Otherwise the key is ignored.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param key The message key.
+ * @param key_len The key length in bytes.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the send buffer is full, or another error.
+ */
+int lmq_publish_keyed(lmq_client_t *client, const char *topic, const void *key, size_t key_len, const void *payload,
+                      size_t len);
+
+/**
+ * @brief Publishes a message and waits until the broker confirms that it is stored.
+ * A broker running with --replication sync confirms once a follower has stored the
+ * message as well. Not available on a connection that holds a subscription.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param seq Receives the message's sequence number (0 if the broker does not persist it), or NULL.
+ * @param timeout_ms Maximum time to wait for the confirmation (-1 waits indefinitely).
+ * @return int LMQ_OK, LMQ_ERR_TIMEOUT, LMQ_ERR_CLOSED if the connection was lost first, or another error.
+ */
+int lmq_publish_confirmed(lmq_client_t *client, const char *topic, const void *payload, size_t len, uint64_t *seq,
+                          int timeout_ms);
+
+/**
+ * @brief Sends the current batch now instead of waiting for the linger time.
+ * Does not block; use lmq_flush() to wait until the data has left the send buffer.
+ *
+ * @param client The client.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_flush_batch(lmq_client_t *client);
+
+/**
+ * @brief Subscribes the connection to a topic. A connection holds one subscription.
+ *
+ * @param client The client.
+ * @param topic The topic to subscribe to.
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe(lmq_client_t *client, const char *topic, lmq_message_cb cb, void *arg);
+
+/**
+ * @brief Subscribes the connection to a topic, replaying persisted messages from a sequence number.
+ *
+ * @param client The client.
+ * @param topic The topic to subscribe to.
+ * @param from_seq First sequence number to replay (0 replays all persisted messages).
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe_from(lmq_client_t *client, const char *topic, uint64_t from_seq, lmq_message_cb cb, void *arg);
+
+/**
+ * @brief Joins a consumer group of a partitioned topic. The broker deals the topic's
+ * partitions out to the group's members and deals them out again when members come
+ * and go. Messages arrive under the partition's name ("<topic>:<n>"), and the group
+ * resumes after the last message it was given, also after reconnecting.
+ *
+ * @param client The client.
+ * @param topic The partitioned topic.
+ * @param group The group number (not 0).
+ * @param cb Callback for lmq_poll() delivery, or NULL to use lmq_next_message().
+ * @param arg Pointer passed through to the callback.
+ * @return int LMQ_OK or an error.
+ */
+int lmq_subscribe_group(lmq_client_t *client, const char *topic, uint64_t group, lmq_message_cb cb, void *arg);
+
+/**
+ * @brief Performs pending I/O and delivers received messages to the subscription callback.
+ *
+ * @param client The client.
+ * @param timeout_ms Maximum time to wait for data (-1 waits indefinitely, 0 does not wait).
+ * @return int The number of messages delivered, or an error.
+ */
+int lmq_poll(lmq_client_t *client, int timeout_ms);
+
+/**
+ * @brief Waits for the next message on the connection.
+ *
+ * @param client The client.
+ * @param msg Receives the message; valid until the next call for this client.
+ * @param timeout_ms Maximum time to wait (-1 waits indefinitely).
+ * @return int 1 if a message was received, 0 on timeout, or an error.
+ */
+int lmq_next_message(lmq_client_t *client, lmq_message_t *msg, int timeout_ms);
+
+/**
+ * @brief Blocks until all queued output, including any open batch, has been written to the socket.
+ *
+ * @param client The client.
+ * @param timeout_ms Maximum time to wait (-1 waits indefinitely).
+ * @return int LMQ_OK, LMQ_ERR_TIMEOUT, or another error.
+ */
+int lmq_flush(lmq_client_t *client, int timeout_ms);
+
+/**
+ * @brief Returns a human-readable description of a status code.
+ *
+ * @param status A value of lmq_status_t.
+ * @return const char* A static description string.
+ */
+const char *lmq_strerror(int status);
+
+#endif // LITEMQ_LITEMQ_H
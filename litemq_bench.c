@@ -0,0 +1,574 @@
+/**
+ * @file litemq_bench.c
+ * @brief Implements litemq-bench, a load generator that measures broker throughput and latency.
+ * @author Mohammed Uddin
+ *
+ * All publisher and subscriber connections are driven from one event loop. Every
+ * payload starts with a bench_header_t carrying its send time, so subscribers can
+ * record end-to-end latency in a histogram. When the broker stamps messages
+ * (--timestamps), latency is also split into publisher-to-broker and
+ * broker-to-subscriber parts, plus the time spent persisting.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include "litemq.h"
+#include "histogram.h"
+
+#define BENCH_MAGIC 0x424d514cU
+#define BENCH_DRAIN_MS 2000
+#define BENCH_SUBSCRIBE_SETTLE_MS 200
+#define BENCH_MAX_BURST 256
+
+/**
+ * @brief How publishers pace their sends.
+ */
+typedef enum {
+    LOAD_MAX,    ///< Send as fast as the connection accepts.
+    LOAD_OPEN,   ///< Send at a fixed rate regardless of delivery (open loop).
+    LOAD_CLOSED  ///< Keep a fixed number of messages in flight (closed loop).
+} load_mode_t;
+
+/**
+ * @brief Header at the start of every bench payload.
+ */
+typedef struct {
+    uint32_t magic;     ///< BENCH_MAGIC.
+    uint32_t run_id;    ///< Identifies this run, so replayed messages from older runs are ignored.
+    uint32_t publisher; ///< Index of the sending publisher.
+    uint32_t reserved;  ///< Padding; always zero.
+    uint64_t send_ns;   ///< Send time (CLOCK_MONOTONIC); the scheduled time in open-loop mode.
+    uint64_t seq;       ///< Per-publisher sequence number.
+} bench_header_t;
+
+/**
+ * @brief Command-line configuration.
+ */
+typedef struct {
+    const char *host;        ///< Broker host.
+    int port;                ///< Broker port.
+    int publishers;          ///< Number of publisher connections.
+    int subscribers;         ///< Number of subscriber connections.
+    int topics;              ///< Number of topics the connections are spread over.
+    size_t message_size;     ///< Payload size in bytes.
+    double rate;             ///< Open-loop rate per publisher (messages per second).
+    int window;              ///< Closed-loop messages in flight per publisher.
+    double duration;         ///< Measurement time in seconds.
+    int linger_ms;           ///< Publisher batch linger time.
+    const char *prefix;      ///< Topic name prefix.
+    const char *json_path;   ///< Where to write the JSON report ("-" for stdout), or NULL.
+    load_mode_t mode;        ///< Pacing mode, derived from rate and window.
+} bench_config_t;
+
+/**
+ * @brief State of one publisher connection.
+ */
+typedef struct {
+    lmq_client_t *client;    ///< The connection.
+    int topic;               ///< Topic index it publishes to.
+    uint64_t seq;            ///< Next sequence number.
+    uint64_t next_send_ns;   ///< Scheduled time of the next open-loop send.
+    uint64_t inflight;       ///< Closed-loop messages sent but not yet received.
+    uint64_t sent;           ///< Messages sent.
+} bench_publisher_t;
+
+/**
+ * @brief State of one subscriber connection.
+ */
+typedef struct {
+    lmq_client_t *client;    ///< The connection.
+    int topic;               ///< Topic index it subscribes to.
+    int primary;             ///< Whether its receipts complete closed-loop messages for the topic.
+} bench_subscriber_t;
+
+static bench_config_t config;
+static bench_publisher_t *pubs;
+static bench_subscriber_t *subs;
+static histogram_t latency;
+static histogram_t to_broker;
+static histogram_t from_broker;
+static histogram_t persist_time;
+static uint64_t received;
+static uint64_t received_bytes;
+static uint32_t run_id;
+static char *payload;
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Prints the command-line usage and exits.
+ *
+ * @param prog The program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "  -h host      Broker host (default 127.0.0.1)\n"
+            "  -p port      Broker port (default 8080)\n"
+            "  -P count     Publisher connections (default 1)\n"
+            "  -S count     Subscriber connections (default 1)\n"
+            "  -t count     Topics to spread connections over (default 1)\n"
+            "  -s bytes     Message size, at least %zu (default 100)\n"
+            "  -r rate      Open loop: messages per second per publisher\n"
+            "  -w window    Closed loop: messages in flight per publisher\n"
+            "  -d seconds   Test duration (default 10)\n"
+            "  -l ms        Publisher batch linger time (default 0)\n"
+            "  -T prefix    Topic name prefix (default bench)\n"
+            "  -j file      Also write the report as JSON (- for stdout)\n"
+            "\n"
+            "Without -r or -w, publishers send as fast as the broker accepts.\n",
+            prog, sizeof(bench_header_t));
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the command line into the global configuration.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ */
+static void parse_args(int argc, char *argv[]) {
+    config.host = "127.0.0.1";
+    config.port = 8080;
+    config.publishers = 1;
+    config.subscribers = 1;
+    config.topics = 1;
+    config.message_size = 100;
+    config.duration = 10;
+    config.prefix = "bench";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:P:S:t:s:r:w:d:l:T:j:")) != -1) {
+        switch (opt) {
+        case 'h': config.host = optarg; break;
+        case 'p': config.port = atoi(optarg); break;
+        case 'P': config.publishers = atoi(optarg); break;
+        case 'S': config.subscribers = atoi(optarg); break;
+        case 't': config.topics = atoi(optarg); break;
+        case 's': config.message_size = (size_t)atol(optarg); break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'w': config.window = atoi(optarg); break;
+        case 'd': config.duration = atof(optarg); break;
+        case 'l': config.linger_ms = atoi(optarg); break;
+        case 'T': config.prefix = optarg; break;
+        case 'j': config.json_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || config.publishers < 1 || config.subscribers < 0 || config.topics < 1 ||
+        config.message_size < sizeof(bench_header_t) || config.duration <= 0 ||
+        (config.rate > 0 && config.window > 0)) {
+        usage(argv[0]);
+    }
+    config.mode = config.rate > 0 ? LOAD_OPEN : config.window > 0 ? LOAD_CLOSED : LOAD_MAX;
+    if (config.mode == LOAD_CLOSED && config.subscribers < config.topics) {
+        fprintf(stderr, "Closed-loop mode needs at least one subscriber per topic.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Formats the name of a topic by index.
+ *
+ * @param out Destination buffer.
+ * @param cap Capacity of the destination.
+ * @param topic The topic index.
+ */
+static void topic_name(char *out, size_t cap, int topic) {
+    snprintf(out, cap, "%s-%d", config.prefix, topic);
+}
+
+/**
+ * @brief Records latency for each bench message a subscriber receives.
+ *
+ * @param msg The received message.
+ * @param arg The bench_subscriber_t that received it.
+ */
+static void on_message(const lmq_message_t *msg, void *arg) {
+    bench_subscriber_t *sub = arg;
+    bench_header_t header;
+    if (msg->len < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, msg->payload, sizeof(header));
+    if (header.magic != BENCH_MAGIC || header.run_id != run_id || header.publisher >= (uint32_t)config.publishers) {
+        return;
+    }
+    uint64_t now = now_ns();
+    histogram_record(&latency, now > header.send_ns ? now - header.send_ns : 0);
+    if (msg->ingress_ns != 0) {
+        histogram_record(&to_broker, msg->ingress_ns > header.send_ns ? msg->ingress_ns - header.send_ns : 0);
+        histogram_record(&from_broker, now > msg->ingress_ns ? now - msg->ingress_ns : 0);
+    }
+    if (msg->persist_ns != 0 && msg->ingress_ns != 0) {
+        histogram_record(&persist_time, msg->persist_ns > msg->ingress_ns ? msg->persist_ns - msg->ingress_ns : 0);
+    }
+    received++;
+    received_bytes += msg->len;
+    if (sub->primary && pubs[header.publisher].inflight > 0) {
+        pubs[header.publisher].inflight--;
+    }
+}
+
+/**
+ * @brief Publishes one bench message.
+ *
+ * @param pub The publisher.
+ * @param index The publisher index.
+ * @param send_ns The send time to embed.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK, or another error.
+ */
+static int send_one(bench_publisher_t *pub, int index, uint64_t send_ns) {
+    char topic[64];
+    bench_header_t header = { BENCH_MAGIC, run_id, (uint32_t)index, 0, send_ns, pub->seq };
+    memcpy(payload, &header, sizeof(header));
+    topic_name(topic, sizeof(topic), pub->topic);
+    int rc = lmq_publish(pub->client, topic, payload, config.message_size);
+    if (rc == LMQ_OK) {
+        pub->seq++;
+        pub->sent++;
+        pub->inflight++;
+    }
+    return rc;
+}
+
+/**
+ * @brief Sends whatever a publisher is due to send according to the pacing mode.
+ *
+ * @param pub The publisher.
+ * @param index The publisher index.
+ * @param now The current time.
+ * @return int LMQ_OK, LMQ_ERR_WOULDBLOCK if the connection is backed up, or another error.
+ */
+static int pump_publisher(bench_publisher_t *pub, int index, uint64_t now) {
+    int rc = LMQ_OK;
+    for (int burst = 0; burst < BENCH_MAX_BURST && rc == LMQ_OK; burst++) {
+        if (config.mode == LOAD_OPEN) {
+            if (pub->next_send_ns > now) {
+                break;
+            }
+            // Stamp the scheduled time so queueing behind a stall counts as latency
+            rc = send_one(pub, index, pub->next_send_ns);
+            if (rc == LMQ_OK) {
+                pub->next_send_ns += (uint64_t)(1e9 / config.rate);
+            }
+        } else if (config.mode == LOAD_CLOSED) {
+            if (pub->inflight >= (uint64_t)config.window) {
+                break;
+            }
+            rc = send_one(pub, index, now_ns());
+        } else {
+            rc = send_one(pub, index, now_ns());
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief Runs lmq_poll() without waiting on every connection that poll() reported ready.
+ *
+ * @param pfds The poll set (publishers first, then subscribers).
+ * @return int 0 on success, -1 if a connection failed.
+ */
+static int service_connections(struct pollfd *pfds) {
+    int total = config.publishers + config.subscribers;
+    for (int i = 0; i < total; i++) {
+        lmq_client_t *client = i < config.publishers ? pubs[i].client : subs[i - config.publishers].client;
+        // Publishers are always serviced so that lingering batches are sent on time
+        if (i >= config.publishers && pfds[i].revents == 0) {
+            continue;
+        }
+        int rc = lmq_poll(client, 0);
+        if (rc < 0) {
+            fprintf(stderr, "Connection %d failed: %s\n", i, lmq_strerror(rc));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Fills the poll set for all connections.
+ *
+ * @param pfds The poll set (publishers first, then subscribers).
+ */
+static void build_pollset(struct pollfd *pfds) {
+    for (int i = 0; i < config.publishers; i++) {
+        pfds[i].fd = lmq_fd(pubs[i].client);
+        pfds[i].events = POLLIN | (lmq_wants_write(pubs[i].client) ? POLLOUT : 0);
+        pfds[i].revents = 0;
+    }
+    for (int i = 0; i < config.subscribers; i++) {
+        pfds[config.publishers + i].fd = lmq_fd(subs[i].client);
+        pfds[config.publishers + i].events = POLLIN;
+        pfds[config.publishers + i].revents = 0;
+    }
+}
+
+/**
+ * @brief Opens all connections and subscribes the subscribers.
+ *
+ * @return int 0 on success, -1 on failure.
+ */
+static int open_connections(void) {
+    lmq_options_t opts;
+    lmq_options_init(&opts);
+    opts.host = config.host;
+    opts.port = config.port;
+
+    pubs = calloc((size_t)config.publishers, sizeof(*pubs));
+    subs = calloc((size_t)(config.subscribers ? config.subscribers : 1), sizeof(*subs));
+    if (pubs == NULL || subs == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (int i = 0; i < config.subscribers; i++) {
+        char topic[64];
+        subs[i].topic = i % config.topics;
+        subs[i].primary = i < config.topics;
+        subs[i].client = lmq_connect(&opts);
+        if (subs[i].client == NULL) {
+            perror("subscriber connect");
+            return -1;
+        }
+        topic_name(topic, sizeof(topic), subs[i].topic);
+        if (lmq_subscribe(subs[i].client, topic, on_message, &subs[i]) != LMQ_OK) {
+            fprintf(stderr, "Subscribe to %s failed\n", topic);
+            return -1;
+        }
+    }
+
+    opts.linger_ms = config.linger_ms;
+    for (int i = 0; i < config.publishers; i++) {
+        pubs[i].topic = i % config.topics;
+        pubs[i].client = lmq_connect(&opts);
+        if (pubs[i].client == NULL) {
+            perror("publisher connect");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints one latency histogram as a line of text.
+ *
+ * @param label Line label.
+ * @param hist The histogram (nanoseconds).
+ */
+static void print_latency(const char *label, const histogram_t *hist) {
+    printf("%-14s p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n", label,
+           histogram_percentile(hist, 50) / 1000.0, histogram_percentile(hist, 90) / 1000.0,
+           histogram_percentile(hist, 99) / 1000.0, histogram_percentile(hist, 99.9) / 1000.0,
+           hist->total ? hist->max / 1000.0 : 0, histogram_mean(hist) / 1000.0);
+}
+
+/**
+ * @brief Writes one latency histogram as a JSON object member.
+ *
+ * @param out The JSON output.
+ * @param name Member name.
+ * @param hist The histogram (nanoseconds).
+ */
+static void json_latency(FILE *out, const char *name, const histogram_t *hist) {
+    fprintf(out, ",\"%s\":{\"count\":%llu,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p99_9\":%.1f,\"max\":%.1f,\"mean\":%.1f}",
+            name, (unsigned long long)hist->total,
+            histogram_percentile(hist, 50) / 1000.0, histogram_percentile(hist, 90) / 1000.0,
+            histogram_percentile(hist, 99) / 1000.0, histogram_percentile(hist, 99.9) / 1000.0,
+            hist->total ? hist->max / 1000.0 : 0, histogram_mean(hist) / 1000.0);
+}
+
+/**
+ * @brief Prints the results as text and, if requested, as JSON.
+ *
+ * @param sent Total messages sent.
+ * @param expected Total deliveries expected.
+ * @param elapsed Measurement time in seconds.
+ */
+static void report(uint64_t sent, uint64_t expected, double elapsed) {
+    static const char *mode_names[] = { "max", "open", "closed" };
+    static const char *mode_labels[] = { "unthrottled", "open loop", "closed loop" };
+    double msgs_per_sec = received / elapsed;
+    double mb_per_sec = received_bytes / elapsed / (1024.0 * 1024.0);
+
+    printf("litemq-bench: %d publishers, %d subscribers, %d topics, %zu-byte messages, %s, %.1f s\n",
+           config.publishers, config.subscribers, config.topics, config.message_size,
+           mode_labels[config.mode], elapsed);
+    printf("Sent:        %llu messages (%.0f msg/s)\n", (unsigned long long)sent, sent / elapsed);
+    printf("Received:    %llu of %llu expected deliveries\n",
+           (unsigned long long)received, (unsigned long long)expected);
+    printf("Throughput:  %.0f msg/s, %.2f MB/s\n", msgs_per_sec, mb_per_sec);
+    printf("Latency (us):\n");
+    print_latency("  end-to-end", &latency);
+    if (to_broker.total > 0) {
+        print_latency("  to broker", &to_broker);
+        print_latency("  from broker", &from_broker);
+    }
+    if (persist_time.total > 0) {
+        print_latency("  persisting", &persist_time);
+    }
+
+    if (config.json_path == NULL) {
+        return;
+    }
+    FILE *out = strcmp(config.json_path, "-") == 0 ? stdout : fopen(config.json_path, "w");
+    if (out == NULL) {
+        perror("fopen JSON report");
+        return;
+    }
+    fprintf(out,
+            "{\"publishers\":%d,\"subscribers\":%d,\"topics\":%d,\"message_size\":%zu,"
+            "\"mode\":\"%s\",\"rate\":%.1f,\"window\":%d,\"linger_ms\":%d,\"duration_s\":%.3f,"
+            "\"sent\":%llu,\"expected\":%llu,\"received\":%llu,"
+            "\"msgs_per_sec\":%.1f,\"mb_per_sec\":%.3f",
+            config.publishers, config.subscribers, config.topics, config.message_size,
+            mode_names[config.mode], config.rate, config.window, config.linger_ms, elapsed,
+            (unsigned long long)sent, (unsigned long long)expected, (unsigned long long)received,
+            msgs_per_sec, mb_per_sec);
+    json_latency(out, "latency_us", &latency);
+    if (to_broker.total > 0) {
+        json_latency(out, "to_broker_us", &to_broker);
+        json_latency(out, "from_broker_us", &from_broker);
+    }
+    if (persist_time.total > 0) {
+        json_latency(out, "persist_us", &persist_time);
+    }
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+}
+
+/**
+ * @brief Main function for litemq-bench.
+ * Opens the connections, generates load for the configured duration, waits for
+ * in-flight messages to arrive, and prints the report.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv An array of command-line argument strings.
+ * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char *argv[]) {
+    parse_args(argc, argv);
+    run_id = (uint32_t)(now_ns() ^ ((uint64_t)getpid() << 16));
+    histogram_init(&latency);
+    payload = calloc(1, config.message_size);
+    if (payload == NULL || open_connections() < 0) {
+        return EXIT_FAILURE;
+    }
+    int total = config.publishers + config.subscribers;
+    struct pollfd *pfds = calloc((size_t)total, sizeof(*pfds));
+    if (pfds == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    // Give the broker time to register the subscriptions before load starts
+    for (uint64_t settle = now_ns() + BENCH_SUBSCRIBE_SETTLE_MS * 1000000ULL; now_ns() < settle;) {
+        build_pollset(pfds);
+        poll(pfds, (nfds_t)total, 10);
+        if (service_connections(pfds) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    histogram_init(&latency);
+    histogram_init(&to_broker);
+    histogram_init(&from_broker);
+    histogram_init(&persist_time);
+    received = 0;
+    received_bytes = 0;
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(config.duration * 1e9);
+    for (int i = 0; i < config.publishers; i++) {
+        // Stagger open-loop publishers across one send interval
+        pubs[i].next_send_ns = config.mode == LOAD_OPEN
+            ? start + (uint64_t)(1e9 / config.rate * i / config.publishers) : start;
+    }
+
+    uint64_t now;
+    while ((now = now_ns()) < end) {
+        int backed_up = 0;
+        uint64_t next_due = end;
+        for (int i = 0; i < config.publishers; i++) {
+            int rc = pump_publisher(&pubs[i], i, now);
+            if (rc == LMQ_ERR_WOULDBLOCK) {
+                backed_up = 1;
+            } else if (rc < 0) {
+                fprintf(stderr, "Publish failed: %s\n", lmq_strerror(rc));
+                return EXIT_FAILURE;
+            }
+            if (config.mode == LOAD_OPEN && pubs[i].next_send_ns < next_due) {
+                next_due = pubs[i].next_send_ns;
+            }
+        }
+
+        int timeout = 1;
+        if (config.mode == LOAD_MAX && !backed_up) {
+            timeout = 0;
+        } else if (config.mode == LOAD_OPEN && next_due <= now_ns()) {
+            timeout = 0;
+        }
+        build_pollset(pfds);
+        if (poll(pfds, (nfds_t)total, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            return EXIT_FAILURE;
+        }
+        if (service_connections(pfds) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // Stop sending, then wait for messages still in flight
+    uint64_t sent = 0;
+    uint64_t expected = 0;
+    for (int i = 0; i < config.publishers; i++) {
+        lmq_flush(pubs[i].client, BENCH_DRAIN_MS);
+        sent += pubs[i].sent;
+        for (int j = 0; j < config.subscribers; j++) {
+            if (subs[j].topic == pubs[i].topic) {
+                expected += pubs[i].sent;
+            }
+        }
+    }
+    for (uint64_t drain_end = now_ns() + BENCH_DRAIN_MS * 1000000ULL; received < expected && now_ns() < drain_end;) {
+        build_pollset(pfds);
+        poll(pfds, (nfds_t)total, 10);
+        if (service_connections(pfds) < 0) {
+            break;
+        }
+    }
+
+    report(sent, expected, elapsed);
+
+    for (int i = 0; i < config.publishers; i++) {
+        lmq_close(pubs[i].client);
+    }
+    for (int i = 0; i < config.subscribers; i++) {
+        lmq_close(subs[i].client);
+    }
+    free(pfds);
+    free(pubs);
+    free(subs);
+    free(payload);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,489 @@
+/**
+ * @file log.c
+ * @brief Implements the asynchronous leveled logger.
+ * @author Mohammed Uddin
+ *
+ * The ring is a bounded multi-producer queue (Vyukov): each slot carries a sequence
+ * number that tells producers whether it is free and the consumer whether it is full,
+ * so producers only contend on one compare-and-swap of the enqueue position.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "utils.h"
+
+#define RING_MASK (LOG_RING_SLOTS - 1)
+#define LINE_MAX_LEN 1024
+#define IDLE_SLEEP_MIN_NS 100000L
+#define IDLE_SLEEP_MAX_NS 20000000L
+
+/**
+ * @brief One ring slot.
+ */
+typedef struct {
+    uint64_t seq;     ///< Slot index when free, index + 1 when it holds a record.
+    log_record_t rec; ///< The captured record.
+} log_slot_t;
+
+unsigned char log_module_levels[LOG_MODULE_COUNT] = {LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO};
+
+static const char *const level_names[] = {"debug", "info", "warn", "error", "off"};
+static const char *const module_names[] = {"broker", "persist", "admin"};
+
+static log_slot_t ring[LOG_RING_SLOTS];
+static uint64_t enqueue_pos;
+static uint64_t dequeue_pos;
+static uint64_t dropped;
+static int running;
+static pthread_t writer;
+
+/**
+ * @brief Returns the current time of a clock in nanoseconds.
+ *
+ * @param clock The clock to read.
+ * @return uint64_t The time in nanoseconds.
+ */
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Looks up a name in a table.
+ *
+ * @param names The table.
+ * @param count The number of entries.
+ * @param name The name to find.
+ * @param len The length of the name.
+ * @return int The index of the name, or -1 if it is not in the table.
+ */
+static int lookup_name(const char *const *names, int count, const char *name, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == len && strncmp(names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Sets the minimum level of one module.
+ *
+ * @param module The module.
+ * @param level The minimum level to log (LOG_LEVEL_OFF silences the module).
+ */
+void log_set_level(log_module_t module, log_level_t level) {
+    log_module_levels[module] = (unsigned char)level;
+}
+
+/**
+ * @brief Applies a filter specification such as "info" or "warn,broker=debug,admin=off".
+ *
+ * @param spec The specification.
+ * @return int 0 on success, -1 if the specification is invalid (nothing is changed).
+ */
+int log_configure(const char *spec) {
+    unsigned char levels[LOG_MODULE_COUNT];
+    memcpy(levels, log_module_levels, sizeof(levels));
+
+    const char *p = spec;
+    while (*p != '\0') {
+        size_t len = strcspn(p, ",");
+        const char *eq = memchr(p, '=', len);
+        if (eq == NULL) {
+            int level = lookup_name(level_names, LOG_LEVEL_OFF + 1, p, len);
+            if (level < 0) {
+                return -1;
+            }
+            memset(levels, level, sizeof(levels));
+        } else {
+            int module = lookup_name(module_names, LOG_MODULE_COUNT, p, (size_t)(eq - p));
+            int level = lookup_name(level_names, LOG_LEVEL_OFF + 1, eq + 1, len - (size_t)(eq - p) - 1);
+            if (module < 0 || level < 0) {
+                return -1;
+            }
+            levels[module] = (unsigned char)level;
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    memcpy(log_module_levels, levels, sizeof(levels));
+    return 0;
+}
+
+/**
+ * @brief Captures the arguments of a log call into a record without formatting them.
+ *
+ * Walks the conversions of the format string to learn the type of each argument. %s
+ * strings are copied, since the caller's buffer may be reused before the record is
+ * written; everything else is stored by value.
+ *
+ * @param rec The record to fill.
+ * @param level The record's level.
+ * @param module The record's module.
+ * @param fmt The format string literal.
+ * @param ap The arguments.
+ */
+void log_capture(log_record_t *rec, log_level_t level, log_module_t module, const char *fmt, va_list ap) {
+    rec->time_ns = clock_ns(CLOCK_REALTIME);
+    rec->fmt = fmt;
+    rec->level = (unsigned char)level;
+    rec->module = (unsigned char)module;
+    rec->nargs = 0;
+    rec->truncated = 0;
+    rec->strings_len = 0;
+
+    for (const char *p = fmt; *p != '\0'; ) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+            p++;
+        }
+        while (isdigit((unsigned char)*p) || *p == '.') {
+            p++;
+        }
+        int longs = 0;
+        int size = 0;
+        while (*p == 'h' || *p == 'l' || *p == 'z') {
+            longs += *p == 'l';
+            size |= *p == 'z';
+            p++;
+        }
+        if (rec->nargs == LOG_MAX_ARGS) {
+            rec->truncated = 1;
+            return;
+        }
+        log_arg_t *arg = &rec->args[rec->nargs];
+        switch (*p) {
+        case 'd':
+        case 'i':
+            arg->i = size ? (long long)va_arg(ap, size_t) : longs == 2 ? va_arg(ap, long long)
+                   : longs == 1 ? va_arg(ap, long) : va_arg(ap, int);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            arg->u = size ? va_arg(ap, size_t) : longs == 2 ? va_arg(ap, unsigned long long)
+                   : longs == 1 ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+            break;
+        case 'c':
+            arg->u = (unsigned char)va_arg(ap, int);
+            break;
+        case 'f':
+        case 'e':
+        case 'g':
+            arg->f = va_arg(ap, double);
+            break;
+        case 'p':
+            arg->p = va_arg(ap, void *);
+            break;
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            if (s == NULL) {
+                s = "(null)";
+            }
+            size_t room = LOG_MAX_STRINGS - rec->strings_len;
+            if (room == 0) {
+                rec->truncated = 1;
+                return;
+            }
+            size_t n = strlen(s);
+            if (n >= room) {
+                n = room - 1;
+                rec->truncated = 1;
+            }
+            memcpy(rec->strings + rec->strings_len, s, n);
+            rec->strings[rec->strings_len + n] = '\0';
+            arg->s = rec->strings_len;
+            rec->strings_len = (unsigned short)(rec->strings_len + n + 1);
+            break;
+        }
+        default:
+            // Unsupported conversion: the remaining arguments cannot be located.
+            rec->truncated = 1;
+            return;
+        }
+        rec->nargs++;
+        p++;
+    }
+}
+
+/**
+ * @brief Formats the message of a captured record (without timestamp or level prefix).
+ *
+ * @param rec The record.
+ * @param out Destination buffer.
+ * @param cap Capacity of the destination buffer.
+ * @return size_t The length of the formatted text (truncated to cap - 1).
+ */
+size_t log_render(const log_record_t *rec, char *out, size_t cap) {
+    size_t len = 0;
+    size_t next = 0;
+    const char *p = rec->fmt;
+    out[0] = '\0';
+
+    while (*p != '\0' && len + 1 < cap) {
+        if (*p != '%' || p[1] == '%') {
+            out[len++] = *p;
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        if (next == rec->nargs) {
+            break;
+        }
+        // Rebuild the conversion with the width the argument was stored at.
+        char spec[32];
+        size_t spec_len = 0;
+        spec[spec_len++] = *p++;
+        while (*p != '\0' && (strchr("-+ #0.", *p) != NULL || isdigit((unsigned char)*p))) {
+            if (spec_len < sizeof(spec) - 4) {
+                spec[spec_len++] = *p;
+            }
+            p++;
+        }
+        while (*p == 'h' || *p == 'l' || *p == 'z') {
+            p++;
+        }
+        char conv = *p++;
+        const log_arg_t *arg = &rec->args[next++];
+        if (strchr("diuxXo", conv) != NULL) {
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+        }
+        spec[spec_len++] = conv;
+        spec[spec_len] = '\0';
+
+        int n;
+        switch (conv) {
+        case 'd':
+        case 'i':
+            n = snprintf(out + len, cap - len, spec, arg->i);
+            break;
+        case 'c':
+            n = snprintf(out + len, cap - len, spec, (int)arg->u);
+            break;
+        case 'f':
+        case 'e':
+        case 'g':
+            n = snprintf(out + len, cap - len, spec, arg->f);
+            break;
+        case 'p':
+            n = snprintf(out + len, cap - len, spec, arg->p);
+            break;
+        case 's':
+            n = snprintf(out + len, cap - len, spec, rec->strings + arg->s);
+            break;
+        default:
+            n = snprintf(out + len, cap - len, spec, arg->u);
+            break;
+        }
+        if (n < 0) {
+            break;
+        }
+        len += (size_t)n < cap - len ? (size_t)n : cap - len - 1;
+    }
+    if (rec->truncated && len + 6 < cap) {
+        memcpy(out + len, " [...]", 6);
+        len += 6;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Formats a record as a complete line and writes it to stdout or stderr.
+ *
+ * @param rec The record.
+ */
+static void emit(const log_record_t *rec) {
+    char line[LINE_MAX_LEN];
+    time_t secs = (time_t)(rec->time_ns / 1000000000ULL);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    size_t len = strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%S", &tm);
+    len += (size_t)snprintf(line + len, sizeof(line) - len, ".%03uZ %-5s %s: ",
+                            (unsigned)(rec->time_ns / 1000000 % 1000), level_names[rec->level],
+                            module_names[rec->module]);
+    len += log_render(rec, line + len, sizeof(line) - len - 1);
+    line[len++] = '\n';
+    fwrite(line, 1, len, rec->level >= LOG_LEVEL_WARN ? stderr : stdout);
+}
+
+/**
+ * @brief Writes every record currently in the ring.
+ *
+ * @return size_t The number of records written.
+ */
+static size_t drain(void) {
+    size_t count = 0;
+    for (;;) {
+        log_slot_t *slot = &ring[dequeue_pos & RING_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1) {
+            break;
+        }
+        emit(&slot->rec);
+        __atomic_store_n(&slot->seq, dequeue_pos + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        dequeue_pos++;
+        count++;
+    }
+    if (count > 0) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return count;
+}
+
+/**
+ * @brief Background thread: drains the ring, sleeping progressively longer while it is idle.
+ *
+ * @param arg Unused.
+ * @return void* Always NULL.
+ */
+static void *writer_main(void *arg) {
+    (void)arg;
+    long idle_ns = IDLE_SLEEP_MIN_NS;
+    for (;;) {
+        if (drain() > 0) {
+            idle_ns = IDLE_SLEEP_MIN_NS;
+            continue;
+        }
+        if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+            drain();
+            return NULL;
+        }
+        struct timespec ts = {0, idle_ns};
+        nanosleep(&ts, NULL);
+        if (idle_ns < IDLE_SLEEP_MAX_NS) {
+            idle_ns *= 2;
+        }
+    }
+}
+
+/**
+ * @brief Starts the background thread that formats and writes records.
+ *
+ * @return int 0 on success, -1 if the thread could not be started (logging stays synchronous).
+ */
+int log_start(void) {
+    if (running) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) {
+        ring[i].seq = i;
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    int err = pthread_create(&writer, NULL, writer_main, NULL);
+    if (err != 0) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        fprintf(stderr, "log writer thread: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes all pending records and stops the background thread.
+ */
+void log_stop(void) {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    uint64_t lost = log_dropped();
+    if (lost > 0) {
+        fprintf(stderr, "log: %llu records dropped (ring full)\n", (unsigned long long)lost);
+    }
+}
+
+/**
+ * @brief Returns the number of records dropped because the ring was full.
+ *
+ * @return uint64_t The number of dropped records.
+ */
+uint64_t log_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Captures a log call into the ring, or writes it directly if no writer thread runs.
+ *
+ * @param level The record's level.
+ * @param module The record's module.
+ * @param fmt A printf-style format string literal.
+ */
+void log_write(log_level_t level, log_module_t module, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        log_record_t rec;
+        log_capture(&rec, level, module, fmt, ap);
+        va_end(ap);
+        emit(&rec);
+        return;
+    }
+
+    uint64_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    log_slot_t *slot;
+    for (;;) {
+        slot = &ring[pos & RING_MASK];
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            va_end(ap);
+            return;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    log_capture(&slot->rec, level, module, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Decides whether a rate-limited call site may log now.
+ *
+ * @param rl The call site's state.
+ * @param level The level of the record, used to report suppressed records.
+ * @param module The module of the record.
+ * @return int 1 if the record may be logged, 0 if it is suppressed.
+ */
+int log_ratelimit_allow(log_ratelimit_t *rl, log_level_t level, log_module_t module) {
+    uint64_t now = monotonic_ns();
+    if (rl->window_start == 0 || now - rl->window_start >= 1000000000ULL) {
+        if (rl->suppressed > 0 && level >= log_module_levels[module]) {
+            log_write(level, module, "%u similar messages suppressed", (unsigned)rl->suppressed);
+        }
+        rl->window_start = now;
+        rl->count = 0;
+        rl->suppressed = 0;
+    }
+    if (rl->count < LOG_RATE_BURST) {
+        rl->count++;
+        return 1;
+    }
+    rl->suppressed++;
+    return 0;
+}
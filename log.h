@@ -0,0 +1,199 @@
+/**
+ * @file log.h
+ * @brief Declares the asynchronous leveled logger used by the broker.
+ * @author Mohammed Uddin
+ *
+ * A log call does not format anything. It copies the format string pointer, the
+ * argument values and any %s strings into a slot of a lock-free ring, and returns. A
+ * background thread takes records off the ring, formats them and writes them to
+ * stdout (debug, info) or stderr (warn, error). When the ring is full, records are
+ * dropped and counted rather than blocking the caller. Until log_start() is called,
+ * and after log_stop(), records are formatted and written synchronously.
+ *
+ * Format strings must be string literals (they are read after the call returns).
+ * Supported conversions: d i u x X o c s p f e g %, with flags, width, precision and
+ * the length modifiers hh h l ll z. A '*' width or precision is not supported.
+ *
+ * Debug logging can be compiled out entirely with -DLOG_MIN_LEVEL=LOG_LEVEL_INFO.
+ */
+
+#ifndef LITEMQ_LOG_H
+#define LITEMQ_LOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_MAX_ARGS 8
+#define LOG_MAX_STRINGS 192
+#define LOG_RING_SLOTS 4096
+#define LOG_RATE_BURST 10
+
+/**
+ * @brief Severity of a log record.
+ */
+typedef enum {
+    LOG_LEVEL_DEBUG, ///< Per-message tracing; off by default.
+    LOG_LEVEL_INFO,  ///< Connection lifecycle and configuration.
+    LOG_LEVEL_WARN,  ///< Misbehaving clients and recoverable problems.
+    LOG_LEVEL_ERROR, ///< Failed system calls and lost data.
+    LOG_LEVEL_OFF    ///< Filter value that disables a module.
+} log_level_t;
+
+/**
+ * @brief Part of the broker a record comes from, for per-module filtering.
+ */
+typedef enum {
+    LOG_MODULE_BROKER,  ///< Event loop, connections and routing.
+    LOG_MODULE_PERSIST, ///< Topic logs and replay.
+    LOG_MODULE_ADMIN,   ///< Admin listener.
+    LOG_MODULE_COUNT
+} log_module_t;
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * @brief One captured argument.
+ */
+typedef union {
+    long long i;        ///< Signed integer conversions.
+    unsigned long long u; ///< Unsigned integer conversions and %c.
+    double f;           ///< Floating-point conversions.
+    const void *p;      ///< %p.
+    size_t s;           ///< %s: offset of the copied string within the record.
+} log_arg_t;
+
+/**
+ * @brief A log call captured for deferred formatting.
+ */
+typedef struct {
+    uint64_t time_ns;              ///< CLOCK_REALTIME of the call.
+    const char *fmt;               ///< The format string literal.
+    log_arg_t args[LOG_MAX_ARGS];  ///< Argument values in order.
+    unsigned char level;           ///< log_level_t of the record.
+    unsigned char module;          ///< log_module_t of the record.
+    unsigned char nargs;           ///< Number of captured arguments.
+    unsigned char truncated;       ///< Set if arguments or strings did not fit.
+    unsigned short strings_len;    ///< Bytes used in strings.
+    char strings[LOG_MAX_STRINGS]; ///< Copies of %s arguments, NUL-terminated.
+} log_record_t;
+
+/**
+ * @brief State of a rate-limited call site.
+ */
+typedef struct {
+    uint64_t window_start; ///< Start of the current one-second window (ns).
+    uint32_t count;        ///< Records let through in the current window.
+    uint32_t suppressed;   ///< Records dropped in the current window.
+} log_ratelimit_t;
+
+/**
+ * @brief Minimum level per module. Checked inline by the logging macros.
+ */
+extern unsigned char log_module_levels[LOG_MODULE_COUNT];
+
+#define LOG_AT(level, module, ...)                                                       \
+    do {                                                                                 \
+        if ((level) >= LOG_MIN_LEVEL && (level) >= log_module_levels[(module)]) {       \
+            log_write((level), (module), __VA_ARGS__);                                   \
+        }                                                                                \
+    } while (0)
+
+#define log_debug(module, ...) LOG_AT(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#define log_info(module, ...) LOG_AT(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define log_warn(module, ...) LOG_AT(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define log_error(module, ...) LOG_AT(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+
+/**
+ * @brief Logs at most LOG_RATE_BURST records per second from this call site and thread.
+ * The number of suppressed records is reported with the first record of the next window.
+ * Each worker thread keeps its own window, so the state needs no locking.
+ */
+#define log_ratelimited(level, module, ...)                                              \
+    do {                                                                                 \
+        static __thread log_ratelimit_t log_rl_;                                         \
+        if ((level) >= LOG_MIN_LEVEL && (level) >= log_module_levels[(module)] &&       \
+            log_ratelimit_allow(&log_rl_, (level), (module))) {                          \
+            log_write((level), (module), __VA_ARGS__);                                   \
+        }                                                                                \
+    } while (0)
+
+/**
+ * @brief Sets the minimum level of one module.
+ *
+ * @param module The module.
+ * @param level The minimum level to log (LOG_LEVEL_OFF silences the module).
+ */
+void log_set_level(log_module_t module, log_level_t level);
+
+/**
+ * @brief Applies a filter specification such as "info" or "warn,broker=debug,admin=off".
+ * A bare level applies to every module; module=level entries override it.
+ *
+ * @param spec The specification.
+ * @return int 0 on success, -1 if the specification is invalid (nothing is changed).
+ */
+int log_configure(const char *spec);
+
+/**
+ * @brief Starts the background thread that formats and writes records.
+ *
+ * @return int 0 on success, -1 if the thread could not be started (logging stays synchronous).
+ */
+int log_start(void);
+
+/**
+ * @brief Writes all pending records and stops the background thread.
+ */
+void log_stop(void);
+
+/**
+ * @brief Returns the number of records dropped because the ring was full.
+ *
+ * @return uint64_t The number of dropped records.
+ */
+uint64_t log_dropped(void);
+
+/**
+ * @brief Captures a log call. Use the log_* macros rather than calling this directly.
+ *
+ * @param level The record's level.
+ * @param module The record's module.
+ * @param fmt A printf-style format string literal.
+ */
+void log_write(log_level_t level, log_module_t module, const char *fmt, ...);
+
+/**
+ * @brief Decides whether a rate-limited call site may log now.
+ *
+ * @param rl The call site's state.
+ * @param level The level of the record, used to report suppressed records.
+ * @param module The module of the record.
+ * @return int 1 if the record may be logged, 0 if it is suppressed.
+ */
+int log_ratelimit_allow(log_ratelimit_t *rl, log_level_t level, log_module_t module);
+
+/**
+ * @brief Captures the arguments of a log call into a record without formatting them.
+ *
+ * @param rec The record to fill.
+ * @param level The record's level.
+ * @param module The record's module.
+ * @param fmt The format string literal.
+ * @param ap The arguments.
+ */
+void log_capture(log_record_t *rec, log_level_t level, log_module_t module, const char *fmt, va_list ap);
+
+/**
+ * @brief Formats the message of a captured record (without timestamp or level prefix).
+ *
+ * @param rec The record.
+ * @param out Destination buffer.
+ * @param cap Capacity of the destination buffer.
+ * @return size_t The length of the formatted text (truncated to cap - 1).
+ */
+size_t log_render(const log_record_t *rec, char *out, size_t cap);
+
+#endif // LITEMQ_LOG_H
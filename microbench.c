@@ -0,0 +1,685 @@
+/**
+ * @file microbench.c
+ * @brief Implements litemq-microbench, microbenchmarks of the broker's hot paths.
+ * @author Mohammed Uddin
+ *
+ * Each case calls the real broker code in-process: parse_frame() for frame parsing,
+ * broker_publish() for topic routing and fan-out, broker_handle_input() for the whole
+ * ingest path, and persist_message_len() and replay_persisted_messages() for the
+ * persistence log. Subscribers in the routing and
+ * fan-out cases share one connected UDP socket whose receiver never reads, so sends
+ * never block and 100k subscribers fit in the descriptor limit; the numbers therefore
+ * include one send per delivery, as in the server. Persistence runs in a temporary
+ * directory that is removed afterwards.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "broker.h"
+#include "utils.h"
+#include "log.h"
+
+#define MICROBENCH_MAX_RESULTS 64
+#define MICROBENCH_FANOUT_PAYLOAD 64
+#define MICROBENCH_REPLAY_RECORDS 10000
+#define MICROBENCH_REPLAY_PAYLOAD 100
+#define MICROBENCH_PATH_LEN 512
+#define MICROBENCH_INGEST_SUBS 16
+#define MICROBENCH_INGEST_FRAMES 4096
+#define MICROBENCH_INGEST_PAYLOAD 100
+
+/**
+ * @brief A benchmark body: performs `iterations` operations on `ctx`.
+ */
+typedef void (*bench_fn_t)(void *ctx, uint64_t iterations);
+
+/**
+ * @brief Result of one benchmark case.
+ */
+typedef struct {
+    const char *bench;     ///< Benchmark group, e.g. "parse".
+    const char *param;     ///< Name of the varied parameter, e.g. "bytes".
+    uint64_t value;        ///< Value of the varied parameter.
+    uint64_t ops;          ///< Operations performed.
+    uint64_t elapsed_ns;   ///< Time taken.
+    uint64_t bytes_per_op; ///< Payload bytes per operation, for MB/s.
+    uint64_t deliveries;   ///< Subscriber deliveries (routing and fan-out cases).
+} bench_result_t;
+
+/**
+ * @brief Command-line configuration.
+ */
+static struct {
+    double min_time;       ///< Minimum measuring time per case in seconds.
+    uint64_t max_subs;     ///< Largest subscriber count to run.
+    const char *only;      ///< Run only this benchmark group, or NULL for all.
+    const char *json_path; ///< Where to write the JSON report ("-" for stdout), or NULL.
+    int pool_threads;      ///< Fan-out pool threads for route and fanout, or 0 for none.
+} config;
+
+static bench_result_t results[MICROBENCH_MAX_RESULTS];
+static size_t result_count;
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Prints the command-line usage and exits.
+ *
+ * @param prog The program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "  -b name      Run only one benchmark: parse, route, fanout, ingest, persist or replay\n"
+            "  -t seconds   Minimum measuring time per case (default 0.2)\n"
+            "  -m count     Largest subscriber count for route and fanout (default 100000)\n"
+            "  -j file      Also write the results as JSON (- for stdout)\n"
+            "  -p threads   Split route and fanout cases with enough subscribers over a fan-out pool\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the command line into the global configuration.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ */
+static void parse_args(int argc, char *argv[]) {
+    config.min_time = 0.2;
+    config.max_subs = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:t:m:j:p:")) != -1) {
+        switch (opt) {
+        case 'b': config.only = optarg; break;
+        case 't': config.min_time = atof(optarg); break;
+        case 'm': config.max_subs = (uint64_t)atol(optarg); break;
+        case 'j': config.json_path = optarg; break;
+        case 'p': config.pool_threads = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || config.min_time <= 0 || config.max_subs < 1 || config.pool_threads < 0 ||
+        config.pool_threads > FANPOOL_MAX_THREADS) {
+        usage(argv[0]);
+    }
+}
+
+/**
+ * @brief Returns whether a benchmark group was selected on the command line.
+ *
+ * @param bench The group name.
+ * @return int 1 if it should run, 0 otherwise.
+ */
+static int selected(const char *bench) {
+    return config.only == NULL || strcmp(config.only, bench) == 0;
+}
+
+/**
+ * @brief Runs a benchmark body until the minimum time has passed and records the result.
+ * The batch size doubles while batches are short, so clock reads stay off the measured path.
+ *
+ * @param bench Benchmark group.
+ * @param param Name of the varied parameter.
+ * @param value Value of the varied parameter.
+ * @param bytes_per_op Payload bytes per operation.
+ * @param ops_per_call Operations performed by one iteration of `fn`.
+ * @param fn The benchmark body.
+ * @param ctx Context passed to `fn`.
+ * @return bench_result_t* The recorded result, or NULL if the result table is full.
+ */
+static bench_result_t *run_case(const char *bench, const char *param, uint64_t value, uint64_t bytes_per_op,
+                                uint64_t ops_per_call, bench_fn_t fn, void *ctx) {
+    if (result_count == MICROBENCH_MAX_RESULTS) {
+        return NULL;
+    }
+    uint64_t min_ns = (uint64_t)(config.min_time * 1e9);
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    uint64_t start = now_ns();
+    uint64_t elapsed = 0;
+    while (elapsed < min_ns) {
+        fn(ctx, batch);
+        iterations += batch;
+        elapsed = now_ns() - start;
+        if (elapsed < min_ns / 8 && batch < (1U << 20)) {
+            batch *= 2;
+        }
+    }
+
+    bench_result_t *r = &results[result_count++];
+    memset(r, 0, sizeof(*r));
+    r->bench = bench;
+    r->param = param;
+    r->value = value;
+    r->ops = iterations * ops_per_call;
+    r->elapsed_ns = elapsed;
+    r->bytes_per_op = bytes_per_op;
+    printf("%-8s %-6s %-7llu %12llu ops %10.1f ns/op %12.0f ops/s %9.2f MB/s\n", bench, param,
+           (unsigned long long)value, (unsigned long long)r->ops, (double)elapsed / (double)r->ops,
+           (double)r->ops * 1e9 / (double)elapsed,
+           (double)(r->ops * bytes_per_op) * 1e9 / (double)elapsed / (1024.0 * 1024.0));
+    return r;
+}
+
+/**
+ * @brief Context of the parse benchmark: one encoded PUB frame.
+ */
+typedef struct {
+    char *buf;  ///< The encoded frame.
+    size_t len; ///< Its length in bytes.
+} parse_ctx_t;
+
+/**
+ * @brief Parses the same frame `iterations` times.
+ *
+ * @param ctx Pointer to a parse_ctx_t.
+ * @param iterations Number of frames to parse.
+ */
+static void bench_parse(void *ctx, uint64_t iterations) {
+    parse_ctx_t *p = ctx;
+    frame_t frame;
+    size_t consumed;
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (parse_frame(p->buf, p->len, &frame, &consumed) != FRAME_OK) {
+            fprintf(stderr, "parse_frame failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Measures frame parsing of PUB frames at several payload sizes.
+ */
+static void run_parse(void) {
+    static const size_t sizes[] = { 16, 256, 4096, 65536 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        parse_ctx_t p;
+        p.buf = malloc(FRAME_MAX_HEADER + sizes[s]);
+        if (p.buf == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        int header_len = format_frame_header(p.buf, FRAME_MAX_HEADER, FRAME_PUB, "bench", sizes[s]);
+        memset(p.buf + header_len, 'x', sizes[s]);
+        p.len = (size_t)header_len + sizes[s];
+        run_case("parse", "bytes", sizes[s], sizes[s], 1, bench_parse, &p);
+        free(p.buf);
+    }
+}
+
+/**
+ * @brief Context of the routing and fan-out benchmarks.
+ */
+typedef struct {
+    broker_t broker;          ///< The broker under test.
+    struct pollfd *fds;       ///< Its poll slots.
+    client_t *clients;        ///< Its client slots.
+    char payload[MICROBENCH_FANOUT_PAYLOAD]; ///< The published payload.
+    uint64_t deliveries;      ///< Deliveries reported by broker_publish().
+    fanpool_t pool;           ///< Fan-out pool (-p).
+} route_ctx_t;
+
+/**
+ * @brief Publishes the payload to topic "target" `iterations` times.
+ *
+ * @param ctx Pointer to a route_ctx_t.
+ * @param iterations Number of messages to publish.
+ */
+static void bench_publish(void *ctx, uint64_t iterations) {
+    route_ctx_t *r = ctx;
+    for (uint64_t i = 0; i < iterations; i++) {
+        r->deliveries += broker_publish(&r->broker, "target", r->payload, sizeof(r->payload), 0);
+    }
+}
+
+/**
+ * @brief Opens a connected UDP socket whose peer never reads.
+ * Datagrams beyond the peer's receive buffer are dropped, so sends never block.
+ *
+ * @param peer Receives the peer socket, which must stay open while the sink is used.
+ * @return int The sink socket, or -1 on error.
+ */
+static int open_sink(int *peer) {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    *peer = socket(AF_INET, SOCK_DGRAM, 0);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (*peer < 0 || fd < 0 || bind(*peer, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(*peer, (struct sockaddr *)&addr, &addrlen) < 0 ||
+        connect(fd, (struct sockaddr *)&addr, addrlen) < 0) {
+        perror("UDP sink");
+        return -1;
+    }
+    set_non_blocking(fd);
+    return fd;
+}
+
+/**
+ * @brief Measures broker_publish() with `subs` subscribers, of which `targets` are on the published topic.
+ *
+ * @param bench Benchmark group name.
+ * @param subs Total subscribers.
+ * @param targets Subscribers on the published topic.
+ * @param sink_fd Socket every subscriber slot writes to.
+ */
+static void run_publish_case(const char *bench, uint64_t subs, uint64_t targets, int sink_fd) {
+    route_ctx_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    r->fds = calloc(subs + 1, sizeof(struct pollfd));
+    r->clients = calloc(subs + 1, sizeof(client_t));
+    if (r->fds == NULL || r->clients == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(r->payload, 'x', sizeof(r->payload));
+    broker_init(&r->broker, r->fds, r->clients, (int)subs);
+    // Slots are filled directly: broker_add_client() scans for a free slot, which is quadratic here
+    for (uint64_t i = 1; i <= subs; i++) {
+        r->fds[i].fd = sink_fd;
+        r->fds[i].events = POLLIN;
+        r->clients[i].fd = sink_fd;
+        r->clients[i].type = CLIENT_TYPE_SUBSCRIBER;
+        r->clients[i].conn_id = (uint32_t)i;
+        if (i <= targets) {
+            strcpy(r->clients[i].topic, "target");
+        } else {
+            snprintf(r->clients[i].topic, MAX_TOPIC_LEN, "other-%llu", (unsigned long long)i);
+        }
+        if (subtable_add(&r->broker.subs, r->clients[i].topic, (int)i, (uint32_t)i) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.pool_threads > 0 && (fanpool_init(&r->pool, config.pool_threads, &r->broker.subs) < 0 ||
+                                    broker_set_fanout_pool(&r->broker, &r->pool, BROKER_DEFAULT_PARALLEL_MIN) < 0)) {
+        perror("fan-out pool");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_result_t *result = run_case(bench, "subs", subs, sizeof(r->payload), 1, bench_publish, r);
+    if (result != NULL) {
+        result->deliveries = r->deliveries;
+    }
+
+    // The slots share the sink, which must survive broker_free()
+    for (uint64_t i = 1; i <= subs; i++) {
+        r->fds[i].fd = -1;
+    }
+    if (config.pool_threads > 0) {
+        fanpool_free(&r->pool);
+    }
+    broker_free(&r->broker);
+    free(r->fds);
+    free(r->clients);
+    free(r);
+}
+
+/**
+ * @brief Measures topic routing and fan-out with 1 to 100k subscribers.
+ * Routing publishes to a topic with one subscriber among many on other topics, so it
+ * isolates the cost of finding subscribers; fan-out puts every subscriber on the topic.
+ *
+ * @param route Whether to run the routing cases.
+ * @param fanout Whether to run the fan-out cases.
+ */
+static void run_publish(int route, int fanout) {
+    static const uint64_t counts[] = { 1, 10, 100, 1000, 10000, 100000 };
+    int peer;
+    int sink_fd = open_sink(&peer);
+    if (sink_fd < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]) && counts[c] <= config.max_subs; c++) {
+        if (route) {
+            run_publish_case("route", counts[c], 1, sink_fd);
+        }
+    }
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]) && counts[c] <= config.max_subs; c++) {
+        if (fanout) {
+            run_publish_case("fanout", counts[c], counts[c], sink_fd);
+        }
+    }
+    close(sink_fd);
+    close(peer);
+}
+
+/**
+ * @brief Context of the ingest benchmark: a publisher and subscribers driven through broker_handle_input().
+ */
+typedef struct {
+    broker_t broker;                                ///< The broker under test.
+    struct pollfd fds[MICROBENCH_INGEST_SUBS + 2];  ///< Its poll slots.
+    client_t clients[MICROBENCH_INGEST_SUBS + 2];   ///< Its client slots.
+    int peers[MICROBENCH_INGEST_SUBS + 2];          ///< Harness ends of the slots' socketpairs.
+    int subs;                                       ///< Number of subscribers.
+    int pub_slot;                                   ///< Slot of the publisher.
+    char *stream;                                   ///< Encoded PUB frames.
+    size_t stream_len;                              ///< Length of the stream in bytes.
+    char *scratch;                                  ///< Buffer for draining subscriber sockets.
+} ingest_ctx_t;
+
+/**
+ * @brief Reads everything a subscriber's socket holds and lets the broker send what it queued.
+ *
+ * @param g The ingest context.
+ */
+static void drain_subscribers(ingest_ctx_t *g) {
+    for (int s = 1; s <= g->subs; s++) {
+        while (recv(g->peers[s], g->scratch, BROKER_READ_CHUNK, MSG_DONTWAIT) > 0) {
+            if (g->fds[s].events & POLLOUT) {
+                broker_handle_writable(&g->broker, s);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Injects the frame stream `iterations` times, in read-sized chunks that split frames.
+ *
+ * @param ctx Pointer to an ingest_ctx_t.
+ * @param iterations Number of times to inject the stream.
+ */
+static void bench_ingest(void *ctx, uint64_t iterations) {
+    ingest_ctx_t *g = ctx;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (size_t off = 0; off < g->stream_len; off += BROKER_READ_CHUNK) {
+            size_t chunk = g->stream_len - off < BROKER_READ_CHUNK ? g->stream_len - off : BROKER_READ_CHUNK;
+            if (broker_handle_input(&g->broker, g->pub_slot, g->stream + off, chunk) < 0) {
+                fprintf(stderr, "broker closed the publisher\n");
+                exit(EXIT_FAILURE);
+            }
+            drain_subscribers(g);
+        }
+    }
+}
+
+/**
+ * @brief Opens a socketpair for a broker slot and registers the broker's end.
+ *
+ * @param g The ingest context.
+ * @return int The slot, or -1 on error.
+ */
+static int add_loopback_client(ingest_ctx_t *g) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    set_non_blocking(sv[0]);
+    int slot = broker_add_client(&g->broker, sv[0]);
+    g->peers[slot] = sv[1];
+    return slot;
+}
+
+/**
+ * @brief Measures the broker core per published message with no TCP in the path.
+ * Frames are injected with broker_handle_input() as if read from a publisher; subscribers
+ * subscribe through the same path and their socketpairs are drained after every chunk.
+ * With no subscribers this is the pure cost of parsing, dispatch and routing.
+ */
+static void run_ingest(void) {
+    static const int counts[] = { 0, 1, 4, 16 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        ingest_ctx_t *g = calloc(1, sizeof(*g));
+        if (g == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        broker_init(&g->broker, g->fds, g->clients, MICROBENCH_INGEST_SUBS + 1);
+        g->subs = counts[c];
+        char sub[FRAME_MAX_HEADER];
+        int sub_len = format_frame_header(sub, sizeof(sub), FRAME_SUB, "bench", 0);
+        for (int s = 0; s < g->subs; s++) {
+            int slot = add_loopback_client(g);
+            if (slot < 0 || broker_handle_input(&g->broker, slot, sub, (size_t)sub_len) < 0) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        g->pub_slot = add_loopback_client(g);
+        g->scratch = malloc(BROKER_READ_CHUNK);
+        g->stream = malloc(MICROBENCH_INGEST_FRAMES * (FRAME_MAX_HEADER + MICROBENCH_INGEST_PAYLOAD));
+        if (g->pub_slot < 0 || g->scratch == NULL || g->stream == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        for (int f = 0; f < MICROBENCH_INGEST_FRAMES; f++) {
+            int header_len = format_frame_header(g->stream + g->stream_len, FRAME_MAX_HEADER, FRAME_PUB, "bench",
+                                                 MICROBENCH_INGEST_PAYLOAD);
+            memset(g->stream + g->stream_len + header_len, 'x', MICROBENCH_INGEST_PAYLOAD);
+            g->stream_len += (size_t)header_len + MICROBENCH_INGEST_PAYLOAD;
+        }
+
+        bench_result_t *result = run_case("ingest", "subs", (uint64_t)g->subs, MICROBENCH_INGEST_PAYLOAD,
+                                          MICROBENCH_INGEST_FRAMES, bench_ingest, g);
+        if (result != NULL) {
+            result->deliveries = g->broker.stats.messages_out;
+        }
+
+        broker_free(&g->broker);
+        for (int s = 1; s <= g->subs + 1; s++) {
+            close(g->peers[s]);
+        }
+        free(g->stream);
+        free(g->scratch);
+        free(g);
+    }
+}
+
+/**
+ * @brief Context of the persistence benchmarks.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< Topic whose log is written or replayed.
+    char *payload;             ///< Payload to persist.
+    size_t len;                ///< Payload length.
+    uint64_t replayed;         ///< Records handed to the replay sink.
+} persist_ctx_t;
+
+/**
+ * @brief Appends the payload to the topic's log `iterations` times.
+ *
+ * @param ctx Pointer to a persist_ctx_t.
+ * @param iterations Number of messages to persist.
+ */
+static void bench_persist(void *ctx, uint64_t iterations) {
+    persist_ctx_t *p = ctx;
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (persist_message_len(p->topic, p->payload, p->len, PERSIST_ALL) == 0) {
+            fprintf(stderr, "persist_message_len failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Replay sink that counts the records it receives.
+ *
+ * @param topic The topic being replayed (unused).
+ * @param message The message content (unused).
+ * @param len The length of the message (unused).
+ * @param seq The sequence number (unused).
+ * @param origin The origin (unused).
+ * @param ctx Pointer to a persist_ctx_t.
+ */
+static void count_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin, void *ctx) {
+    (void)topic;
+    (void)message;
+    (void)len;
+    (void)seq;
+    (void)origin;
+    ((persist_ctx_t *)ctx)->replayed++;
+}
+
+/**
+ * @brief Replays the topic's whole log `iterations` times.
+ *
+ * @param ctx Pointer to a persist_ctx_t.
+ * @param iterations Number of full replays.
+ */
+static void bench_replay(void *ctx, uint64_t iterations) {
+    persist_ctx_t *p = ctx;
+    for (uint64_t i = 0; i < iterations; i++) {
+        replay_persisted_messages(p->topic, PERSIST_ALL, 0, 0, count_sink, p);
+    }
+}
+
+/**
+ * @brief Removes a directory and the regular files directly inside it.
+ *
+ * @param path The directory.
+ */
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char file[MICROBENCH_PATH_LEN];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            unlink(file);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/**
+ * @brief Measures appends with persist_message_len() and replay with replay_persisted_messages().
+ * Runs in a fresh temporary directory, since the logs live under LOG_DIR in the working directory.
+ *
+ * @param persist Whether to run the append cases.
+ * @param replay Whether to run the replay case.
+ */
+static void run_persistence(int persist, int replay) {
+    static const size_t sizes[] = { 100, 4096 };
+    char cwd[MICROBENCH_PATH_LEN];
+    char tmpdir[] = "/tmp/litemq-microbench.XXXXXX";
+    if (getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(tmpdir) == NULL || chdir(tmpdir) < 0) {
+        perror("temporary directory");
+        exit(EXIT_FAILURE);
+    }
+    mkdir(LOG_DIR, 0755);
+
+    persist_ctx_t p;
+    memset(&p, 0, sizeof(p));
+    p.payload = malloc(sizes[1]);
+    if (p.payload == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(p.payload, 'x', sizes[1]);
+    for (size_t s = 0; persist && s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        snprintf(p.topic, sizeof(p.topic), "persist-%zu", sizes[s]);
+        p.len = sizes[s];
+        run_case("persist", "bytes", sizes[s], sizes[s], 1, bench_persist, &p);
+    }
+    if (replay) {
+        strcpy(p.topic, "replay");
+        p.len = MICROBENCH_REPLAY_PAYLOAD;
+        bench_persist(&p, MICROBENCH_REPLAY_RECORDS);
+        run_case("replay", "bytes", MICROBENCH_REPLAY_PAYLOAD, MICROBENCH_REPLAY_PAYLOAD,
+                 MICROBENCH_REPLAY_RECORDS, bench_replay, &p);
+    }
+    free(p.payload);
+
+    remove_dir(LOG_DIR);
+    if (chdir(cwd) < 0) {
+        perror("chdir");
+    }
+    rmdir(tmpdir);
+}
+
+/**
+ * @brief Writes the results as JSON to the configured path.
+ */
+static void write_json(void) {
+    FILE *out = strcmp(config.json_path, "-") == 0 ? stdout : fopen(config.json_path, "w");
+    if (out == NULL) {
+        perror("fopen JSON report");
+        return;
+    }
+    fprintf(out, "{\"min_time_s\":%.3f,\"results\":[", config.min_time);
+    for (size_t i = 0; i < result_count; i++) {
+        const bench_result_t *r = &results[i];
+        double seconds = (double)r->elapsed_ns / 1e9;
+        fprintf(out,
+                "%s{\"bench\":\"%s\",\"%s\":%llu,\"ops\":%llu,\"elapsed_s\":%.6f,\"ns_per_op\":%.2f,"
+                "\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f",
+                i > 0 ? "," : "", r->bench, r->param, (unsigned long long)r->value, (unsigned long long)r->ops,
+                seconds, (double)r->elapsed_ns / (double)r->ops, (double)r->ops / seconds,
+                (double)(r->ops * r->bytes_per_op) / seconds / (1024.0 * 1024.0));
+        if (r->deliveries > 0) {
+            fprintf(out, ",\"deliveries\":%llu", (unsigned long long)r->deliveries);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+}
+
+/**
+ * @brief Main function for litemq-microbench.
+ * Runs the selected benchmark groups, printing one line per case.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv An array of command-line argument strings.
+ * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char *argv[]) {
+    parse_args(argc, argv);
+    // Keep broker log lines out of the results
+    log_configure("warn");
+
+    if (selected("parse")) {
+        run_parse();
+    }
+    if (selected("route") || selected("fanout")) {
+        run_publish(selected("route"), selected("fanout"));
+    }
+    if (selected("ingest")) {
+        run_ingest();
+    }
+    if (selected("persist") || selected("replay")) {
+        run_persistence(selected("persist"), selected("replay"));
+    }
+    if (result_count == 0) {
+        usage(argv[0]);
+    }
+    if (config.json_path != NULL) {
+        write_json();
+    }
+    return EXIT_SUCCESS;
+}
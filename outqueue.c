@@ -0,0 +1,521 @@
+/**
+ * @file outqueue.c
+ * @brief Implements the per-connection output queue and reference-counted message payloads.
+ * @author Mohammed Uddin
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include "outqueue.h"
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define OUTQ_HAVE_ZEROCOPY 1
+#endif
+
+/**
+ * @brief Creates a payload holding a copy of the given bytes, with one reference.
+ *
+ * @param data The payload bytes.
+ * @param len The payload length.
+ * @return payload_t* The new payload, or NULL if allocation failed.
+ */
+payload_t *payload_create(const char *data, size_t len) {
+    payload_t *payload = malloc(sizeof(*payload) + len);
+    if (payload == NULL) {
+        return NULL;
+    }
+    payload->refs = 1;
+    payload->len = len;
+    memcpy(payload->data, data, len);
+    return payload;
+}
+
+/**
+ * @brief Adds a reference to a payload.
+ * Atomic, since fan-out pool threads queue one payload for different clients at once.
+ *
+ * @param payload The payload.
+ */
+void payload_retain(payload_t *payload) {
+    __atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drops a reference to a payload, freeing it with the last one.
+ *
+ * @param payload The payload (may be NULL).
+ */
+void payload_release(payload_t *payload) {
+    if (payload != NULL && __atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(payload);
+    }
+}
+
+/**
+ * @brief Initialises an empty output queue.
+ *
+ * @param q The queue.
+ */
+void outq_init(out_queue_t *q) {
+    memset(q, 0, sizeof(*q));
+}
+
+/**
+ * @brief Discards all queued output and releases its payload references.
+ *
+ * @param q The queue.
+ */
+void outq_clear(out_queue_t *q) {
+    for (size_t i = q->seg_head; i < q->seg_len; i++) {
+        payload_release(q->segs[i].payload);
+    }
+    for (size_t i = q->zc_head; i < q->zc_len; i++) {
+        payload_release(q->zc[i].payload);
+    }
+    q->bytes_head = 0;
+    q->bytes_len = 0;
+    q->seg_head = 0;
+    q->seg_len = 0;
+    q->head_sent = 0;
+    q->pending = 0;
+    q->zerocopy = 0;
+    q->zc_head = 0;
+    q->zc_len = 0;
+    q->zc_next_id = 0;
+    q->zc_sends = 0;
+    q->zc_copied = 0;
+}
+
+/**
+ * @brief Clears the queue and frees its buffers.
+ *
+ * @param q The queue.
+ */
+void outq_free(out_queue_t *q) {
+    outq_clear(q);
+    free(q->bytes);
+    free(q->segs);
+    free(q->zc);
+    outq_init(q);
+}
+
+/**
+ * @brief Makes room for one more element in a FIFO array, compacting or growing it.
+ *
+ * @param array Pointer to the array pointer.
+ * @param elem_size Size of one element.
+ * @param head Pointer to the index of the oldest element.
+ * @param len Pointer to the end of the elements in use.
+ * @param cap Pointer to the allocated number of elements.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int reserve_fifo(void **array, size_t elem_size, size_t *head, size_t *len, size_t *cap) {
+    if (*len < *cap) {
+        return 0;
+    }
+    if (*head > 0) {
+        memmove(*array, (char *)*array + *head * elem_size, (*len - *head) * elem_size);
+        *len -= *head;
+        *head = 0;
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap * 2 : 64;
+    void *grown = realloc(*array, new_cap * elem_size);
+    if (grown == NULL) {
+        return -1;
+    }
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Appends a segment to the queue.
+ *
+ * @param q The queue.
+ * @param seg The segment.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int push_segment(out_queue_t *q, const out_segment_t *seg) {
+    if (reserve_fifo((void **)&q->segs, sizeof(*q->segs), &q->seg_head, &q->seg_len, &q->seg_cap) < 0) {
+        return -1;
+    }
+    q->segs[q->seg_len++] = *seg;
+    q->pending += seg->len;
+    return 0;
+}
+
+/**
+ * @brief Ensures the byte area can take `len` more bytes.
+ * Bytes that have already been sent are dropped from the front first; segment offsets
+ * are adjusted accordingly.
+ *
+ * @param q The queue.
+ * @param len The number of bytes to add.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+static int reserve_bytes(out_queue_t *q, size_t len) {
+    if (q->bytes_len + len <= q->bytes_cap) {
+        return 0;
+    }
+    if (q->bytes_head > 0) {
+        memmove(q->bytes, q->bytes + q->bytes_head, q->bytes_len - q->bytes_head);
+        for (size_t i = q->seg_head; i < q->seg_len; i++) {
+            if (q->segs[i].payload == NULL) {
+                q->segs[i].offset -= q->bytes_head;
+            }
+        }
+        q->bytes_len -= q->bytes_head;
+        q->bytes_head = 0;
+        if (q->bytes_len + len <= q->bytes_cap) {
+            return 0;
+        }
+    }
+    size_t new_cap = q->bytes_cap ? q->bytes_cap : 64 * 1024;
+    while (new_cap < q->bytes_len + len) {
+        new_cap *= 2;
+    }
+    char *grown = realloc(q->bytes, new_cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    q->bytes = grown;
+    q->bytes_cap = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Appends a copy of some bytes to the queue.
+ * Bytes that directly follow the previous byte segment extend it, so runs of small
+ * frames are sent as one iovec.
+ *
+ * @param q The queue.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_bytes(out_queue_t *q, const char *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (reserve_bytes(q, len) < 0) {
+        return -1;
+    }
+    memcpy(q->bytes + q->bytes_len, data, len);
+
+    out_segment_t *tail = q->seg_len > q->seg_head ? &q->segs[q->seg_len - 1] : NULL;
+    if (tail != NULL && tail->payload == NULL && tail->offset + tail->len == q->bytes_len) {
+        tail->len += len;
+        q->pending += len;
+    } else {
+        out_segment_t seg = { NULL, q->bytes_len, len, 0 };
+        if (push_segment(q, &seg) < 0) {
+            return -1;
+        }
+    }
+    q->bytes_len += len;
+    return 0;
+}
+
+/**
+ * @brief Appends a reference to a shared payload to the queue.
+ *
+ * @param q The queue.
+ * @param payload The payload; the queue takes its own reference.
+ * @param zerocopy Whether to send it with MSG_ZEROCOPY (ignored unless enabled on the queue).
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_payload(out_queue_t *q, payload_t *payload, int zerocopy) {
+    return outq_append_payload_range(q, payload, 0, payload->len, zerocopy);
+}
+
+/**
+ * @brief Appends a reference to part of a shared payload to the queue.
+ *
+ * @param q The queue.
+ * @param payload The payload; the queue takes its own reference.
+ * @param offset Offset of the first byte to send.
+ * @param len Number of bytes to send.
+ * @param zerocopy Whether to send it with MSG_ZEROCOPY (ignored unless enabled on the queue).
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_payload_range(out_queue_t *q, payload_t *payload, size_t offset, size_t len, int zerocopy) {
+    if (len == 0) {
+        return 0;
+    }
+    out_segment_t seg = { payload, offset, len, zerocopy };
+    if (push_segment(q, &seg) < 0) {
+        return -1;
+    }
+    payload_retain(payload);
+    return 0;
+}
+
+/**
+ * @brief Returns the start of a segment's unsent bytes.
+ *
+ * @param q The queue.
+ * @param seg The segment.
+ * @param skip Bytes of the segment already sent.
+ * @return char* The first unsent byte.
+ */
+static char *segment_data(const out_queue_t *q, const out_segment_t *seg, size_t skip) {
+    const char *base = seg->payload ? seg->payload->data : q->bytes;
+    return (char *)base + seg->offset + skip;
+}
+
+/**
+ * @brief Removes `n` sent bytes from the front of the queue.
+ *
+ * @param q The queue.
+ * @param n The number of bytes sent.
+ */
+static void consume(out_queue_t *q, size_t n) {
+    q->pending -= n;
+    while (n > 0) {
+        out_segment_t *head = &q->segs[q->seg_head];
+        size_t left = head->len - q->head_sent;
+        if (n < left) {
+            q->head_sent += n;
+            return;
+        }
+        n -= left;
+        if (head->payload != NULL) {
+            payload_release(head->payload);
+        } else {
+            q->bytes_head = head->offset + head->len;
+        }
+        q->head_sent = 0;
+        q->seg_head++;
+    }
+    if (q->seg_head == q->seg_len) {
+        q->seg_head = 0;
+        q->seg_len = 0;
+        q->bytes_head = 0;
+        q->bytes_len = 0;
+    }
+}
+
+#ifdef OUTQ_HAVE_ZEROCOPY
+/**
+ * @brief Sends the rest of the head segment with MSG_ZEROCOPY and records the send.
+ * Falls back to a copying send when the kernel is out of zero-copy resources.
+ *
+ * @param q The queue.
+ * @param fd The socket.
+ * @return ssize_t Bytes sent, or -1 on error.
+ */
+static ssize_t send_zerocopy(out_queue_t *q, int fd) {
+    out_segment_t *head = &q->segs[q->seg_head];
+    struct iovec iov;
+    iov.iov_base = segment_data(q, head, q->head_sent);
+    iov.iov_len = head->len - q->head_sent;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    if (reserve_fifo((void **)&q->zc, sizeof(*q->zc), &q->zc_head, &q->zc_len, &q->zc_cap) < 0) {
+        return sendmsg(fd, &mh, MSG_NOSIGNAL);
+    }
+    ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (n < 0 && errno == ENOBUFS) {
+        return sendmsg(fd, &mh, MSG_NOSIGNAL);
+    }
+    if (n >= 0) {
+        // Every successful zero-copy send consumes one notification counter value
+        q->zc[q->zc_len].id = q->zc_next_id++;
+        q->zc[q->zc_len].payload = head->payload;
+        q->zc_len++;
+        q->zc_sends++;
+        payload_retain(head->payload);
+    }
+    return n;
+}
+#endif
+
+/**
+ * @brief Collects the unsent head of the queue into an iovec array.
+ * Stops before a zero-copy segment, which must be sent on its own.
+ *
+ * @param q The queue.
+ * @param iov Destination array of OUTQ_MAX_IOV entries.
+ * @return int The number of entries filled.
+ */
+static int gather(const out_queue_t *q, struct iovec *iov) {
+    int count = 0;
+    size_t skip = q->head_sent;
+    for (size_t i = q->seg_head; i < q->seg_len && count < OUTQ_MAX_IOV; i++) {
+        const out_segment_t *seg = &q->segs[i];
+        if (seg->zerocopy && q->zerocopy && count > 0) {
+            break;
+        }
+        iov[count].iov_base = segment_data(q, seg, skip);
+        iov[count].iov_len = seg->len - skip;
+        count++;
+        skip = 0;
+    }
+    return count;
+}
+
+/**
+ * @brief Sends as much queued output as the socket accepts without blocking.
+ *
+ * @param q The queue.
+ * @param fd The non-blocking socket.
+ * @return ssize_t The number of bytes sent (0 if the socket is full), or -1 on error (errno is set).
+ */
+ssize_t outq_send(out_queue_t *q, int fd) {
+    size_t total = 0;
+    while (q->pending > 0) {
+        ssize_t n;
+#ifdef OUTQ_HAVE_ZEROCOPY
+        if (q->zerocopy && q->segs[q->seg_head].zerocopy) {
+            n = send_zerocopy(q, fd);
+        } else
+#endif
+        {
+            struct iovec iov[OUTQ_MAX_IOV];
+            struct msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = (size_t)gather(q, iov);
+            n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        consume(q, (size_t)n);
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+/**
+ * @brief Enables MSG_ZEROCOPY on a socket for this queue's payload segments.
+ *
+ * @param q The queue.
+ * @param fd The socket.
+ * @return int 0 on success, -1 if the platform or socket does not support it.
+ */
+int outq_enable_zerocopy(out_queue_t *q, int fd) {
+#ifdef OUTQ_HAVE_ZEROCOPY
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        q->zerocopy = 1;
+        return 0;
+    }
+    return -1;
+#else
+    (void)q;
+    (void)fd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Returns whether zero-copy sends are waiting for completion notifications.
+ *
+ * @param q The queue.
+ * @return int 1 if notifications are outstanding, 0 otherwise.
+ */
+int outq_zerocopy_pending(const out_queue_t *q) {
+    return q->zc_head < q->zc_len;
+}
+
+#ifdef OUTQ_HAVE_ZEROCOPY
+/**
+ * @brief Releases the payloads of the sends with counter values in [lo, hi].
+ *
+ * @param q The queue.
+ * @param lo First completed counter value.
+ * @param hi Last completed counter value.
+ * @param copied Whether the kernel copied the data.
+ */
+static void complete_range(out_queue_t *q, uint32_t lo, uint32_t hi, int copied) {
+    for (size_t i = q->zc_head; i < q->zc_len; i++) {
+        // Counter values wrap around, so compare distances from lo
+        if (q->zc[i].payload != NULL && (uint32_t)(q->zc[i].id - lo) <= (uint32_t)(hi - lo)) {
+            payload_release(q->zc[i].payload);
+            q->zc[i].payload = NULL;
+            if (copied) {
+                q->zc_copied++;
+            }
+        }
+    }
+    while (q->zc_head < q->zc_len && q->zc[q->zc_head].payload == NULL) {
+        q->zc_head++;
+    }
+    if (q->zc_head == q->zc_len) {
+        q->zc_head = 0;
+        q->zc_len = 0;
+    }
+}
+#endif
+
+/**
+ * @brief Reads zero-copy completion notifications and releases completed payloads.
+ *
+ * @param q The queue.
+ * @param fd The socket.
+ * @return int The number of notifications processed, or -1 on error (errno is set).
+ */
+int outq_reap_zerocopy(out_queue_t *q, int fd) {
+#ifdef OUTQ_HAVE_ZEROCOPY
+    int reaped = 0;
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return reaped;
+            }
+            return -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (!((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            int copied = (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            complete_range(q, serr.ee_info, serr.ee_data, copied);
+            if (copied) {
+                q->zerocopy = 0;
+            }
+            reaped++;
+        }
+    }
+#else
+    (void)q;
+    (void)fd;
+    return 0;
+#endif
+}
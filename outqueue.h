@@ -0,0 +1,190 @@
+/**
+ * @file outqueue.h
+ * @brief Declares the per-connection output queue and reference-counted message payloads.
+ * @author Mohammed Uddin
+ *
+ * An output queue is a FIFO of segments. Small pieces (frame headers, short payloads)
+ * are copied into a byte area owned by the queue; large payloads are referenced through
+ * a shared payload_t, so one message fanned out to many subscribers is stored once and
+ * handed to each socket with a gathering send. Payload segments may additionally be sent
+ * with MSG_ZEROCOPY; the payload is then kept alive until the kernel reports completion
+ * on the socket's error queue.
+ */
+
+#ifndef LITEMQ_OUTQUEUE_H
+#define LITEMQ_OUTQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define OUTQ_MAX_IOV 64
+
+/**
+ * @brief An immutable, reference-counted message payload.
+ */
+typedef struct {
+    size_t refs;  ///< Queue segments and in-flight zero-copy sends referencing the payload (atomic).
+    size_t len;   ///< Payload length in bytes.
+    char data[];  ///< Payload bytes.
+} payload_t;
+
+/**
+ * @brief One contiguous piece of queued output.
+ */
+typedef struct {
+    payload_t *payload; ///< Referenced payload, or NULL for bytes held in the queue's byte area.
+    size_t offset;      ///< Offset into the byte area (payload == NULL) or into the payload.
+    size_t len;         ///< Segment length in bytes.
+    int zerocopy;       ///< Whether to send this segment with MSG_ZEROCOPY.
+} out_segment_t;
+
+/**
+ * @brief A zero-copy send whose completion has not been reported yet.
+ */
+typedef struct {
+    uint32_t id;        ///< Kernel notification counter value of the send.
+    payload_t *payload; ///< Payload kept alive until completion (NULL once completed).
+} zc_pending_t;
+
+/**
+ * @brief Output queue of one connection.
+ */
+typedef struct {
+    char *bytes;           ///< Byte area for copied segments.
+    size_t bytes_head;     ///< Start of the bytes still referenced by segments.
+    size_t bytes_len;      ///< End of the used byte area.
+    size_t bytes_cap;      ///< Allocated size of the byte area.
+    out_segment_t *segs;   ///< Segment FIFO.
+    size_t seg_head;       ///< Index of the oldest segment.
+    size_t seg_len;        ///< End of the segments in use.
+    size_t seg_cap;        ///< Allocated number of segments.
+    size_t head_sent;      ///< Bytes of the oldest segment already sent.
+    size_t pending;        ///< Total unsent bytes.
+    int zerocopy;          ///< Whether MSG_ZEROCOPY is enabled on the socket.
+    zc_pending_t *zc;      ///< In-flight zero-copy sends (FIFO).
+    size_t zc_head;        ///< Index of the oldest in-flight send.
+    size_t zc_len;         ///< End of the in-flight sends.
+    size_t zc_cap;         ///< Allocated number of in-flight entries.
+    uint32_t zc_next_id;   ///< Counter value the kernel will assign to the next zero-copy send.
+    uint64_t zc_sends;     ///< Zero-copy sends issued.
+    uint64_t zc_copied;    ///< Zero-copy sends the kernel reported as copied after all.
+} out_queue_t;
+
+/**
+ * @brief Creates a payload holding a copy of the given bytes, with one reference.
+ *
+ * @param data The payload bytes.
+ * @param len The payload length.
+ * @return payload_t* The new payload, or NULL if allocation failed.
+ */
+payload_t *payload_create(const char *data, size_t len);
+
+/**
+ * @brief Adds a reference to a payload.
+ *
+ * @param payload The payload.
+ */
+void payload_retain(payload_t *payload);
+
+/**
+ * @brief Drops a reference to a payload, freeing it with the last one.
+ *
+ * @param payload The payload (may be NULL).
+ */
+void payload_release(payload_t *payload);
+
+/**
+ * @brief Initialises an empty output queue.
+ *
+ * @param q The queue.
+ */
+void outq_init(out_queue_t *q);
+
+/**
+ * @brief Discards all queued output and releases its payload references.
+ * Buffers stay allocated for reuse; zero-copy sends in flight are forgotten.
+ *
+ * @param q The queue.
+ */
+void outq_clear(out_queue_t *q);
+
+/**
+ * @brief Clears the queue and frees its buffers.
+ *
+ * @param q The queue.
+ */
+void outq_free(out_queue_t *q);
+
+/**
+ * @brief Appends a copy of some bytes to the queue.
+ *
+ * @param q The queue.
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_bytes(out_queue_t *q, const char *data, size_t len);
+
+/**
+ * @brief Appends a reference to a shared payload to the queue.
+ *
+ * @param q The queue.
+ * @param payload The payload; the queue takes its own reference.
+ * @param zerocopy Whether to send it with MSG_ZEROCOPY (ignored unless enabled on the queue).
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_payload(out_queue_t *q, payload_t *payload, int zerocopy);
+
+/**
+ * @brief Appends a reference to part of a shared payload to the queue.
+ *
+ * @param q The queue.
+ * @param payload The payload; the queue takes its own reference.
+ * @param offset Offset of the first byte to send.
+ * @param len Number of bytes to send.
+ * @param zerocopy Whether to send it with MSG_ZEROCOPY (ignored unless enabled on the queue).
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int outq_append_payload_range(out_queue_t *q, payload_t *payload, size_t offset, size_t len, int zerocopy);
+
+/**
+ * @brief Sends as much queued output as the socket accepts without blocking.
+ *
+ * @param q The queue.
+ * @param fd The non-blocking socket.
+ * @return ssize_t The number of bytes sent (0 if the socket is full), or -1 on error (errno is set).
+ */
+ssize_t outq_send(out_queue_t *q, int fd);
+
+/**
+ * @brief Enables MSG_ZEROCOPY on a socket for this queue's payload segments.
+ *
+ * @param q The queue.
+ * @param fd The socket.
+ * @return int 0 on success, -1 if the platform or socket does not support it.
+ */
+int outq_enable_zerocopy(out_queue_t *q, int fd);
+
+/**
+ * @brief Returns whether zero-copy sends are waiting for completion notifications.
+ *
+ * @param q The queue.
+ * @return int 1 if notifications are outstanding, 0 otherwise.
+ */
+int outq_zerocopy_pending(const out_queue_t *q);
+
+/**
+ * @brief Reads zero-copy completion notifications from the socket's error queue and
+ * releases the payloads of completed sends.
+ *
+ * If the kernel reports that it had to copy the data anyway (e.g. on loopback), zero-copy
+ * is switched off for the queue, since deferred completion then only adds cost.
+ *
+ * @param q The queue.
+ * @param fd The socket.
+ * @return int The number of notifications processed, or -1 on error (errno is set).
+ */
+int outq_reap_zerocopy(out_queue_t *q, int fd);
+
+#endif // LITEMQ_OUTQUEUE_H
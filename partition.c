@@ -0,0 +1,343 @@
+/**
+ * @file partition.c
+ * @brief Implements partitioned topics and the consumer groups that share their partitions.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "partition.h"
+#include "log.h"
+
+/**
+ * @brief Adds a partitioned topic from a "<topic>=<count>" specification.
+ *
+ * @param t The table.
+ * @param spec The specification.
+ * @return int 0 on success, -1 if it is malformed, names a topic twice or the table is full.
+ */
+int partition_table_add(partition_table_t *t, const char *spec) {
+    const char *eq = strrchr(spec, '=');
+    if (eq == NULL || t->count == PARTITION_MAX_TOPICS) {
+        return -1;
+    }
+    size_t topic_len = (size_t)(eq - spec);
+    if (topic_len >= sizeof(t->specs[0].topic) || !is_valid_topic(spec, topic_len)) {
+        return -1;
+    }
+    char *end;
+    long count = strtol(eq + 1, &end, 10);
+    if (*end != '\0' || eq[1] == '\0' || count < 1 || count > PARTITION_MAX) {
+        return -1;
+    }
+    partition_spec_t *entry = &t->specs[t->count];
+    memcpy(entry->topic, spec, topic_len);
+    entry->topic[topic_len] = '\0';
+    if (partition_find(t, entry->topic) != NULL) {
+        return -1;
+    }
+    entry->count = (unsigned)count;
+    t->count++;
+    return 0;
+}
+
+/**
+ * @brief Finds a partitioned topic.
+ *
+ * @param t The table, or NULL.
+ * @param topic The topic.
+ * @return const partition_spec_t* The topic's entry, or NULL if it is not partitioned.
+ */
+const partition_spec_t *partition_find(const partition_table_t *t, const char *topic) {
+    for (size_t i = 0; t != NULL && i < t->count; i++) {
+        if (strcmp(t->specs[i].topic, topic) == 0) {
+            return &t->specs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the partitioned topic a partition name belongs to.
+ *
+ * @param t The table, or NULL.
+ * @param topic A topic name such as "orders:3".
+ * @param index Receives the partition number.
+ * @return const partition_spec_t* The partitioned topic, or NULL if `topic` is not one of its partitions.
+ */
+const partition_spec_t *partition_of(const partition_table_t *t, const char *topic, unsigned *index) {
+    const char *colon = strrchr(topic, ':');
+    if (t == NULL || t->count == 0 || colon == NULL || colon[1] == '\0' || strlen(colon + 1) > 3) {
+        return NULL;
+    }
+    unsigned value = 0;
+    for (const char *c = colon + 1; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9' || (c == colon + 1 && *c == '0' && c[1] != '\0')) {
+            return NULL;
+        }
+        value = value * 10 + (unsigned)(*c - '0');
+    }
+    for (size_t i = 0; i < t->count; i++) {
+        const partition_spec_t *spec = &t->specs[i];
+        size_t len = strlen(spec->topic);
+        if ((size_t)(colon - topic) == len && memcmp(spec->topic, topic, len) == 0) {
+            if (value >= spec->count) {
+                return NULL;
+            }
+            *index = value;
+            return spec;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Formats the name of a partition.
+ *
+ * @param out Destination buffer (MAX_TOPIC_LEN bytes is always enough).
+ * @param cap Capacity of the buffer.
+ * @param spec The partitioned topic.
+ * @param index The partition number.
+ */
+void partition_name(char *out, size_t cap, const partition_spec_t *spec, unsigned index) {
+    snprintf(out, cap, "%s:%u", spec->topic, index);
+}
+
+/**
+ * @brief Initialises a core's partition state.
+ *
+ * @param s The state.
+ * @param table The partitioned topics, or NULL.
+ */
+void partition_state_init(partition_state_t *s, const partition_table_t *table) {
+    memset(s, 0, sizeof(*s));
+    s->table = table;
+}
+
+/**
+ * @brief Frees the allocations of a group.
+ *
+ * @param g The group.
+ */
+static void free_group(partition_group_t *g) {
+    free(g->members);
+    free(g->owner);
+    free(g->next_seq);
+}
+
+/**
+ * @brief Frees a core's partition state, including its groups.
+ *
+ * @param s The state.
+ */
+void partition_state_free(partition_state_t *s) {
+    for (size_t i = 0; i < s->group_count; i++) {
+        free_group(&s->groups[i]);
+    }
+    free(s->groups);
+    partition_state_init(s, s->table);
+}
+
+/**
+ * @brief Chooses the partition of a message published to a partitioned topic.
+ *
+ * @param s The state.
+ * @param spec The topic.
+ * @param key The message's "key" field, 0 for round-robin.
+ * @return unsigned The partition number.
+ */
+unsigned partition_pick(partition_state_t *s, const partition_spec_t *spec, uint64_t key) {
+    if (key != 0) {
+        s->keyed++;
+        return (unsigned)(key % spec->count);
+    }
+    s->round_robin++;
+    uint32_t *next = &s->next[spec - s->table->specs];
+    unsigned index = *next % spec->count;
+    *next = index + 1;
+    return index;
+}
+
+/**
+ * @brief Deals the partitions out to the members in contiguous ranges, in join order,
+ * and reports which partitions changed hands.
+ *
+ * @param g The group.
+ * @param moved Receives, per partition, 1 if it now has a different member, 0 otherwise.
+ */
+static void deal(partition_group_t *g, unsigned char *moved) {
+    unsigned count = g->spec->count;
+    for (unsigned p = 0; p < count; p++) {
+        partition_member_t owner = { 0, 0 };
+        if (g->member_count > 0) {
+            owner = g->members[(size_t)p * g->member_count / count];
+        }
+        moved[p] = owner.slot != 0 && (owner.slot != g->owner[p].slot || owner.conn_id != g->owner[p].conn_id);
+        g->owner[p] = owner;
+    }
+    g->stale = 0;
+    g->rebalances++;
+}
+
+/**
+ * @brief Finds a named group.
+ *
+ * @param s The state.
+ * @param spec The partitioned topic.
+ * @param id The group number.
+ * @return partition_group_t* The group, or NULL if it does not exist.
+ */
+static partition_group_t *find_group(partition_state_t *s, const partition_spec_t *spec, uint64_t id) {
+    for (size_t i = 0; id != 0 && i < s->group_count; i++) {
+        if (s->groups[i].spec == spec && s->groups[i].id == id) {
+            return &s->groups[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates an empty group.
+ *
+ * @param s The state.
+ * @param spec The partitioned topic.
+ * @param id The group number, 0 for a group of its own.
+ * @param next_seq Positions of the group, one per partition.
+ * @return partition_group_t* The group, or NULL if allocation failed.
+ */
+static partition_group_t *new_group(partition_state_t *s, const partition_spec_t *spec, uint64_t id,
+                                    const uint64_t *next_seq) {
+    if (s->group_count == s->group_cap) {
+        size_t new_cap = s->group_cap ? s->group_cap * 2 : 8;
+        partition_group_t *grown = realloc(s->groups, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            return NULL;
+        }
+        s->groups = grown;
+        s->group_cap = new_cap;
+    }
+    partition_group_t *g = &s->groups[s->group_count];
+    memset(g, 0, sizeof(*g));
+    g->spec = spec;
+    g->id = id;
+    g->owner = calloc(spec->count, sizeof(*g->owner));
+    g->next_seq = malloc(spec->count * sizeof(*g->next_seq));
+    if (g->owner == NULL || g->next_seq == NULL) {
+        free_group(g);
+        return NULL;
+    }
+    memcpy(g->next_seq, next_seq, spec->count * sizeof(*g->next_seq));
+    s->group_count++;
+    return g;
+}
+
+/**
+ * @brief Adds a member to a group, creating the group if needed, and deals out the partitions.
+ * A new group's positions start at `next_seq`, whose entries may be 0 for "not tracked".
+ *
+ * @param s The state.
+ * @param spec The partitioned topic.
+ * @param id The group number, 0 for a group of its own.
+ * @param slot The member's client slot.
+ * @param conn_id Its connection number.
+ * @param next_seq Positions of a new group, one per partition (ignored if the group exists).
+ * @param moved Receives, per partition, 1 if it now has a different member, 0 otherwise.
+ * @return partition_group_t* The group, or NULL if allocation failed.
+ */
+partition_group_t *partition_group_join(partition_state_t *s, const partition_spec_t *spec, uint64_t id, int slot,
+                                        uint32_t conn_id, const uint64_t *next_seq, unsigned char *moved) {
+    partition_group_t *g = find_group(s, spec, id);
+    if (g == NULL) {
+        g = new_group(s, spec, id, next_seq);
+    }
+    if (g == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc consumer group: %s", strerror(errno));
+        return NULL;
+    }
+    if (g->member_count == g->member_cap) {
+        size_t new_cap = g->member_cap ? g->member_cap * 2 : 4;
+        partition_member_t *grown = realloc(g->members, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            log_error(LOG_MODULE_BROKER, "realloc consumer group: %s", strerror(errno));
+            return NULL;
+        }
+        g->members = grown;
+        g->member_cap = new_cap;
+    }
+    g->members[g->member_count].slot = slot;
+    g->members[g->member_count].conn_id = conn_id;
+    g->member_count++;
+    deal(g, moved);
+    return g;
+}
+
+/**
+ * @brief Removes a connection from the group it belongs to. Its partitions are dealt
+ * out again by the next partition_group_rebalance().
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return int 1 if the connection was a member, 0 otherwise.
+ */
+int partition_group_leave(partition_state_t *s, int slot, uint32_t conn_id) {
+    for (size_t i = 0; i < s->group_count; i++) {
+        partition_group_t *g = &s->groups[i];
+        for (size_t m = 0; m < g->member_count; m++) {
+            if (g->members[m].slot == slot && g->members[m].conn_id == conn_id) {
+                memmove(&g->members[m], &g->members[m + 1], (g->member_count - m - 1) * sizeof(*g->members));
+                g->member_count--;
+                g->stale = 1;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Deals out the partitions of a group again if a member has left it.
+ *
+ * @param g The group.
+ * @param moved Receives, per partition, 1 if it now has a different member, 0 otherwise.
+ * @return int 1 if the group was dealt out again, 0 if it was up to date.
+ */
+int partition_group_rebalance(partition_group_t *g, unsigned char *moved) {
+    if (!g->stale) {
+        return 0;
+    }
+    deal(g, moved);
+    return 1;
+}
+
+/**
+ * @brief Drops the groups of plain subscriptions that have no member left.
+ * Other groups are kept, with their positions, for members joining later.
+ *
+ * @param s The state.
+ */
+void partition_group_prune(partition_state_t *s) {
+    size_t kept = 0;
+    for (size_t i = 0; i < s->group_count; i++) {
+        if (s->groups[i].id == 0 && s->groups[i].member_count == 0) {
+            free_group(&s->groups[i]);
+        } else {
+            s->groups[kept++] = s->groups[i];
+        }
+    }
+    s->group_count = kept;
+}
+
+/**
+ * @brief Returns the member a partition is dealt to.
+ *
+ * @param g The group.
+ * @param index The partition number.
+ * @return const partition_member_t* The member, or NULL if the partition has none.
+ */
+const partition_member_t *partition_group_owner(const partition_group_t *g, unsigned index) {
+    return g->owner[index].slot != 0 ? &g->owner[index] : NULL;
+}
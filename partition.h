@@ -0,0 +1,206 @@
+/**
+ * @file partition.h
+ * @brief Declares partitioned topics and the consumer groups that share their partitions.
+ * @author Mohammed Uddin
+ *
+ * A topic configured with N partitions is stored as N ordinary topics named
+ * "<topic>:0" to "<topic>:<N-1>". Each has its own log and sequence numbers, and with
+ * several workers each has its own owner, so the partitions of a hot topic are
+ * persisted and fanned out in parallel. Order is kept within a partition only.
+ *
+ * A PUB to the topic itself goes to partition key % N when it carries a "key" field,
+ * so messages with the same key stay in order, and round-robin otherwise. A PUB or SUB
+ * naming a partition directly uses it like any other topic.
+ *
+ * "SUB <topic> group=<id>" joins a consumer group. The partitions are dealt out to the
+ * members in contiguous ranges, in the order they joined, and dealt out again when a
+ * member joins or leaves. Members receive MSG frames named after the partition, with
+ * its sequence numbers. The group remembers, per partition, the first message it has
+ * not been given yet. A member taking over a partition is first sent the persisted
+ * messages from there, so nothing stored while the partition had no member is skipped.
+ * A plain "SUB <topic>" forms a group of its own and receives every partition.
+ *
+ * The configured topics (partition_table_t) are shared read-only by every core. The
+ * groups and the round-robin positions (partition_state_t) belong to one core.
+ */
+
+#ifndef LITEMQ_PARTITION_H
+#define LITEMQ_PARTITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#define PARTITION_MAX 256
+#define PARTITION_MAX_TOPICS 64
+#define PARTITION_SUFFIX_LEN 4 // ":" and up to three digits
+
+/**
+ * @brief A topic split into partitions.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN - PARTITION_SUFFIX_LEN]; ///< The topic.
+    unsigned count;                                   ///< Number of partitions, 1 to PARTITION_MAX.
+} partition_spec_t;
+
+/**
+ * @brief The partitioned topics of a broker. Filled before the cores start, then read-only.
+ */
+typedef struct {
+    partition_spec_t specs[PARTITION_MAX_TOPICS]; ///< The topics.
+    size_t count;                                 ///< Number of topics.
+} partition_table_t;
+
+/**
+ * @brief A member of a consumer group.
+ */
+typedef struct {
+    int slot;         ///< The member's client slot.
+    uint32_t conn_id; ///< Its connection number.
+} partition_member_t;
+
+/**
+ * @brief A consumer group of one partitioned topic.
+ */
+typedef struct {
+    const partition_spec_t *spec; ///< The topic.
+    uint64_t id;                  ///< Group number, 0 for the group of a plain subscription.
+    partition_member_t *members;  ///< Members in the order they joined.
+    size_t member_count;          ///< Number of members.
+    size_t member_cap;            ///< Allocated number of members.
+    partition_member_t *owner;    ///< Member per partition, slot 0 if it has none.
+    uint64_t *next_seq;           ///< Per partition, first sequence number not given to a member (0: not tracked).
+    int stale;                    ///< Whether a member left since the partitions were last dealt out.
+    uint64_t rebalances;          ///< Times the partitions were dealt out.
+} partition_group_t;
+
+/**
+ * @brief Partition state of one broker core.
+ */
+typedef struct {
+    const partition_table_t *table;       ///< The partitioned topics, or NULL if there are none.
+    uint32_t next[PARTITION_MAX_TOPICS];  ///< Next round-robin partition, per topic of the table.
+    partition_group_t *groups;            ///< The consumer groups.
+    size_t group_count;                   ///< Number of groups.
+    size_t group_cap;                     ///< Allocated number of groups.
+    uint64_t keyed;                       ///< Messages placed by key.
+    uint64_t round_robin;                 ///< Messages placed round-robin.
+} partition_state_t;
+
+/**
+ * @brief Adds a partitioned topic from a "<topic>=<count>" specification.
+ *
+ * @param t The table.
+ * @param spec The specification.
+ * @return int 0 on success, -1 if it is malformed, names a topic twice or the table is full.
+ */
+int partition_table_add(partition_table_t *t, const char *spec);
+
+/**
+ * @brief Finds a partitioned topic.
+ *
+ * @param t The table, or NULL.
+ * @param topic The topic.
+ * @return const partition_spec_t* The topic's entry, or NULL if it is not partitioned.
+ */
+const partition_spec_t *partition_find(const partition_table_t *t, const char *topic);
+
+/**
+ * @brief Finds the partitioned topic a partition name belongs to.
+ *
+ * @param t The table, or NULL.
+ * @param topic A topic name such as "orders:3".
+ * @param index Receives the partition number.
+ * @return const partition_spec_t* The partitioned topic, or NULL if `topic` is not one of its partitions.
+ */
+const partition_spec_t *partition_of(const partition_table_t *t, const char *topic, unsigned *index);
+
+/**
+ * @brief Formats the name of a partition.
+ *
+ * @param out Destination buffer (MAX_TOPIC_LEN bytes is always enough).
+ * @param cap Capacity of the buffer.
+ * @param spec The partitioned topic.
+ * @param index The partition number.
+ */
+void partition_name(char *out, size_t cap, const partition_spec_t *spec, unsigned index);
+
+/**
+ * @brief Initialises a core's partition state.
+ *
+ * @param s The state.
+ * @param table The partitioned topics, or NULL.
+ */
+void partition_state_init(partition_state_t *s, const partition_table_t *table);
+
+/**
+ * @brief Frees a core's partition state, including its groups.
+ *
+ * @param s The state.
+ */
+void partition_state_free(partition_state_t *s);
+
+/**
+ * @brief Chooses the partition of a message published to a partitioned topic.
+ *
+ * @param s The state.
+ * @param spec The topic.
+ * @param key The message's "key" field, 0 for round-robin.
+ * @return unsigned The partition number.
+ */
+unsigned partition_pick(partition_state_t *s, const partition_spec_t *spec, uint64_t key);
+
+/**
+ * @brief Adds a member to a group, creating the group if needed, and deals out the partitions.
+ * A new group's positions start at `next_seq`, whose entries may be 0 for "not tracked".
+ *
+ * @param s The state.
+ * @param spec The partitioned topic.
+ * @param id The group number, 0 for a group of its own.
+ * @param slot The member's client slot.
+ * @param conn_id Its connection number.
+ * @param next_seq Positions of a new group, one per partition (ignored if the group exists).
+ * @param moved Receives, per partition, 1 if it now has a different member, 0 otherwise.
+ * @return partition_group_t* The group, or NULL if allocation failed.
+ */
+partition_group_t *partition_group_join(partition_state_t *s, const partition_spec_t *spec, uint64_t id, int slot,
+                                        uint32_t conn_id, const uint64_t *next_seq, unsigned char *moved);
+
+/**
+ * @brief Removes a connection from the group it belongs to. Its partitions are dealt
+ * out again by the next partition_group_rebalance().
+ *
+ * @param s The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return int 1 if the connection was a member, 0 otherwise.
+ */
+int partition_group_leave(partition_state_t *s, int slot, uint32_t conn_id);
+
+/**
+ * @brief Deals out the partitions of a group again if a member has left it.
+ *
+ * @param g The group.
+ * @param moved Receives, per partition, 1 if it now has a different member, 0 otherwise.
+ * @return int 1 if the group was dealt out again, 0 if it was up to date.
+ */
+int partition_group_rebalance(partition_group_t *g, unsigned char *moved);
+
+/**
+ * @brief Drops the groups of plain subscriptions that have no member left.
+ * Other groups are kept, with their positions, for members joining later.
+ *
+ * @param s The state.
+ */
+void partition_group_prune(partition_state_t *s);
+
+/**
+ * @brief Returns the member a partition is dealt to.
+ *
+ * @param g The group.
+ * @param index The partition number.
+ * @return const partition_member_t* The member, or NULL if the partition has none.
+ */
+const partition_member_t *partition_group_owner(const partition_group_t *g, unsigned index);
+
+#endif // LITEMQ_PARTITION_H
@@ -4,45 +4,841 @@
  * @author Mohammed Uddin
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include "persistence.h"
+#include "protocol.h"
+#include "log.h"
+#include "utils.h"
+#include "probes.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/stat.h>
 
-#define BUFFER_SIZE 1024
+/**
+ * @brief Next sequence number of a topic that has been written to in this process.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< The topic name.
+    uint64_t next;             ///< Sequence number the next record will receive.
+    int corrupt;               ///< Whether the log holds a malformed record, so nothing is appended.
+} topic_seq_t;
+
+/**
+ * @brief A record read from a topic's log.
+ */
+typedef struct {
+    char header[96];   ///< The header line as read, for copying the record unchanged.
+    size_t header_len; ///< Length of the header line, including its newline.
+    time_t time;       ///< Time the message was received.
+    uint64_t seq;      ///< Sequence number of the record.
+    uint64_t origin;   ///< The broker a bridged message originated on, 0 for one published here.
+    char *payload;     ///< The message, when read (owned, grown as needed).
+    size_t len;        ///< Length of the message in bytes.
+    size_t cap;        ///< Allocated size of the payload buffer.
+} stored_record_t;
+
+// Each topic is persisted by one thread, so the table and counters are per thread
+static __thread topic_seq_t *seq_table = NULL;
+static __thread size_t seq_count = 0;
+static __thread size_t seq_cap = 0;
+
+static __thread persist_stats_t stats;
+static int sync_enabled = 0;
+static int timing_enabled = 0;
+
+/**
+ * @brief Opens a log file and counts it.
+ *
+ * @param path The file.
+ * @param mode The fopen mode.
+ * @return FILE* The stream, or NULL on failure (errno is set).
+ */
+static FILE *open_log(const char *path, const char *mode) {
+    FILE *fp = fopen(path, mode);
+    if (fp != NULL) {
+        stats.files_opened++;
+        stats.open_files++;
+    }
+    return fp;
+}
+
+/**
+ * @brief Closes a log file opened with open_log().
+ *
+ * @param fp The stream.
+ * @return int 0 on success, EOF if flushing or closing failed.
+ */
+static int close_log(FILE *fp) {
+    stats.open_files--;
+    return fclose(fp);
+}
+
+/**
+ * @brief Flushes a log file to stable storage, timing the fsync.
+ *
+ * @param fp The stream, already flushed.
+ * @return uint64_t The time the fsync took (0 when timing is off).
+ */
+static uint64_t sync_log(FILE *fp) {
+    uint64_t start = timing_enabled ? monotonic_ns() : 0;
+    if (fsync(fileno(fp)) != 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "fsync: %s", strerror(errno));
+    }
+    stats.fsyncs++;
+    if (!timing_enabled) {
+        return 0;
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    histogram_record(&stats.fsync_ns, elapsed);
+    return elapsed;
+}
+
+/**
+ * @brief Makes every append, and every compacted log before it replaces the original,
+ * reach stable storage with fsync().
+ *
+ * @param enabled Non-zero to sync, zero to leave flushing to the kernel (the default).
+ */
+void persist_set_fsync(int enabled) {
+    sync_enabled = enabled;
+}
+
+/**
+ * @brief Turns on the latency histograms and replay read timing of the storage layer.
+ *
+ * @param enabled Non-zero to time I/O, zero to only count it (the default).
+ */
+void persist_set_timing(int enabled) {
+    static __thread int histograms_ready = 0;
+    if (enabled && !histograms_ready) {
+        histogram_init(&stats.append_ns);
+        histogram_init(&stats.fsync_ns);
+        histograms_ready = 1;
+    }
+    timing_enabled = enabled;
+}
+
+/**
+ * @brief Returns the calling thread's storage I/O counters.
+ *
+ * @return const persist_stats_t* The counters, valid for the life of the thread.
+ */
+const persist_stats_t *persist_get_stats(void) {
+    return &stats;
+}
+
+/**
+ * @brief Adds the storage counters of one thread to another set of counters.
+ *
+ * @param dst The counters receiving the sums.
+ * @param src The counters to add.
+ */
+void persist_merge_stats(persist_stats_t *dst, const persist_stats_t *src) {
+    dst->appends += src->appends;
+    dst->append_errors += src->append_errors;
+    dst->bytes_written += src->bytes_written;
+    dst->files_opened += src->files_opened;
+    dst->open_files += src->open_files;
+    dst->log_files += src->log_files;
+    dst->fsyncs += src->fsyncs;
+    dst->compactions += src->compactions;
+    dst->records_expired += src->records_expired;
+    dst->bytes_expired += src->bytes_expired;
+    dst->bytes_rewritten += src->bytes_rewritten;
+    dst->replays += src->replays;
+    dst->replay_records += src->replay_records;
+    dst->replay_bytes += src->replay_bytes;
+    dst->replay_read_ns += src->replay_read_ns;
+    // A thread that never timed I/O has histograms that were never initialised
+    if (src->append_ns.total > 0) {
+        histogram_merge(&dst->append_ns, &src->append_ns);
+    }
+    if (src->fsync_ns.total > 0) {
+        histogram_merge(&dst->fsync_ns, &src->fsync_ns);
+    }
+}
+
+/**
+ * @brief Resets the calling thread's storage I/O counters (the open-file and log-file gauges are kept).
+ */
+void persist_reset_stats(void) {
+    uint64_t open_files = stats.open_files;
+    uint64_t log_files = stats.log_files;
+    memset(&stats, 0, sizeof(stats));
+    histogram_init(&stats.append_ns);
+    histogram_init(&stats.fsync_ns);
+    stats.open_files = open_files;
+    stats.log_files = log_files;
+}
+
+/**
+ * @brief Reads the sequence number of the first record in a topic's log.
+ *
+ * @param topic The topic name.
+ * @return uint64_t The first sequence number (1 if no records were ever dropped).
+ */
+static uint64_t read_first_seq(const char *topic) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log.first", LOG_DIR, topic);
+    FILE *fp = fopen(filepath, "r");
+    if (fp == NULL) {
+        return 1;
+    }
+    unsigned long long first = 1;
+    if (fscanf(fp, "%llu", &first) != 1 || first == 0) {
+        first = 1;
+    }
+    fclose(fp);
+    return first;
+}
+
+/**
+ * @brief Records the sequence number of the first record in a topic's log.
+ *
+ * @param topic The topic name.
+ * @param first The first sequence number.
+ */
+static void write_first_seq(const char *topic, uint64_t first) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log.first", LOG_DIR, topic);
+    FILE *fp = fopen(filepath, "w");
+    if (fp == NULL) {
+        log_error(LOG_MODULE_PERSIST, "fopen %s: %s", filepath, strerror(errno));
+        return;
+    }
+    fprintf(fp, "%llu\n", (unsigned long long)first);
+    fclose(fp);
+}
+
+/**
+ * @brief Reads the header line of the next record in a log.
+ *
+ * @param fp The log, positioned at the start of a record.
+ * @param r Receives the header.
+ * @return int 1 if a header was read, 0 at the end of the log, -1 if the header is
+ * malformed, -2 if it is cut short by the end of the log.
+ */
+static int read_record_header(FILE *fp, stored_record_t *r) {
+    if (fgets(r->header, sizeof(r->header), fp) == NULL) {
+        return 0;
+    }
+    r->header_len = strlen(r->header);
+    if (r->header_len == 0 || r->header[r->header_len - 1] != '\n') {
+        return feof(fp) ? -2 : -1;
+    }
+    char *end;
+    errno = 0;
+    r->time = (time_t)strtoll(r->header, &end, 10);
+    if (end == r->header || *end != ' ') {
+        return -1;
+    }
+    const char *seq_start = end + 1;
+    r->seq = strtoull(seq_start, &end, 10);
+    if (end == seq_start || *end != ' ' || r->seq == 0) {
+        return -1;
+    }
+    const char *len_start = end + 1;
+    unsigned long long len = strtoull(len_start, &end, 10);
+    if (end == len_start || (*end != '\n' && *end != ' ') || errno != 0 || len > FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+    r->len = (size_t)len;
+    r->origin = 0;
+    if (*end == ' ') {
+        const char *origin_start = end + 1;
+        r->origin = strtoull(origin_start, &end, 10);
+        if (end == origin_start || *end != '\n' || errno != 0 || r->origin == 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads the payload of the record whose header was just read, and its terminator.
+ *
+ * @param fp The log.
+ * @param r The record; its payload buffer grows as needed.
+ * @return int 0 on success, -1 if the record is malformed or allocation failed, -2 if it
+ * is cut short by the end of the log.
+ */
+static int read_record_payload(FILE *fp, stored_record_t *r) {
+    if (r->len + 1 > r->cap) {
+        char *grown = realloc(r->payload, r->len + 1);
+        if (grown == NULL) {
+            log_error(LOG_MODULE_PERSIST, "realloc record buffer: %s", strerror(errno));
+            return -1;
+        }
+        r->payload = grown;
+        r->cap = r->len + 1;
+    }
+    if (fread(r->payload, 1, r->len + 1, fp) != r->len + 1) {
+        return feof(fp) ? -2 : -1;
+    }
+    return r->payload[r->len] == '\n' ? 0 : -1;
+}
+
+/**
+ * @brief Skips the payload of the record whose header was just read, and its terminator.
+ *
+ * @param fp The log.
+ * @param r The record.
+ * @return int 0 on success, -1 if the record is malformed, -2 if it is cut short by the end of the log.
+ */
+static int skip_record_payload(FILE *fp, const stored_record_t *r) {
+    if (fseeko(fp, (off_t)r->len, SEEK_CUR) != 0) {
+        return -1;
+    }
+    int c = fgetc(fp);
+    if (c == EOF) {
+        return feof(fp) ? -2 : -1;
+    }
+    return c == '\n' ? 0 : -1;
+}
+
+/**
+ * @brief Appends a record to a log: its header line, the payload and a terminating newline.
+ *
+ * @param fp The log.
+ * @param when The time the message was received.
+ * @param seq The sequence number of the record.
+ * @param origin The broker a bridged message originated on, 0 for one published here.
+ * @param payload The message.
+ * @param len The length of the message in bytes.
+ * @return uint64_t The number of bytes written.
+ */
+static uint64_t write_record(FILE *fp, time_t when, uint64_t seq, uint64_t origin, const char *payload, size_t len) {
+    int header = origin != 0 ? fprintf(fp, "%lld %llu %zu %llu\n", (long long)when, (unsigned long long)seq, len,
+                                       (unsigned long long)origin)
+                             : fprintf(fp, "%lld %llu %zu\n", (long long)when, (unsigned long long)seq, len);
+    fwrite(payload, 1, len, fp);
+    fputc('\n', fp);
+    return (header > 0 ? (uint64_t)header : 0) + len + 1;
+}
+
+/**
+ * @brief Reads a log up to its first record that cannot be read.
+ *
+ * @param fp The log, positioned at its start.
+ * @param last Receives the sequence number of the last whole record (0 if there is none).
+ * @param good Receives the offset just past it.
+ * @return int 0 if every record was read, -1 at a malformed record, -2 at a record cut
+ * short by the end of the log.
+ */
+static int scan_records(FILE *fp, uint64_t *last, off_t *good) {
+    stored_record_t record;
+    int rc;
+    *last = 0;
+    *good = 0;
+    while ((rc = read_record_header(fp, &record)) > 0 && (rc = skip_record_payload(fp, &record)) == 0) {
+        *last = record.seq;
+        *good = ftello(fp);
+    }
+    return rc;
+}
+
+/**
+ * @brief Returns the sequence number of the last record in a log file. A record cut
+ * short by a crash at the end of the log is cut off, so that records appended after it
+ * can be read. A malformed record anywhere else is left alone for an operator to look at.
+ *
+ * @param filepath The log file.
+ * @param last Receives the sequence number (0 if the log is empty or does not exist).
+ * @return int 0 on success, -1 if the log holds a malformed record.
+ */
+static int last_record_seq(const char *filepath, uint64_t *last) {
+    *last = 0;
+    FILE *fp = open_log(filepath, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    off_t good;
+    int rc = scan_records(fp, last, &good);
+    close_log(fp);
+    if (rc == -2) {
+        log_warn(LOG_MODULE_PERSIST, "%s: the record after sequence number %llu is cut short, truncating it",
+                 filepath, (unsigned long long)*last);
+        if (truncate(filepath, good) != 0) {
+            log_error(LOG_MODULE_PERSIST, "truncate %s: %s", filepath, strerror(errno));
+            return -1;
+        }
+    } else if (rc < 0) {
+        log_error(LOG_MODULE_PERSIST, "%s: malformed record after sequence number %llu (a log from before the "
+                  "record format is converted when the server starts); not appending to it", filepath,
+                  (unsigned long long)*last);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the sequence counter of a topic, loading it from the log on first use.
+ *
+ * @param topic The topic name.
+ * @param filepath The topic's log file.
+ * @return topic_seq_t* The counter, or NULL if allocation failed.
+ */
+static topic_seq_t *lookup_seq(const char *topic, const char *filepath) {
+    for (size_t i = 0; i < seq_count; i++) {
+        if (strcmp(seq_table[i].topic, topic) == 0) {
+            return &seq_table[i];
+        }
+    }
+    if (seq_count == seq_cap) {
+        size_t new_cap = seq_cap ? seq_cap * 2 : 16;
+        topic_seq_t *grown = realloc(seq_table, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            log_error(LOG_MODULE_PERSIST, "realloc sequence table: %s", strerror(errno));
+            return NULL;
+        }
+        seq_table = grown;
+        seq_cap = new_cap;
+    }
+    topic_seq_t *entry = &seq_table[seq_count++];
+    snprintf(entry->topic, sizeof(entry->topic), "%s", topic);
+    uint64_t last;
+    entry->corrupt = last_record_seq(filepath, &last) < 0;
+    entry->next = last != 0 ? last + 1 : read_first_seq(topic);
+    stats.log_files++;
+    return entry;
+}
 
 /**
  * @brief Persists a message to a topic's log file based on the persistence mode.
  *
- * If `PERSIST_NONE`, the message is not saved. If `PERSIST_ALL`, the message is appended
- * to the topic's log file. If `PERSIST_TIMED`, the message is appended with a timestamp.
+ * If `PERSIST_NONE`, the message is not saved. Otherwise it is appended to the topic's
+ * log file; in `PERSIST_TIMED` mode its timestamp decides when it expires.
  *
  * @param topic The topic of the message.
  * @param message The content of the message.
  * @param p_mode The persistence mode to use.
  */
 void persist_message(const char *topic, const char *message, persistence_mode_t p_mode) {
-    if (p_mode == PERSIST_NONE) return;
+    persist_message_len(topic, message, strlen(message), p_mode);
+}
+
+/**
+ * @brief Persists a message of known length to a topic's log file.
+ *
+ * The message is stored as one record, "<time> <seq> <length>\n<message>\n", so it
+ * may contain any bytes, newlines included, and takes exactly one sequence number.
+ *
+ * @param topic The topic of the message.
+ * @param message The content of the message.
+ * @param len The length of the message in bytes.
+ * @param p_mode The persistence mode to use.
+ * @return uint64_t The sequence number assigned to the message, or 0 if it was not persisted.
+ */
+uint64_t persist_message_len(const char *topic, const char *message, size_t len, persistence_mode_t p_mode) {
+    return persist_message_origin(topic, message, len, p_mode, 0);
+}
+
+/**
+ * @brief Persists a message of known length together with the broker it originated on.
+ * A non-zero origin is appended to the record's header line.
+ *
+ * @param topic The topic of the message.
+ * @param message The content of the message.
+ * @param len The length of the message in bytes.
+ * @param p_mode The persistence mode to use.
+ * @param origin The broker a bridged message originated on, 0 for one published here.
+ * @return uint64_t The sequence number assigned to the message, or 0 if it was not persisted.
+ */
+uint64_t persist_message_origin(const char *topic, const char *message, size_t len, persistence_mode_t p_mode,
+                                uint64_t origin) {
+    if (p_mode == PERSIST_NONE) return 0;
 
     char filepath[256];
     snprintf(filepath, sizeof(filepath), "%s/%s.log", LOG_DIR, topic);
 
-    FILE *fp = fopen(filepath, "a");
+    PROBE_PERSIST_START(topic, len);
+    topic_seq_t *counter = lookup_seq(topic, filepath);
+    if (counter != NULL && counter->corrupt) {
+        stats.append_errors++;
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "%s holds a malformed record, not appending", filepath);
+        PROBE_PERSIST_END(topic, len, (uint64_t)0);
+        return 0;
+    }
+    uint64_t start = timing_enabled ? monotonic_ns() : 0;
+    FILE *fp = counter != NULL ? open_log(filepath, "a") : NULL;
     if (fp == NULL) {
-        perror("fopen for persistence");
-        return;
+        stats.append_errors++;
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "fopen %s: %s", filepath, strerror(errno));
+        PROBE_PERSIST_END(topic, len, (uint64_t)0);
+        return 0;
     }
 
-    if (p_mode == PERSIST_TIMED) {
-        fprintf(fp, "%ld %s", time(NULL), message);
-    } else { // PERSIST_ALL
-        fprintf(fp, "%s", message);
+    uint64_t seq = counter->next++;
+    uint64_t bytes = write_record(fp, time(NULL), seq, origin, message, len);
+    int failed = fflush(fp) != 0;
+    uint64_t sync_ns = 0;
+    if (sync_enabled && !failed) {
+        sync_ns = sync_log(fp);
+    }
+    failed |= close_log(fp) != 0;
+    if (failed) {
+        stats.append_errors++;
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "write %s: %s", filepath, strerror(errno));
+    } else {
+        stats.appends++;
+        stats.bytes_written += bytes;
+    }
+    if (timing_enabled) {
+        // The fsync is reported in its own histogram
+        histogram_record(&stats.append_ns, monotonic_ns() - start - sync_ns);
+    }
+
+    PROBE_PERSIST_END(topic, len, seq);
+    return seq;
+}
+
+/**
+ * @brief Returns the sequence number the next record of a topic will receive.
+ *
+ * @param topic The topic.
+ * @return uint64_t The next sequence number (1 for a topic never written), or 0 if allocation failed.
+ */
+uint64_t persist_next_seq(const char *topic) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log", LOG_DIR, topic);
+    topic_seq_t *counter = lookup_seq(topic, filepath);
+    return counter != NULL ? counter->next : 0;
+}
+
+/**
+ * @brief Makes the next record of a topic with an empty log take a given sequence number.
+ * The log is empty when its next number is still the number of its first record.
+ *
+ * @param topic The topic.
+ * @param seq The sequence number of the next record.
+ * @return int 0 on success, -1 if the log still holds records, is malformed or seq lies behind the next number.
+ */
+int persist_skip_to(const char *topic, uint64_t seq) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log", LOG_DIR, topic);
+    topic_seq_t *counter = lookup_seq(topic, filepath);
+    if (counter == NULL || counter->corrupt || seq < counter->next) {
+        return -1;
+    }
+    if (seq == counter->next) {
+        return 0;
+    }
+    if (counter->next != read_first_seq(topic)) {
+        return -1;
+    }
+    write_first_seq(topic, seq);
+    counter->next = seq;
+    return 0;
+}
+
+/**
+ * @brief Saves a bridging broker's position in a topic in "<topic>.log.bridge", so that
+ * it resumes there after a restart. The position is written to a temporary file that
+ * replaces the old one, so a crash leaves either position; it is synced like the log
+ * (see persist_set_fsync()).
+ *
+ * @param topic The topic.
+ * @param next_seq The next upstream sequence number.
+ * @return int 0 on success, -1 if the file could not be written.
+ */
+int persist_save_bridge_position(const char *topic, uint64_t next_seq) {
+    char filepath[256];
+    char tmppath[272];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log.bridge", LOG_DIR, topic);
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", filepath);
+    FILE *fp = fopen(tmppath, "w");
+    if (fp == NULL) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "fopen %s: %s", tmppath, strerror(errno));
+        return -1;
+    }
+    int failed = fprintf(fp, "%llu\n", (unsigned long long)next_seq) < 0;
+    failed |= fflush(fp) != 0;
+    if (sync_enabled && !failed) {
+        sync_log(fp);
+    }
+    failed |= fclose(fp) != 0;
+    if (failed || rename(tmppath, filepath) != 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "write %s: %s", filepath, strerror(errno));
+        unlink(tmppath);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lists the positions saved with persist_save_bridge_position().
+ *
+ * @param fn The callback receiving each topic and its next upstream sequence number.
+ * @param ctx Context pointer passed through to `fn`.
+ * @return int The number of positions listed, or -1 if the directory cannot be read.
+ */
+int persist_load_bridge_positions(persist_position_fn fn, void *ctx) {
+    DIR *dir = opendir(LOG_DIR);
+    if (dir == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    const char *suffix = ".log.bridge";
+    size_t suffix_len = strlen(suffix);
+    int listed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= suffix_len || strcmp(entry->d_name + len - suffix_len, suffix) != 0 ||
+            !is_valid_topic(entry->d_name, len - suffix_len)) {
+            continue;
+        }
+        char filepath[512];
+        snprintf(filepath, sizeof(filepath), "%s/%s", LOG_DIR, entry->d_name);
+        FILE *fp = fopen(filepath, "r");
+        if (fp == NULL) {
+            continue;
+        }
+        unsigned long long next = 0;
+        int found = fscanf(fp, "%llu", &next) == 1 && next != 0;
+        fclose(fp);
+        if (!found) {
+            continue;
+        }
+        char topic[MAX_TOPIC_LEN];
+        memcpy(topic, entry->d_name, len - suffix_len);
+        topic[len - suffix_len] = '\0';
+        fn(topic, next, ctx);
+        listed++;
+    }
+    closedir(dir);
+    return listed;
+}
+
+/**
+ * @brief Returns the broker id kept in LOG_DIR/broker.id, saving `fresh` there first if
+ * the file does not hold one yet.
+ *
+ * @param fresh A new id, non-zero.
+ * @return uint64_t The kept id, or `fresh` if it could not be saved.
+ */
+uint64_t persist_broker_id(uint64_t fresh) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/broker.id", LOG_DIR);
+    FILE *fp = fopen(filepath, "r");
+    if (fp != NULL) {
+        unsigned long long id = 0;
+        int found = fscanf(fp, "%llu", &id) == 1 && id != 0;
+        fclose(fp);
+        if (found) {
+            return id;
+        }
+    }
+    fp = fopen(filepath, "w");
+    if (fp == NULL) {
+        log_error(LOG_MODULE_PERSIST, "fopen %s: %s", filepath, strerror(errno));
+        return fresh;
+    }
+    fprintf(fp, "%llu\n", (unsigned long long)fresh);
+    if (fclose(fp) != 0) {
+        log_error(LOG_MODULE_PERSIST, "write %s: %s", filepath, strerror(errno));
+    }
+    return fresh;
+}
+
+/**
+ * @brief Lists the topics that have a log in LOG_DIR.
+ * Compaction leftovers and sequence files do not end in ".log" and are skipped.
+ *
+ * @param fn The callback receiving each topic.
+ * @param ctx Context pointer passed through to `fn`.
+ * @return int The number of topics listed, or -1 if the directory cannot be read.
+ */
+int persist_list_topics(persist_topic_fn fn, void *ctx) {
+    DIR *dir = opendir(LOG_DIR);
+    if (dir == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    int listed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".log") != 0 || !is_valid_topic(entry->d_name, len - 4)) {
+            continue;
+        }
+        char topic[MAX_TOPIC_LEN];
+        memcpy(topic, entry->d_name, len - 4);
+        topic[len - 4] = '\0';
+        fn(topic, ctx);
+        listed++;
+    }
+    closedir(dir);
+    return listed;
+}
+
+/**
+ * @brief Tells whether a log was written before the record format: its first line is
+ * not a record header, nor the start of one cut short by a crash.
+ *
+ * @param filepath The log file.
+ * @return int 1 if it is a legacy log, 0 otherwise.
+ */
+static int is_legacy_log(const char *filepath) {
+    FILE *fp = open_log(filepath, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    stored_record_t record;
+    int rc = read_record_header(fp, &record);
+    close_log(fp);
+    if (rc == -2) {
+        // A torn header holds digits and spaces only
+        return strspn(record.header, "0123456789 ") != record.header_len;
+    }
+    return rc == -1;
+}
+
+/**
+ * @brief Converts one legacy log into records, keeping the original as "<topic>.log.legacy".
+ *
+ * @param topic The topic.
+ * @param p_mode The persistence mode the log was written in.
+ * @return int 1 if the log was converted, 0 if it needed no conversion, -1 on failure.
+ */
+static int upgrade_log(const char *topic, persistence_mode_t p_mode) {
+    char filepath[256];
+    char temp_filepath[256];
+    char legacy_filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/%s.log", LOG_DIR, topic);
+    snprintf(temp_filepath, sizeof(temp_filepath), "%s/%s.log.tmp", LOG_DIR, topic);
+    snprintf(legacy_filepath, sizeof(legacy_filepath), "%s/%s.log.legacy", LOG_DIR, topic);
+    if (!is_legacy_log(filepath)) {
+        return 0;
+    }
+    FILE *fp_read = open_log(filepath, "r");
+    if (fp_read == NULL) {
+        log_error(LOG_MODULE_PERSIST, "fopen %s: %s", filepath, strerror(errno));
+        return -1;
+    }
+    FILE *fp_write = open_log(temp_filepath, "w");
+    if (fp_write == NULL) {
+        log_error(LOG_MODULE_PERSIST, "fopen %s: %s", temp_filepath, strerror(errno));
+        close_log(fp_read);
+        return -1;
+    }
+    time_t now = time(NULL);
+    uint64_t seq = read_first_seq(topic);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, fp_read)) > 0) {
+        size_t len = (size_t)n;
+        if (line[len - 1] == '\n') {
+            len--;
+        }
+        time_t when = now;
+        const char *message = line;
+        if (p_mode == PERSIST_TIMED) {
+            char *end;
+            long long stamp = strtoll(line, &end, 10);
+            if (end != line && *end == ' ') {
+                when = (time_t)stamp;
+                message = end + 1;
+                len -= (size_t)(message - line);
+            }
+        }
+        write_record(fp_write, when, seq++, 0, message, len);
+    }
+    free(line);
+    int failed = ferror(fp_read);
+    close_log(fp_read);
+    failed |= fflush(fp_write) != 0;
+    if (sync_enabled && !failed) {
+        sync_log(fp_write);
+    }
+    failed |= close_log(fp_write) != 0;
+    if (failed) {
+        log_error(LOG_MODULE_PERSIST, "convert %s: %s", filepath, strerror(errno));
+        unlink(temp_filepath);
+        return -1;
+    }
+    if (link(filepath, legacy_filepath) != 0) {
+        log_error(LOG_MODULE_PERSIST, "keep %s as %s: %s, not converting it", filepath, legacy_filepath, strerror(errno));
+        unlink(temp_filepath);
+        return -1;
+    }
+    if (rename(temp_filepath, filepath) != 0) {
+        log_error(LOG_MODULE_PERSIST, "rename %s: %s", temp_filepath, strerror(errno));
+        unlink(temp_filepath);
+        unlink(legacy_filepath);
+        return -1;
+    }
+    log_warn(LOG_MODULE_PERSIST, "Converted %s to the record format, the original is kept as %s", filepath,
+             legacy_filepath);
+    return 1;
+}
+
+/**
+ * @brief Progress of persist_upgrade_logs().
+ */
+typedef struct {
+    persistence_mode_t p_mode; ///< The mode the logs were written in.
+    int converted;             ///< Logs converted.
+    int failed;                ///< Logs that could not be converted.
+} upgrade_ctx_t;
+
+/**
+ * @brief Converts the log of one listed topic.
+ *
+ * @param topic The topic.
+ * @param ctx Pointer to an upgrade_ctx_t.
+ */
+static void upgrade_topic(const char *topic, void *ctx) {
+    upgrade_ctx_t *upgrade = ctx;
+    int rc = upgrade_log(topic, upgrade->p_mode);
+    if (rc > 0) {
+        upgrade->converted++;
+    } else if (rc < 0) {
+        upgrade->failed++;
+    }
+}
+
+/**
+ * @brief Converts the logs in LOG_DIR that were written before the record format into records.
+ *
+ * @param p_mode The persistence mode the logs were written in.
+ * @return int The number of logs converted, or -1 if the directory cannot be read or a log could not be converted.
+ */
+int persist_upgrade_logs(persistence_mode_t p_mode) {
+    upgrade_ctx_t upgrade = { p_mode, 0, 0 };
+    if (persist_list_topics(upgrade_topic, &upgrade) < 0 || upgrade.failed > 0) {
+        return -1;
+    }
+    return upgrade.converted;
+}
+
+/**
+ * @brief Replay sink that writes each message to a file descriptor as a MSG frame.
+ *
+ * @param topic The topic being replayed.
+ * @param message The message content.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the record (unused).
+ * @param origin The broker the record originated on (unused).
+ * @param ctx Pointer to the destination file descriptor.
+ */
+static void write_frame_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                             void *ctx) {
+    (void)seq;
+    (void)origin;
+    int fd = *(int *)ctx;
+    char header[FRAME_MAX_HEADER];
+    int header_len = format_frame_header(header, sizeof(header), FRAME_MSG, topic, len);
+    if (header_len < 0) {
+        return;
+    }
+    if (write(fd, header, (size_t)header_len) < 0 || write(fd, message, len) < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_PERSIST, "write persisted: %s", strerror(errno));
     }
-    fflush(fp);
-    fclose(fp);
 }
 
 /**
@@ -50,6 +846,7 @@ void persist_message(const char *topic, const char *message, persistence_mode_t
  *
  * For `PERSIST_ALL` mode, all messages in the log file are sent. For `PERSIST_TIMED` mode,
  * only messages that have not expired are sent, and expired messages are removed from the log file.
+ * Each message is written as a `MSG` frame.
  *
  * @param fd The file descriptor of the subscriber to send messages to.
  * @param topic The topic for which to send persisted messages.
@@ -57,6 +854,26 @@ void persist_message(const char *topic, const char *message, persistence_mode_t
  * @param p_duration The duration in seconds for timed persistence.
  */
 void send_persisted_messages(int fd, const char *topic, persistence_mode_t p_mode, int p_duration) {
+    replay_persisted_messages(topic, p_mode, p_duration, 0, write_frame_sink, &fd);
+}
+
+/**
+ * @brief Replays persisted messages for a given topic into a sink.
+ *
+ * For `PERSIST_ALL` mode, every message in the log file is replayed. For `PERSIST_TIMED` mode,
+ * only messages that have not expired are replayed, and expired messages are removed from the
+ * front of the log file. Records numbered below `from_seq` are skipped. If the log holds a
+ * record that cannot be read, or the compacted copy cannot be written, the log is kept as it is.
+ *
+ * @param topic The topic for which to replay persisted messages.
+ * @param p_mode The persistence mode of the server.
+ * @param p_duration The duration in seconds for timed persistence.
+ * @param from_seq The first sequence number to replay (0 or 1 replays everything).
+ * @param sink The callback receiving each message.
+ * @param ctx Context pointer passed through to `sink`.
+ */
+void replay_persisted_messages(const char *topic, persistence_mode_t p_mode, int p_duration, uint64_t from_seq,
+                               replay_sink_t sink, void *ctx) {
     if (p_mode == PERSIST_NONE) return;
 
     char filepath[256];
@@ -64,61 +881,108 @@ void send_persisted_messages(int fd, const char *topic, persistence_mode_t p_mod
     snprintf(filepath, sizeof(filepath), "%s/%s.log", LOG_DIR, topic);
     snprintf(temp_filepath, sizeof(temp_filepath), "%s/%s.log.tmp", LOG_DIR, topic);
 
-    FILE *fp_read = fopen(filepath, "r");
+    FILE *fp_read = open_log(filepath, "r");
     if (fp_read == NULL) {
         // No log file yet, which is fine
         return;
     }
+    stats.replays++;
 
     FILE *fp_write = NULL;
     if (p_mode == PERSIST_TIMED) {
-        fp_write = fopen(temp_filepath, "w");
+        fp_write = open_log(temp_filepath, "w");
         if (fp_write == NULL) {
-            perror("fopen for temp persistence file");
-            fclose(fp_read);
+            log_error(LOG_MODULE_PERSIST, "fopen %s: %s", temp_filepath, strerror(errno));
+            close_log(fp_read);
             return;
         }
     }
 
-    char line[BUFFER_SIZE];
+    stored_record_t record;
+    memset(&record, 0, sizeof(record));
     time_t now = time(NULL);
+    uint64_t first_seq = read_first_seq(topic);
+    uint64_t seq = first_seq;
+    uint64_t first_kept = 0;
+    uint64_t expired = 0;
+    uint64_t bytes_expired = 0;
+    uint64_t rewritten = 0;
+    int write_failed = 0;
 
-    while (fgets(line, sizeof(line), fp_read)) {
+    int rc;
+    uint64_t read_start = timing_enabled ? monotonic_ns() : 0;
+    while ((rc = read_record_header(fp_read, &record)) > 0) {
+        uint64_t record_seq = record.seq;
+        int wanted = p_mode == PERSIST_TIMED || record_seq >= from_seq;
+        rc = wanted ? read_record_payload(fp_read, &record) : skip_record_payload(fp_read, &record);
+        if (rc < 0) {
+            break;
+        }
+        if (timing_enabled) {
+            stats.replay_read_ns += monotonic_ns() - read_start;
+        }
+        seq = record_seq + 1;
+        uint64_t record_bytes = record.header_len + record.len + 1;
+        stats.replay_records++;
+        stats.replay_bytes += record_bytes;
         if (p_mode == PERSIST_TIMED) {
-            time_t msg_time;
-            char *msg_content_start;
-
-            // Parse timestamp and message content
-            msg_time = strtol(line, &msg_content_start, 10);
-            // Skip space after timestamp
-            if (*msg_content_start == ' ') {
-                msg_content_start++;
-            }
-
-            if (now - msg_time <= p_duration) {
-                // Message is still valid, send it and write to temp file
-                if (write(fd, msg_content_start, strlen(msg_content_start)) < 0) {
-                    perror("write persisted (timed)");
+            // Only the expired prefix is dropped, so later records keep their numbers
+            if (first_kept != 0 || now - record.time <= p_duration) {
+                if (first_kept == 0) {
+                    first_kept = record_seq;
+                }
+                if (record_seq >= from_seq) {
+                    sink(topic, record.payload, record.len, record_seq, record.origin, ctx);
                 }
-                fprintf(fp_write, "%ld %s", msg_time, msg_content_start);
+                if (fwrite(record.header, 1, record.header_len, fp_write) != record.header_len ||
+                    fwrite(record.payload, 1, record.len + 1, fp_write) != record.len + 1) {
+                    write_failed = 1;
+                }
+                rewritten += record_bytes;
             } else {
-                // Message expired, do not send or write to temp file
-            }
-        } else { // PERSIST_ALL
-            // Send message
-            if (write(fd, line, strlen(line)) < 0) {
-                perror("write persisted (all)");
+                expired++;
+                bytes_expired += record_bytes;
             }
-            // For PERSIST_ALL, we don't rewrite the file here, as it's append-only
+        } else if (wanted) { // PERSIST_ALL is append-only and not rewritten
+            sink(topic, record.payload, record.len, record_seq, record.origin, ctx);
         }
+        if (timing_enabled) {
+            read_start = monotonic_ns();
+        }
+    }
+    if (rc < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_PERSIST, "%s: record %llu is cut short or malformed, ignoring the rest%s",
+                        filepath, (unsigned long long)seq, p_mode == PERSIST_TIMED ? " and keeping the log" : "");
     }
-    fclose(fp_read);
+    free(record.payload);
+    close_log(fp_read);
 
     if (p_mode == PERSIST_TIMED) {
-        fclose(fp_write);
-        // Replace original file with temp file
+        write_failed |= fflush(fp_write) != 0;
+        if (sync_enabled && !write_failed) {
+            sync_log(fp_write);
+        }
+        write_failed |= close_log(fp_write) != 0;
+        if (write_failed) {
+            log_error(LOG_MODULE_PERSIST, "write %s: %s, keeping the log", temp_filepath, strerror(errno));
+        }
+        // Replace the original only with a complete copy
+        if (rc < 0 || write_failed) {
+            unlink(temp_filepath);
+            return;
+        }
         if (rename(temp_filepath, filepath) != 0) {
-            perror("rename temp file");
+            log_error(LOG_MODULE_PERSIST, "rename %s: %s", temp_filepath, strerror(errno));
+            unlink(temp_filepath);
+            return;
+        }
+        stats.compactions++;
+        stats.records_expired += expired;
+        stats.bytes_expired += bytes_expired;
+        stats.bytes_rewritten += rewritten;
+        uint64_t new_first = first_kept != 0 ? first_kept : seq;
+        if (new_first != first_seq) {
+            write_first_seq(topic, new_first);
         }
     }
 }
@@ -2,13 +2,39 @@
  * @file persistence.h
  * @brief Declares functions and types related to message persistence in liteMQ.
  * @author Mohammed Uddin
+ *
+ * A topic's log is a sequence of records, one per message:
+ *
+ *     <time> <seq> <length>[ <origin>]\n<payload>\n
+ *
+ * "time" is when the message was received, in seconds since the epoch, and decides
+ * when it expires in timed mode. The payload is stored as is, so messages may contain
+ * any bytes. The trailing newline only marks a complete record.
+ *
+ * "seq" is the record's sequence number: the first record ever written is 1 and each
+ * further record adds one, so one message always has one number. Records dropped from
+ * the front of a timed log keep their numbers reserved; the number the next record of
+ * an emptied log takes is kept in "<topic>.log.first" next to the log.
+ *
+ * "origin" is present on messages bridged from another broker and names the broker
+ * they were first published on (see bridge.h). A bridging broker keeps its position in
+ * each bridged topic in "<topic>.log.bridge", and the broker's own id in "broker.id",
+ * so that loop prevention and resuming survive a restart.
+ *
+ * The module counts its own I/O in a persist_stats_t. The sequence table and the
+ * counters are kept per thread, so several threads may persist without locking as long
+ * as each topic is only ever written by one of them (see shard.h). A report adds up
+ * the threads' counters with persist_merge_stats().
  */
 
 #ifndef LITEMQ_PERSISTENCE_H
 #define LITEMQ_PERSISTENCE_H
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include "histogram.h"
 
 #define LOG_DIR "logs"
 
@@ -21,11 +47,71 @@ typedef enum {
     PERSIST_TIMED   ///< Messages are persisted for a specified duration.
 } persistence_mode_t;
 
+/**
+ * @brief I/O counters of the storage layer.
+ */
+typedef struct {
+    uint64_t appends;         ///< Records appended.
+    uint64_t append_errors;   ///< Appends that could not be opened, written or closed.
+    uint64_t bytes_written;   ///< Bytes appended, including timestamps and terminators.
+    uint64_t files_opened;    ///< Log files opened for appending, replay or compaction.
+    uint64_t open_files;      ///< Log files open right now.
+    uint64_t log_files;       ///< Topic logs appended to by this process.
+    uint64_t fsyncs;          ///< fsync calls made (see persist_set_fsync()).
+    uint64_t compactions;     ///< Timed logs rewritten to drop expired records.
+    uint64_t records_expired; ///< Records dropped by retention.
+    uint64_t bytes_expired;   ///< Bytes dropped by retention.
+    uint64_t bytes_rewritten; ///< Bytes copied into compacted logs.
+    uint64_t replays;         ///< Log replays.
+    uint64_t replay_records;  ///< Records read during replays.
+    uint64_t replay_bytes;    ///< Bytes read during replays.
+    uint64_t replay_read_ns;  ///< Time spent reading logs during replays (when timing is on).
+    histogram_t append_ns;    ///< Time to open, write and close the log for one append (when timing is on).
+    histogram_t fsync_ns;     ///< Duration of each fsync (when timing is on).
+} persist_stats_t;
+
+/**
+ * @brief Makes every append, and every compacted log before it replaces the original,
+ * reach stable storage with fsync().
+ *
+ * @param enabled Non-zero to sync, zero to leave flushing to the kernel (the default).
+ */
+void persist_set_fsync(int enabled);
+
+/**
+ * @brief Turns on the latency histograms and replay read timing of the storage layer.
+ * Every thread that persists messages calls it once to set up its own histograms.
+ *
+ * @param enabled Non-zero to time I/O, zero to only count it (the default).
+ */
+void persist_set_timing(int enabled);
+
+/**
+ * @brief Returns the calling thread's storage I/O counters.
+ *
+ * @return const persist_stats_t* The counters, valid for the life of the thread.
+ */
+const persist_stats_t *persist_get_stats(void);
+
+/**
+ * @brief Adds the storage counters of one thread to another set of counters.
+ * The destination's histograms must have been initialised with histogram_init().
+ *
+ * @param dst The counters receiving the sums.
+ * @param src The counters to add.
+ */
+void persist_merge_stats(persist_stats_t *dst, const persist_stats_t *src);
+
+/**
+ * @brief Resets the calling thread's storage I/O counters (the open-file and log-file gauges are kept).
+ */
+void persist_reset_stats(void);
+
 /**
  * @brief Persists a message to a topic's log file based on the persistence mode.
  *
- * If `PERSIST_NONE`, the message is not saved. If `PERSIST_ALL`, the message is appended
- * to the topic's log file. If `PERSIST_TIMED`, the message is appended with a timestamp.
+ * If `PERSIST_NONE`, the message is not saved. Otherwise it is appended to the topic's
+ * log file; in `PERSIST_TIMED` mode its timestamp decides when it expires.
  *
  * @param topic The topic of the message.
  * @param message The content of the message.
@@ -33,11 +119,153 @@ typedef enum {
  */
 void persist_message(const char *topic, const char *message, persistence_mode_t p_mode);
 
+/**
+ * @brief Persists a message of known length to a topic's log file.
+ *
+ * Behaves like persist_message() but does not require the message to be NUL-terminated.
+ * The message may contain any bytes and is stored as one record.
+ *
+ * @param topic The topic of the message.
+ * @param message The content of the message.
+ * @param len The length of the message in bytes.
+ * @param p_mode The persistence mode to use.
+ * @return uint64_t The sequence number assigned to the message, or 0 if it was not persisted.
+ */
+uint64_t persist_message_len(const char *topic, const char *message, size_t len, persistence_mode_t p_mode);
+
+/**
+ * @brief Persists a message of known length together with the broker it originated on.
+ * Behaves like persist_message_len() otherwise.
+ *
+ * @param topic The topic of the message.
+ * @param message The content of the message.
+ * @param len The length of the message in bytes.
+ * @param p_mode The persistence mode to use.
+ * @param origin The broker a bridged message originated on, 0 for one published here.
+ * @return uint64_t The sequence number assigned to the message, or 0 if it was not persisted.
+ */
+uint64_t persist_message_origin(const char *topic, const char *message, size_t len, persistence_mode_t p_mode,
+                                uint64_t origin);
+
+/**
+ * @brief Returns the sequence number the next record of a topic will receive.
+ * A follower announces it to its leader to resume replication (see replication.h).
+ *
+ * @param topic The topic.
+ * @return uint64_t The next sequence number (1 for a topic never written), or 0 if allocation failed.
+ */
+uint64_t persist_next_seq(const char *topic);
+
+/**
+ * @brief Makes the next record of a topic with an empty log take a given sequence number.
+ * A follower uses it when its leader's log starts after records that have expired.
+ *
+ * @param topic The topic.
+ * @param seq The sequence number of the next record.
+ * @return int 0 on success, -1 if the log still holds records, is malformed or seq lies behind the next number.
+ */
+int persist_skip_to(const char *topic, uint64_t seq);
+
+/**
+ * @brief Saves a bridging broker's position in a topic, so that it resumes there after a restart.
+ *
+ * @param topic The topic.
+ * @param next_seq The next upstream sequence number.
+ * @return int 0 on success, -1 if the file could not be written.
+ */
+int persist_save_bridge_position(const char *topic, uint64_t next_seq);
+
+/**
+ * @brief Callback that receives each saved bridge position.
+ *
+ * @param topic The topic.
+ * @param next_seq The next upstream sequence number.
+ * @param ctx Caller-supplied context pointer.
+ */
+typedef void (*persist_position_fn)(const char *topic, uint64_t next_seq, void *ctx);
+
+/**
+ * @brief Lists the positions saved with persist_save_bridge_position().
+ *
+ * @param fn The callback receiving each topic and its position.
+ * @param ctx Context pointer passed through to `fn`.
+ * @return int The number of positions listed, or -1 if the directory cannot be read.
+ */
+int persist_load_bridge_positions(persist_position_fn fn, void *ctx);
+
+/**
+ * @brief Returns the broker id kept in LOG_DIR, saving `fresh` there first if there is none yet.
+ *
+ * @param fresh A new id, non-zero.
+ * @return uint64_t The kept id, or `fresh` if it could not be saved.
+ */
+uint64_t persist_broker_id(uint64_t fresh);
+
+/**
+ * @brief Converts the logs in LOG_DIR that were written before the record format, one
+ * line per message, into records. Lines of a `PERSIST_TIMED` log start with their
+ * time; lines of a `PERSIST_ALL` log are the message alone. The records are numbered
+ * from "<topic>.log.first" on, and each original is kept as "<topic>.log.legacy".
+ * Call it before anything is appended.
+ *
+ * @param p_mode The persistence mode the logs were written in.
+ * @return int The number of logs converted, or -1 if the directory cannot be read or a log could not be converted.
+ */
+int persist_upgrade_logs(persistence_mode_t p_mode);
+
+/**
+ * @brief Callback that receives each topic found in the log directory.
+ *
+ * @param topic The topic.
+ * @param ctx Caller-supplied context pointer.
+ */
+typedef void (*persist_topic_fn)(const char *topic, void *ctx);
+
+/**
+ * @brief Lists the topics that have a log in LOG_DIR.
+ *
+ * @param fn The callback receiving each topic.
+ * @param ctx Context pointer passed through to `fn`.
+ * @return int The number of topics listed, or -1 if the directory cannot be read.
+ */
+int persist_list_topics(persist_topic_fn fn, void *ctx);
+
+/**
+ * @brief Callback that receives each persisted message during a replay.
+ *
+ * @param topic The topic being replayed.
+ * @param message The message content, exactly as published.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the record.
+ * @param origin The broker a bridged record originated on, 0 for one published here.
+ * @param ctx Caller-supplied context pointer.
+ */
+typedef void (*replay_sink_t)(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                              void *ctx);
+
+/**
+ * @brief Replays persisted messages for a given topic into a sink.
+ *
+ * Applies the same retention rules as send_persisted_messages(), but hands each message
+ * to `sink` instead of writing it to a file descriptor. Records numbered below
+ * `from_seq` are skipped, so a subscriber can resume after the last message it received.
+ *
+ * @param topic The topic for which to replay persisted messages.
+ * @param p_mode The persistence mode of the server.
+ * @param p_duration The duration in seconds for timed persistence.
+ * @param from_seq The first sequence number to replay (0 or 1 replays everything).
+ * @param sink The callback receiving each message.
+ * @param ctx Context pointer passed through to `sink`.
+ */
+void replay_persisted_messages(const char *topic, persistence_mode_t p_mode, int p_duration, uint64_t from_seq,
+                               replay_sink_t sink, void *ctx);
+
 /**
  * @brief Sends persisted messages for a given topic to a subscriber.
  *
  * For `PERSIST_ALL` mode, all messages in the log file are sent. For `PERSIST_TIMED` mode,
  * only messages that have not expired are sent, and expired messages are removed from the log file.
+ * Each message is written as a `MSG` frame.
  *
  * @param fd The file descriptor of the subscriber to send messages to.
  * @param topic The topic for which to send persisted messages.
@@ -0,0 +1,69 @@
+/**
+ * @file probes.h
+ * @brief Declares the broker's USDT (user-level statically defined tracing) probes.
+ * @author Mohammed Uddin
+ *
+ * When <sys/sdt.h> is available (systemtap-sdt-dev / systemtap-sdt-devel), every probe
+ * compiles to a single nop plus an ELF note describing where its arguments live, so
+ * bpftrace, perf and systemtap can attach to a running broker without a rebuild. An
+ * unattached probe costs only that nop. Without the header, or when built with
+ * -DLITEMQ_NO_USDT, the probes compile to nothing (their arguments are type-checked
+ * but not evaluated).
+ *
+ * All probes belong to the provider "litemq". Strings are passed as pointers
+ * (read them with str(argN) in bpftrace). Probe arguments:
+ *
+ * | Probe          | arg0          | arg1              | arg2                  |
+ * |----------------|---------------|-------------------|-----------------------|
+ * | conn_accept    | int fd        |                   |                       |
+ * | conn_close     | int fd        | int client type   |                       |
+ * | frame_parsed   | int fd        | int frame type    | size_t payload length |
+ * | publish_routed | char *topic   | size_t length     | int subscribers       |
+ * | persist_start  | char *topic   | size_t length     |                       |
+ * | persist_end    | char *topic   | size_t length     | uint64_t seq (0=none) |
+ * | replay_start   | int fd        | char *topic       | uint64_t from_seq     |
+ * | replay_end     | int fd        | char *topic       | uint64_t replayed     |
+ * | queue_overflow | int fd        | size_t queued     | size_t frame length   |
+ *
+ * The client type is a client_type_t of broker.h (0 unknown, 1 publisher, 2 subscriber,
+ * 3 follower, 4 leader, 5 bridge, 6 upstream) and the frame type a frame_type_t of
+ * protocol.h.
+ */
+
+#ifndef LITEMQ_PROBES_H
+#define LITEMQ_PROBES_H
+
+#if !defined(LITEMQ_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define LITEMQ_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef LITEMQ_HAVE_USDT
+#include <sys/sdt.h>
+
+#define PROBE_CONN_ACCEPT(fd) DTRACE_PROBE1(litemq, conn_accept, fd)
+#define PROBE_CONN_CLOSE(fd, type) DTRACE_PROBE2(litemq, conn_close, fd, type)
+#define PROBE_FRAME_PARSED(fd, type, len) DTRACE_PROBE3(litemq, frame_parsed, fd, type, len)
+#define PROBE_PUBLISH_ROUTED(topic, len, subscribers) DTRACE_PROBE3(litemq, publish_routed, topic, len, subscribers)
+#define PROBE_PERSIST_START(topic, len) DTRACE_PROBE2(litemq, persist_start, topic, len)
+#define PROBE_PERSIST_END(topic, len, seq) DTRACE_PROBE3(litemq, persist_end, topic, len, seq)
+#define PROBE_REPLAY_START(fd, topic, from_seq) DTRACE_PROBE3(litemq, replay_start, fd, topic, from_seq)
+#define PROBE_REPLAY_END(fd, topic, replayed) DTRACE_PROBE3(litemq, replay_end, fd, topic, replayed)
+#define PROBE_QUEUE_OVERFLOW(fd, queued, len) DTRACE_PROBE3(litemq, queue_overflow, fd, queued, len)
+
+#else
+
+#define PROBE_CONN_ACCEPT(fd) ((void)sizeof(fd))
+#define PROBE_CONN_CLOSE(fd, type) ((void)sizeof(fd), (void)sizeof(type))
+#define PROBE_FRAME_PARSED(fd, type, len) ((void)sizeof(fd), (void)sizeof(type), (void)sizeof(len))
+#define PROBE_PUBLISH_ROUTED(topic, len, subscribers) ((void)sizeof(topic), (void)sizeof(len), (void)sizeof(subscribers))
+#define PROBE_PERSIST_START(topic, len) ((void)sizeof(topic), (void)sizeof(len))
+#define PROBE_PERSIST_END(topic, len, seq) ((void)sizeof(topic), (void)sizeof(len), (void)sizeof(seq))
+#define PROBE_REPLAY_START(fd, topic, from_seq) ((void)sizeof(fd), (void)sizeof(topic), (void)sizeof(from_seq))
+#define PROBE_REPLAY_END(fd, topic, replayed) ((void)sizeof(fd), (void)sizeof(topic), (void)sizeof(replayed))
+#define PROBE_QUEUE_OVERFLOW(fd, queued, len) ((void)sizeof(fd), (void)sizeof(queued), (void)sizeof(len))
+
+#endif
+
+#endif // LITEMQ_PROBES_H
@@ -0,0 +1,65 @@
+/**
+ * @file prof.c
+ * @brief Implements the broker's phase profiler.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "prof.h"
+#include "utils.h"
+
+static const char *const phase_names[PROF_PHASE_COUNT] = {
+    "read", "parse", "persist", "fanout", "forward", "send", "iteration"
+};
+
+static double ns_per_tick = 1.0;
+
+/**
+ * @brief Returns the report name of a phase.
+ *
+ * @param phase The phase.
+ * @return const char* The name, e.g. "persist".
+ */
+const char *prof_phase_name(prof_phase_t phase) {
+    return phase_names[phase];
+}
+
+/**
+ * @brief Measures the length of a tick against CLOCK_MONOTONIC over about 10 ms.
+ */
+void prof_calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns_start = monotonic_ns();
+    uint64_t ticks_start = prof_now();
+    struct timespec pause = {0, 10000000L};
+    nanosleep(&pause, NULL);
+    uint64_t ticks = prof_now() - ticks_start;
+    uint64_t ns = monotonic_ns() - ns_start;
+    if (ticks > 0) {
+        ns_per_tick = (double)ns / (double)ticks;
+    }
+#endif
+}
+
+/**
+ * @brief Returns the length of a tick in nanoseconds.
+ *
+ * @return double Nanoseconds per tick.
+ */
+double prof_ns_per_tick(void) {
+    return ns_per_tick;
+}
+
+/**
+ * @brief Adds the counters of one set to another.
+ *
+ * @param dst The counters receiving the sums.
+ * @param src The counters to add.
+ */
+void prof_merge(prof_counters_t *dst, const prof_counters_t *src) {
+    for (int i = 0; i < PROF_PHASE_COUNT; i++) {
+        dst->ticks[i] += src->ticks[i];
+        dst->calls[i] += src->calls[i];
+    }
+}
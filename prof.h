@@ -0,0 +1,113 @@
+/**
+ * @file prof.h
+ * @brief Declares the broker's phase profiler.
+ * @author Mohammed Uddin
+ *
+ * The profiler splits the work of the event loop into phases (reading, parsing,
+ * persistence, fan-out, draining backlogs) and accumulates the ticks spent in each, plus the
+ * ticks of every event loop iteration excluding the time blocked in poll(). A phase
+ * boundary costs one timestamp read: the time stamp counter on x86 (a few ns),
+ * CLOCK_MONOTONIC elsewhere (about 20 ns through the vDSO). Ticks are converted to
+ * nanoseconds only when a report is written.
+ *
+ * Building with -DLITEMQ_NO_PROF removes the instrumentation completely.
+ */
+
+#ifndef LITEMQ_PROF_H
+#define LITEMQ_PROF_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief A profiled phase.
+ */
+typedef enum {
+    PROF_READ,      ///< Reading client sockets.
+    PROF_PARSE,     ///< Parsing frames.
+    PROF_PERSIST,   ///< Appending published messages to their logs.
+    PROF_FANOUT,    ///< Queueing published messages for subscribers, including immediate sends.
+    PROF_FORWARD,   ///< Queueing published messages for followers, bridges and other cores.
+    PROF_SEND,      ///< Draining backlogged output when a socket becomes writable.
+    PROF_ITERATION, ///< One whole event loop iteration, excluding the wait in poll().
+    PROF_PHASE_COUNT
+} prof_phase_t;
+
+/**
+ * @brief Accumulated ticks and entries of each phase.
+ */
+typedef struct {
+    uint64_t ticks[PROF_PHASE_COUNT]; ///< Ticks spent in each phase.
+    uint64_t calls[PROF_PHASE_COUNT]; ///< Number of times each phase was entered.
+} prof_counters_t;
+
+/**
+ * @brief Reads the profiler's clock.
+ *
+ * @return uint64_t The current tick count.
+ */
+static inline uint64_t prof_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Charges the ticks since `*mark` to a phase and moves the mark to now.
+ *
+ * @param counters The counters.
+ * @param phase The phase that just ended.
+ * @param mark The start of the phase; updated to its end.
+ */
+static inline void prof_lap(prof_counters_t *counters, prof_phase_t phase, uint64_t *mark) {
+    uint64_t now = prof_now();
+    counters->ticks[phase] += now - *mark;
+    counters->calls[phase]++;
+    *mark = now;
+}
+
+#ifndef LITEMQ_NO_PROF
+#define PROF_ENABLED 1
+#define PROF_START(mark) uint64_t mark = prof_now()
+#define PROF_RESTART(mark) ((mark) = prof_now())
+#define PROF_LAP(counters, phase, mark) prof_lap((counters), (phase), &(mark))
+#else
+#define PROF_ENABLED 0
+#define PROF_START(mark) ((void)0)
+#define PROF_RESTART(mark) ((void)0)
+#define PROF_LAP(counters, phase, mark) ((void)0)
+#endif
+
+/**
+ * @brief Returns the report name of a phase.
+ *
+ * @param phase The phase.
+ * @return const char* The name, e.g. "persist".
+ */
+const char *prof_phase_name(prof_phase_t phase);
+
+/**
+ * @brief Measures the length of a tick. Call once at startup; takes about 10 ms on x86.
+ */
+void prof_calibrate(void);
+
+/**
+ * @brief Returns the length of a tick in nanoseconds (1.0 until prof_calibrate() is called).
+ *
+ * @return double Nanoseconds per tick.
+ */
+double prof_ns_per_tick(void);
+
+/**
+ * @brief Adds the counters of one set to another.
+ *
+ * @param dst The counters receiving the sums.
+ * @param src The counters to add.
+ */
+void prof_merge(prof_counters_t *dst, const prof_counters_t *src);
+
+#endif // LITEMQ_PROF_H
@@ -0,0 +1,459 @@
+/**
+ * @file protocol.c
+ * @brief Implements the liteMQ wire protocol encoder and incremental frame parser.
+ * @author Mohammed Uddin
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include "protocol.h"
+
+/**
+ * @brief Maps a frame type to the verb used on the wire.
+ */
+static const char *frame_verbs[] = {
+    [FRAME_SUB] = "SUB",
+    [FRAME_PUB] = "PUB",
+    [FRAME_MSG] = "MSG",
+    [FRAME_BATCH] = "BATCH",
+    [FRAME_STATS] = "STATS",
+    [FRAME_ACK] = "ACK",
+    [FRAME_REPL] = "REPL",
+    [FRAME_BRIDGE] = "BRIDGE"
+};
+
+/**
+ * @brief Checks whether a character may appear in a topic name.
+ *
+ * @param c The character.
+ * @return int 1 if it may, 0 otherwise.
+ */
+static int is_topic_char(char c) {
+    unsigned char u = (unsigned char)c;
+    return isalnum(u) || u == '_' || u == '-' || u == '.' || u == ':';
+}
+
+/**
+ * @brief Checks whether a topic name is acceptable on the wire and as a log file name.
+ *
+ * @param topic The topic name.
+ * @param len The length of the topic name.
+ * @return int 1 if the topic is valid, 0 otherwise.
+ */
+int is_valid_topic(const char *topic, size_t len) {
+    if (len == 0 || len >= MAX_TOPIC_LEN || topic[0] == '.') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!is_topic_char(topic[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks whether a BRIDGE topic pattern is acceptable on the wire.
+ *
+ * @param pattern The pattern.
+ * @param len The length of the pattern.
+ * @return int 1 if the pattern is valid, 0 otherwise.
+ */
+int is_valid_pattern(const char *pattern, size_t len) {
+    if (len == 0 || len >= MAX_TOPIC_LEN || pattern[0] == '.') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (pattern[i] != '*' && !is_topic_char(pattern[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Splits the next space-separated token off a header line.
+ *
+ * @param cursor In/out pointer to the current position in the header.
+ * @param end One past the last header byte (the '\n').
+ * @param tok_len Receives the token length.
+ * @return const char* The token start, or NULL when the header is exhausted.
+ */
+static const char *next_token(const char **cursor, const char *end, size_t *tok_len) {
+    const char *p = *cursor;
+    if (p >= end) {
+        return NULL;
+    }
+    const char *space = memchr(p, ' ', end - p);
+    const char *tok_end = space ? space : end;
+    *tok_len = tok_end - p;
+    *cursor = space ? space + 1 : end;
+    return p;
+}
+
+/**
+ * @brief Parses a decimal payload length token.
+ *
+ * @param tok The token.
+ * @param tok_len The token length.
+ * @param out Receives the value.
+ * @return int 0 on success, -1 if the token is not a valid length.
+ */
+static int parse_length(const char *tok, size_t tok_len, size_t *out) {
+    size_t value = 0;
+    if (tok_len == 0 || tok_len > 9) {
+        return -1;
+    }
+    for (size_t i = 0; i < tok_len; i++) {
+        if (!isdigit((unsigned char)tok[i])) {
+            return -1;
+        }
+        value = value * 10 + (size_t)(tok[i] - '0');
+    }
+    if (value > FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+/**
+ * @brief Describes one optional header field: its key and where it lives in frame_fields_t.
+ */
+typedef struct {
+    const char *key;  ///< Key including the '=' separator.
+    size_t offset;    ///< Offset of the value within frame_fields_t.
+} field_desc_t;
+
+/**
+ * @brief The optional header fields, in the order they are written.
+ */
+static const field_desc_t field_descs[] = {
+    { "seq=", offsetof(frame_fields_t, seq) },
+    { "from=", offsetof(frame_fields_t, from_seq) },
+    { "ti=", offsetof(frame_fields_t, ingress_ns) },
+    { "tp=", offsetof(frame_fields_t, persist_ns) },
+    { "ack=", offsetof(frame_fields_t, ack) },
+    { "key=", offsetof(frame_fields_t, key) },
+    { "group=", offsetof(frame_fields_t, group) },
+    { "origin=", offsetof(frame_fields_t, origin) }
+};
+
+#define FIELD_COUNT (sizeof(field_descs) / sizeof(field_descs[0]))
+
+/**
+ * @brief Returns a pointer to the value of a field.
+ *
+ * @param fields The field set.
+ * @param desc The field descriptor.
+ * @return uint64_t* The field value.
+ */
+static uint64_t *field_value(frame_fields_t *fields, const field_desc_t *desc) {
+    return (uint64_t *)((char *)fields + desc->offset);
+}
+
+/**
+ * @brief Parses a decimal field value in the range of a uint64_t (key hashes use all of it).
+ *
+ * @param tok The value text.
+ * @param tok_len The value length.
+ * @param out Receives the value.
+ * @return int 0 on success, -1 if the value is not a valid number.
+ */
+static int parse_u64(const char *tok, size_t tok_len, uint64_t *out) {
+    uint64_t value = 0;
+    if (tok_len == 0 || tok_len > 20) {
+        return -1;
+    }
+    for (size_t i = 0; i < tok_len; i++) {
+        uint64_t digit = (uint64_t)(tok[i] - '0');
+        if (!isdigit((unsigned char)tok[i]) || value > (UINT64_MAX - digit) / 10) {
+            return -1;
+        }
+        value = value * 10 + digit;
+    }
+    *out = value;
+    return 0;
+}
+
+/**
+ * @brief Parses the optional key=value fields that remain on a header line.
+ * Unknown keys and tokens without '=' are ignored.
+ *
+ * @param cursor In/out position within the header.
+ * @param newline The header terminator.
+ * @param fields Receives the recognised fields.
+ * @return int 0 on success, -1 if a recognised field has a malformed value.
+ */
+static int parse_fields(const char **cursor, const char *newline, frame_fields_t *fields) {
+    size_t tok_len;
+    const char *tok;
+    memset(fields, 0, sizeof(*fields));
+    while ((tok = next_token(cursor, newline, &tok_len)) != NULL) {
+        for (size_t i = 0; i < FIELD_COUNT; i++) {
+            size_t key_len = strlen(field_descs[i].key);
+            if (tok_len > key_len && memcmp(tok, field_descs[i].key, key_len) == 0) {
+                if (parse_u64(tok + key_len, tok_len - key_len, field_value(fields, &field_descs[i])) < 0) {
+                    return -1;
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses the length token of a header and locates the payload that follows.
+ *
+ * @param buf The buffer holding received bytes.
+ * @param len The number of bytes available in the buffer.
+ * @param header_len Length of the header line including its '\n'.
+ * @param cursor In/out position within the header.
+ * @param newline The header terminator.
+ * @param frame Receives the payload location.
+ * @param consumed Receives the total frame length when FRAME_OK is returned.
+ * @return frame_status_t FRAME_OK, FRAME_INCOMPLETE or FRAME_ERROR.
+ */
+static frame_status_t parse_payload(const char *buf, size_t len, size_t header_len, const char **cursor,
+                                    const char *newline, frame_t *frame, size_t *consumed) {
+    size_t tok_len;
+    const char *len_tok = next_token(cursor, newline, &tok_len);
+    if (len_tok == NULL || parse_length(len_tok, tok_len, &frame->payload_len) < 0 ||
+        parse_fields(cursor, newline, &frame->fields) < 0) {
+        return FRAME_ERROR;
+    }
+    if (len - header_len < frame->payload_len) {
+        return FRAME_INCOMPLETE;
+    }
+    frame->payload = buf + header_len;
+    *consumed = header_len + frame->payload_len;
+    return FRAME_OK;
+}
+
+/**
+ * @brief Parses one frame from the start of a buffer.
+ *
+ * The header must be terminated within FRAME_MAX_HEADER bytes. Unknown trailing
+ * header tokens are ignored so that newer peers can add optional fields.
+ * Recognised key=value fields are returned in frame->fields.
+ *
+ * @param buf The buffer holding received bytes.
+ * @param len The number of bytes available in the buffer.
+ * @param frame Receives the parsed frame when FRAME_OK is returned.
+ * @param consumed Receives the total frame length when FRAME_OK is returned.
+ * @return frame_status_t FRAME_OK, FRAME_INCOMPLETE or FRAME_ERROR.
+ */
+frame_status_t parse_frame(const char *buf, size_t len, frame_t *frame, size_t *consumed) {
+    size_t scan = len < FRAME_MAX_HEADER ? len : FRAME_MAX_HEADER;
+    const char *newline = memchr(buf, '\n', scan);
+    if (newline == NULL) {
+        return len >= FRAME_MAX_HEADER ? FRAME_ERROR : FRAME_INCOMPLETE;
+    }
+
+    const char *cursor = buf;
+    size_t tok_len;
+    const char *verb = next_token(&cursor, newline, &tok_len);
+    if (verb == NULL) {
+        return FRAME_ERROR;
+    }
+    size_t nverbs = sizeof(frame_verbs) / sizeof(frame_verbs[0]);
+    size_t v;
+    for (v = 0; v < nverbs; v++) {
+        if (strlen(frame_verbs[v]) == tok_len && memcmp(verb, frame_verbs[v], tok_len) == 0) {
+            break;
+        }
+    }
+    if (v == nverbs) {
+        return FRAME_ERROR;
+    }
+    frame->type = (frame_type_t)v;
+    frame->count = 0;
+
+    size_t header_len = (size_t)(newline - buf) + 1;
+    if (frame->type == FRAME_BATCH) {
+        const char *count_tok = next_token(&cursor, newline, &tok_len);
+        if (count_tok == NULL || parse_length(count_tok, tok_len, &frame->count) < 0) {
+            return FRAME_ERROR;
+        }
+        frame->topic[0] = '\0';
+        return parse_payload(buf, len, header_len, &cursor, newline, frame, consumed);
+    }
+    if (frame->type == FRAME_STATS) {
+        frame->topic[0] = '\0';
+        if (cursor >= newline) {
+            // A bare "STATS" line is a request and carries no payload
+            frame->payload = NULL;
+            frame->payload_len = 0;
+            memset(&frame->fields, 0, sizeof(frame->fields));
+            *consumed = header_len;
+            return FRAME_OK;
+        }
+        return parse_payload(buf, len, header_len, &cursor, newline, frame, consumed);
+    }
+    if ((frame->type == FRAME_REPL || frame->type == FRAME_BRIDGE) && cursor >= newline) {
+        // A bare "REPL" or "BRIDGE" line ends the follower's or bridge's handshake
+        frame->topic[0] = '\0';
+        frame->payload = NULL;
+        frame->payload_len = 0;
+        memset(&frame->fields, 0, sizeof(frame->fields));
+        *consumed = header_len;
+        return FRAME_OK;
+    }
+
+    const char *topic = next_token(&cursor, newline, &tok_len);
+    if (topic == NULL || !(frame->type == FRAME_BRIDGE ? is_valid_pattern(topic, tok_len) : is_valid_topic(topic, tok_len))) {
+        return FRAME_ERROR;
+    }
+    memcpy(frame->topic, topic, tok_len);
+    frame->topic[tok_len] = '\0';
+
+    if (frame->type == FRAME_SUB || frame->type == FRAME_ACK || frame->type == FRAME_REPL || frame->type == FRAME_BRIDGE) {
+        frame->payload = NULL;
+        frame->payload_len = 0;
+        if (parse_fields(&cursor, newline, &frame->fields) < 0) {
+            return FRAME_ERROR;
+        }
+        *consumed = header_len;
+        return FRAME_OK;
+    }
+    return parse_payload(buf, len, header_len, &cursor, newline, frame, consumed);
+}
+
+/**
+ * @brief Formats the header line of a frame.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param type The frame command.
+ * @param topic The topic name.
+ * @param payload_len The payload length (ignored for FRAME_SUB, FRAME_ACK, FRAME_REPL and FRAME_BRIDGE).
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_frame_header(char *out, size_t cap, frame_type_t type, const char *topic, size_t payload_len) {
+    return format_frame_header_fields(out, cap, type, topic, payload_len, NULL);
+}
+
+/**
+ * @brief Formats the header line of a frame followed by its optional fields.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param type The frame command.
+ * @param topic The topic name.
+ * @param payload_len The payload length (ignored for FRAME_SUB, FRAME_ACK, FRAME_REPL and FRAME_BRIDGE).
+ * @param fields The optional fields, or NULL for none.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_frame_header_fields(char *out, size_t cap, frame_type_t type, const char *topic, size_t payload_len,
+                               const frame_fields_t *fields) {
+    int n;
+    if (type == FRAME_SUB || type == FRAME_ACK || type == FRAME_REPL || type == FRAME_BRIDGE) {
+        n = snprintf(out, cap, "%s %s", frame_verbs[type], topic);
+    } else {
+        n = snprintf(out, cap, "%s %s %zu", frame_verbs[type], topic, payload_len);
+    }
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    size_t used = (size_t)n;
+    for (size_t i = 0; fields != NULL && i < FIELD_COUNT; i++) {
+        uint64_t value = *field_value((frame_fields_t *)fields, &field_descs[i]);
+        if (value == 0) {
+            continue;
+        }
+        n = snprintf(out + used, cap - used, " %s%llu", field_descs[i].key, (unsigned long long)value);
+        if (n < 0 || (used += (size_t)n) >= cap) {
+            return -1;
+        }
+    }
+    if (used + 1 >= cap) {
+        return -1;
+    }
+    out[used++] = '\n';
+    out[used] = '\0';
+    return (int)used;
+}
+
+/**
+ * @brief Formats the header line of a BATCH frame.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param count The number of PUB frames in the batch.
+ * @param payload_len The total length of the enclosed frames.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_batch_header(char *out, size_t cap, size_t count, size_t payload_len) {
+    int n = snprintf(out, cap, "%s %zu %zu\n", frame_verbs[FRAME_BATCH], count, payload_len);
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Formats the header line of a STATS reply.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param payload_len The length of the report.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_stats_header(char *out, size_t cap, size_t payload_len) {
+    int n = snprintf(out, cap, "%s %zu\n", frame_verbs[FRAME_STATS], payload_len);
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Formats a bare REPL line, which ends a follower's handshake.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_repl_start(char *out, size_t cap) {
+    int n = snprintf(out, cap, "%s\n", frame_verbs[FRAME_REPL]);
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Formats a bare BRIDGE line, which ends a bridge's handshake.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_bridge_start(char *out, size_t cap) {
+    int n = snprintf(out, cap, "%s\n", frame_verbs[FRAME_BRIDGE]);
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Hashes a message key for the "key" field: 64-bit FNV-1a, with 0 mapped to 1
+ * because a field value of 0 means the field is absent.
+ *
+ * @param key The key bytes.
+ * @param len The key length.
+ * @return uint64_t The hash, never 0.
+ */
+uint64_t frame_key_hash(const void *key, size_t len) {
+    const unsigned char *bytes = key;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file protocol.h
+ * @brief Declares the liteMQ wire protocol: frame layout, encoder and incremental parser.
+ * @author Mohammed Uddin
+ *
+ * Every frame starts with a single text header line terminated by '\n'. Frames that
+ * carry a payload announce its length in the header, so a reader can reassemble frames
+ * regardless of how the byte stream was split by the network:
+ *
+ *     SUB <topic>\n
+ *     PUB <topic> <length>\n<payload>
+ *     MSG <topic> <length>\n<payload>
+ *     BATCH <count> <length>\n<count PUB frames, length bytes in total>
+ *     STATS\n                      (request)
+ *     STATS <length>\n<report>      (reply from the broker)
+ *     ACK <topic>\n                 (message stored; see the "ack" and "seq" fields)
+ *     REPL <topic>\n                (follower's position in a topic, see the "from" field)
+ *     REPL\n                        (follower starts replicating)
+ *     BRIDGE <pattern>\n            (bridge's topic pattern or position, see bridge.h)
+ *     BRIDGE\n                      (bridge starts receiving)
+ *
+ * Optional key=value fields may follow the mandatory tokens of a header line. The
+ * broker uses them to annotate MSG frames, e.g. "MSG news 5 seq=7 ti=123 tp=456\n",
+ * and a subscriber uses "SUB news from=8\n" to resume after the last message it saw.
+ * A publisher asks for confirmation with "PUB news 5 ack=1\n"; the broker answers
+ * "ACK news seq=7\n" once the message is stored.
+ *
+ * A topic may be split into partitions, each an ordinary topic named "<topic>:<n>". A
+ * PUB to the topic itself is stored in one of them, chosen by its "key" field (a hash
+ * of the message key, see frame_key_hash()) or round-robin without one. "SUB orders
+ * group=3\n" joins consumer group 3, whose members share the partitions between them.
+ *
+ * A broker bridging topics from another one receives "MSG news 5 seq=7 origin=12\n",
+ * where "origin" identifies the broker the message was first published on.
+ */
+
+#ifndef LITEMQ_PROTOCOL_H
+#define LITEMQ_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LMQ_DEFAULT_HOST "127.0.0.1"
+#define LMQ_DEFAULT_PORT 8080
+#define MAX_TOPIC_LEN 50
+#define FRAME_MAX_HEADER 256
+#define FRAME_MAX_PAYLOAD (16 * 1024 * 1024)
+
+/**
+ * @brief Identifies the command carried by a frame.
+ */
+typedef enum {
+    FRAME_SUB,   ///< Client subscribes to a topic.
+    FRAME_PUB,   ///< Client publishes a payload to a topic.
+    FRAME_MSG,   ///< Server delivers a payload to a subscriber.
+    FRAME_BATCH, ///< Client publishes several PUB frames at once.
+    FRAME_STATS, ///< Client requests runtime statistics; the broker replies with a report payload.
+    FRAME_ACK,   ///< Broker confirms a publish, or a follower confirms a replicated message.
+    FRAME_REPL,  ///< Follower announces its log positions and starts replicating (see replication.h).
+    FRAME_BRIDGE ///< Bridge announces its topic patterns and positions, or is told a position (see bridge.h).
+} frame_type_t;
+
+/**
+ * @brief Result of an attempt to parse a frame from a buffer.
+ */
+typedef enum {
+    FRAME_ERROR = -1,     ///< The buffer does not start with a valid frame.
+    FRAME_INCOMPLETE = 0, ///< More bytes are needed to complete the frame.
+    FRAME_OK = 1          ///< A complete frame was parsed.
+} frame_status_t;
+
+/**
+ * @brief Optional header fields. A value of 0 means the field is absent.
+ */
+typedef struct {
+    uint64_t ingress_ns;  ///< "ti": CLOCK_MONOTONIC time at which the broker received the message.
+    uint64_t persist_ns;  ///< "tp": CLOCK_MONOTONIC time at which the broker finished persisting it.
+    uint64_t seq;         ///< "seq": per-topic sequence number of a persisted message (MSG).
+    uint64_t from_seq;    ///< "from": first sequence number to replay on subscription (SUB, REPL).
+    uint64_t ack;         ///< "ack": non-zero on a PUB to request an ACK once the message is stored.
+    uint64_t key;         ///< "key": hash of the message key, selecting the partition of a PUB (see frame_key_hash()).
+    uint64_t group;       ///< "group": consumer group a SUB to a partitioned topic joins.
+    uint64_t origin;      ///< "origin": id of the broker a bridged message was first published on (MSG, BRIDGE).
+} frame_fields_t;
+
+/**
+ * @brief A parsed frame. The payload points into the buffer that was parsed.
+ */
+typedef struct {
+    frame_type_t type;          ///< The frame command.
+    char topic[MAX_TOPIC_LEN];  ///< NUL-terminated topic name or BRIDGE pattern (empty for FRAME_BATCH, FRAME_STATS and a bare REPL or BRIDGE).
+    const char *payload;        ///< Start of the payload (NULL for frames without one, e.g. a STATS request).
+    size_t payload_len;         ///< Length of the payload in bytes.
+    size_t count;               ///< Number of frames inside a FRAME_BATCH payload.
+    frame_fields_t fields;      ///< Optional header fields.
+} frame_t;
+
+/**
+ * @brief Checks whether a topic name is acceptable on the wire and as a log file name.
+ *
+ * Topics are 1 to MAX_TOPIC_LEN - 1 characters drawn from letters, digits and "_-.:",
+ * and may not start with '.'.
+ *
+ * @param topic The topic name.
+ * @param len The length of the topic name.
+ * @return int 1 if the topic is valid, 0 otherwise.
+ */
+int is_valid_topic(const char *topic, size_t len);
+
+/**
+ * @brief Checks whether a BRIDGE topic pattern is acceptable on the wire.
+ * Patterns are topic names that may also contain '*', which matches any run of characters.
+ *
+ * @param pattern The pattern.
+ * @param len The length of the pattern.
+ * @return int 1 if the pattern is valid, 0 otherwise.
+ */
+int is_valid_pattern(const char *pattern, size_t len);
+
+/**
+ * @brief Parses one frame from the start of a buffer.
+ *
+ * @param buf The buffer holding received bytes.
+ * @param len The number of bytes available in the buffer.
+ * @param frame Receives the parsed frame when FRAME_OK is returned.
+ * @param consumed Receives the total frame length when FRAME_OK is returned.
+ * @return frame_status_t FRAME_OK, FRAME_INCOMPLETE or FRAME_ERROR.
+ */
+frame_status_t parse_frame(const char *buf, size_t len, frame_t *frame, size_t *consumed);
+
+/**
+ * @brief Formats the header line of a frame.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param type The frame command.
+ * @param topic The topic name.
+ * @param payload_len The payload length (ignored for FRAME_SUB, FRAME_ACK, FRAME_REPL and FRAME_BRIDGE).
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_frame_header(char *out, size_t cap, frame_type_t type, const char *topic, size_t payload_len);
+
+/**
+ * @brief Formats the header line of a frame followed by its optional fields.
+ * Fields that are 0 are omitted.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param type The frame command.
+ * @param topic The topic name.
+ * @param payload_len The payload length (ignored for FRAME_SUB, FRAME_ACK, FRAME_REPL and FRAME_BRIDGE).
+ * @param fields The optional fields, or NULL for none.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_frame_header_fields(char *out, size_t cap, frame_type_t type, const char *topic, size_t payload_len,
+                               const frame_fields_t *fields);
+
+/**
+ * @brief Formats the header line of a BATCH frame.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param count The number of PUB frames in the batch.
+ * @param payload_len The total length of the enclosed frames.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_batch_header(char *out, size_t cap, size_t count, size_t payload_len);
+
+/**
+ * @brief Formats the header line of a STATS reply.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @param payload_len The length of the report.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_stats_header(char *out, size_t cap, size_t payload_len);
+
+/**
+ * @brief Formats a bare REPL line, which ends a follower's handshake.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_repl_start(char *out, size_t cap);
+
+/**
+ * @brief Formats a bare BRIDGE line, which ends a bridge's handshake.
+ *
+ * @param out Destination buffer (FRAME_MAX_HEADER bytes is always enough).
+ * @param cap Capacity of the destination buffer.
+ * @return int The header length, or -1 if it does not fit.
+ */
+int format_bridge_start(char *out, size_t cap);
+
+/**
+ * @brief Hashes a message key for the "key" field: 64-bit FNV-1a, with 0 mapped to 1
+ * because a field value of 0 means the field is absent.
+ *
+ * @param key The key bytes.
+ * @param len The key length.
+ * @return uint64_t The hash, never 0.
+ */
+uint64_t frame_key_hash(const void *key, size_t len);
+
+#endif // LITEMQ_PROTOCOL_H
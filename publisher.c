@@ -4,57 +4,396 @@
  * @author Mohammed Uddin
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
+#include "litemq.h"
 
-#define PORT 8080
+#define STREAM_CHUNK (1024 * 1024)
+#define MMAP_THRESHOLD (1024 * 1024)
+#define STREAM_LINGER_MS 5
+#define CONFIRM_TIMEOUT_MS 10000
 
 /**
- * @brief Main function for the liteMQ publisher client.
- * Connects to the server and sends a message to a specified topic.
+ * @brief How messages are delimited in streaming input.
+ */
+typedef enum {
+    DELIM_NEWLINE, ///< One message per line; the newline is not part of the message.
+    DELIM_LENGTH   ///< Each message is preceded by a 4-byte big-endian length.
+} delimiter_t;
+
+/**
+ * @brief Streaming input source, backed either by a memory mapping or a read buffer.
+ */
+typedef struct {
+    int fd;             ///< Input descriptor.
+    char *data;         ///< Mapped file or read buffer.
+    size_t pos;         ///< Offset of the next unconsumed byte.
+    size_t len;         ///< Number of valid bytes in data.
+    size_t cap;         ///< Allocated size of the read buffer (0 when mapped).
+    int mapped;         ///< Whether data is a memory mapping.
+    int eof;            ///< Whether no more bytes will arrive.
+} input_t;
+
+/**
+ * @brief Prints the command-line usage and exits.
  *
- * @param argc The number of command-line arguments.
- * @param argv An array of command-line argument strings (expected: <topic> <message>).
- * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ * @param prog The program name.
  */
-int main(int argc, char const *argv[]) {
-    int sock = 0;
-    struct sockaddr_in serv_addr;
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-a | -k key] <topic> <message>\n"
+            "       %s [-h host] [-p port] [-k key] -s [-f file] [-d newline|length] [-l linger_ms] <topic>\n"
+            "\n"
+            "  -a  Wait until the broker confirms that the message is stored.\n"
+            "  -k  Message key; on a partitioned topic, equal keys go to the same partition.\n"
+            "  -s  Stream messages from stdin (or -f file) over one connection.\n"
+            "  -d  Input delimiting: one message per line (default), or a 4-byte\n"
+            "      big-endian length before each message.\n"
+            "  -l  Batch linger time in milliseconds for streaming (default %d).\n",
+            prog, prog, STREAM_LINGER_MS);
+    exit(EXIT_FAILURE);
+}
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <topic> <message>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
+/**
+ * @brief Returns the current monotonic time in seconds.
+ *
+ * @return double Seconds since an arbitrary epoch.
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        printf("\n Socket creation error \n");
+/**
+ * @brief Opens the streaming input, mapping regular files of at least MMAP_THRESHOLD bytes.
+ *
+ * @param in The input to initialise.
+ * @param path File to read, or NULL for stdin.
+ * @return int 0 on success, -1 on error.
+ */
+static int input_open(input_t *in, const char *path) {
+    memset(in, 0, sizeof(*in));
+    in->fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (in->fd < 0) {
+        perror("open input");
         return -1;
     }
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(PORT);
+    struct stat st;
+    if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= MMAP_THRESHOLD) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+            in->data = map;
+            in->len = (size_t)st.st_size;
+            in->mapped = 1;
+            in->eof = 1;
+            return 0;
+        }
+    }
 
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if(inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr)<=0) {
-        printf("\nInvalid address/ Address not supported \n");
+    in->data = malloc(STREAM_CHUNK);
+    if (in->data == NULL) {
+        perror("malloc input buffer");
         return -1;
     }
+    in->cap = STREAM_CHUNK;
+    return 0;
+}
+
+/**
+ * @brief Releases the streaming input.
+ *
+ * @param in The input.
+ */
+static void input_close(input_t *in) {
+    if (in->mapped) {
+        munmap(in->data, in->len);
+    } else {
+        free(in->data);
+    }
+    if (in->fd != STDIN_FILENO) {
+        close(in->fd);
+    }
+}
 
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        printf("\nConnection Failed \n");
-        return -1;
+/**
+ * @brief Reads more bytes into the buffer, compacting or growing it as needed.
+ *
+ * @param in The input.
+ * @return int 0 on success (in->eof is set at end of input), -1 on error.
+ */
+static int input_fill(input_t *in) {
+    if (in->mapped || in->eof) {
+        in->eof = 1;
+        return 0;
     }
+    if (in->pos > 0) {
+        memmove(in->data, in->data + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->len == in->cap) {
+        char *grown = realloc(in->data, in->cap * 2);
+        if (grown == NULL) {
+            perror("realloc input buffer");
+            return -1;
+        }
+        in->data = grown;
+        in->cap *= 2;
+    }
+    for (;;) {
+        ssize_t n = read(in->fd, in->data + in->len, in->cap - in->len);
+        if (n > 0) {
+            in->len += (size_t)n;
+            return 0;
+        }
+        if (n == 0) {
+            in->eof = 1;
+            return 0;
+        }
+        if (errno != EINTR) {
+            perror("read input");
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Extracts the next message from the streaming input.
+ *
+ * @param in The input.
+ * @param delim The input delimiting.
+ * @param msg Receives a pointer to the message (valid until the next call).
+ * @param len Receives the message length.
+ * @return int 1 if a message was extracted, 0 at end of input, -1 on error.
+ */
+static int input_next(input_t *in, delimiter_t delim, const char **msg, size_t *len) {
+    for (;;) {
+        const char *start = in->data + in->pos;
+        size_t avail = in->len - in->pos;
 
-    char message[1024];
-    snprintf(message, sizeof(message), "PUB %s\n%s", argv[1], argv[2]);
+        if (delim == DELIM_NEWLINE) {
+            const char *newline = memchr(start, '\n', avail);
+            if (newline != NULL) {
+                *msg = start;
+                *len = (size_t)(newline - start);
+                in->pos += *len + 1;
+                return 1;
+            }
+            if (in->eof) {
+                if (avail == 0) {
+                    return 0;
+                }
+                // Final line without a trailing newline
+                *msg = start;
+                *len = avail;
+                in->pos += avail;
+                return 1;
+            }
+        } else {
+            if (avail >= 4) {
+                uint32_t net_len;
+                memcpy(&net_len, start, 4);
+                size_t msg_len = ntohl(net_len);
+                if (avail >= 4 + msg_len) {
+                    *msg = start + 4;
+                    *len = msg_len;
+                    in->pos += 4 + msg_len;
+                    return 1;
+                }
+            }
+            if (in->eof) {
+                if (avail == 0) {
+                    return 0;
+                }
+                fprintf(stderr, "Input ends with a truncated length-prefixed message\n");
+                return -1;
+            }
+        }
 
-    send(sock, message, strlen(message), 0);
-    printf("Message sent\n");
-    close(sock);
-    return 0;
+        if (input_fill(in) < 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Publishes a message, driving the connection while the send buffer is full.
+ *
+ * @param client The client.
+ * @param topic The destination topic.
+ * @param key The message key, or NULL.
+ * @param msg The message.
+ * @param len The message length.
+ * @return int LMQ_OK or an error.
+ */
+static int publish_blocking(lmq_client_t *client, const char *topic, const char *key, const char *msg, size_t len) {
+    int rc;
+    while ((rc = key != NULL ? lmq_publish_keyed(client, topic, key, strlen(key), msg, len)
+                             : lmq_publish(client, topic, msg, len)) == LMQ_ERR_WOULDBLOCK) {
+        rc = lmq_poll(client, 100);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief Publishes every message of the input over one connection and reports throughput.
+ *
+ * @param opts Connection options (batching enabled by the caller).
+ * @param topic The destination topic.
+ * @param key The key of every message, or NULL.
+ * @param path Input file, or NULL for stdin.
+ * @param delim The input delimiting.
+ * @return int EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int stream_messages(const lmq_options_t *opts, const char *topic, const char *key, const char *path,
+                           delimiter_t delim) {
+    input_t in;
+    if (input_open(&in, path) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    lmq_client_t *client = lmq_connect(opts);
+    if (client == NULL) {
+        perror("Connection Failed");
+        input_close(&in);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long long count = 0;
+    unsigned long long bytes = 0;
+    double start = now_seconds();
+    const char *msg;
+    size_t len;
+    int rc = LMQ_OK;
+    int got;
+
+    while ((got = input_next(&in, delim, &msg, &len)) == 1) {
+        rc = publish_blocking(client, topic, key, msg, len);
+        if (rc != LMQ_OK) {
+            break;
+        }
+        count++;
+        bytes += len;
+    }
+    if (rc == LMQ_OK) {
+        rc = lmq_flush(client, -1);
+    }
+    double elapsed = now_seconds() - start;
+
+    lmq_close(client);
+    input_close(&in);
+
+    if (rc != LMQ_OK) {
+        fprintf(stderr, "Publish failed after %llu messages: %s\n", count, lmq_strerror(rc));
+        return EXIT_FAILURE;
+    }
+    if (elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+    fprintf(stderr, "Published %llu messages (%llu bytes) in %.3f s: %.0f msg/s, %.2f MB/s\n",
+            count, bytes, elapsed, count / elapsed, bytes / elapsed / (1024.0 * 1024.0));
+    return got < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Main function for the liteMQ publisher client.
+ * Connects to the server and sends a message to a specified topic, or streams
+ * messages from stdin or a file with -s.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv An array of command-line argument strings (expected: [options] <topic> [message]).
+ * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char *argv[]) {
+    lmq_options_t opts;
+    lmq_options_init(&opts);
+    int streaming = 0;
+    const char *path = NULL;
+    delimiter_t delim = DELIM_NEWLINE;
+    int linger_ms = STREAM_LINGER_MS;
+    int confirm = 0;
+    const char *key = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:ak:sf:d:l:")) != -1) {
+        switch (opt) {
+        case 'h': opts.host = optarg; break;
+        case 'a': confirm = 1; break;
+        case 'k': key = optarg; break;
+        case 'p': opts.port = atoi(optarg); break;
+        case 's': streaming = 1; break;
+        case 'f': path = optarg; break;
+        case 'd':
+            if (strcmp(optarg, "newline") == 0) {
+                delim = DELIM_NEWLINE;
+            } else if (strcmp(optarg, "length") == 0) {
+                delim = DELIM_LENGTH;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'l': linger_ms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (streaming) {
+        if (argc - optind != 1) {
+            usage(argv[0]);
+        }
+        opts.linger_ms = linger_ms;
+        return stream_messages(&opts, argv[optind], key, path, delim);
+    }
+
+    if (argc - optind != 2 || (confirm && key != NULL)) {
+        usage(argv[0]);
+    }
+    const char *topic = argv[optind];
+    const char *message = argv[optind + 1];
+
+    lmq_client_t *client = lmq_connect(&opts);
+    if (client == NULL) {
+        perror("Connection Failed");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t seq = 0;
+    int rc;
+    if (confirm) {
+        rc = lmq_publish_confirmed(client, topic, message, strlen(message), &seq, CONFIRM_TIMEOUT_MS);
+    } else {
+        rc = publish_blocking(client, topic, key, message, strlen(message));
+        if (rc == LMQ_OK) {
+            rc = lmq_flush(client, -1);
+        }
+    }
+    lmq_close(client);
+    if (rc != LMQ_OK) {
+        fprintf(stderr, "Publish failed: %s\n", lmq_strerror(rc));
+        return EXIT_FAILURE;
+    }
+    if (confirm && seq != 0) {
+        printf("Message confirmed (seq %llu)\n", (unsigned long long)seq);
+    } else if (confirm) {
+        printf("Message confirmed\n");
+    } else {
+        printf("Message sent\n");
+    }
+    return EXIT_SUCCESS;
 }
@@ -0,0 +1,284 @@
+/**
+ * @file replay.c
+ * @brief Implements litemq-replay, which feeds a capture recorded with --capture back into a broker.
+ * @author Mohammed Uddin
+ *
+ * Every captured publisher connection gets its own connection to the target broker,
+ * and each frame is sent byte for byte as the broker received it. At speed 1 frames
+ * leave at their original times; other speeds scale the gaps, and speed 0 sends as
+ * fast as the broker accepts. How far sends fall behind their schedule is recorded
+ * in a histogram, so a replay that could not keep up is visible in the report.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "capture.h"
+#include "histogram.h"
+
+/**
+ * @brief A connection to the broker standing in for one captured publisher.
+ */
+typedef struct {
+    uint32_t conn; ///< Connection number in the capture.
+    int fd;        ///< Socket to the broker.
+} replay_conn_t;
+
+/**
+ * @brief Command-line configuration.
+ */
+static struct {
+    const char *host;      ///< Broker host.
+    int port;              ///< Broker port.
+    double speed;          ///< Time scale (1: original, 0: as fast as possible).
+    const char *path;      ///< Capture to replay.
+    const char *json_path; ///< Where to write the JSON report ("-" for stdout), or NULL.
+} config;
+
+static replay_conn_t *conns;
+static size_t conn_count;
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Prints the command-line usage and exits.
+ *
+ * @param prog The program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <capture>\n"
+            "\n"
+            "  -h host      Broker host (default 127.0.0.1)\n"
+            "  -p port      Broker port (default 8080)\n"
+            "  -s speed     Time scale: 1 original, 2 twice as fast, 0 as fast as possible (default 1)\n"
+            "  -j file      Also write the report as JSON (- for stdout)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the command line into the global configuration.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ */
+static void parse_args(int argc, char *argv[]) {
+    config.host = "127.0.0.1";
+    config.port = 8080;
+    config.speed = 1.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:j:")) != -1) {
+        switch (opt) {
+        case 'h': config.host = optarg; break;
+        case 'p': config.port = atoi(optarg); break;
+        case 's': config.speed = atof(optarg); break;
+        case 'j': config.json_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || config.speed < 0) {
+        usage(argv[0]);
+    }
+    config.path = argv[optind];
+}
+
+/**
+ * @brief Opens a blocking TCP connection to the broker.
+ *
+ * @return int The connected socket, or -1 on failure.
+ */
+static int open_socket(void) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", config.port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    if (getaddrinfo(config.host, port_str, &hints, &res) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+/**
+ * @brief Returns the broker connection for a captured connection, opening it on first use.
+ *
+ * @param conn Connection number in the capture.
+ * @return int The socket, or -1 if it could not be opened.
+ */
+static int conn_fd(uint32_t conn) {
+    for (size_t i = 0; i < conn_count; i++) {
+        if (conns[i].conn == conn) {
+            return conns[i].fd;
+        }
+    }
+    replay_conn_t *grown = realloc(conns, (conn_count + 1) * sizeof(*conns));
+    if (grown == NULL) {
+        return -1;
+    }
+    conns = grown;
+    conns[conn_count].conn = conn;
+    conns[conn_count].fd = open_socket();
+    if (conns[conn_count].fd < 0) {
+        fprintf(stderr, "connect to %s:%d: %s\n", config.host, config.port, strerror(errno));
+        return -1;
+    }
+    return conns[conn_count++].fd;
+}
+
+/**
+ * @brief Sends a whole buffer on a blocking socket.
+ *
+ * @param fd The socket.
+ * @param buf The data.
+ * @param len The length.
+ * @return int 0 on success, -1 on failure.
+ */
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sleeps until a point in CLOCK_MONOTONIC time.
+ *
+ * @param when_ns The wake-up time in nanoseconds.
+ */
+static void sleep_until(uint64_t when_ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(when_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(when_ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/**
+ * @brief Main function for litemq-replay.
+ * Replays every frame of the capture on the schedule given by -s and prints a report.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv An array of command-line argument strings.
+ * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int main(int argc, char *argv[]) {
+    parse_args(argc, argv);
+    capture_reader_t reader;
+    if (capture_reader_open(&reader, config.path) < 0) {
+        fprintf(stderr, "%s: not a readable capture: %s\n", config.path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    static histogram_t lag;
+    histogram_init(&lag);
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t captured_ns = 0;
+    capture_record_t rec;
+    int rc;
+    uint64_t start = now_ns();
+    while ((rc = capture_next(&reader, &rec)) == 1) {
+        if (config.speed > 0) {
+            uint64_t due = start + (uint64_t)((double)rec.offset_ns / config.speed);
+            uint64_t now = now_ns();
+            if (now < due) {
+                sleep_until(due);
+                now = now_ns();
+            }
+            histogram_record(&lag, now - due);
+        }
+        int fd = conn_fd(rec.conn);
+        if (fd < 0 || send_all(fd, rec.data, rec.len) < 0) {
+            fprintf(stderr, "send to broker failed: %s\n", strerror(errno));
+            rc = -2;
+            break;
+        }
+        frames++;
+        bytes += rec.len;
+        captured_ns = rec.offset_ns;
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    if (rc == -1) {
+        fprintf(stderr, "%s: truncated or corrupt record after %llu frames\n", config.path, (unsigned long long)frames);
+    }
+    for (size_t i = 0; i < conn_count; i++) {
+        close(conns[i].fd);
+    }
+    free(conns);
+    capture_reader_close(&reader);
+
+    printf("litemq-replay: %llu frames, %llu bytes over %zu connections in %.3f s (captured over %.3f s)\n",
+           (unsigned long long)frames, (unsigned long long)bytes, conn_count, elapsed, (double)captured_ns / 1e9);
+    printf("Rate:        %.0f frames/s, %.2f MB/s\n", frames / elapsed, bytes / elapsed / (1024.0 * 1024.0));
+    if (lag.total > 0) {
+        printf("Behind schedule (us): p50 %.1f  p99 %.1f  max %.1f\n", histogram_percentile(&lag, 50) / 1000.0,
+               histogram_percentile(&lag, 99) / 1000.0, lag.max / 1000.0);
+    }
+
+    if (config.json_path != NULL) {
+        FILE *out = strcmp(config.json_path, "-") == 0 ? stdout : fopen(config.json_path, "w");
+        if (out == NULL) {
+            perror("fopen JSON report");
+        } else {
+            fprintf(out,
+                    "{\"capture\":\"%s\",\"speed\":%.3f,\"frames\":%llu,\"bytes\":%llu,\"connections\":%zu,"
+                    "\"elapsed_s\":%.6f,\"captured_s\":%.6f,\"frames_per_sec\":%.1f,\"lag_p50_us\":%.1f,"
+                    "\"lag_p99_us\":%.1f,\"lag_max_us\":%.1f}\n",
+                    config.path, config.speed, (unsigned long long)frames, (unsigned long long)bytes, conn_count,
+                    elapsed, (double)captured_ns / 1e9, frames / elapsed, histogram_percentile(&lag, 50) / 1000.0,
+                    histogram_percentile(&lag, 99) / 1000.0, lag.total ? lag.max / 1000.0 : 0.0);
+            if (out != stdout) {
+                fclose(out);
+            }
+        }
+    }
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
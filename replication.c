@@ -0,0 +1,335 @@
+/**
+ * @file replication.c
+ * @brief Implements the bookkeeping of leader-follower log replication.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "replication.h"
+#include "log.h"
+
+/**
+ * @brief Initialises the replication state: no followers, asynchronous acknowledgement.
+ *
+ * @param r The state.
+ */
+void repl_init(repl_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->ack_mode = REPL_ACK_ASYNC;
+}
+
+/**
+ * @brief Frees the replication state.
+ *
+ * @param r The state.
+ */
+void repl_free(repl_t *r) {
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        free(r->followers[i].from.items);
+    }
+    free(r->acked.items);
+    free(r->pending);
+    repl_init(r);
+}
+
+/**
+ * @brief Parses a "host:port" address.
+ *
+ * @param address The address.
+ * @param host Receives the host.
+ * @param host_cap Capacity of `host`.
+ * @param port Receives the port.
+ * @return int 0 on success, -1 if the address is malformed.
+ */
+int repl_parse_address(const char *address, char *host, size_t host_cap, int *port) {
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || colon == address || (size_t)(colon - address) >= host_cap) {
+        return -1;
+    }
+    char *end;
+    long value = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || value < 1 || value > 65535) {
+        return -1;
+    }
+    memcpy(host, address, (size_t)(colon - address));
+    host[colon - address] = '\0';
+    *port = (int)value;
+    return 0;
+}
+
+/**
+ * @brief Starts a non-blocking TCP connection to a leader.
+ * The connection completes in the background; the caller polls for POLLOUT.
+ *
+ * @param host The leader's host.
+ * @param port The leader's client port.
+ * @return int The socket, connected or connecting, or -1 on failure (errno is set).
+ */
+int repl_connect(const char *host, int port) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            int saved = errno;
+            close(fd);
+            fd = -1;
+            errno = saved;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Finds a topic in a position list.
+ *
+ * @param list The list.
+ * @param topic The topic.
+ * @return repl_pos_t* The position, or NULL if the topic is not listed.
+ */
+repl_pos_t *repl_pos_find(const repl_pos_list_t *list, const char *topic) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (strcmp(list->items[i].topic, topic) == 0) {
+            return &list->items[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds a topic in a position list, adding it with position 0 if it is missing.
+ *
+ * @param list The list.
+ * @param topic The topic.
+ * @return repl_pos_t* The position, or NULL if allocation failed.
+ */
+repl_pos_t *repl_pos_upsert(repl_pos_list_t *list, const char *topic) {
+    repl_pos_t *pos = repl_pos_find(list, topic);
+    if (pos != NULL) {
+        return pos;
+    }
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap ? list->cap * 2 : 16;
+        repl_pos_t *grown = realloc(list->items, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            log_error(LOG_MODULE_BROKER, "realloc replication positions: %s", strerror(errno));
+            return NULL;
+        }
+        list->items = grown;
+        list->cap = new_cap;
+    }
+    pos = &list->items[list->count++];
+    snprintf(pos->topic, sizeof(pos->topic), "%s", topic);
+    pos->seq = 0;
+    return pos;
+}
+
+/**
+ * @brief Returns the follower on a connection.
+ *
+ * @param r The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return repl_follower_t* The follower, or NULL if the connection is not one.
+ */
+repl_follower_t *repl_find_follower(repl_t *r, int slot, uint32_t conn_id) {
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        if (r->followers[i].slot == slot && r->followers[i].conn_id == conn_id && slot != 0) {
+            return &r->followers[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Registers a connection as a follower.
+ *
+ * @param r The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return repl_follower_t* The follower, or NULL if REPL_MAX_FOLLOWERS are connected.
+ */
+repl_follower_t *repl_add_follower(repl_t *r, int slot, uint32_t conn_id) {
+    for (int i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        repl_follower_t *f = &r->followers[i];
+        if (f->slot == 0) {
+            f->slot = slot;
+            f->conn_id = conn_id;
+            f->live = 0;
+            f->from.count = 0;
+            r->follower_count++;
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Forgets a follower. Its position list stays allocated for the next one.
+ *
+ * @param r The state.
+ * @param f The follower.
+ */
+void repl_remove_follower(repl_t *r, repl_follower_t *f) {
+    f->slot = 0;
+    f->conn_id = 0;
+    f->live = 0;
+    f->from.count = 0;
+    r->follower_count--;
+}
+
+/**
+ * @brief Records a follower's position in a topic from its handshake.
+ *
+ * @param f The follower.
+ * @param topic The topic.
+ * @param next_seq The sequence number of the follower's next record.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int repl_set_position(repl_follower_t *f, const char *topic, uint64_t next_seq) {
+    repl_pos_t *pos = repl_pos_upsert(&f->from, topic);
+    if (pos == NULL) {
+        return -1;
+    }
+    pos->seq = next_seq;
+    return 0;
+}
+
+/**
+ * @brief Returns the first sequence number a follower is missing in a topic.
+ *
+ * @param f The follower.
+ * @param topic The topic.
+ * @return uint64_t The announced position, or 1 for a topic the follower did not announce.
+ */
+uint64_t repl_position(const repl_follower_t *f, const char *topic) {
+    const repl_pos_t *pos = repl_pos_find(&f->from, topic);
+    return pos != NULL && pos->seq > 0 ? pos->seq : 1;
+}
+
+/**
+ * @brief Records that a follower has written a topic up to a sequence number.
+ * Acknowledgements only move forward.
+ *
+ * @param r The state.
+ * @param topic The topic.
+ * @param seq The sequence number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int repl_acknowledge(repl_t *r, const char *topic, uint64_t seq) {
+    repl_pos_t *pos = repl_pos_upsert(&r->acked, topic);
+    if (pos == NULL) {
+        return -1;
+    }
+    if (seq > pos->seq) {
+        pos->seq = seq;
+    }
+    r->acks_received++;
+    return 0;
+}
+
+/**
+ * @brief Returns the highest sequence number a follower has acknowledged in a topic.
+ *
+ * @param r The state.
+ * @param topic The topic.
+ * @return uint64_t The sequence number, or 0 if none was acknowledged.
+ */
+uint64_t repl_acked(const repl_t *r, const char *topic) {
+    const repl_pos_t *pos = repl_pos_find(&r->acked, topic);
+    return pos != NULL ? pos->seq : 0;
+}
+
+/**
+ * @brief Holds a publisher's confirmation until a follower acknowledges the message.
+ *
+ * @param r The state.
+ * @param slot The publisher's client slot.
+ * @param conn_id Its connection number.
+ * @param topic The topic of the message.
+ * @param seq The message's sequence number.
+ * @return int 0 on success, -1 if REPL_MAX_PENDING are held or allocation failed.
+ */
+int repl_hold_confirm(repl_t *r, int slot, uint32_t conn_id, const char *topic, uint64_t seq) {
+    if (repl_pending(r) >= REPL_MAX_PENDING) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (r->pending_len == r->pending_cap) {
+        if (r->pending_head > 0) {
+            memmove(r->pending, r->pending + r->pending_head, (r->pending_len - r->pending_head) * sizeof(*r->pending));
+            r->pending_len -= r->pending_head;
+            r->pending_head = 0;
+        } else {
+            size_t new_cap = r->pending_cap ? r->pending_cap * 2 : 256;
+            repl_confirm_t *grown = realloc(r->pending, new_cap * sizeof(*grown));
+            if (grown == NULL) {
+                return -1;
+            }
+            r->pending = grown;
+            r->pending_cap = new_cap;
+        }
+    }
+    repl_confirm_t *c = &r->pending[r->pending_len++];
+    c->slot = slot;
+    c->conn_id = conn_id;
+    snprintf(c->topic, sizeof(c->topic), "%s", topic);
+    c->seq = seq;
+    return 0;
+}
+
+/**
+ * @brief Returns the number of held confirmations.
+ *
+ * @param r The state.
+ * @return size_t The number of confirmations.
+ */
+size_t repl_pending(const repl_t *r) {
+    return r->pending_len - r->pending_head;
+}
+
+/**
+ * @brief Takes the oldest held confirmation if a follower has acknowledged its message.
+ *
+ * @param r The state.
+ * @param out Receives the confirmation.
+ * @return int 1 if a confirmation was taken, 0 if none is ready.
+ */
+int repl_next_confirm(repl_t *r, repl_confirm_t *out) {
+    if (r->pending_head == r->pending_len) {
+        return 0;
+    }
+    const repl_confirm_t *head = &r->pending[r->pending_head];
+    if (repl_acked(r, head->topic) < head->seq) {
+        return 0;
+    }
+    *out = *head;
+    if (++r->pending_head == r->pending_len) {
+        r->pending_head = 0;
+        r->pending_len = 0;
+    }
+    return 1;
+}
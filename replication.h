@@ -0,0 +1,260 @@
+/**
+ * @file replication.h
+ * @brief Declares the bookkeeping of leader-follower log replication.
+ * @author Mohammed Uddin
+ *
+ * A follower broker keeps a copy of every topic log of its leader. It connects to the
+ * leader's client port and announces, for each topic it already has, the sequence
+ * number of its next record:
+ *
+ *     REPL news from=8\n
+ *     REPL sport from=1\n
+ *     REPL\n
+ *
+ * The bare REPL ends the list. The leader then sends every record the follower is
+ * missing, for every topic in its log directory, as MSG frames with their sequence
+ * numbers, and from then on every message it persists. The follower appends each one
+ * to its own log, which therefore holds the same records under the same numbers, and
+ * answers "ACK <topic> seq=<n>". After a lost connection the follower reconnects and
+ * announces its positions again, so it resumes where it stopped.
+ *
+ * A publisher that sends "PUB <topic> <len> ack=1" gets "ACK <topic> seq=<n>" back.
+ * With asynchronous acknowledgement it is sent as soon as the leader has written the
+ * message. With synchronous acknowledgement it is held until a follower has
+ * acknowledged the message as well, so a confirmed message survives the loss of the
+ * leader. Confirmations are released in the order the messages were published.
+ *
+ * This module keeps the leader's state: its followers, their announced positions,
+ * the acknowledged position per topic and the held confirmations. The broker core
+ * (broker.c) moves the frames.
+ */
+
+#ifndef LITEMQ_REPLICATION_H
+#define LITEMQ_REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#define REPL_MAX_FOLLOWERS 8
+#define REPL_MAX_PENDING (1024 * 1024)
+
+/**
+ * @brief When a publisher that asked for an ACK is confirmed.
+ */
+typedef enum {
+    REPL_ACK_ASYNC, ///< Once the leader has written the message.
+    REPL_ACK_SYNC   ///< Once a follower has written it too.
+} repl_ack_mode_t;
+
+/**
+ * @brief A sequence number per topic.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< The topic.
+    uint64_t seq;              ///< The sequence number.
+} repl_pos_t;
+
+/**
+ * @brief A list of per-topic positions.
+ */
+typedef struct {
+    repl_pos_t *items; ///< The positions.
+    size_t count;      ///< Number of positions.
+    size_t cap;        ///< Allocated number of positions.
+} repl_pos_list_t;
+
+/**
+ * @brief A follower connected to this broker.
+ */
+typedef struct {
+    int slot;              ///< The follower's client slot, 0 if the entry is free.
+    uint32_t conn_id;      ///< Its connection number.
+    int live;              ///< Whether it has caught up and receives new messages.
+    repl_pos_list_t from;  ///< Positions it announced, until it has caught up.
+} repl_follower_t;
+
+/**
+ * @brief A publisher confirmation held until a follower has the message.
+ */
+typedef struct {
+    int slot;                  ///< The publisher's client slot.
+    uint32_t conn_id;          ///< Its connection number.
+    char topic[MAX_TOPIC_LEN]; ///< The topic of the message.
+    uint64_t seq;              ///< The message's sequence number.
+} repl_confirm_t;
+
+/**
+ * @brief Replication state of one broker core.
+ */
+typedef struct {
+    repl_ack_mode_t ack_mode;                      ///< When publishers are confirmed.
+    repl_follower_t followers[REPL_MAX_FOLLOWERS]; ///< Connected followers.
+    size_t follower_count;                         ///< Followers in use.
+    repl_pos_list_t acked;                         ///< Highest sequence number a follower acknowledged, per topic.
+    repl_confirm_t *pending;                       ///< Held confirmations, oldest first from pending_head.
+    size_t pending_head;                           ///< Index of the oldest held confirmation.
+    size_t pending_len;                            ///< End of the held confirmations.
+    size_t pending_cap;                            ///< Allocated number of confirmations.
+    int following;                                 ///< Whether this broker follows a leader.
+    int upstream_slot;                             ///< Client slot of the connection to the leader, 0 if none.
+    uint32_t upstream_conn;                        ///< Its connection number.
+    uint64_t catchups;                             ///< Followers caught up from the logs.
+    uint64_t records_sent;                         ///< Records sent to followers.
+    uint64_t acks_received;                        ///< ACKs received from followers.
+    uint64_t confirms;                             ///< ACKs sent to publishers.
+    uint64_t records_applied;                      ///< Records received from the leader and written.
+    uint64_t duplicates;                           ///< Records received from the leader that were already written.
+    uint64_t diverged;                             ///< Records whose number differed from the local log's.
+} repl_t;
+
+/**
+ * @brief Initialises the replication state: no followers, asynchronous acknowledgement.
+ *
+ * @param r The state.
+ */
+void repl_init(repl_t *r);
+
+/**
+ * @brief Frees the replication state.
+ *
+ * @param r The state.
+ */
+void repl_free(repl_t *r);
+
+/**
+ * @brief Parses a "host:port" address.
+ *
+ * @param address The address.
+ * @param host Receives the host.
+ * @param host_cap Capacity of `host`.
+ * @param port Receives the port.
+ * @return int 0 on success, -1 if the address is malformed.
+ */
+int repl_parse_address(const char *address, char *host, size_t host_cap, int *port);
+
+/**
+ * @brief Starts a non-blocking TCP connection to a leader.
+ *
+ * @param host The leader's host.
+ * @param port The leader's client port.
+ * @return int The socket, connected or connecting, or -1 on failure (errno is set).
+ */
+int repl_connect(const char *host, int port);
+
+/**
+ * @brief Finds a topic in a position list.
+ *
+ * @param list The list.
+ * @param topic The topic.
+ * @return repl_pos_t* The position, or NULL if the topic is not listed.
+ */
+repl_pos_t *repl_pos_find(const repl_pos_list_t *list, const char *topic);
+
+/**
+ * @brief Finds a topic in a position list, adding it with position 0 if it is missing.
+ *
+ * @param list The list.
+ * @param topic The topic.
+ * @return repl_pos_t* The position, or NULL if allocation failed.
+ */
+repl_pos_t *repl_pos_upsert(repl_pos_list_t *list, const char *topic);
+
+/**
+ * @brief Returns the follower on a connection.
+ *
+ * @param r The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return repl_follower_t* The follower, or NULL if the connection is not one.
+ */
+repl_follower_t *repl_find_follower(repl_t *r, int slot, uint32_t conn_id);
+
+/**
+ * @brief Registers a connection as a follower.
+ *
+ * @param r The state.
+ * @param slot The client slot.
+ * @param conn_id The connection number.
+ * @return repl_follower_t* The follower, or NULL if REPL_MAX_FOLLOWERS are connected.
+ */
+repl_follower_t *repl_add_follower(repl_t *r, int slot, uint32_t conn_id);
+
+/**
+ * @brief Forgets a follower.
+ *
+ * @param r The state.
+ * @param f The follower.
+ */
+void repl_remove_follower(repl_t *r, repl_follower_t *f);
+
+/**
+ * @brief Records a follower's position in a topic from its handshake.
+ *
+ * @param f The follower.
+ * @param topic The topic.
+ * @param next_seq The sequence number of the follower's next record.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int repl_set_position(repl_follower_t *f, const char *topic, uint64_t next_seq);
+
+/**
+ * @brief Returns the first sequence number a follower is missing in a topic.
+ *
+ * @param f The follower.
+ * @param topic The topic.
+ * @return uint64_t The announced position, or 1 for a topic the follower did not announce.
+ */
+uint64_t repl_position(const repl_follower_t *f, const char *topic);
+
+/**
+ * @brief Records that a follower has written a topic up to a sequence number.
+ *
+ * @param r The state.
+ * @param topic The topic.
+ * @param seq The sequence number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int repl_acknowledge(repl_t *r, const char *topic, uint64_t seq);
+
+/**
+ * @brief Returns the highest sequence number a follower has acknowledged in a topic.
+ *
+ * @param r The state.
+ * @param topic The topic.
+ * @return uint64_t The sequence number, or 0 if none was acknowledged.
+ */
+uint64_t repl_acked(const repl_t *r, const char *topic);
+
+/**
+ * @brief Holds a publisher's confirmation until a follower acknowledges the message.
+ *
+ * @param r The state.
+ * @param slot The publisher's client slot.
+ * @param conn_id Its connection number.
+ * @param topic The topic of the message.
+ * @param seq The message's sequence number.
+ * @return int 0 on success, -1 if REPL_MAX_PENDING are held or allocation failed.
+ */
+int repl_hold_confirm(repl_t *r, int slot, uint32_t conn_id, const char *topic, uint64_t seq);
+
+/**
+ * @brief Returns the number of held confirmations.
+ *
+ * @param r The state.
+ * @return size_t The number of confirmations.
+ */
+size_t repl_pending(const repl_t *r);
+
+/**
+ * @brief Takes the oldest held confirmation if a follower has acknowledged its message.
+ * Later confirmations wait behind an unacknowledged one, so every publisher is
+ * confirmed in publish order.
+ *
+ * @param r The state.
+ * @param out Receives the confirmation.
+ * @return int 1 if a confirmation was taken, 0 if none is ready.
+ */
+int repl_next_confirm(repl_t *r, repl_confirm_t *out);
+
+#endif // LITEMQ_REPLICATION_H
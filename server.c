@@ -4,94 +4,887 @@
  * @author Mohammed Uddin
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <poll.h>
-#include <fcntl.h>
 #include <time.h>
 #include <sys/stat.h>
 #include "utils.h"
-#include "persistence.h"
+#include "broker.h"
+#include "admin.h"
+#include "shard.h"
+#include "log.h"
+#include "prof.h"
 
 #define MAX_CLIENTS 32
-#define PORT 8080
-#define MAX_TOPIC_LEN 50
-#define BUFFER_SIZE 1024
-#define LOG_DIR "logs"
+#define PORT LMQ_DEFAULT_PORT
+#define WAKE_SLOT (MAX_CLIENTS + 1)
+#define ADMIN_SLOT (WAKE_SLOT + 1)
+#define POLL_SLOTS (ADMIN_SLOT + 1 + ADMIN_MAX_CONNS)
+#define DEFAULT_SLOW_LOOP_MS 100
+#define FOLLOW_RETRY_MS 1000
+#define REPORT_TIMEOUT_MS 1000
 
 /**
- * @brief Defines the type of client connected to the server.
+ * @brief The slowest handler call of one event-loop iteration.
  */
-typedef enum {
-    CLIENT_TYPE_UNKNOWN,    ///< Client type is not yet determined.
-    CLIENT_TYPE_SUBSCRIBER  ///< Client is a subscriber.
-} client_type_t;
+typedef struct {
+    stats_handler_t handler; ///< Category of the call.
+    int fd;                  ///< Descriptor it served.
+    uint64_t ns;             ///< Duration of the call.
+} slowest_handler_t;
+
+/**
+ * @brief A connection as listed in a report's `conn` lines.
+ */
+typedef struct {
+    int fd;                    ///< The client's descriptor.
+    client_type_t type;        ///< Its type.
+    char topic[MAX_TOPIC_LEN]; ///< Its topic, if it subscribed.
+    size_t queued;             ///< Bytes queued for it but not yet sent.
+    uint64_t sent;             ///< Bytes sent to it.
+    uint64_t backlog_since;    ///< When its backlog started, 0 if it has none.
+} conn_snapshot_t;
+
+/**
+ * @brief A copy of what one worker contributes to a report. Each worker copies its own
+ * state on its own thread when a report asks for it.
+ */
+typedef struct {
+    stats_shard_t *stats;            ///< Broker counters with per-topic subscriber counts, or NULL.
+    persist_stats_t persist;         ///< Storage counters of the worker's thread.
+    histogram_t queue_delay;         ///< Queueing delay (--timestamps).
+    uint64_t keyed;                  ///< Messages placed in a partition by key.
+    uint64_t round_robin;            ///< Messages placed in a partition round-robin.
+    int index;                       ///< The worker's shard index (--workers above 1).
+    size_t shared_topics;            ///< Topics the worker owns.
+    uint64_t posted;                 ///< Messages the worker posted to others.
+    uint64_t received;               ///< Messages the worker took off its inbox.
+    conn_snapshot_t conns[MAX_CLIENTS]; ///< Open client connections.
+    size_t conn_count;               ///< Number of entries in conns.
+    char *group_lines;               ///< The `group` lines of the worker's consumer groups, or NULL.
+} worker_snapshot_t;
+
+/**
+ * @brief One event loop and the broker core it drives.
+ */
+typedef struct {
+    broker_t broker;                   ///< The broker core.
+    struct pollfd fds[POLL_SLOTS];     ///< Listener, clients, wake pipe, admin listener and admin connections.
+    client_t clients[MAX_CLIENTS + 1]; ///< Client slots, parallel to fds.
+    int listen_fd;                     ///< This worker's listening socket.
+    int admin_fd;                      ///< The admin listener (worker 0 only), or -1.
+    shard_t *shard;                    ///< Topic ownership (--workers above 1), or NULL.
+    const persist_stats_t *persist;    ///< Storage counters of the worker's thread (NULL until it starts).
+    pthread_t thread;                  ///< The worker's thread (--workers above 1).
+    int stop;                          ///< Set to make the worker's loop exit.
+    fanpool_t pool;                    ///< Threads splitting large fan-outs (--fanout-threads).
+} worker_t;
+
+/**
+ * @brief Totals over every worker, assembled for one report.
+ */
+typedef struct {
+    stats_shard_t *total;     ///< Merged broker counters, with per-topic subscriber counts.
+    persist_stats_t persist;  ///< Merged storage counters.
+    histogram_t queue_delay;  ///< Merged queueing delay (--timestamps).
+    size_t connections;       ///< Open client connections.
+    size_t subscribers;       ///< Connected subscribers.
+    uint64_t queued;          ///< Bytes queued for clients but not yet sent.
+    uint64_t keyed;           ///< Messages placed in a partition by key.
+    uint64_t round_robin;     ///< Messages placed in a partition round-robin.
+    worker_snapshot_t *snapshots[SHARD_MAX_WORKERS]; ///< Each worker's copy, NULL if it did not answer.
+} report_t;
 
 /**
- * @brief Structure to hold information about each connected client.
+ * @brief A report's request for the copies of the running workers. It is shared by the
+ * reporting thread and the calls it posted, and freed by the last of them to finish.
  */
 typedef struct {
-    int fd;                 ///< File descriptor of the client socket.
-    client_type_t type;     ///< Type of the client (publisher or subscriber).
-    char topic[MAX_TOPIC_LEN]; ///< The topic the client is subscribed to (if applicable).
-} client_t;
+    pthread_mutex_t lock;     ///< Guards the fields below.
+    pthread_cond_t answered;  ///< Signalled whenever a worker answers.
+    int refs;                 ///< The reporting thread plus every posted call not yet run.
+    int pending;              ///< Workers that have not answered yet.
+    worker_snapshot_t *snapshots[SHARD_MAX_WORKERS]; ///< Answers not yet taken, by worker index.
+} snapshot_request_t;
+
+/**
+ * @brief The event loops (--workers, default 1). With one worker it runs on the main thread.
+ */
+static worker_t *workers = NULL;
+static int worker_count = 1;
+
+/**
+ * @brief Whether the worker threads run (--workers above 1), so that reports must ask
+ * the other workers for their snapshots rather than read their state.
+ */
+static int workers_running = 0;
+
+/**
+ * @brief Topic ownership between the workers, when there is more than one.
+ */
+static shard_group_t shard_group;
+
+/**
+ * @brief Set by the signal handler to request a clean shutdown.
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * @brief Set by the SIGUSR1 handler to request a statistics dump on stdout.
+ */
+static volatile sig_atomic_t dump_requested = 0;
+
+/**
+ * @brief Time the server started, for the uptime in reports.
+ */
+static uint64_t start_ns = 0;
+
+/**
+ * @brief Connections to the admin listener (--admin-port).
+ */
+static admin_conn_t admin_conns[ADMIN_MAX_CONNS];
+
+/**
+ * @brief Iterations longer than this are counted and logged (--slow-loop), 0 to disable.
+ */
+static uint64_t slow_loop_ns = DEFAULT_SLOW_LOOP_MS * 1000000ULL;
+
+/**
+ * @brief The client port (--port).
+ */
+static int listen_port = PORT;
+
+/**
+ * @brief The leader this broker replicates (--follow), port 0 if none.
+ */
+static char follow_host[256];
+static int follow_port = 0;
+
+/**
+ * @brief The broker this broker bridges topics from (--bridge), port 0 if none, and
+ * the topic patterns it bridges (--bridge-topics).
+ */
+static char bridge_host[256];
+static int bridge_port = 0;
+static bridge_filter_t bridge_topics;
+
+/**
+ * @brief The partitioned topics (--partitions), shared read-only by every worker.
+ */
+static partition_table_t partition_table;
 
 // --- Function Prototypes ---
-void handle_new_connection(int server_fd, struct pollfd *fds, client_t *clients);
-void handle_client_data(struct pollfd *pfd, client_t *client, persistence_mode_t p_mode, int p_duration, struct pollfd *fds, client_t *clients);
+static void handle_admin_connection(int admin_fd, struct pollfd *fds);
+static void handle_admin_io(struct pollfd *pfd, admin_conn_t *conn, const broker_t *b);
+static void write_stats(FILE *out, const broker_t *b);
 
 /**
- * @brief Main function for the liteMQ server.
- * Initializes the server, handles command-line arguments for persistence, and enters the main event loop.
+ * @brief Records a shutdown request so the main loop can exit and report statistics.
  *
- * @param argc The number of command-line arguments.
- * @param argv An array of command-line argument strings.
- * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ * @param sig The signal number (unused).
  */
-int main(int argc, char *argv[]) {
-    persistence_mode_t persistence_mode = PERSIST_NONE;
-    int persistence_duration = 0;
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
 
-    // --- Argument Parsing ---
-    if (argc > 1) {
-        if (strcmp(argv[1], "--persist-all") == 0) {
-            persistence_mode = PERSIST_ALL;
-            printf("Persistence mode: ALL\n");
-        } else if (strcmp(argv[1], "--persist-timed") == 0) {
-            if (argc > 2) {
-                persistence_mode = PERSIST_TIMED;
-                persistence_duration = atoi(argv[2]);
-                printf("Persistence mode: TIMED (%d seconds)\n", persistence_duration);
-            } else {
-                fprintf(stderr, "Usage: %s --persist-timed <seconds>\n", argv[0]);
-                exit(EXIT_FAILURE);
+/**
+ * @brief Records a request to dump statistics from the main loop.
+ *
+ * @param sig The signal number (unused).
+ */
+static void handle_dump(int sig) {
+    (void)sig;
+    dump_requested = 1;
+}
+
+/**
+ * @brief Copies a worker's contribution to a report. Runs on the worker's own thread,
+ * or on any thread when the worker is not running.
+ *
+ * @param w The worker.
+ * @return worker_snapshot_t* The copy (free with free_snapshot()), or NULL if allocation failed.
+ */
+static worker_snapshot_t *take_snapshot(const worker_t *w) {
+    // Heap-allocated: a snapshot holds several histograms
+    worker_snapshot_t *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc snapshot: %s", strerror(errno));
+        return NULL;
+    }
+    const broker_t *b = &w->broker;
+    s->stats = broker_collect_stats(b);
+    if (w->persist != NULL) {
+        s->persist = *w->persist;
+    } else {
+        histogram_init(&s->persist.append_ns);
+        histogram_init(&s->persist.fsync_ns);
+    }
+    s->queue_delay = b->queue_delay;
+    s->keyed = b->parts.keyed;
+    s->round_robin = b->parts.round_robin;
+    if (w->shard != NULL) {
+        s->index = w->shard->index;
+        s->shared_topics = w->shard->topic_count;
+        s->posted = w->shard->posted;
+        s->received = w->shard->received;
+    }
+    for (int i = 1; i <= b->max_clients && s->conn_count < MAX_CLIENTS; i++) {
+        if (b->fds[i].fd == -1) {
+            continue;
+        }
+        const client_t *c = &b->clients[i];
+        conn_snapshot_t *conn = &s->conns[s->conn_count++];
+        conn->fd = c->fd;
+        conn->type = c->type;
+        snprintf(conn->topic, sizeof(conn->topic), "%s", c->topic);
+        conn->queued = c->out.pending;
+        conn->sent = c->out_sent;
+        conn->backlog_since = c->backlog_since;
+    }
+    const partition_state_t *parts = &b->parts;
+    if (parts->group_count > 0) {
+        size_t size = 0;
+        FILE *out = open_memstream(&s->group_lines, &size);
+        if (out != NULL) {
+            for (size_t i = 0; i < parts->group_count; i++) {
+                const partition_group_t *g = &parts->groups[i];
+                fprintf(out, "group %s id=%llu members=%zu partitions=%u rebalances=%llu\n", g->spec->topic,
+                        (unsigned long long)g->id, g->member_count, g->spec->count, (unsigned long long)g->rebalances);
             }
+            fclose(out);
+        }
+    }
+    return s;
+}
+
+/**
+ * @brief Frees a snapshot returned by take_snapshot().
+ *
+ * @param s The snapshot, or NULL.
+ */
+static void free_snapshot(worker_snapshot_t *s) {
+    if (s == NULL) {
+        return;
+    }
+    if (s->stats != NULL) {
+        stats_shard_free(s->stats);
+        free(s->stats);
+    }
+    free(s->group_lines);
+    free(s);
+}
+
+/**
+ * @brief Lets go of a snapshot request, freeing it and any answers nobody took if this
+ * was the last holder.
+ *
+ * @param req The request.
+ */
+static void release_request(snapshot_request_t *req) {
+    pthread_mutex_lock(&req->lock);
+    int last = --req->refs == 0;
+    pthread_mutex_unlock(&req->lock);
+    if (!last) {
+        return;
+    }
+    for (int k = 0; k < SHARD_MAX_WORKERS; k++) {
+        free_snapshot(req->snapshots[k]);
+    }
+    pthread_cond_destroy(&req->answered);
+    pthread_mutex_destroy(&req->lock);
+    free(req);
+}
+
+/**
+ * @brief Answers a snapshot request on the worker's thread, between its events.
+ *
+ * @param shard The worker's shard, or NULL if the request was discarded at shutdown.
+ * @param arg The snapshot_request_t.
+ */
+static void answer_snapshot(shard_t *shard, void *arg) {
+    snapshot_request_t *req = arg;
+    if (shard != NULL) {
+        worker_snapshot_t *s = take_snapshot(&workers[shard->index]);
+        pthread_mutex_lock(&req->lock);
+        req->snapshots[shard->index] = s;
+        req->pending--;
+        pthread_cond_signal(&req->answered);
+        pthread_mutex_unlock(&req->lock);
+    }
+    release_request(req);
+}
+
+/**
+ * @brief Collects the snapshot of every worker for one report. The reporting worker,
+ * and every worker when none runs concurrently, is copied on the spot. The others are
+ * asked through their inboxes and copy themselves at their next event; a worker that
+ * does not answer within REPORT_TIMEOUT_MS is left out of the report.
+ *
+ * The reporting thread blocks until the answers arrive. Only the main thread and the
+ * worker serving the admin port report while workers run, and neither is asked for
+ * anything by a worker, so the waits cannot form a cycle.
+ *
+ * @param self The broker of the worker making the report, or NULL from the main thread.
+ * @param snapshots Receives one snapshot per worker, NULL where none was taken.
+ */
+static void gather_snapshots(const broker_t *self, worker_snapshot_t **snapshots) {
+    int asked = 0;
+    for (int k = 0; k < worker_count; k++) {
+        worker_t *w = &workers[k];
+        if (!workers_running || &w->broker == self) {
+            snapshots[k] = take_snapshot(w);
+        } else {
+            asked++;
         }
+    }
+    if (asked == 0) {
+        return;
+    }
+    snapshot_request_t *req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc snapshot request: %s", strerror(errno));
+        return;
+    }
+    pthread_mutex_init(&req->lock, NULL);
+    pthread_cond_init(&req->answered, NULL);
+    req->refs = 1 + asked;
+    req->pending = asked;
+    for (int k = 0; k < worker_count; k++) {
+        if (snapshots[k] == NULL && &workers[k].broker != self && shard_call(&shard_group, k, answer_snapshot, req) < 0) {
+            pthread_mutex_lock(&req->lock);
+            req->refs--;
+            req->pending--;
+            pthread_mutex_unlock(&req->lock);
+        }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += REPORT_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (long)(REPORT_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&req->lock);
+    while (req->pending > 0 && pthread_cond_timedwait(&req->answered, &req->lock, &deadline) != ETIMEDOUT) {
+    }
+    if (req->pending > 0) {
+        log_warn(LOG_MODULE_BROKER, "%d worker(s) did not answer a report within %d ms; leaving them out", req->pending,
+                 REPORT_TIMEOUT_MS);
+    }
+    for (int k = 0; k < worker_count; k++) {
+        if (req->snapshots[k] != NULL) {
+            snapshots[k] = req->snapshots[k];
+            req->snapshots[k] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&req->lock);
+    release_request(req);
+}
+
+/**
+ * @brief Calls a function with the snapshot of every worker that contributed to a report.
+ *
+ * @param r The report.
+ * @param fn The function.
+ * @param ctx Context passed through to `fn`.
+ */
+static void for_each_worker(const report_t *r, void (*fn)(const worker_snapshot_t *s, void *ctx), void *ctx) {
+    for (int k = 0; k < worker_count; k++) {
+        if (r->snapshots[k] != NULL) {
+            fn(r->snapshots[k], ctx);
+        }
+    }
+}
+
+/**
+ * @brief Adds one worker's counters to a report.
+ *
+ * @param s The worker's snapshot.
+ * @param ctx The report_t.
+ */
+static void collect_worker(const worker_snapshot_t *s, void *ctx) {
+    report_t *r = ctx;
+    if (s->stats != NULL) {
+        stats_merge(r->total, s->stats);
+    }
+    persist_merge_stats(&r->persist, &s->persist);
+    if (s->queue_delay.total > 0) {
+        histogram_merge(&r->queue_delay, &s->queue_delay);
+    }
+    r->keyed += s->keyed;
+    r->round_robin += s->round_robin;
+    r->connections += s->conn_count;
+    for (size_t i = 0; i < s->conn_count; i++) {
+        r->queued += s->conns[i].queued;
+        if (s->conns[i].type == CLIENT_TYPE_SUBSCRIBER) {
+            r->subscribers++;
+        }
+    }
+}
+
+/**
+ * @brief Adds up the counters of every worker.
+ *
+ * @param self The broker of the worker making the report, or NULL from the main thread.
+ * @return report_t* The report (free with free_report()), or NULL if allocation failed.
+ */
+static report_t *collect_report(const broker_t *self) {
+    // Heap-allocated: a report holds several histograms
+    report_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc report: %s", strerror(errno));
+        return NULL;
+    }
+    r->total = malloc(sizeof(*r->total));
+    if (r->total == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc stats: %s", strerror(errno));
+        free(r);
+        return NULL;
+    }
+    stats_shard_init(r->total);
+    histogram_init(&r->persist.append_ns);
+    histogram_init(&r->persist.fsync_ns);
+    histogram_init(&r->queue_delay);
+    gather_snapshots(self, r->snapshots);
+    for_each_worker(r, collect_worker, r);
+    return r;
+}
+
+/**
+ * @brief Frees a report returned by collect_report().
+ *
+ * @param r The report.
+ */
+static void free_report(report_t *r) {
+    for (int k = 0; k < worker_count; k++) {
+        free_snapshot(r->snapshots[k]);
+    }
+    stats_shard_free(r->total);
+    free(r->total);
+    free(r);
+}
+
+/**
+ * @brief Writes the `conn` lines of one worker's connections.
+ *
+ * @param s The worker's snapshot.
+ * @param ctx The output stream.
+ */
+static void write_conn_lines(const worker_snapshot_t *s, void *ctx) {
+    FILE *out = ctx;
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < s->conn_count; i++) {
+        const conn_snapshot_t *c = &s->conns[i];
+        uint64_t lag_ms = c->backlog_since != 0 && now > c->backlog_since ? (now - c->backlog_since) / 1000000 : 0;
+        fprintf(out, "conn fd=%d type=%s topic=%s queued_bytes=%zu sent_bytes=%llu lag_ms=%llu\n",
+                c->fd, broker_client_type_name(c->type), c->type == CLIENT_TYPE_SUBSCRIBER ? c->topic : "-",
+                c->queued, (unsigned long long)c->sent, (unsigned long long)lag_ms);
+    }
+}
+
+/**
+ * @brief Writes the `worker` line of one worker (--workers above 1).
+ *
+ * @param s The worker's snapshot.
+ * @param ctx The output stream.
+ */
+static void write_worker_line(const worker_snapshot_t *s, void *ctx) {
+    FILE *out = ctx;
+    uint64_t messages_in = s->stats != NULL ? s->stats->messages_in : 0;
+    uint64_t messages_out = s->stats != NULL ? s->stats->messages_out : 0;
+    fprintf(out, "worker %d connections=%zu messages_in=%llu messages_out=%llu shared_topics=%zu posted=%llu received=%llu\n",
+            s->index, s->conn_count, (unsigned long long)messages_in, (unsigned long long)messages_out,
+            s->shared_topics, (unsigned long long)s->posted, (unsigned long long)s->received);
+}
+
+/**
+ * @brief Writes the `group` lines of one worker's consumer groups.
+ *
+ * @param s The worker's snapshot.
+ * @param ctx The output stream.
+ */
+static void write_group_lines(const worker_snapshot_t *s, void *ctx) {
+    FILE *out = ctx;
+    if (s->group_lines != NULL) {
+        fputs(s->group_lines, out);
+    }
+}
+
+/**
+ * @brief Writes the `replication` line of a single-worker broker.
+ *
+ * @param out The stream to write to.
+ * @param repl The worker's replication state.
+ */
+static void write_replication_line(FILE *out, const repl_t *repl) {
+    fprintf(out, "replication ack=%s followers=%zu leader=%s records_sent=%llu acks_received=%llu confirms=%llu "
+            "confirms_held=%zu records_applied=%llu duplicates=%llu diverged=%llu\n",
+            repl->ack_mode == REPL_ACK_SYNC ? "sync" : "async", repl->follower_count,
+            !repl->following ? "none" : repl->upstream_slot != 0 ? "connected" : "disconnected",
+            (unsigned long long)repl->records_sent, (unsigned long long)repl->acks_received,
+            (unsigned long long)repl->confirms, repl_pending(repl), (unsigned long long)repl->records_applied,
+            (unsigned long long)repl->duplicates, (unsigned long long)repl->diverged);
+}
+
+/**
+ * @brief Writes the `bridge` line of a single-worker broker.
+ *
+ * @param out The stream to write to.
+ * @param bridge The worker's bridge state.
+ */
+static void write_bridge_line(FILE *out, const bridge_t *bridge) {
+    fprintf(out, "bridge id=%llu bridges=%zu upstream=%s catchups=%llu records_sent=%llu exported=%llu suppressed=%llu "
+            "imported=%llu duplicates=%llu looped=%llu\n",
+            (unsigned long long)bridge->id, bridge->peer_count,
+            !bridge->bridging ? "none" : bridge->upstream_slot != 0 ? "connected" : "disconnected",
+            (unsigned long long)bridge->catchups, (unsigned long long)bridge->records_sent,
+            (unsigned long long)bridge->exported, (unsigned long long)bridge->suppressed,
+            (unsigned long long)bridge->imported, (unsigned long long)bridge->duplicates,
+            (unsigned long long)bridge->looped);
+}
+
+/**
+ * @brief Writes a statistics report: global counters, one line per topic and one per connection.
+ * The per-worker counters are merged here, so reading them costs nothing on the hot path.
+ *
+ * @param out The stream to write to.
+ * @param b The broker of the worker making the report, or NULL from the main thread.
+ */
+static void write_stats(FILE *out, const broker_t *b) {
+    report_t *r = collect_report(b);
+    if (r == NULL) {
+        return;
+    }
+    const stats_shard_t *total = r->total;
+    const persist_stats_t *ps = &r->persist;
+    persistence_mode_t p_mode = workers[0].broker.p_mode;
+    uint64_t now = monotonic_ns();
+
+    fprintf(out, "uptime_ms %llu\n", (unsigned long long)((now - start_ns) / 1000000));
+    fprintf(out, "connections %zu\n", r->connections);
+    fprintf(out, "subscribers %zu\n", r->subscribers);
+    fprintf(out, "loop_iterations %llu\n", (unsigned long long)total->loop_iterations);
+    fprintf(out, "poll_events %llu\n", (unsigned long long)total->poll_events);
+    fprintf(out, "connections_accepted %llu\n", (unsigned long long)total->connections_accepted);
+    fprintf(out, "frames_in %llu\n", (unsigned long long)total->frames_in);
+    fprintf(out, "bytes_read %llu\n", (unsigned long long)total->bytes_read);
+    fprintf(out, "bytes_written %llu\n", (unsigned long long)total->bytes_written);
+    fprintf(out, "messages_in %llu\n", (unsigned long long)total->messages_in);
+    fprintf(out, "messages_out %llu\n", (unsigned long long)total->messages_out);
+    fprintf(out, "slow_disconnects %llu\n", (unsigned long long)total->slow_disconnects);
+    fprintf(out, "slow_iterations %llu\n", (unsigned long long)total->slow_iterations);
+    fprintf(out, "parallel_fanouts %llu\n", (unsigned long long)total->parallel_fanouts);
+    fprintf(out, "fanout_steals %llu\n", (unsigned long long)total->fanout_steals);
+    if (total->loop_ns.total > 0) {
+        fprintf(out, "loop iteration_us p50=%.1f p99=%.1f max=%.1f events_per_wake p50=%llu p99=%llu max=%llu\n",
+                histogram_percentile(&total->loop_ns, 50) / 1000.0, histogram_percentile(&total->loop_ns, 99) / 1000.0,
+                total->loop_ns.max / 1000.0, (unsigned long long)histogram_percentile(&total->loop_events, 50),
+                (unsigned long long)histogram_percentile(&total->loop_events, 99),
+                (unsigned long long)total->loop_events.max);
+    }
+    if (total->read_lag_ns.total > 0) {
+        fprintf(out, "loop read_lag_us p50=%.1f p99=%.1f max=%.1f\n",
+                histogram_percentile(&total->read_lag_ns, 50) / 1000.0,
+                histogram_percentile(&total->read_lag_ns, 99) / 1000.0, total->read_lag_ns.max / 1000.0);
+    }
+    if (p_mode != PERSIST_NONE) {
+        fprintf(out, "persist appends=%llu append_errors=%llu bytes_written=%llu files_opened=%llu open_files=%llu "
+                "log_files=%llu fsyncs=%llu\n",
+                (unsigned long long)ps->appends, (unsigned long long)ps->append_errors,
+                (unsigned long long)ps->bytes_written, (unsigned long long)ps->files_opened,
+                (unsigned long long)ps->open_files, (unsigned long long)ps->log_files, (unsigned long long)ps->fsyncs);
+        fprintf(out, "persist compactions=%llu records_expired=%llu bytes_expired=%llu bytes_rewritten=%llu\n",
+                (unsigned long long)ps->compactions, (unsigned long long)ps->records_expired,
+                (unsigned long long)ps->bytes_expired, (unsigned long long)ps->bytes_rewritten);
+        fprintf(out, "persist replays=%llu replay_records=%llu replay_bytes=%llu replay_read_mb_per_s=%.1f\n",
+                (unsigned long long)ps->replays, (unsigned long long)ps->replay_records,
+                (unsigned long long)ps->replay_bytes,
+                ps->replay_read_ns > 0 ? ps->replay_bytes / (ps->replay_read_ns / 1e9) / (1024.0 * 1024.0) : 0.0);
+    }
+    if (ps->append_ns.total > 0) {
+        fprintf(out, "persist append_us p50=%.1f p99=%.1f max=%.1f\n", histogram_percentile(&ps->append_ns, 50) / 1000.0,
+                histogram_percentile(&ps->append_ns, 99) / 1000.0, ps->append_ns.max / 1000.0);
+    }
+    if (ps->fsync_ns.total > 0) {
+        fprintf(out, "persist fsync_us p50=%.1f p99=%.1f max=%.1f\n", histogram_percentile(&ps->fsync_ns, 50) / 1000.0,
+                histogram_percentile(&ps->fsync_ns, 99) / 1000.0, ps->fsync_ns.max / 1000.0);
+    }
+    for (int h = 0; h < STATS_HANDLER_COUNT; h++) {
+        const histogram_t *hist = &total->handler_ns[h];
+        if (hist->total > 0) {
+            fprintf(out, "handler %s calls=%llu p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+                    stats_handler_name((stats_handler_t)h), (unsigned long long)hist->total,
+                    histogram_percentile(hist, 50) / 1000.0, histogram_percentile(hist, 99) / 1000.0,
+                    hist->max / 1000.0);
+        }
+    }
+    if (PROF_ENABLED) {
+        double ns_per_tick = prof_ns_per_tick();
+        for (int p = 0; p < PROF_PHASE_COUNT; p++) {
+            uint64_t calls = total->prof.calls[p];
+            double ns = (double)total->prof.ticks[p] * ns_per_tick;
+            fprintf(out, "phase %s calls=%llu ticks=%llu total_us=%.0f avg_ns=%.1f\n", prof_phase_name((prof_phase_t)p),
+                    (unsigned long long)calls, (unsigned long long)total->prof.ticks[p], ns / 1000.0,
+                    calls > 0 ? ns / (double)calls : 0.0);
+        }
+    }
+    if (worker_count > 1) {
+        for_each_worker(r, write_worker_line, out);
     } else {
-        printf("Persistence mode: NONE\n");
+        write_replication_line(out, &workers[0].broker.repl);
+        write_bridge_line(out, &workers[0].broker.bridge);
+    }
+    if (partition_table.count > 0) {
+        fprintf(out, "partitions topics=%zu keyed=%llu round_robin=%llu\n", partition_table.count,
+                (unsigned long long)r->keyed, (unsigned long long)r->round_robin);
+        for_each_worker(r, write_group_lines, out);
     }
 
-    // Create logs directory if it doesn't exist
-    mkdir(LOG_DIR, 0755);
+    for (size_t t = 0; t < total->topic_count; t++) {
+        const topic_stats_t *ts = &total->topics[t];
+        fprintf(out, "topic %s subscribers=%llu msgs_in=%llu bytes_in=%llu msgs_out=%llu bytes_out=%llu persist_bytes=%llu\n",
+                ts->topic, (unsigned long long)ts->subscribers, (unsigned long long)ts->msgs_in,
+                (unsigned long long)ts->bytes_in, (unsigned long long)ts->msgs_out,
+                (unsigned long long)ts->bytes_out, (unsigned long long)ts->persist_bytes);
+    }
+
+    for_each_worker(r, write_conn_lines, out);
+    free_report(r);
+}
+
+/**
+ * @brief Writes the broker metrics in the Prometheus text exposition format.
+ *
+ * @param out The stream to write to.
+ * @param b The broker of the worker serving the request.
+ */
+static void write_metrics(FILE *out, const broker_t *b) {
+    report_t *r = collect_report(b);
+    if (r == NULL) {
+        return;
+    }
+    const stats_shard_t *total = r->total;
+    const persist_stats_t *ps = &r->persist;
+
+    admin_metric_header(out, "litemq_uptime_seconds", "gauge", "Seconds since the broker started.");
+    admin_metric_value(out, "litemq_uptime_seconds", NULL, NULL, (monotonic_ns() - start_ns) / 1000000000ULL);
+    admin_metric_header(out, "litemq_connections", "gauge", "Open client connections.");
+    admin_metric_value(out, "litemq_connections", NULL, NULL, r->connections);
+    admin_metric_header(out, "litemq_subscribers", "gauge", "Connected subscribers.");
+    admin_metric_value(out, "litemq_subscribers", NULL, NULL, r->subscribers);
+    admin_metric_header(out, "litemq_queued_bytes", "gauge", "Bytes queued for clients but not yet sent.");
+    admin_metric_value(out, "litemq_queued_bytes", NULL, NULL, r->queued);
+    admin_metric_header(out, "litemq_persist_open_files", "gauge", "Log files currently open.");
+    admin_metric_value(out, "litemq_persist_open_files", NULL, NULL, ps->open_files);
+    admin_metric_header(out, "litemq_persist_log_files", "gauge", "Topic logs appended to since the broker started.");
+    admin_metric_value(out, "litemq_persist_log_files", NULL, NULL, ps->log_files);
+
+    const struct {
+        const char *name;
+        const char *help;
+        uint64_t value;
+    } counters[] = {
+        { "litemq_loop_iterations_total", "Event loop wakeups.", total->loop_iterations },
+        { "litemq_poll_events_total", "Ready descriptors reported by poll.", total->poll_events },
+        { "litemq_connections_accepted_total", "Client connections accepted.", total->connections_accepted },
+        { "litemq_frames_received_total", "Frames parsed from clients.", total->frames_in },
+        { "litemq_bytes_read_total", "Bytes read from client sockets.", total->bytes_read },
+        { "litemq_bytes_written_total", "Bytes written to client sockets.", total->bytes_written },
+        { "litemq_messages_published_total", "Messages published.", total->messages_in },
+        { "litemq_messages_delivered_total", "Messages delivered to subscribers.", total->messages_out },
+        { "litemq_slow_disconnects_total", "Subscribers disconnected for exceeding the backlog limit.", total->slow_disconnects },
+        { "litemq_slow_loop_iterations_total", "Event loop iterations longer than the --slow-loop threshold.", total->slow_iterations },
+        { "litemq_parallel_fanouts_total", "Messages fanned out on the fan-out thread pool.", total->parallel_fanouts },
+        { "litemq_fanout_steals_total", "Fan-out chunks stolen by an idle pool lane.", total->fanout_steals },
+        { "litemq_persist_appends_total", "Records appended to topic logs.", ps->appends },
+        { "litemq_persist_append_errors_total", "Appends that failed to open, write or close a log.", ps->append_errors },
+        { "litemq_persist_bytes_written_total", "Bytes appended to topic logs, including record framing.", ps->bytes_written },
+        { "litemq_persist_files_opened_total", "Log files opened for appending, replay or compaction.", ps->files_opened },
+        { "litemq_persist_fsyncs_total", "fsync calls on topic logs.", ps->fsyncs },
+        { "litemq_persist_compactions_total", "Timed logs rewritten to drop expired records.", ps->compactions },
+        { "litemq_persist_records_expired_total", "Records dropped by retention.", ps->records_expired },
+        { "litemq_persist_bytes_expired_total", "Bytes dropped by retention.", ps->bytes_expired },
+        { "litemq_persist_bytes_rewritten_total", "Bytes copied into compacted logs.", ps->bytes_rewritten },
+        { "litemq_persist_replays_total", "Topic log replays.", ps->replays },
+        { "litemq_persist_replay_records_total", "Records read from topic logs during replays.", ps->replay_records },
+        { "litemq_persist_replay_bytes_read_total", "Bytes read from topic logs during replays.", ps->replay_bytes },
+        { "litemq_partition_keyed_total", "Messages placed in a partition by their key.", r->keyed },
+        { "litemq_partition_round_robin_total", "Messages without a key placed in a partition round-robin.", r->round_robin }
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        admin_metric_header(out, counters[i].name, "counter", counters[i].help);
+        admin_metric_value(out, counters[i].name, NULL, NULL, counters[i].value);
+    }
+    // Replication and bridging run on a single worker only
+    if (worker_count == 1) {
+        const repl_t *repl = &workers[0].broker.repl;
+        admin_metric_header(out, "litemq_replication_followers", "gauge", "Connected follower brokers.");
+        admin_metric_value(out, "litemq_replication_followers", NULL, NULL, repl->follower_count);
+        admin_metric_header(out, "litemq_replication_confirms_held", "gauge",
+                            "Publisher confirmations waiting for a follower (--replication sync).");
+        admin_metric_value(out, "litemq_replication_confirms_held", NULL, NULL, repl_pending(repl));
+        const struct {
+            const char *name;
+            const char *help;
+            uint64_t value;
+        } repl_counters[] = {
+            { "litemq_replication_records_sent_total", "Records sent to followers.", repl->records_sent },
+            { "litemq_replication_acks_received_total", "ACKs received from followers.", repl->acks_received },
+            { "litemq_replication_confirms_total", "ACKs sent to publishers.", repl->confirms },
+            { "litemq_replication_records_applied_total", "Records received from the leader and stored.", repl->records_applied },
+            { "litemq_replication_duplicates_total", "Records received from the leader that were already stored.", repl->duplicates },
+            { "litemq_replication_diverged_total", "Leader records stored under a different sequence number.", repl->diverged }
+        };
+        for (size_t i = 0; i < sizeof(repl_counters) / sizeof(repl_counters[0]); i++) {
+            admin_metric_header(out, repl_counters[i].name, "counter", repl_counters[i].help);
+            admin_metric_value(out, repl_counters[i].name, NULL, NULL, repl_counters[i].value);
+        }
+
+        const bridge_t *bridge = &workers[0].broker.bridge;
+        admin_metric_header(out, "litemq_bridge_peers", "gauge", "Connected brokers bridging topics from this one.");
+        admin_metric_value(out, "litemq_bridge_peers", NULL, NULL, bridge->peer_count);
+        const struct {
+            const char *name;
+            const char *help;
+            uint64_t value;
+        } bridge_counters[] = {
+            { "litemq_bridge_records_sent_total", "Records sent to bridges from the logs.", bridge->records_sent },
+            { "litemq_bridge_exported_total", "Messages sent to bridges as they were published.", bridge->exported },
+            { "litemq_bridge_suppressed_total", "Messages not sent to a bridge because they originated there.", bridge->suppressed },
+            { "litemq_bridge_imported_total", "Messages received from the upstream broker and published.", bridge->imported },
+            { "litemq_bridge_duplicates_total", "Messages received from the upstream broker twice.", bridge->duplicates },
+            { "litemq_bridge_looped_total", "Messages received from the upstream broker that originated here.", bridge->looped }
+        };
+        for (size_t i = 0; i < sizeof(bridge_counters) / sizeof(bridge_counters[0]); i++) {
+            admin_metric_header(out, bridge_counters[i].name, "counter", bridge_counters[i].help);
+            admin_metric_value(out, bridge_counters[i].name, NULL, NULL, bridge_counters[i].value);
+        }
+    }
+
+    // Labelled families list every topic under one HELP/TYPE header
+    admin_metric_header(out, "litemq_topic_subscribers", "gauge", "Connected subscribers per topic.");
+    for (size_t t = 0; t < total->topic_count; t++) {
+        admin_metric_value(out, "litemq_topic_subscribers", "topic", total->topics[t].topic,
+                           total->topics[t].subscribers);
+    }
+    const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } topic_counters[] = {
+        { "litemq_topic_messages_published_total", "Messages published per topic.", offsetof(topic_stats_t, msgs_in) },
+        { "litemq_topic_bytes_published_total", "Payload bytes published per topic.", offsetof(topic_stats_t, bytes_in) },
+        { "litemq_topic_messages_delivered_total", "Messages delivered per topic.", offsetof(topic_stats_t, msgs_out) },
+        { "litemq_topic_bytes_delivered_total", "Payload bytes delivered per topic.", offsetof(topic_stats_t, bytes_out) },
+        { "litemq_topic_persisted_bytes_total", "Payload bytes persisted per topic.", offsetof(topic_stats_t, persist_bytes) }
+    };
+    for (size_t i = 0; i < sizeof(topic_counters) / sizeof(topic_counters[0]); i++) {
+        admin_metric_header(out, topic_counters[i].name, "counter", topic_counters[i].help);
+        for (size_t t = 0; t < total->topic_count; t++) {
+            const uint64_t *value = (const uint64_t *)((const char *)&total->topics[t] + topic_counters[i].offset);
+            admin_metric_value(out, topic_counters[i].name, "topic", total->topics[t].topic, *value);
+        }
+    }
+
+    admin_metric_histogram(out, "litemq_publish_duration_seconds",
+                           "Time to persist a message and queue it for all subscribers.", &total->publish_ns);
+    admin_metric_histogram(out, "litemq_fanout_duration_seconds",
+                           "Time to queue a message for all subscribers.", &total->fanout_ns);
+    admin_metric_histogram(out, "litemq_persist_duration_seconds",
+                           "Time to append a message to its log.", &total->persist_ns);
+    admin_metric_histogram(out, "litemq_replay_duration_seconds",
+                           "Time to replay a topic's log to a new subscriber.", &total->replay_ns);
+    admin_metric_header(out, "litemq_persist_replay_read_seconds_total", "counter",
+                        "Time spent reading topic logs during replays.");
+    fprintf(out, "litemq_persist_replay_read_seconds_total %.9f\n", ps->replay_read_ns / 1e9);
+    admin_metric_histogram(out, "litemq_persist_append_duration_seconds",
+                           "Time to open, write and close a topic log for one append, excluding fsync.", &ps->append_ns);
+    admin_metric_histogram(out, "litemq_persist_fsync_duration_seconds",
+                           "Duration of each fsync of a topic log.", &ps->fsync_ns);
+    admin_metric_histogram(out, "litemq_loop_iteration_duration_seconds",
+                           "Time from poll returning to the end of the event loop iteration.", &total->loop_ns);
+    admin_metric_count_histogram(out, "litemq_loop_events_per_wakeup",
+                                 "Ready descriptors handled per event loop wakeup.", &total->loop_events);
+    admin_metric_histogram(out, "litemq_loop_read_lag_seconds",
+                           "Time from the kernel receiving client data to the broker reading it.", &total->read_lag_ns);
+    admin_metric_header(out, "litemq_loop_handler_duration_seconds", "histogram",
+                        "Time per event loop handler call, by handler.");
+    for (int h = 0; h < STATS_HANDLER_COUNT; h++) {
+        admin_metric_histogram_samples(out, "litemq_loop_handler_duration_seconds", "handler",
+                                       stats_handler_name((stats_handler_t)h), &total->handler_ns[h]);
+    }
+    if (b->stamp_messages) {
+        admin_metric_histogram(out, "litemq_delivery_queue_delay_seconds",
+                               "Time from ingress until a message was written to a subscriber.", &r->queue_delay);
+    }
+    free_report(r);
+}
+
+/**
+ * @brief Records the duration of one handler call and tracks the slowest of the iteration.
+ *
+ * @param b The broker whose loop made the call.
+ * @param handler Category of the call.
+ * @param fd Descriptor it served (taken before the call, which may close it).
+ * @param start Time the call started.
+ * @param slowest The slowest call so far in this iteration.
+ * @return uint64_t The current time, the start of the next call.
+ */
+static uint64_t time_handler(broker_t *b, stats_handler_t handler, int fd, uint64_t start, slowest_handler_t *slowest) {
+    uint64_t now = monotonic_ns();
+    uint64_t ns = now - start;
+    if (b->timing_enabled) {
+        histogram_record(&b->stats.handler_ns[handler], ns);
+    }
+    if (ns > slowest->ns) {
+        slowest->handler = handler;
+        slowest->fd = fd;
+        slowest->ns = ns;
+    }
+    return now;
+}
+
+/**
+ * @brief Prints the broker queueing-delay histogram collected with --timestamps.
+ *
+ * @param queue_delay The histogram.
+ */
+static void print_queue_delay(const histogram_t *queue_delay) {
+    if (queue_delay->total == 0) {
+        printf("Broker queue delay: no stamped messages delivered\n");
+        return;
+    }
+    printf("Broker queue delay over %llu deliveries (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n",
+           (unsigned long long)queue_delay->total,
+           histogram_percentile(queue_delay, 50) / 1000.0, histogram_percentile(queue_delay, 90) / 1000.0,
+           histogram_percentile(queue_delay, 99) / 1000.0, histogram_percentile(queue_delay, 99.9) / 1000.0,
+           queue_delay->max / 1000.0, histogram_mean(queue_delay) / 1000.0);
+}
 
+/**
+ * @brief Opens a non-blocking listening socket on the broker port.
+ * With several workers each opens its own socket with SO_REUSEPORT, and the kernel
+ * spreads incoming connections over them.
+ *
+ * @param reuseport Whether to share the port with the other workers.
+ * @return int The socket (exits on failure).
+ */
+static int open_listener(int reuseport) {
     int server_fd;
     struct sockaddr_in address;
     int opt = 1;
-    
-    struct pollfd fds[MAX_CLIENTS + 1];
-    client_t clients[MAX_CLIENTS + 1];
-
-    // Initializing data structures
-    for (int i = 0; i <= MAX_CLIENTS; i++) {
-        fds[i].fd = -1;
-        clients[i].fd = -1;
-        clients[i].type = CLIENT_TYPE_UNKNOWN;
-        memset(clients[i].topic, 0, MAX_TOPIC_LEN);
-    }
 
     if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
         perror("socket failed");
@@ -102,10 +895,14 @@ int main(int argc, char *argv[]) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
+    if (reuseport && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons((uint16_t)listen_port);
 
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
@@ -118,186 +915,747 @@ int main(int argc, char *argv[]) {
     }
 
     set_non_blocking(server_fd);
+    return server_fd;
+}
+
+/**
+ * @brief Connects to the leader (--follow) while not connected, at most once per FOLLOW_RETRY_MS.
+ * A refused or failed connection surfaces as a failed write and closes the slot again.
+ *
+ * @param b The broker.
+ * @param next_attempt_ns Time of the next allowed attempt, updated here.
+ */
+static void follow_leader(broker_t *b, uint64_t *next_attempt_ns) {
+    uint64_t now = monotonic_ns();
+    if (b->repl.upstream_slot != 0 || now < *next_attempt_ns) {
+        return;
+    }
+    *next_attempt_ns = now + FOLLOW_RETRY_MS * 1000000ULL;
+    int fd = repl_connect(follow_host, follow_port);
+    if (fd < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "connect to leader %s:%d: %s", follow_host, follow_port, strerror(errno));
+        return;
+    }
+    if (broker_follow(b, fd) < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Cannot follow the leader: no free client slot");
+    }
+}
+
+/**
+ * @brief Connects to the upstream broker (--bridge) while not connected, at most once per FOLLOW_RETRY_MS.
+ *
+ * @param b The broker.
+ * @param next_attempt_ns Time of the next allowed attempt, updated here.
+ */
+static void bridge_upstream(broker_t *b, uint64_t *next_attempt_ns) {
+    uint64_t now = monotonic_ns();
+    if (b->bridge.upstream_slot != 0 || now < *next_attempt_ns) {
+        return;
+    }
+    *next_attempt_ns = now + FOLLOW_RETRY_MS * 1000000ULL;
+    int fd = repl_connect(bridge_host, bridge_port);
+    if (fd < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "connect to upstream broker %s:%d: %s", bridge_host, bridge_port,
+                        strerror(errno));
+        return;
+    }
+    if (broker_bridge(b, fd) < 0) {
+        log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER, "Cannot bridge from the upstream broker: no free client slot");
+    }
+}
 
-    fds[0].fd = server_fd;
-    fds[0].events = POLLIN;
-    clients[0].fd = server_fd; 
+/**
+ * @brief Runs a worker's event loop until a shutdown is requested.
+ *
+ * @param w The worker.
+ */
+static void run_worker(worker_t *w) {
+    broker_t *b = &w->broker;
+    struct pollfd *fds = w->fds;
 
-    printf("Server listening on port %d\n", PORT);
+    // Loop health needs a clock read per handler; skip it when nothing consumes it
+    int timed = b->timing_enabled || slow_loop_ns > 0;
+    // A follower or bridge wakes up periodically to reconnect to its leader or upstream broker
+    int timeout_ms = follow_port > 0 || bridge_port > 0 ? FOLLOW_RETRY_MS : -1;
+    uint64_t next_follow_ns = 0;
+    uint64_t next_bridge_ns = 0;
 
-    while (1) {
-        int ret = poll(fds, MAX_CLIENTS + 1, -1);
+    while (!stop_requested && !__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        if (follow_port > 0) {
+            follow_leader(b, &next_follow_ns);
+        }
+        if (bridge_port > 0) {
+            bridge_upstream(b, &next_bridge_ns);
+        }
+        int ret = poll(fds, POLL_SLOTS, timeout_ms);
+        int poll_errno = errno;
+        if (dump_requested) {
+            dump_requested = 0;
+            write_stats(stdout, b);
+            fflush(stdout);
+        }
         if (ret < 0) {
-            perror("poll");
+            if (poll_errno == EINTR) {
+                continue;
+            }
+            log_error(LOG_MODULE_BROKER, "poll: %s", strerror(poll_errno));
             break;
         }
+        b->stats.loop_iterations++;
+        b->stats.poll_events += (uint64_t)ret;
+        PROF_START(iteration);
+        uint64_t woke = timed ? monotonic_ns() : 0;
+        uint64_t mark = woke;
+        slowest_handler_t slowest = { STATS_HANDLER_ACCEPT, -1, 0 };
 
         if (fds[0].revents & POLLIN) {
-            handle_new_connection(server_fd, fds, clients);
+            broker_accept(b, w->listen_fd);
+            if (timed) {
+                mark = time_handler(b, STATS_HANDLER_ACCEPT, w->listen_fd, mark, &slowest);
+            }
         }
 
         for (int i = 1; i <= MAX_CLIENTS; i++) {
-            if (fds[i].fd != -1 && (fds[i].revents & POLLIN)) {
-                handle_client_data(&fds[i], &clients[i], persistence_mode, persistence_duration, fds, clients);
+            int fd = fds[i].fd;
+            if (fd == -1 || fds[i].revents == 0) {
+                continue;
+            }
+            int wrote = 0;
+            // Zero-copy completions are reported as POLLERR; they are not a socket failure
+            if ((fds[i].revents & POLLERR) && outq_zerocopy_pending(&w->clients[i].out)) {
+                wrote = 1;
+                if (broker_reap_zerocopy(b, i) > 0) {
+                    fds[i].revents &= ~POLLERR;
+                }
+            }
+            if (fds[i].fd != -1 && (fds[i].revents & POLLOUT)) {
+                wrote = 1;
+                broker_handle_writable(b, i);
+            }
+            if (timed && wrote) {
+                mark = time_handler(b, STATS_HANDLER_WRITE, fd, mark, &slowest);
+            }
+            if (fds[i].fd != -1 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                broker_handle_readable(b, i);
+                if (timed) {
+                    mark = time_handler(b, STATS_HANDLER_READ, fd, mark, &slowest);
+                }
+            }
+        }
+
+        if (w->shard != NULL && (fds[WAKE_SLOT].revents & POLLIN)) {
+            shard_drain(w->shard);
+            if (timed) {
+                mark = time_handler(b, STATS_HANDLER_INBOX, fds[WAKE_SLOT].fd, mark, &slowest);
+            }
+        }
+
+        if (w->admin_fd != -1 && (fds[ADMIN_SLOT].revents & POLLIN)) {
+            handle_admin_connection(w->admin_fd, fds);
+            if (timed) {
+                mark = time_handler(b, STATS_HANDLER_ADMIN, w->admin_fd, mark, &slowest);
+            }
+        }
+        for (int k = 0; k < ADMIN_MAX_CONNS; k++) {
+            int fd = fds[ADMIN_SLOT + 1 + k].fd;
+            if (fd != -1 && fds[ADMIN_SLOT + 1 + k].revents) {
+                handle_admin_io(&fds[ADMIN_SLOT + 1 + k], &admin_conns[k], b);
+                if (timed) {
+                    mark = time_handler(b, STATS_HANDLER_ADMIN, fd, mark, &slowest);
+                }
             }
         }
+
+        if (timed) {
+            uint64_t elapsed = mark - woke;
+            if (b->timing_enabled) {
+                histogram_record(&b->stats.loop_ns, elapsed);
+                histogram_record(&b->stats.loop_events, (uint64_t)ret);
+            }
+            if (slow_loop_ns > 0 && elapsed > slow_loop_ns) {
+                b->stats.slow_iterations++;
+                log_ratelimited(LOG_LEVEL_WARN, LOG_MODULE_BROKER,
+                                "Slow event loop iteration: %.1f ms for %d ready descriptors; slowest %s on fd %d took %.1f ms",
+                                elapsed / 1e6, ret, stats_handler_name(slowest.handler), slowest.fd, slowest.ns / 1e6);
+            }
+        }
+        PROF_LAP(&b->stats.prof, PROF_ITERATION, iteration);
     }
+}
 
-    close(server_fd);
-    return 0;
+/**
+ * @brief Thread entry point of a worker (--workers above 1).
+ *
+ * @param arg The worker_t.
+ * @return void* NULL.
+ */
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    // Storage counters are per thread; reports find this thread's through w->persist
+    if (w->broker.timing_enabled) {
+        persist_set_timing(1);
+    }
+    w->persist = persist_get_stats();
+    run_worker(w);
+    // The counters go away with the thread
+    w->persist = NULL;
+    return NULL;
 }
 
 /**
- * @brief Handles a new incoming client connection.
- * Accepts the new connection, sets it to non-blocking mode, and adds it to the list of monitored file descriptors.
+ * @brief Main function for the liteMQ server.
+ * Initializes the server, handles command-line arguments for persistence, and enters the main event loop.
+ * With --workers N, N event loops run on their own threads while the main thread waits for signals.
  *
- * @param server_fd The server's listening socket file descriptor.
- * @param fds Pointer to the array of pollfd structures.
- * @param clients Pointer to the array of client_t structures.
+ * @param argc The number of command-line arguments.
+ * @param argv An array of command-line argument strings.
+ * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
  */
-void handle_new_connection(int server_fd, struct pollfd *fds, client_t *clients) {
-    struct sockaddr_in address;
-    socklen_t addrlen = sizeof(address);
-    int new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
-    if (new_socket < 0) {
-        perror("accept");
-        return;
+int main(int argc, char *argv[]) {
+    persistence_mode_t persistence_mode = PERSIST_NONE;
+    int persistence_duration = 0;
+    int admin_port = 0;
+    int persist_sync = 0;
+    int stamp_messages = 0;
+    size_t zerocopy_min = 0;
+    size_t splice_min = 0;
+    const char *capture_path = NULL;
+    capture_t capture;
+    int fanout_threads = 0;
+    size_t parallel_min = BROKER_DEFAULT_PARALLEL_MIN;
+    repl_ack_mode_t ack_mode = REPL_ACK_ASYNC;
+    uint64_t broker_id = 0;
+
+    // --- Argument Parsing ---
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--persist-all") == 0) {
+            persistence_mode = PERSIST_ALL;
+        } else if (strcmp(argv[i], "--persist-timed") == 0) {
+            if (i + 1 < argc) {
+                persistence_mode = PERSIST_TIMED;
+                persistence_duration = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --persist-timed <seconds>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--fsync") == 0) {
+            persist_sync = 1;
+        } else if (strcmp(argv[i], "--timestamps") == 0) {
+            stamp_messages = 1;
+        } else if (strcmp(argv[i], "--admin-port") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+                admin_port = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --admin-port <port>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--splice") == 0) {
+            if (i + 1 < argc && atol(argv[i + 1]) > 0) {
+                splice_min = (size_t)atol(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --splice <min_bytes>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--capture") == 0) {
+            if (i + 1 < argc) {
+                capture_path = argv[++i];
+            } else {
+                fprintf(stderr, "Usage: %s --capture <file>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--slow-loop") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+                slow_loop_ns = (uint64_t)atoi(argv[++i]) * 1000000ULL;
+            } else {
+                fprintf(stderr, "Usage: %s --slow-loop <ms>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--log") == 0) {
+            if (i + 1 >= argc || log_configure(argv[i + 1]) < 0) {
+                fprintf(stderr, "Usage: %s --log <level>[,<module>=<level>...]\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            if (i + 1 < argc && atol(argv[i + 1]) > 0) {
+                zerocopy_min = (size_t)atol(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --zerocopy <min_bytes>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--fanout-threads") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= FANPOOL_MAX_THREADS) {
+                fanout_threads = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --fanout-threads <1-%d>\n", argv[0], FANPOOL_MAX_THREADS);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--fanout-min") == 0) {
+            if (i + 1 < argc && atol(argv[i + 1]) > 0) {
+                parallel_min = (size_t)atol(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --fanout-min <subscribers>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--port") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0 && atoi(argv[i + 1]) <= 65535) {
+                listen_port = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --port <port>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            if (i + 1 >= argc || repl_parse_address(argv[i + 1], follow_host, sizeof(follow_host), &follow_port) < 0) {
+                fprintf(stderr, "Usage: %s --follow <host:port>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--replication") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "sync") == 0) {
+                ack_mode = REPL_ACK_SYNC;
+            } else if (i + 1 < argc && strcmp(argv[i + 1], "async") == 0) {
+                ack_mode = REPL_ACK_ASYNC;
+            } else {
+                fprintf(stderr, "Usage: %s --replication sync|async\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--bridge") == 0) {
+            if (i + 1 >= argc || repl_parse_address(argv[i + 1], bridge_host, sizeof(bridge_host), &bridge_port) < 0) {
+                fprintf(stderr, "Usage: %s --bridge <host:port>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--bridge-topics") == 0) {
+            if (i + 1 >= argc || bridge_filter_parse(&bridge_topics, argv[i + 1]) < 0) {
+                fprintf(stderr, "Usage: %s --bridge-topics <pattern>[,<pattern>...] (up to %d patterns, '*' matches any run of characters)\n",
+                        argv[0], BRIDGE_MAX_PATTERNS);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--broker-id") == 0) {
+            if (i + 1 < argc && strtoull(argv[i + 1], NULL, 10) > 0) {
+                broker_id = strtoull(argv[++i], NULL, 10);
+            } else {
+                fprintf(stderr, "Usage: %s --broker-id <non-zero number>\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--partitions") == 0) {
+            if (i + 1 >= argc || partition_table_add(&partition_table, argv[i + 1]) < 0) {
+                fprintf(stderr, "Usage: %s --partitions <topic>=<1-%d> (topics of up to %d characters)\n", argv[0],
+                        PARTITION_MAX, MAX_TOPIC_LEN - PARTITION_SUFFIX_LEN - 1);
+                exit(EXIT_FAILURE);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= SHARD_MAX_WORKERS) {
+                worker_count = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Usage: %s --workers <1-%d>\n", argv[0], SHARD_MAX_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    if (capture_path != NULL && worker_count > 1) {
+        fprintf(stderr, "--capture records one event loop and cannot be combined with --workers\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((follow_port > 0 || ack_mode == REPL_ACK_SYNC) &&
+        (persistence_mode == PERSIST_NONE || worker_count > 1)) {
+        fprintf(stderr, "--follow and --replication sync need --persist-all or --persist-timed, and one worker\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((bridge_port > 0) != (bridge_topics.count > 0) || (bridge_port > 0 && (worker_count > 1 || follow_port > 0))) {
+        fprintf(stderr, "--bridge needs --bridge-topics and one worker, and cannot be combined with --follow\n");
+        exit(EXIT_FAILURE);
+    }
+    // Create logs directory if it doesn't exist
+    mkdir(LOG_DIR, 0755);
+    if (persistence_mode != PERSIST_NONE) {
+        int converted = persist_upgrade_logs(persistence_mode);
+        if (converted < 0) {
+            fprintf(stderr, "Could not convert the logs in %s/ to the record format\n", LOG_DIR);
+            exit(EXIT_FAILURE);
+        }
+        if (converted > 0) {
+            printf("Converted %d log(s) to the record format\n", converted);
+        }
     }
 
-    set_non_blocking(new_socket);
+    // Records keep the ids of the brokers they came from, so a persisting broker keeps its own
+    if (broker_id == 0) {
+        broker_id = bridge_new_id(listen_port);
+        if (persistence_mode != PERSIST_NONE) {
+            broker_id = persist_broker_id(broker_id);
+        }
+    }
+    if (persistence_mode == PERSIST_ALL) {
+        printf("Persistence mode: ALL\n");
+    } else if (persistence_mode == PERSIST_TIMED) {
+        printf("Persistence mode: TIMED (%d seconds)\n", persistence_duration);
+    } else {
+        printf("Persistence mode: NONE\n");
+    }
+    if (persist_sync && persistence_mode != PERSIST_NONE) {
+        persist_set_fsync(1);
+        printf("Persistence fsync: ON\n");
+    }
+    if (stamp_messages) {
+        printf("Message timestamps: ON\n");
+    }
+    if (zerocopy_min > 0) {
+        printf("Zero-copy sends: payloads of %zu bytes or more\n", zerocopy_min);
+    }
+    for (size_t t = 0; t < partition_table.count; t++) {
+        printf("Partitioned topic: %s (%u partitions)\n", partition_table.specs[t].topic, partition_table.specs[t].count);
+    }
+    if (fanout_threads > 0) {
+        printf("Fan-out pool: %d threads per worker for topics with %zu subscribers or more\n", fanout_threads,
+               parallel_min);
+    }
 
-    int i;
-    for (i = 1; i <= MAX_CLIENTS; i++) {
-        if (fds[i].fd == -1) {
-            fds[i].fd = new_socket;
-            fds[i].events = POLLIN;
-            clients[i].fd = new_socket;
-            printf("New connection on fd %d\n", new_socket);
-            return;
+    // Worker state is large (client slots, histograms), so it lives on the heap
+    workers = calloc((size_t)worker_count, sizeof(worker_t));
+    if (workers == NULL || (worker_count > 1 && shard_group_init(&shard_group, worker_count) < 0)) {
+        perror("worker setup");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < worker_count; k++) {
+        worker_t *w = &workers[k];
+        for (int i = 0; i < POLL_SLOTS; i++) {
+            w->fds[i].fd = -1;
+            w->fds[i].events = 0;
         }
+        broker_init(&w->broker, w->fds, w->clients, MAX_CLIENTS);
+        w->broker.report = write_stats;
+        w->broker.p_mode = persistence_mode;
+        w->broker.p_duration = persistence_duration;
+        w->broker.stamp_messages = stamp_messages;
+        w->broker.zerocopy_min = zerocopy_min;
+        w->broker.repl.ack_mode = ack_mode;
+        w->broker.repl.following = follow_port > 0;
+        w->broker.parts.table = &partition_table;
+        w->broker.bridge.id = broker_id;
+        w->broker.bridge.imports = bridge_topics;
+        w->broker.bridge.bridging = bridge_port > 0;
+        w->listen_fd = -1;
+        w->admin_fd = -1;
+        if (splice_min > 0) {
+            if (splice_fanout_init(&w->broker.fanout, BROKER_SPLICE_MAX_PAYLOAD) < 0) {
+                perror("splice fan-out unavailable");
+                splice_min = 0;
+            } else {
+                w->broker.splice_min = splice_min;
+            }
+        }
+        if (fanout_threads > 0) {
+            // Signals go to the event loops, never to pool threads
+            sigset_t signals;
+            sigset_t saved;
+            sigemptyset(&signals);
+            sigaddset(&signals, SIGINT);
+            sigaddset(&signals, SIGTERM);
+            sigaddset(&signals, SIGUSR1);
+            pthread_sigmask(SIG_BLOCK, &signals, &saved);
+            int failed = fanpool_init(&w->pool, fanout_threads, &w->broker.subs) < 0 ||
+                         broker_set_fanout_pool(&w->broker, &w->pool, parallel_min) < 0;
+            pthread_sigmask(SIG_SETMASK, &saved, NULL);
+            if (failed) {
+                perror("fan-out pool");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (worker_count > 1) {
+            w->shard = &shard_group.shards[k];
+            shard_attach(w->shard, &w->broker);
+            w->fds[WAKE_SLOT].fd = w->shard->wake_fds[0];
+            w->fds[WAKE_SLOT].events = POLLIN;
+        }
+    }
+    if (splice_min > 0) {
+        printf("Splice fan-out: payloads of %zu to %zu bytes\n", splice_min, workers[0].broker.fanout.capacity);
+    }
+    if (capture_path != NULL) {
+        if (capture_open(&capture, capture_path, monotonic_ns()) < 0) {
+            perror("capture file");
+            exit(EXIT_FAILURE);
+        }
+        workers[0].broker.capture = &capture;
+        printf("Capturing published frames to %s\n", capture_path);
+    }
+
+    // A subscriber that goes away mid-write must not terminate the broker
+    signal(SIGPIPE, SIG_IGN);
+
+    // No SA_RESTART, so that poll() returns and the loop can exit cleanly
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = handle_dump;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    start_ns = monotonic_ns();
+    if (PROF_ENABLED) {
+        prof_calibrate();
+    }
+
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        admin_conns[i].fd = -1;
+    }
+
+    for (int k = 0; k < worker_count; k++) {
+        worker_t *w = &workers[k];
+        w->listen_fd = open_listener(worker_count > 1);
+        w->fds[0].fd = w->listen_fd;
+        w->fds[0].events = POLLIN;
+        w->clients[0].fd = w->listen_fd;
+    }
+
+    printf("Server listening on port %d\n", listen_port);
+    if (follow_port > 0) {
+        printf("Following leader at %s:%d\n", follow_host, follow_port);
+    }
+    if (bridge_port > 0) {
+        printf("Bridging %zu topic pattern(s) from %s:%d\n", bridge_topics.count, bridge_host, bridge_port);
+    }
+    printf("Broker id: %llu\n", (unsigned long long)broker_id);
+    if (ack_mode == REPL_ACK_SYNC) {
+        printf("Publisher confirmations: after a follower has stored the message\n");
+    }
+    if (worker_count > 1) {
+        printf("Workers: %d, connections shared with SO_REUSEPORT, topics owned by hash\n", worker_count);
     }
 
-    printf("Max clients reached. Rejecting new connection.\n");
-    close(new_socket);
+    if (admin_port > 0) {
+        // The first worker serves the admin listener; reports cover every worker
+        int admin_fd = admin_listen(admin_port);
+        if (admin_fd < 0) {
+            exit(EXIT_FAILURE);
+        }
+        workers[0].admin_fd = admin_fd;
+        workers[0].fds[ADMIN_SLOT].fd = admin_fd;
+        workers[0].fds[ADMIN_SLOT].events = POLLIN;
+        for (int k = 0; k < worker_count; k++) {
+            workers[k].broker.timing_enabled = 1;
+        }
+        persist_set_timing(1);
+        printf("Admin metrics on http://127.0.0.1:%d/metrics\n", admin_port);
+    }
+
+    // Runtime logging goes through the background writer from here on
+    log_start();
+
+    if (worker_count == 1) {
+        workers[0].persist = persist_get_stats();
+        run_worker(&workers[0]);
+    } else {
+        // Workers inherit the blocked signals; only the main thread receives them
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        int started = 0;
+        workers_running = 1;
+        for (; started < worker_count; started++) {
+            if (pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0) {
+                log_error(LOG_MODULE_BROKER, "pthread_create: %s", strerror(errno));
+                break;
+            }
+        }
+        while (started == worker_count) {
+            int sig;
+            if (sigwait(&signals, &sig) != 0) {
+                break;
+            }
+            if (sig != SIGUSR1) {
+                break;
+            }
+            write_stats(stdout, NULL);
+            fflush(stdout);
+        }
+        for (int k = 0; k < started; k++) {
+            __atomic_store_n(&workers[k].stop, 1, __ATOMIC_RELEASE);
+            ssize_t n = write(workers[k].shard->wake_fds[1], "", 1);
+            (void)n;
+        }
+        for (int k = 0; k < started; k++) {
+            pthread_join(workers[k].thread, NULL);
+        }
+        workers_running = 0;
+    }
+
+    // Flush pending records so the shutdown report follows them
+    log_stop();
+    printf("Shutting down.\n");
+    if (stamp_messages) {
+        report_t *r = collect_report(NULL);
+        if (r != NULL) {
+            print_queue_delay(&r->queue_delay);
+            free_report(r);
+        }
+    }
+    if (splice_min > 0) {
+        uint64_t loads = 0;
+        uint64_t deliveries = 0;
+        for (int k = 0; k < worker_count; k++) {
+            loads += workers[k].broker.splice_loads;
+            deliveries += workers[k].broker.splice_deliveries;
+        }
+        printf("Splice fan-out: %llu messages loaded, %llu deliveries spliced\n", (unsigned long long)loads,
+               (unsigned long long)deliveries);
+    }
+    if (capture_path != NULL) {
+        int failed = capture_close(&capture) < 0;
+        printf("Capture: %llu frames, %llu bytes written to %s%s\n", (unsigned long long)capture.frames,
+               (unsigned long long)capture.bytes, capture_path, failed ? " (write failed, capture is incomplete)" : "");
+    }
+    for (int k = 0; k < worker_count; k++) {
+        if (fanout_threads > 0) {
+            fanpool_free(&workers[k].pool);
+        }
+        broker_free(&workers[k].broker);
+        close(workers[k].listen_fd);
+    }
+    for (int k = 0; k < ADMIN_MAX_CONNS; k++) {
+        if (admin_conns[k].fd != -1) {
+            close(admin_conns[k].fd);
+            free(admin_conns[k].response);
+        }
+    }
+    if (workers[0].admin_fd != -1) {
+        close(workers[0].admin_fd);
+    }
+    if (worker_count > 1) {
+        shard_group_free(&shard_group);
+    }
+    free(workers);
+    return 0;
 }
 
 /**
- * @brief Handles incoming data from an existing client connection.
- * Reads data from the client, parses commands (SUB/PUB), and manages client state and message forwarding.
+ * @brief Accepts a connection on the admin listener into a free admin slot.
  *
- * @param pfd Pointer to the pollfd structure for the client.
- * @param client Pointer to the client_t structure for the client.
- * @param p_mode The current persistence mode of the server.
- * @param p_duration The persistence duration in seconds (if PERSIST_TIMED).
- * @param fds Pointer to the array of pollfd structures (for forwarding messages).
- * @param clients Pointer to the array of client_t structures (for forwarding messages).
- */
-void handle_client_data(struct pollfd *pfd, client_t *client, persistence_mode_t p_mode, int p_duration, struct pollfd *fds, client_t *clients) {
-    char buffer[BUFFER_SIZE] = {0};
-    int valread = read(pfd->fd, buffer, BUFFER_SIZE - 1);
-
-    if (valread <= 0) {
-        printf("Client on fd %d disconnected.\n", pfd->fd);
-        close(pfd->fd);
-        pfd->fd = -1;
-        client->fd = -1;
-        client->type = CLIENT_TYPE_UNKNOWN;
-        memset(client->topic, 0, MAX_TOPIC_LEN);
+ * @param admin_fd The admin listening socket.
+ * @param fds Pointer to the array of pollfd structures.
+ */
+static void handle_admin_connection(int admin_fd, struct pollfd *fds) {
+    int fd = accept(admin_fd, NULL, NULL);
+    if (fd < 0) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_ADMIN, "admin accept: %s", strerror(errno));
         return;
     }
+    for (int k = 0; k < ADMIN_MAX_CONNS; k++) {
+        if (admin_conns[k].fd == -1) {
+            set_non_blocking(fd);
+            admin_conns[k].fd = fd;
+            admin_conns[k].request_len = 0;
+            admin_conns[k].response = NULL;
+            admin_conns[k].response_len = 0;
+            admin_conns[k].response_off = 0;
+            fds[ADMIN_SLOT + 1 + k].fd = fd;
+            fds[ADMIN_SLOT + 1 + k].events = POLLIN;
+            return;
+        }
+    }
+    // All slots busy: the scraper will retry on its next interval
+    close(fd);
+}
 
-    buffer[valread] = '\0';
-
-    if (client->type == CLIENT_TYPE_UNKNOWN) {
-        if (strncmp(buffer, "SUB ", 4) == 0) {
-            char *topic_start = buffer + 4;
-            char *newline_pos = strchr(topic_start, '\n');
-            size_t topic_len;
+/**
+ * @brief Closes an admin connection and frees its slot.
+ *
+ * @param pfd Pointer to the pollfd structure for the connection.
+ * @param conn The connection.
+ */
+static void close_admin(struct pollfd *pfd, admin_conn_t *conn) {
+    close(conn->fd);
+    free(conn->response);
+    conn->response = NULL;
+    conn->fd = -1;
+    pfd->fd = -1;
+    pfd->events = 0;
+}
 
-            if (newline_pos) {
-                topic_len = newline_pos - topic_start;
-            } else {
-                topic_len = strlen(topic_start);
-            }
+/**
+ * @brief Builds the response to a complete admin request.
+ *
+ * @param conn The connection.
+ * @param b The broker.
+ * @return int 0 on success, -1 on failure.
+ */
+static int build_admin_response(admin_conn_t *conn, const broker_t *b) {
+    switch (admin_route(conn->request, conn->request_len)) {
+    case ADMIN_ROUTE_METRICS: {
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        if (out == NULL) {
+            log_error(LOG_MODULE_ADMIN, "open_memstream: %s", strerror(errno));
+            return -1;
+        }
+        write_metrics(out, b);
+        fclose(out);
+        int rc = admin_build_response("200 OK", body, body_len, &conn->response, &conn->response_len);
+        free(body);
+        return rc;
+    }
+    case ADMIN_ROUTE_NOT_FOUND:
+        return admin_build_response("404 Not Found", "not found\n", 10, &conn->response, &conn->response_len);
+    case ADMIN_ROUTE_BAD_METHOD:
+        return admin_build_response("405 Method Not Allowed", "method not allowed\n", 19, &conn->response,
+                                    &conn->response_len);
+    default:
+        return admin_build_response("400 Bad Request", "bad request\n", 12, &conn->response, &conn->response_len);
+    }
+}
 
-            if (topic_len > 0 && topic_len < MAX_TOPIC_LEN) {
-                client->type = CLIENT_TYPE_SUBSCRIBER;
-                strncpy(client->topic, topic_start, topic_len);
-                client->topic[topic_len] = '\0';
-                printf("fd %d subscribed to topic '%s'\n", pfd->fd, client->topic);
-                send_persisted_messages(pfd->fd, client->topic, p_mode, p_duration);
-            } else {
-                fprintf(stderr, "fd %d sent malformed SUB command: %s\n", pfd->fd, buffer);
-                close(pfd->fd);
-                pfd->fd = -1;
-                client->fd = -1;
-                client->type = CLIENT_TYPE_UNKNOWN;
-                memset(client->topic, 0, MAX_TOPIC_LEN);
-            }
-        } else if (strncmp(buffer, "PUB ", 4) == 0) {
-            // This is a publisher trying to send a message without first being identified.
-            // For simplicity, we'll allow it to proceed as a publisher for this single message.
-            // In a more complex system, publishers might also register.
-            // Fall through to the PUB handling below.
-        } else {
-            fprintf(stderr, "fd %d sent unknown command: %s\n", pfd->fd, buffer);
-            close(pfd->fd);
-            pfd->fd = -1;
-            client->fd = -1;
-            client->type = CLIENT_TYPE_UNKNOWN;
-            memset(client->topic, 0, MAX_TOPIC_LEN);
+/**
+ * @brief Reads an admin request and, once it is complete, sends the response without blocking.
+ * The connection is closed when the response has been sent.
+ *
+ * @param pfd Pointer to the pollfd structure for the connection.
+ * @param conn The connection.
+ * @param b The broker.
+ */
+static void handle_admin_io(struct pollfd *pfd, admin_conn_t *conn, const broker_t *b) {
+    if (conn->response == NULL) {
+        ssize_t n = recv(conn->fd, conn->request + conn->request_len, sizeof(conn->request) - conn->request_len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
             return;
         }
+        if (n <= 0) {
+            close_admin(pfd, conn);
+            return;
+        }
+        conn->request_len += (size_t)n;
+        if (!admin_request_complete(conn->request, conn->request_len) && conn->request_len < sizeof(conn->request)) {
+            return;
+        }
+        if (build_admin_response(conn, b) < 0) {
+            close_admin(pfd, conn);
+            return;
+        }
+        conn->response_off = 0;
+        pfd->events = POLLOUT;
     }
 
-    if (strncmp(buffer, "PUB ", 4) == 0) {
-        char pub_topic[MAX_TOPIC_LEN];
-        char *msg_start = strchr(buffer, '\n');
-
-        if (msg_start) {
-            int topic_len = msg_start - (buffer + 4);
-            if (topic_len > 0 && topic_len < MAX_TOPIC_LEN) {
-                strncpy(pub_topic, buffer + 4, topic_len);
-                pub_topic[topic_len] = '\0';
-                msg_start++; 
-
-                printf("Received message for topic '%s' from fd %d\n", pub_topic, pfd->fd);
-                persist_message(pub_topic, msg_start, p_mode);
-
-                // Forward to subscribers
-                for (int j = 1; j <= MAX_CLIENTS; j++) {
-                    if (fds[j].fd != -1 && clients[j].type == CLIENT_TYPE_SUBSCRIBER && strcmp(clients[j].topic, pub_topic) == 0) {
-                        char message_to_send[BUFFER_SIZE];
-                        int bytes_to_send = snprintf(message_to_send, BUFFER_SIZE, "MSG %s\n%s", pub_topic, msg_start);
-                        if (bytes_to_send < 0 || bytes_to_send >= BUFFER_SIZE) {
-                            fprintf(stderr, "Error formatting message for subscriber fd %d\n", clients[j].fd);
-                            continue;
-                        }
-                        if (write(clients[j].fd, message_to_send, bytes_to_send) < 0) {
-                            perror("write to subscriber failed");
-                        }
-                    }
-                }
-            } else {
-                fprintf(stderr, "fd %d sent malformed PUB topic: %s\n", pfd->fd, buffer);
+    while (conn->response_off < conn->response_len) {
+        ssize_t n = send(conn->fd, conn->response + conn->response_off, conn->response_len - conn->response_off,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-        } else {
-            fprintf(stderr, "fd %d sent malformed PUB message (no newline): %s\n", pfd->fd, buffer);
-        }
-        // Disconnect publisher
-        close(pfd->fd);
-        pfd->fd = -1;
-        client->fd = -1;
-    } else if (client->type == CLIENT_TYPE_SUBSCRIBER) {
-        // If a subscriber sends data after initial SUB command, it's unexpected.
-        // For now, we'll just log it and close the connection.
-        fprintf(stderr, "Subscriber fd %d sent unexpected data: %s\n", pfd->fd, buffer);
-        close(pfd->fd);
-        pfd->fd = -1;
-        client->fd = -1;
-        client->type = CLIENT_TYPE_UNKNOWN;
-        memset(client->topic, 0, MAX_TOPIC_LEN);
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_admin(pfd, conn);
+            }
+            return;
+        }
+        conn->response_off += (size_t)n;
     }
+    close_admin(pfd, conn);
 }
-
-
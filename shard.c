@@ -0,0 +1,480 @@
+/**
+ * @file shard.c
+ * @brief Implements topic ownership between broker cores running on separate worker threads.
+ * @author Mohammed Uddin
+ *
+ * The inbox is Vyukov's intrusive MPSC queue: a producer swaps its entry into `head`
+ * and then links the previous entry to it, so posting costs one atomic exchange and
+ * never waits. Between those two steps the consumer cannot see the new entry yet and
+ * stops early; the producer's wakeup, which comes after the link, makes it look again.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shard.h"
+#include "utils.h"
+#include "log.h"
+
+/**
+ * @brief Context for replaying an owned topic's log to a subscriber on another core.
+ */
+typedef struct {
+    shard_t *shard;                 ///< The owner.
+    const shard_msg_t *subscribe;   ///< The SUBSCRIBE message being served.
+} remote_replay_t;
+
+/**
+ * @brief Appends an entry to an inbox.
+ *
+ * @param inbox The inbox.
+ * @param link The entry.
+ */
+static void push_link(shard_inbox_t *inbox, shard_link_t *link) {
+    __atomic_store_n(&link->next, NULL, __ATOMIC_RELAXED);
+    shard_link_t *prev = __atomic_exchange_n(&inbox->head, link, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, link, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Appends a message to an inbox. Safe to call from any thread.
+ *
+ * @param inbox The inbox.
+ * @param msg The message; the inbox owns it from now on.
+ * @return int 1 if the consumer has to be woken, 0 if a wakeup is already pending.
+ */
+int shard_inbox_push(shard_inbox_t *inbox, shard_msg_t *msg) {
+    push_link(inbox, &msg->link);
+    return __atomic_exchange_n(&inbox->signalled, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+/**
+ * @brief Takes the oldest message off an inbox. Only the owning core may call it.
+ *
+ * @param inbox The inbox.
+ * @return shard_msg_t* The message (free it with free()), or NULL if none is ready.
+ */
+shard_msg_t *shard_inbox_pop(shard_inbox_t *inbox) {
+    shard_link_t *tail = inbox->tail;
+    shard_link_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &inbox->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        inbox->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        inbox->tail = next;
+        return (shard_msg_t *)tail;
+    }
+    // A producer has swapped itself in but not linked yet; its wakeup follows the link
+    if (tail != __atomic_load_n(&inbox->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    // The last entry can only be taken once the stub stands in for it
+    push_link(inbox, &inbox->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        inbox->tail = next;
+        return (shard_msg_t *)tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates the inboxes of a group of cores.
+ *
+ * @param group The group.
+ * @param count The number of cores, 1 to SHARD_MAX_WORKERS.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int shard_group_init(shard_group_t *group, int count) {
+    if (count < 1 || count > SHARD_MAX_WORKERS) {
+        errno = EINVAL;
+        return -1;
+    }
+    group->shards = calloc((size_t)count, sizeof(shard_t));
+    if (group->shards == NULL) {
+        return -1;
+    }
+    group->count = 0;
+    for (int i = 0; i < count; i++) {
+        shard_t *shard = &group->shards[i];
+        shard->group = group;
+        shard->index = i;
+        shard->inbox.head = &shard->inbox.stub;
+        shard->inbox.tail = &shard->inbox.stub;
+        if (pipe(shard->wake_fds) < 0) {
+            shard_group_free(group);
+            return -1;
+        }
+        set_non_blocking(shard->wake_fds[0]);
+        set_non_blocking(shard->wake_fds[1]);
+        group->count++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees a group, discarding messages still in its inboxes.
+ *
+ * @param group The group.
+ */
+void shard_group_free(shard_group_t *group) {
+    for (int i = 0; i < group->count; i++) {
+        shard_t *shard = &group->shards[i];
+        shard_msg_t *msg;
+        while ((msg = shard_inbox_pop(&shard->inbox)) != NULL) {
+            if (msg->type == SHARD_MSG_CALL) {
+                msg->call(NULL, msg->arg);
+            }
+            free(msg);
+        }
+        close(shard->wake_fds[0]);
+        close(shard->wake_fds[1]);
+        free(shard->topics);
+    }
+    free(group->shards);
+    group->shards = NULL;
+    group->count = 0;
+}
+
+/**
+ * @brief Returns the index of the core that owns a topic (FNV-1a hash of the name).
+ *
+ * @param group The group.
+ * @param topic The topic.
+ * @return int The owner's index.
+ */
+int shard_owner(const shard_group_t *group, const char *topic) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)topic; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return (int)(hash % (uint32_t)group->count);
+}
+
+/**
+ * @brief Allocates a message with room for its payload.
+ *
+ * @param type The kind of message.
+ * @param topic The topic.
+ * @param payload The payload, or NULL.
+ * @param len The payload length in bytes.
+ * @return shard_msg_t* The message, or NULL if allocation failed.
+ */
+static shard_msg_t *new_msg(shard_msg_type_t type, const char *topic, const char *payload, size_t len) {
+    shard_msg_t *msg = malloc(sizeof(*msg) + len);
+    if (msg == NULL) {
+        log_ratelimited(LOG_LEVEL_ERROR, LOG_MODULE_BROKER, "malloc worker message: %s", strerror(errno));
+        return NULL;
+    }
+    memset(msg, 0, sizeof(*msg));
+    msg->type = type;
+    snprintf(msg->topic, sizeof(msg->topic), "%s", topic);
+    msg->len = len;
+    if (len > 0) {
+        memcpy(msg->payload, payload, len);
+    }
+    return msg;
+}
+
+/**
+ * @brief Appends a message to a core's inbox and wakes the core if it is idle.
+ *
+ * @param target The receiving core.
+ * @param msg The message.
+ */
+static void push(shard_t *target, shard_msg_t *msg) {
+    if (shard_inbox_push(&target->inbox, msg)) {
+        // A full pipe already holds a wakeup, so a failed write loses nothing
+        ssize_t n = write(target->wake_fds[1], "", 1);
+        (void)n;
+    }
+}
+
+/**
+ * @brief Posts a message to another core and wakes it if it is idle.
+ *
+ * @param from The sending core.
+ * @param to Index of the receiving core.
+ * @param msg The message (may be NULL after a failed allocation, which is ignored).
+ */
+static void post(shard_t *from, int to, shard_msg_t *msg) {
+    if (msg == NULL) {
+        return;
+    }
+    msg->from = from->index;
+    from->posted++;
+    push(&from->group->shards[to], msg);
+}
+
+/**
+ * @brief Has a function run on a core's thread the next time it drains its inbox.
+ *
+ * @param group The group.
+ * @param to Index of the core.
+ * @param fn The function, called with a NULL core if the group is freed first.
+ * @param arg Argument passed through to `fn`.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int shard_call(shard_group_t *group, int to, shard_call_fn fn, void *arg) {
+    shard_msg_t *msg = new_msg(SHARD_MSG_CALL, "", NULL, 0);
+    if (msg == NULL) {
+        return -1;
+    }
+    msg->from = -1;
+    msg->call = fn;
+    msg->arg = arg;
+    push(&group->shards[to], msg);
+    return 0;
+}
+
+/**
+ * @brief Finds the entry of an owned topic, optionally adding it.
+ *
+ * @param shard The owner.
+ * @param topic The topic.
+ * @param create Whether to add the topic if it has no entry.
+ * @return shard_topic_t* The entry, or NULL if absent (or allocation failed).
+ */
+static shard_topic_t *find_topic(shard_t *shard, const char *topic, int create) {
+    for (size_t i = 0; i < shard->topic_count; i++) {
+        if (strcmp(shard->topics[i].topic, topic) == 0) {
+            return &shard->topics[i];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (shard->topic_count == shard->topic_cap) {
+        size_t new_cap = shard->topic_cap ? shard->topic_cap * 2 : 16;
+        shard_topic_t *grown = realloc(shard->topics, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            log_error(LOG_MODULE_BROKER, "realloc owned topics: %s", strerror(errno));
+            return NULL;
+        }
+        shard->topics = grown;
+        shard->topic_cap = new_cap;
+    }
+    shard_topic_t *entry = &shard->topics[shard->topic_count++];
+    snprintf(entry->topic, sizeof(entry->topic), "%s", topic);
+    entry->remote = 0;
+    return entry;
+}
+
+/**
+ * @brief Router hook: posts publishes for topics owned elsewhere to their owner.
+ *
+ * @param ctx The publishing core's shard_t.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param ingress_ns Time the message was received (0 when not stamping).
+ * @return int 1 if the message was posted, 0 if this core owns the topic.
+ */
+static int route_publish(void *ctx, const char *topic, const char *payload, size_t len, uint64_t ingress_ns) {
+    shard_t *shard = ctx;
+    int owner = shard_owner(shard->group, topic);
+    if (owner == shard->index) {
+        return 0;
+    }
+    shard_msg_t *msg = new_msg(SHARD_MSG_PUBLISH, topic, payload, len);
+    if (msg != NULL) {
+        msg->fields.ingress_ns = ingress_ns;
+    }
+    post(shard, owner, msg);
+    return 1;
+}
+
+/**
+ * @brief Router hook: asks the owner of a topic owned elsewhere to replay and confirm a subscription.
+ *
+ * @param ctx The subscribing core's shard_t.
+ * @param slot The subscriber's client slot.
+ * @param conn_id The subscriber's connection number.
+ * @param topic The topic.
+ * @param from_seq The first sequence number to replay.
+ * @return int 1 if the request was posted, 0 if this core owns the topic.
+ */
+static int route_subscribe(void *ctx, int slot, uint32_t conn_id, const char *topic, uint64_t from_seq) {
+    shard_t *shard = ctx;
+    int owner = shard_owner(shard->group, topic);
+    if (owner == shard->index) {
+        return 0;
+    }
+    shard_msg_t *msg = new_msg(SHARD_MSG_SUBSCRIBE, topic, NULL, 0);
+    if (msg != NULL) {
+        msg->slot = slot;
+        msg->conn_id = conn_id;
+        msg->fields.from_seq = from_seq;
+    }
+    post(shard, owner, msg);
+    return 1;
+}
+
+/**
+ * @brief Router hook: sends a message the owner has just persisted to every core that wants it.
+ *
+ * @param ctx The owner's shard_t.
+ * @param topic The topic of the message.
+ * @param payload The message payload.
+ * @param len The payload length in bytes.
+ * @param fields The header fields stamped by the owner.
+ */
+static void route_published(void *ctx, const char *topic, const char *payload, size_t len,
+                            const frame_fields_t *fields) {
+    shard_t *shard = ctx;
+    if (shard->topic_count == 0) {
+        return;
+    }
+    shard_topic_t *entry = find_topic(shard, topic, 0);
+    if (entry == NULL) {
+        return;
+    }
+    for (int i = 0; i < shard->group->count; i++) {
+        if (entry->remote & (1ULL << i)) {
+            shard_msg_t *msg = new_msg(SHARD_MSG_DELIVER, topic, payload, len);
+            if (msg != NULL) {
+                msg->fields = *fields;
+            }
+            post(shard, i, msg);
+        }
+    }
+}
+
+static const broker_router_t shard_router = { route_publish, route_subscribe, route_published };
+
+/**
+ * @brief Connects a core to its entry in the group and installs the router on it.
+ *
+ * @param shard The core's entry.
+ * @param broker The core.
+ */
+void shard_attach(shard_t *shard, broker_t *broker) {
+    shard->broker = broker;
+    if (shard->group->count > 1) {
+        broker->router = &shard_router;
+        broker->router_ctx = shard;
+    }
+}
+
+/**
+ * @brief Replay sink that posts each record to the subscribing core.
+ *
+ * @param topic The topic being replayed.
+ * @param message The message content.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the record.
+ * @param origin The broker the record originated on (unused).
+ * @param ctx Pointer to a remote_replay_t.
+ */
+static void remote_replay_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin,
+                               void *ctx) {
+    (void)origin;
+    remote_replay_t *replay = ctx;
+    shard_msg_t *msg = new_msg(SHARD_MSG_REPLAY, topic, message, len);
+    if (msg != NULL) {
+        msg->slot = replay->subscribe->slot;
+        msg->conn_id = replay->subscribe->conn_id;
+        msg->fields.seq = seq;
+    }
+    post(replay->shard, replay->subscribe->from, msg);
+}
+
+/**
+ * @brief Executes one message taken off a core's inbox.
+ *
+ * @param shard The receiving core.
+ * @param msg The message.
+ */
+static void execute(shard_t *shard, const shard_msg_t *msg) {
+    broker_t *b = shard->broker;
+    switch (msg->type) {
+    case SHARD_MSG_PUBLISH:
+        broker_publish(b, msg->topic, msg->payload, msg->len, msg->fields.ingress_ns);
+        break;
+
+    case SHARD_MSG_SUBSCRIBE: {
+        // Nothing is published here while the replay runs, so it ends exactly where live delivery starts
+        remote_replay_t replay = { shard, msg };
+        replay_persisted_messages(msg->topic, b->p_mode, b->p_duration, msg->fields.from_seq, remote_replay_sink,
+                                  &replay);
+        shard_msg_t *confirm = new_msg(SHARD_MSG_CONFIRM, msg->topic, NULL, 0);
+        if (confirm != NULL) {
+            confirm->slot = msg->slot;
+            confirm->conn_id = msg->conn_id;
+        }
+        post(shard, msg->from, confirm);
+        shard_topic_t *entry = find_topic(shard, msg->topic, 1);
+        if (entry != NULL) {
+            entry->remote |= 1ULL << msg->from;
+        }
+        break;
+    }
+
+    case SHARD_MSG_UNSUBSCRIBE: {
+        shard_topic_t *entry = find_topic(shard, msg->topic, 0);
+        if (entry != NULL) {
+            entry->remote &= ~(1ULL << msg->from);
+            if (entry->remote == 0) {
+                *entry = shard->topics[--shard->topic_count];
+            }
+        }
+        break;
+    }
+
+    case SHARD_MSG_DELIVER:
+        // Pending subscribers still count: their confirmation is on its way
+        if (broker_deliver(b, msg->topic, msg->payload, msg->len, &msg->fields) == 0 &&
+            broker_count_subscribers(b, msg->topic) == 0) {
+            post(shard, msg->from, new_msg(SHARD_MSG_UNSUBSCRIBE, msg->topic, NULL, 0));
+        }
+        break;
+
+    case SHARD_MSG_REPLAY:
+        broker_deliver_to(b, msg->slot, msg->conn_id, msg->topic, msg->payload, msg->len, msg->fields.seq);
+        break;
+
+    case SHARD_MSG_CONFIRM:
+        broker_confirm_subscription(b, msg->slot, msg->conn_id);
+        break;
+
+    case SHARD_MSG_CALL:
+        msg->call(shard, msg->arg);
+        break;
+    }
+}
+
+/**
+ * @brief Executes every message posted to a core. Call it when the wake pipe is readable.
+ * The wakeup flag is cleared before the inbox is read, so a message posted while the
+ * inbox is being drained either is seen now or wakes the core again.
+ *
+ * @param shard The core's entry.
+ * @return size_t The number of messages executed.
+ */
+size_t shard_drain(shard_t *shard) {
+    char buf[64];
+    while (read(shard->wake_fds[0], buf, sizeof(buf)) > 0) {
+    }
+    __atomic_store_n(&shard->inbox.signalled, 0, __ATOMIC_SEQ_CST);
+
+    size_t executed = 0;
+    shard_msg_t *msg;
+    while ((msg = shard_inbox_pop(&shard->inbox)) != NULL) {
+        // Calls are not traffic between cores, so they are not counted as received
+        if (msg->type != SHARD_MSG_CALL) {
+            shard->received++;
+        }
+        execute(shard, msg);
+        free(msg);
+        executed++;
+    }
+    return executed;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file shard.h
+ * @brief Declares topic ownership between broker cores running on separate worker threads.
+ * @author Mohammed Uddin
+ *
+ * With `--workers N` the server runs N broker cores, one per thread, each accepting its
+ * own share of the connections. Every topic is owned by exactly one core, chosen by a
+ * hash of its name, and only the owner persists the topic's messages, numbers them and
+ * replays its log. The per-topic order and the single writer per log are therefore the
+ * same as with one core, and the persistence layer needs no locks.
+ *
+ * Cores talk through one inbox each: an unbounded lock-free multi-producer queue, so any
+ * core can post to any other without blocking, and messages from one sender arrive in
+ * the order they were sent. A byte on the inbox's wake pipe makes the owner's poll()
+ * return; only the post that finds the inbox idle writes it.
+ *
+ * - A publish for a topic owned elsewhere is posted to the owner, which persists it,
+ *   fans it out to its own subscribers and posts a copy to every core that has asked
+ *   for the topic.
+ * - A subscription to a topic owned elsewhere is posted to the owner. The owner
+ *   replays the log to that one connection and then confirms the subscription. Until
+ *   the confirmation arrives the subscriber receives no live messages, so the replay
+ *   and the live stream neither overlap nor leave a gap.
+ * - A core that receives a topic's messages but no longer has subscribers for it
+ *   tells the owner to stop sending them.
+ * - Any thread can have a function run on a core's thread between its events, e.g. to
+ *   copy the core's counters for a report only when one is read.
+ */
+
+#ifndef LITEMQ_SHARD_H
+#define LITEMQ_SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "broker.h"
+
+#define SHARD_MAX_WORKERS 64
+
+/**
+ * @brief Kinds of message exchanged between cores.
+ */
+typedef enum {
+    SHARD_MSG_PUBLISH,     ///< A publish for the receiving owner.
+    SHARD_MSG_SUBSCRIBE,   ///< The sender has a new subscriber; replay and confirm it.
+    SHARD_MSG_UNSUBSCRIBE, ///< The sender has no subscribers left for the topic.
+    SHARD_MSG_DELIVER,     ///< A message persisted by the owner, for all local subscribers.
+    SHARD_MSG_REPLAY,      ///< A replayed message for one pending subscriber.
+    SHARD_MSG_CONFIRM,     ///< The replay for one pending subscriber is complete.
+    SHARD_MSG_CALL         ///< A function to run on the receiving core's thread.
+} shard_msg_type_t;
+
+/**
+ * @brief Link of an inbox entry.
+ */
+typedef struct shard_link {
+    struct shard_link *next; ///< The next entry, written by the producer that appended it.
+} shard_link_t;
+
+struct shard;
+
+/**
+ * @brief A function posted with shard_call().
+ *
+ * @param shard The core it runs on, or NULL if the message was discarded unexecuted.
+ * @param arg The argument given to shard_call().
+ */
+typedef void (*shard_call_fn)(struct shard *shard, void *arg);
+
+/**
+ * @brief A message posted to another core. Owned by the inbox until it is taken off.
+ */
+typedef struct {
+    shard_link_t link;         ///< Inbox link (first member).
+    shard_msg_type_t type;     ///< What the message asks for.
+    int from;                  ///< Index of the sending core.
+    char topic[MAX_TOPIC_LEN]; ///< The topic.
+    int slot;                  ///< Subscriber slot on the subscribing core (subscribe, replay, confirm).
+    uint32_t conn_id;          ///< Connection number of that subscriber.
+    frame_fields_t fields;     ///< Ingress and persist times, sequence number or replay start.
+    shard_call_fn call;        ///< The function to run (call).
+    void *arg;                 ///< Its argument (call).
+    size_t len;                ///< Payload length in bytes.
+    char payload[];            ///< The payload (publish, deliver, replay).
+} shard_msg_t;
+
+/**
+ * @brief Unbounded multi-producer, single-consumer queue (Vyukov's intrusive design).
+ */
+typedef struct {
+    shard_link_t *head; ///< Most recently appended entry; producers swap themselves in here.
+    shard_link_t *tail; ///< Oldest entry, only touched by the consumer.
+    shard_link_t stub;  ///< Placeholder entry that keeps the list non-empty.
+    int signalled;      ///< Set once a post has woken the consumer, until the consumer drains.
+} shard_inbox_t;
+
+/**
+ * @brief A topic owned by a core that subscribers on other cores have asked for.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< The topic.
+    uint64_t remote;           ///< Bit per other core that wants the topic's messages.
+} shard_topic_t;
+
+typedef struct shard_group shard_group_t;
+
+/**
+ * @brief One core's side of the topic ownership.
+ */
+typedef struct shard {
+    shard_group_t *group;  ///< The group this core belongs to.
+    int index;             ///< Index of this core in the group.
+    broker_t *broker;      ///< The core (set by shard_attach()).
+    shard_inbox_t inbox;   ///< Messages posted to this core.
+    int wake_fds[2];       ///< Pipe that wakes this core's poll() (read end first).
+    shard_topic_t *topics; ///< Owned topics with subscribers elsewhere.
+    size_t topic_count;    ///< Number of entries in topics.
+    size_t topic_cap;      ///< Allocated number of entries.
+    uint64_t posted;       ///< Messages this core posted to others.
+    uint64_t received;     ///< Messages from other cores this core took off its inbox, not counting calls.
+} shard_t;
+
+/**
+ * @brief All cores of one server.
+ */
+struct shard_group {
+    shard_t *shards; ///< One entry per core.
+    int count;       ///< Number of cores.
+};
+
+/**
+ * @brief Creates the inboxes of a group of cores.
+ *
+ * @param group The group.
+ * @param count The number of cores, 1 to SHARD_MAX_WORKERS.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int shard_group_init(shard_group_t *group, int count);
+
+/**
+ * @brief Frees a group, discarding messages still in its inboxes.
+ *
+ * @param group The group.
+ */
+void shard_group_free(shard_group_t *group);
+
+/**
+ * @brief Connects a core to its entry in the group and installs the router on it.
+ * The broker's persistence settings must be final, since the owner replays with them.
+ *
+ * @param shard The core's entry.
+ * @param broker The core.
+ */
+void shard_attach(shard_t *shard, broker_t *broker);
+
+/**
+ * @brief Returns the index of the core that owns a topic.
+ *
+ * @param group The group.
+ * @param topic The topic.
+ * @return int The owner's index.
+ */
+int shard_owner(const shard_group_t *group, const char *topic);
+
+/**
+ * @brief Appends a message to an inbox. Safe to call from any thread.
+ *
+ * @param inbox The inbox.
+ * @param msg The message; the inbox owns it from now on.
+ * @return int 1 if the consumer has to be woken, 0 if a wakeup is already pending.
+ */
+int shard_inbox_push(shard_inbox_t *inbox, shard_msg_t *msg);
+
+/**
+ * @brief Takes the oldest message off an inbox. Only the owning core may call it.
+ *
+ * @param inbox The inbox.
+ * @return shard_msg_t* The message (free it with free()), or NULL if none is ready.
+ */
+shard_msg_t *shard_inbox_pop(shard_inbox_t *inbox);
+
+/**
+ * @brief Has a function run on a core's thread the next time it drains its inbox.
+ * Safe to call from any thread, including threads that are not cores.
+ *
+ * @param group The group.
+ * @param to Index of the core.
+ * @param fn The function; it is called exactly once, with a NULL core if the group is
+ * freed before the message is executed.
+ * @param arg Argument passed through to `fn`.
+ * @return int 0 on success, -1 if allocation failed (`fn` is not called).
+ */
+int shard_call(shard_group_t *group, int to, shard_call_fn fn, void *arg);
+
+/**
+ * @brief Executes every message posted to a core. Call it when the wake pipe is readable.
+ *
+ * @param shard The core's entry.
+ * @return size_t The number of messages executed.
+ */
+size_t shard_drain(shard_t *shard);
+
+#endif // LITEMQ_SHARD_H
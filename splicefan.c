@@ -0,0 +1,174 @@
+/**
+ * @file splicefan.c
+ * @brief Implements the experimental pipe-based fan-out engine.
+ * @author Mohammed Uddin
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "splicefan.h"
+
+/**
+ * @brief Moves everything left in a pipe into /dev/null.
+ *
+ * @param sf The engine.
+ * @param pipe_read The read end of the pipe.
+ * @param len Upper bound on the bytes left in the pipe.
+ */
+static void discard_pipe(splice_fanout_t *sf, int pipe_read, size_t len) {
+#ifdef __linux__
+    while (len > 0) {
+        ssize_t n = splice(pipe_read, NULL, sf->sink, NULL, len, SPLICE_F_NONBLOCK);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        len -= (size_t)n;
+    }
+#else
+    (void)sf;
+    (void)pipe_read;
+    (void)len;
+#endif
+}
+
+/**
+ * @brief Creates the pipes, sizing them for payloads of up to `max_len` bytes if allowed.
+ *
+ * @param sf The engine.
+ * @param max_len The desired payload capacity.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int splice_fanout_init(splice_fanout_t *sf, size_t max_len) {
+    memset(sf, 0, sizeof(*sf));
+    sf->src[0] = sf->src[1] = sf->scratch[0] = sf->scratch[1] = sf->sink = -1;
+#ifdef __linux__
+    if (pipe2(sf->src, O_NONBLOCK) < 0) {
+        return -1;
+    }
+    if (pipe2(sf->scratch, O_NONBLOCK) < 0 || (sf->sink = open("/dev/null", O_WRONLY)) < 0) {
+        splice_fanout_free(sf);
+        return -1;
+    }
+    // Unprivileged processes are limited by /proc/sys/fs/pipe-max-size; keep what we get
+    fcntl(sf->src[1], F_SETPIPE_SZ, (int)max_len);
+    fcntl(sf->scratch[1], F_SETPIPE_SZ, (int)max_len);
+    int src_size = fcntl(sf->src[1], F_GETPIPE_SZ);
+    int scratch_size = fcntl(sf->scratch[1], F_GETPIPE_SZ);
+    if (src_size <= 0 || scratch_size <= 0) {
+        splice_fanout_free(sf);
+        return -1;
+    }
+    sf->capacity = (size_t)(src_size < scratch_size ? src_size : scratch_size);
+    return 0;
+#else
+    (void)max_len;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Loads a payload into the source pipe, replacing the previous one.
+ *
+ * @param sf The engine.
+ * @param data The payload bytes.
+ * @param len The payload length; must not exceed sf->capacity.
+ * @return int 0 on success, -1 on failure.
+ */
+int splice_fanout_load(splice_fanout_t *sf, const char *data, size_t len) {
+    if (len > sf->capacity) {
+        return -1;
+    }
+    discard_pipe(sf, sf->src[0], sf->loaded);
+    sf->loaded = 0;
+
+    // writev rather than vmsplice: the caller reuses its buffer, so the pipe needs its own copy
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    while (iov.iov_len > 0) {
+        ssize_t n = writev(sf->src[1], &iov, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            discard_pipe(sf, sf->src[0], len);
+            return -1;
+        }
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= (size_t)n;
+    }
+    sf->loaded = len;
+    return 0;
+}
+
+/**
+ * @brief Sends the loaded payload to a non-blocking socket without copying it again.
+ *
+ * @param sf The engine.
+ * @param fd The destination socket.
+ * @return ssize_t Bytes of the payload sent, or -1 on error (errno is set).
+ */
+ssize_t splice_fanout_send(splice_fanout_t *sf, int fd) {
+#ifdef __linux__
+    ssize_t copied;
+    do {
+        copied = tee(sf->src[0], sf->scratch[1], sf->loaded, SPLICE_F_NONBLOCK);
+    } while (copied < 0 && errno == EINTR);
+    if (copied < 0) {
+        return -1;
+    }
+
+    size_t left = (size_t)copied;
+    size_t sent = 0;
+    while (left > 0) {
+        ssize_t n = splice(sf->scratch[0], NULL, fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            int saved = errno;
+            discard_pipe(sf, sf->scratch[0], left);
+            errno = saved;
+            return -1;
+        }
+        left -= (size_t)n;
+        sent += (size_t)n;
+    }
+    discard_pipe(sf, sf->scratch[0], left);
+    return (ssize_t)sent;
+#else
+    (void)sf;
+    (void)fd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Closes the engine's pipes.
+ *
+ * @param sf The engine.
+ */
+void splice_fanout_free(splice_fanout_t *sf) {
+    int fds[] = { sf->src[0], sf->src[1], sf->scratch[0], sf->scratch[1], sf->sink };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    sf->src[0] = sf->src[1] = sf->scratch[0] = sf->scratch[1] = sf->sink = -1;
+    sf->capacity = 0;
+    sf->loaded = 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file splicefan.h
+ * @brief Declares the experimental pipe-based fan-out engine.
+ * @author Mohammed Uddin
+ *
+ * A payload is written into a source pipe once. For each subscriber, tee() duplicates
+ * the pipe's page references into a scratch pipe and splice() moves them into the
+ * socket, so the payload bytes cross from user space into the kernel only once however
+ * many subscribers receive them. Linux only; elsewhere splice_fanout_init() fails and
+ * callers keep using their regular send path.
+ */
+
+#ifndef LITEMQ_SPLICEFAN_H
+#define LITEMQ_SPLICEFAN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief State of the fan-out engine.
+ */
+typedef struct {
+    int src[2];      ///< Pipe holding the loaded payload.
+    int scratch[2];  ///< Pipe receiving a tee of the payload for one socket.
+    int sink;        ///< /dev/null, used to discard pipe contents without copying.
+    size_t capacity; ///< Largest payload the pipes can hold.
+    size_t loaded;   ///< Length of the payload currently in the source pipe.
+} splice_fanout_t;
+
+/**
+ * @brief Creates the pipes, sizing them for payloads of up to `max_len` bytes if allowed.
+ *
+ * @param sf The engine.
+ * @param max_len The desired payload capacity.
+ * @return int 0 on success, -1 on failure (errno is set).
+ */
+int splice_fanout_init(splice_fanout_t *sf, size_t max_len);
+
+/**
+ * @brief Loads a payload into the source pipe, replacing the previous one.
+ *
+ * @param sf The engine.
+ * @param data The payload bytes.
+ * @param len The payload length; must not exceed sf->capacity.
+ * @return int 0 on success, -1 on failure.
+ */
+int splice_fanout_load(splice_fanout_t *sf, const char *data, size_t len);
+
+/**
+ * @brief Sends the loaded payload to a non-blocking socket without copying it again.
+ * Whatever the socket does not accept right away is discarded from the scratch pipe;
+ * the caller queues the remainder through its regular path.
+ *
+ * @param sf The engine.
+ * @param fd The destination socket.
+ * @return ssize_t Bytes of the payload sent, or -1 on error (errno is set).
+ */
+ssize_t splice_fanout_send(splice_fanout_t *sf, int fd);
+
+/**
+ * @brief Closes the engine's pipes.
+ *
+ * @param sf The engine.
+ */
+void splice_fanout_free(splice_fanout_t *sf);
+
+#endif // LITEMQ_SPLICEFAN_H
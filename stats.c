@@ -0,0 +1,126 @@
+/**
+ * @file stats.c
+ * @brief Implements the broker's runtime counters.
+ * @author Mohammed Uddin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+/**
+ * @brief Initialises a shard with all counters at zero.
+ *
+ * @param shard The shard.
+ */
+void stats_shard_init(stats_shard_t *shard) {
+    memset(shard, 0, sizeof(*shard));
+    histogram_init(&shard->publish_ns);
+    histogram_init(&shard->fanout_ns);
+    histogram_init(&shard->persist_ns);
+    histogram_init(&shard->replay_ns);
+    histogram_init(&shard->loop_ns);
+    histogram_init(&shard->loop_events);
+    histogram_init(&shard->read_lag_ns);
+    for (int i = 0; i < STATS_HANDLER_COUNT; i++) {
+        histogram_init(&shard->handler_ns[i]);
+    }
+}
+
+/**
+ * @brief Frees a shard's topic table.
+ *
+ * @param shard The shard.
+ */
+void stats_shard_free(stats_shard_t *shard) {
+    free(shard->topics);
+    stats_shard_init(shard);
+}
+
+/**
+ * @brief Returns the counters of a topic, adding them if the topic is new.
+ *
+ * @param shard The shard.
+ * @param topic The topic name.
+ * @return topic_stats_t* The topic's counters, or NULL if allocation failed.
+ */
+topic_stats_t *stats_topic(stats_shard_t *shard, const char *topic) {
+    for (size_t i = 0; i < shard->topic_count; i++) {
+        if (strcmp(shard->topics[i].topic, topic) == 0) {
+            return &shard->topics[i];
+        }
+    }
+    if (shard->topic_count == shard->topic_cap) {
+        size_t new_cap = shard->topic_cap ? shard->topic_cap * 2 : 16;
+        topic_stats_t *grown = realloc(shard->topics, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            perror("realloc topic stats");
+            return NULL;
+        }
+        shard->topics = grown;
+        shard->topic_cap = new_cap;
+    }
+    topic_stats_t *entry = &shard->topics[shard->topic_count++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->topic, sizeof(entry->topic), "%s", topic);
+    return entry;
+}
+
+/**
+ * @brief Returns the name of a handler category, as used in reports and metric labels.
+ *
+ * @param handler The category.
+ * @return const char* The name.
+ */
+const char *stats_handler_name(stats_handler_t handler) {
+    static const char *const names[STATS_HANDLER_COUNT] = { "accept", "read", "write", "admin", "inbox" };
+    return handler < STATS_HANDLER_COUNT ? names[handler] : "unknown";
+}
+
+/**
+ * @brief Adds the counters of one shard to another.
+ *
+ * @param dst The shard receiving the sums.
+ * @param src The shard to add.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int stats_merge(stats_shard_t *dst, const stats_shard_t *src) {
+    dst->loop_iterations += src->loop_iterations;
+    dst->poll_events += src->poll_events;
+    dst->connections_accepted += src->connections_accepted;
+    dst->frames_in += src->frames_in;
+    dst->bytes_read += src->bytes_read;
+    dst->bytes_written += src->bytes_written;
+    dst->messages_in += src->messages_in;
+    dst->messages_out += src->messages_out;
+    dst->slow_disconnects += src->slow_disconnects;
+    dst->slow_iterations += src->slow_iterations;
+    dst->parallel_fanouts += src->parallel_fanouts;
+    dst->fanout_steals += src->fanout_steals;
+    histogram_merge(&dst->publish_ns, &src->publish_ns);
+    histogram_merge(&dst->fanout_ns, &src->fanout_ns);
+    histogram_merge(&dst->persist_ns, &src->persist_ns);
+    histogram_merge(&dst->replay_ns, &src->replay_ns);
+    histogram_merge(&dst->loop_ns, &src->loop_ns);
+    histogram_merge(&dst->loop_events, &src->loop_events);
+    histogram_merge(&dst->read_lag_ns, &src->read_lag_ns);
+    for (int i = 0; i < STATS_HANDLER_COUNT; i++) {
+        histogram_merge(&dst->handler_ns[i], &src->handler_ns[i]);
+    }
+    prof_merge(&dst->prof, &src->prof);
+    for (size_t i = 0; i < src->topic_count; i++) {
+        const topic_stats_t *from = &src->topics[i];
+        topic_stats_t *to = stats_topic(dst, from->topic);
+        if (to == NULL) {
+            return -1;
+        }
+        to->msgs_in += from->msgs_in;
+        to->bytes_in += from->bytes_in;
+        to->msgs_out += from->msgs_out;
+        to->bytes_out += from->bytes_out;
+        to->persist_bytes += from->persist_bytes;
+        to->subscribers += from->subscribers;
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file stats.h
+ * @brief Declares the broker's runtime counters.
+ * @author Mohammed Uddin
+ *
+ * Counters live in a stats_shard_t owned by the thread that updates them, so the hot
+ * path increments plain integers without locking or atomics. A report merges the
+ * shards only when it is requested (STATS command or SIGUSR1).
+ */
+
+#ifndef LITEMQ_STATS_H
+#define LITEMQ_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "histogram.h"
+#include "prof.h"
+
+/**
+ * @brief Counters of one topic.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< The topic name.
+    uint64_t msgs_in;          ///< Messages published to the topic.
+    uint64_t bytes_in;         ///< Payload bytes published to the topic.
+    uint64_t msgs_out;         ///< Messages delivered to subscribers (including replays).
+    uint64_t bytes_out;        ///< Payload bytes delivered to subscribers.
+    uint64_t persist_bytes;    ///< Payload bytes written to the topic's log.
+    uint64_t subscribers;      ///< Connected subscribers (only filled in by broker_collect_stats()).
+} topic_stats_t;
+
+/**
+ * @brief Categories of event-loop handler timed by the loop health metrics.
+ */
+typedef enum {
+    STATS_HANDLER_ACCEPT, ///< Accepting new connections.
+    STATS_HANDLER_READ,   ///< Reading and dispatching client input.
+    STATS_HANDLER_WRITE,  ///< Flushing queued output and reaping zero-copy completions.
+    STATS_HANDLER_ADMIN,  ///< Serving the admin HTTP endpoint.
+    STATS_HANDLER_INBOX,  ///< Executing messages posted by other workers (--workers).
+    STATS_HANDLER_COUNT
+} stats_handler_t;
+
+/**
+ * @brief Counters updated by one thread.
+ */
+typedef struct {
+    uint64_t loop_iterations;      ///< Event loop wakeups.
+    uint64_t poll_events;          ///< Ready descriptors reported by poll().
+    uint64_t connections_accepted; ///< Connections accepted.
+    uint64_t frames_in;            ///< Frames parsed from clients.
+    uint64_t bytes_read;           ///< Bytes read from client sockets.
+    uint64_t bytes_written;        ///< Bytes written to client sockets.
+    uint64_t messages_in;          ///< Messages published.
+    uint64_t messages_out;         ///< Messages delivered to subscribers.
+    uint64_t slow_disconnects;     ///< Subscribers dropped for exceeding their backlog limit.
+    uint64_t slow_iterations;      ///< Loop iterations longer than the --slow-loop threshold.
+    uint64_t parallel_fanouts;     ///< Messages fanned out on the fan-out pool.
+    uint64_t fanout_steals;        ///< Fan-out chunks a pool lane stole from another.
+    histogram_t publish_ns;        ///< Time to persist and fan out one message (when timing is on).
+    histogram_t fanout_ns;         ///< Time to queue one message for all its subscribers.
+    histogram_t persist_ns;        ///< Time to append one message to its log.
+    histogram_t replay_ns;         ///< Time to replay a topic's log to a new subscriber.
+    histogram_t loop_ns;           ///< Time from poll() returning to the end of the iteration.
+    histogram_t loop_events;       ///< Ready descriptors per wakeup.
+    histogram_t read_lag_ns;       ///< Time from the kernel receiving data to the broker reading it.
+    histogram_t handler_ns[STATS_HANDLER_COUNT]; ///< Time per handler call, by category.
+    prof_counters_t prof;          ///< Ticks spent in each phase of the event loop.
+    topic_stats_t *topics;         ///< Per-topic counters.
+    size_t topic_count;            ///< Number of topics in use.
+    size_t topic_cap;              ///< Allocated number of topics.
+} stats_shard_t;
+
+/**
+ * @brief Initialises a shard with all counters at zero.
+ *
+ * @param shard The shard.
+ */
+void stats_shard_init(stats_shard_t *shard);
+
+/**
+ * @brief Frees a shard's topic table.
+ *
+ * @param shard The shard.
+ */
+void stats_shard_free(stats_shard_t *shard);
+
+/**
+ * @brief Returns the counters of a topic, adding them if the topic is new.
+ *
+ * @param shard The shard.
+ * @param topic The topic name.
+ * @return topic_stats_t* The topic's counters, or NULL if allocation failed.
+ */
+topic_stats_t *stats_topic(stats_shard_t *shard, const char *topic);
+
+/**
+ * @brief Returns the name of a handler category, as used in reports and metric labels.
+ *
+ * @param handler The category.
+ * @return const char* The name.
+ */
+const char *stats_handler_name(stats_handler_t handler);
+
+/**
+ * @brief Adds the counters of one shard to another.
+ *
+ * @param dst The shard receiving the sums.
+ * @param src The shard to add.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int stats_merge(stats_shard_t *dst, const stats_shard_t *src);
+
+#endif // LITEMQ_STATS_H
@@ -4,69 +4,297 @@
  * @author Mohammed Uddin
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include "litemq.h"
 
-#define PORT 8080
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define RECONNECT_MAX_MS 5000
+
+/**
+ * @brief How received messages are written to the output.
+ */
+typedef enum {
+    OUTPUT_LINE,   ///< Each message followed by a newline.
+    OUTPUT_RAW,    ///< Message bytes only, back to back.
+    OUTPUT_LENGTH  ///< Each message preceded by a 4-byte big-endian length.
+} output_mode_t;
+
+/**
+ * @brief Buffered writer that issues one write(2) per OUTPUT_BUFFER_SIZE bytes.
+ */
+typedef struct {
+    int fd;              ///< Destination descriptor.
+    char *buf;           ///< Pending output.
+    size_t len;          ///< Bytes held in buf.
+    size_t cap;          ///< Size of buf.
+    output_mode_t mode;  ///< Message delimiting.
+    int failed;          ///< Set once a write has failed.
+    int timestamps;      ///< Prefix each line with the broker timestamps and the receive time.
+} writer_t;
+
+/**
+ * @brief Set by the signal handler to request a clean shutdown.
+ */
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * @brief Records a shutdown request so buffered output can be flushed before exiting.
+ *
+ * @param sig The signal number (unused).
+ */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * @brief Prints the command-line usage and exits.
+ *
+ * @param prog The program name.
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-m line|raw|length] [-o file] [-t] [-s seq | -g group] [-r ms] <topic>\n"
+            "\n"
+            "  -m  Output format: one message per line (default), raw bytes, or a\n"
+            "      4-byte big-endian length before each message.\n"
+            "  -o  Write messages to a file instead of stdout.\n"
+            "  -t  Line format only: prefix each message with the broker ingress time,\n"
+            "      persist time and local receive time (CLOCK_MONOTONIC ns, 0 if absent).\n"
+            "  -s  Start from this sequence number instead of replaying every persisted\n"
+            "      message (use the last sequence number printed on exit, plus one).\n"
+            "  -g  Join this consumer group (a number) of a partitioned topic; the\n"
+            "      group's members share its partitions and it resumes where it stopped.\n"
+            "  -r  Longest delay between reconnect attempts after the broker goes away\n"
+            "      (default %d ms; 0 exits instead of reconnecting).\n",
+            prog, RECONNECT_MAX_MS);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Writes all buffered output to the destination.
+ *
+ * @param w The writer.
+ * @return int 0 on success, -1 on error.
+ */
+static int writer_flush(writer_t *w) {
+    size_t off = 0;
+    while (off < w->len) {
+        ssize_t n = write(w->fd, w->buf + off, w->len - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!w->failed) {
+                perror("write output");
+            }
+            w->failed = 1;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    w->len = 0;
+    return 0;
+}
+
+/**
+ * @brief Appends bytes to the writer, flushing when the buffer fills.
+ * Chunks larger than the buffer are written directly.
+ *
+ * @param w The writer.
+ * @param data The bytes to write.
+ * @param len The number of bytes.
+ */
+static void writer_put(writer_t *w, const char *data, size_t len) {
+    if (w->len + len > w->cap && writer_flush(w) < 0) {
+        return;
+    }
+    if (len > w->cap) {
+        while (len > 0 && !w->failed) {
+            ssize_t n = write(w->fd, data, len);
+            if (n < 0 && errno != EINTR) {
+                perror("write output");
+                w->failed = 1;
+            } else if (n > 0) {
+                data += n;
+                len -= (size_t)n;
+            }
+        }
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/**
+ * @brief Writes each received message to the output in the selected format.
+ *
+ * @param msg The received message.
+ * @param arg The writer_t.
+ */
+static void write_message(const lmq_message_t *msg, void *arg) {
+    writer_t *w = arg;
+    if (w->timestamps) {
+        struct timespec ts;
+        char prefix[80];
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int n = snprintf(prefix, sizeof(prefix), "%llu %llu %llu ",
+                         (unsigned long long)msg->ingress_ns, (unsigned long long)msg->persist_ns,
+                         (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec);
+        writer_put(w, prefix, (size_t)n);
+    }
+    if (w->mode == OUTPUT_LENGTH) {
+        uint32_t net_len = htonl((uint32_t)msg->len);
+        writer_put(w, (const char *)&net_len, sizeof(net_len));
+    }
+    writer_put(w, msg->payload, msg->len);
+    if (w->mode == OUTPUT_LINE) {
+        writer_put(w, "\n", 1);
+    }
+}
 
 /**
  * @brief Main function for the liteMQ subscriber client.
  * Connects to the server, subscribes to a specified topic, and continuously receives messages.
+ * Output is flushed whenever no further message is immediately available, so a busy
+ * subscriber writes in large blocks while an idle one still shows messages promptly.
+ * If the broker goes away, the client library reconnects and resumes after the last
+ * received sequence number.
  *
  * @param argc The number of command-line arguments.
- * @param argv An array of command-line argument strings (expected: <topic>).
+ * @param argv An array of command-line argument strings (expected: [options] <topic>).
  * @return int Returns EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
  */
-int main(int argc, char const *argv[]) {
-    int sock = 0;
-    struct sockaddr_in serv_addr;
-    char buffer[1024] = {0};
+int main(int argc, char *argv[]) {
+    lmq_options_t opts;
+    lmq_options_init(&opts);
+    opts.reconnect_max_ms = RECONNECT_MAX_MS;
+    unsigned long long from_seq = 0;
+    unsigned long long group = 0;
+    writer_t writer = { STDOUT_FILENO, NULL, 0, OUTPUT_BUFFER_SIZE, OUTPUT_LINE, 0, 0 };
+    const char *path = NULL;
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <topic>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:m:o:ts:g:r:")) != -1) {
+        switch (opt) {
+        case 'h': opts.host = optarg; break;
+        case 'p': opts.port = atoi(optarg); break;
+        case 'm':
+            if (strcmp(optarg, "line") == 0) {
+                writer.mode = OUTPUT_LINE;
+            } else if (strcmp(optarg, "raw") == 0) {
+                writer.mode = OUTPUT_RAW;
+            } else if (strcmp(optarg, "length") == 0) {
+                writer.mode = OUTPUT_LENGTH;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'o': path = optarg; break;
+        case 't': writer.timestamps = 1; break;
+        case 's': from_seq = strtoull(optarg, NULL, 10); break;
+        case 'g':
+            group = strtoull(optarg, NULL, 10);
+            if (group == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'r': opts.reconnect_max_ms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1 || (writer.timestamps && writer.mode != OUTPUT_LINE) || (group != 0 && from_seq != 0)) {
+        usage(argv[0]);
     }
+    const char *topic = argv[optind];
 
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        printf("\n Socket creation error \n");
-        return -1;
+    if (path != NULL) {
+        writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (writer.fd < 0) {
+            perror("open output");
+            return EXIT_FAILURE;
+        }
+    }
+    writer.buf = malloc(writer.cap);
+    if (writer.buf == NULL) {
+        perror("malloc output buffer");
+        return EXIT_FAILURE;
     }
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(PORT);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if(inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr)<=0) {
-        printf("\nInvalid address/ Address not supported \n");
-        return -1;
+    lmq_client_t *client = lmq_connect(&opts);
+    if (client == NULL) {
+        perror("Connection Failed");
+        return EXIT_FAILURE;
     }
 
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        printf("\nConnection Failed \n");
-        return -1;
+    int rc = group != 0 ? lmq_subscribe_group(client, topic, group, write_message, &writer)
+                        : lmq_subscribe_from(client, topic, from_seq, write_message, &writer);
+    if (rc != LMQ_OK) {
+        fprintf(stderr, "Subscribe failed: %s\n", lmq_strerror(rc));
+        lmq_close(client);
+        return EXIT_FAILURE;
+    }
+    if (group != 0) {
+        fprintf(stderr, "Joined consumer group %llu of topic: %s\n", group, topic);
+    } else {
+        fprintf(stderr, "Subscribed to topic: %s\n", topic);
     }
 
-    char message[1024];
-    snprintf(message, sizeof(message), "SUB %s", argv[1]);
-
-    send(sock, message, strlen(message), 0);
-    printf("Subscribed to topic: %s\n", argv[1]);
-
-    while (1) {
-        int valread = read(sock, buffer, 1024);
-        if (valread == 0) {
-            printf("Server disconnected\n");
+    int connected = 1;
+    while (!stop_requested && !writer.failed) {
+        rc = lmq_poll(client, 0);
+        if (rc == 0) {
+            // Nothing more is immediately available: push output out, then wait
+            if (writer_flush(&writer) < 0) {
+                break;
+            }
+            rc = lmq_poll(client, -1);
+        }
+        if (rc < 0) {
             break;
         }
-        printf("%s\n", buffer);
-        memset(buffer, 0, sizeof(buffer));
+        if (connected != lmq_is_connected(client)) {
+            connected = !connected;
+            if (connected) {
+                fprintf(stderr, "Reconnected, resuming after sequence %llu\n",
+                        (unsigned long long)lmq_last_seq(client));
+            } else {
+                fprintf(stderr, "Connection lost, reconnecting...\n");
+            }
+        }
+    }
+    writer_flush(&writer);
+    if (lmq_last_seq(client) != 0) {
+        fprintf(stderr, "Last sequence number: %llu\n", (unsigned long long)lmq_last_seq(client));
     }
 
-    close(sock);
-    return 0;
+    if (rc == LMQ_ERR_CLOSED) {
+        fprintf(stderr, "Server disconnected\n");
+    } else if (rc < 0) {
+        fprintf(stderr, "Receive failed: %s\n", lmq_strerror(rc));
+    }
+
+    lmq_close(client);
+    free(writer.buf);
+    if (writer.fd != STDOUT_FILENO) {
+        close(writer.fd);
+    }
+    return (rc >= 0 || rc == LMQ_ERR_CLOSED) && !writer.failed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
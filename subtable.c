@@ -0,0 +1,424 @@
+/**
+ * @file subtable.c
+ * @brief Implements the subscription index published as immutable snapshots.
+ * @author Mohammed Uddin
+ *
+ * A snapshot is one block: the header, the topics sorted by name, their subscribers
+ * and an open-addressing hash table over the topics. Rebuilding merges the previous
+ * snapshot with the recorded changes; a removal is matched by connection number,
+ * which is unique per broker.
+ *
+ * Reclamation compares epochs. Replacing a snapshot increments the epoch and tags the
+ * old snapshot with the new value; a reader that has since announced a quiescent state
+ * has seen that epoch and can no longer hold the old snapshot.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "subtable.h"
+#include "log.h"
+
+/**
+ * @brief A subscriber with its topic, used while rebuilding.
+ */
+typedef struct {
+    const char *topic;      ///< The topic (owned by the old snapshot or the change log).
+    subtable_entry_t entry; ///< The subscriber.
+} subtable_pair_t;
+
+static const uint32_t empty_bucket = 0;
+
+// Every index starts on this snapshot; it is shared, so it is never retired or freed
+static subtable_snapshot_t empty_snapshot = { 0, 0, 0, &empty_bucket, NULL, 0, NULL };
+
+/**
+ * @brief Hashes a topic name (FNV-1a).
+ *
+ * @param topic The topic.
+ * @return uint32_t The hash.
+ */
+static uint32_t topic_hash(const char *topic) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)topic; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Initialises an empty index.
+ *
+ * @param t The index.
+ */
+void subtable_init(subtable_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->current = &empty_snapshot;
+    for (int i = 0; i < SUBTABLE_MAX_READERS; i++) {
+        t->readers[i].seen = UINT64_MAX;
+    }
+}
+
+/**
+ * @brief Frees a snapshot unless it is the shared empty one.
+ *
+ * @param snap The snapshot.
+ */
+static void free_snapshot(subtable_snapshot_t *snap) {
+    if (snap != &empty_snapshot) {
+        free(snap);
+    }
+}
+
+/**
+ * @brief Frees the index and every snapshot. No reader may be using it.
+ *
+ * @param t The index.
+ */
+void subtable_free(subtable_t *t) {
+    while (t->retired != NULL) {
+        subtable_snapshot_t *next = t->retired->next;
+        free_snapshot(t->retired);
+        t->retired = next;
+    }
+    free_snapshot(t->current);
+    t->current = &empty_snapshot;
+    free(t->changes);
+    t->changes = NULL;
+    t->change_count = 0;
+    t->change_cap = 0;
+}
+
+/**
+ * @brief Appends a change to the log.
+ *
+ * @param t The index.
+ * @return subtable_change_t* The new entry, or NULL if allocation failed.
+ */
+static subtable_change_t *new_change(subtable_t *t) {
+    if (t->change_count == t->change_cap) {
+        size_t new_cap = t->change_cap ? t->change_cap * 2 : 16;
+        subtable_change_t *grown = realloc(t->changes, new_cap * sizeof(*grown));
+        if (grown == NULL) {
+            log_error(LOG_MODULE_BROKER, "realloc subscription changes: %s", strerror(errno));
+            return NULL;
+        }
+        t->changes = grown;
+        t->change_cap = new_cap;
+    }
+    return &t->changes[t->change_count++];
+}
+
+/**
+ * @brief Records a new subscriber. Writer only; visible after the next subtable_publish().
+ *
+ * @param t The index.
+ * @param topic The topic.
+ * @param slot The subscriber's client slot.
+ * @param conn_id Its connection number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int subtable_add(subtable_t *t, const char *topic, int slot, uint32_t conn_id) {
+    subtable_change_t *change = new_change(t);
+    if (change == NULL) {
+        return -1;
+    }
+    snprintf(change->topic, sizeof(change->topic), "%s", topic);
+    change->entry.slot = slot;
+    change->entry.conn_id = conn_id;
+    change->add = 1;
+    return 0;
+}
+
+/**
+ * @brief Records that a subscriber is gone. Writer only; visible after the next subtable_publish().
+ *
+ * @param t The index.
+ * @param slot The subscriber's client slot.
+ * @param conn_id Its connection number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int subtable_remove(subtable_t *t, int slot, uint32_t conn_id) {
+    subtable_change_t *change = new_change(t);
+    if (change == NULL) {
+        return -1;
+    }
+    change->topic[0] = '\0';
+    change->entry.slot = slot;
+    change->entry.conn_id = conn_id;
+    change->add = 0;
+    return 0;
+}
+
+/**
+ * @brief Orders connection numbers for bsearch().
+ */
+static int compare_conn_id(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Orders rebuild pairs by topic, then by slot.
+ */
+static int compare_pair(const void *a, const void *b) {
+    const subtable_pair_t *x = a;
+    const subtable_pair_t *y = b;
+    int cmp = strcmp(x->topic, y->topic);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (x->entry.slot > y->entry.slot) - (x->entry.slot < y->entry.slot);
+}
+
+/**
+ * @brief Builds a snapshot from sorted pairs.
+ *
+ * @param pairs The subscribers, sorted with compare_pair().
+ * @param count Number of pairs.
+ * @return subtable_snapshot_t* The snapshot, or NULL if allocation failed.
+ */
+static subtable_snapshot_t *build_snapshot(const subtable_pair_t *pairs, size_t count) {
+    size_t topic_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || strcmp(pairs[i].topic, pairs[i - 1].topic) != 0) {
+            topic_count++;
+        }
+    }
+    size_t bucket_count = 1;
+    while (bucket_count < topic_count * 2) {
+        bucket_count *= 2;
+    }
+
+    // Header, topics and entries keep pointer alignment; the 32-bit buckets go last
+    size_t size = sizeof(subtable_snapshot_t) + topic_count * sizeof(subtable_topic_t) +
+                  count * sizeof(subtable_entry_t) + bucket_count * sizeof(uint32_t);
+    char *block = calloc(1, size);
+    if (block == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc subscription snapshot: %s", strerror(errno));
+        return NULL;
+    }
+    subtable_snapshot_t *snap = (subtable_snapshot_t *)block;
+    subtable_topic_t *topics = (subtable_topic_t *)(block + sizeof(*snap));
+    subtable_entry_t *entries = (subtable_entry_t *)(topics + topic_count);
+    uint32_t *buckets = (uint32_t *)(entries + count);
+
+    size_t t = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || strcmp(pairs[i].topic, pairs[i - 1].topic) != 0) {
+            snprintf(topics[t].topic, sizeof(topics[t].topic), "%s", pairs[i].topic);
+            topics[t].entries = &entries[i];
+            t++;
+        }
+        entries[i] = pairs[i].entry;
+        topics[t - 1].count++;
+    }
+    for (size_t i = 0; i < topic_count; i++) {
+        size_t b = topic_hash(topics[i].topic) & (bucket_count - 1);
+        while (buckets[b] != 0) {
+            b = (b + 1) & (bucket_count - 1);
+        }
+        buckets[b] = (uint32_t)i + 1;
+    }
+
+    snap->topic_count = topic_count;
+    snap->entry_count = count;
+    snap->bucket_mask = bucket_count - 1;
+    snap->buckets = buckets;
+    snap->topics = topics;
+    return snap;
+}
+
+/**
+ * @brief Frees the replaced snapshots that no registered reader can still hold.
+ *
+ * @param t The index.
+ */
+static void reclaim(subtable_t *t) {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < SUBTABLE_MAX_READERS; i++) {
+        if (t->readers[i].in_use) {
+            uint64_t seen = __atomic_load_n(&t->readers[i].seen, __ATOMIC_SEQ_CST);
+            if (seen < oldest) {
+                oldest = seen;
+            }
+        }
+    }
+    subtable_snapshot_t **link = &t->retired;
+    while (*link != NULL) {
+        subtable_snapshot_t *snap = *link;
+        if (snap->retired_epoch <= oldest) {
+            *link = snap->next;
+            free_snapshot(snap);
+            t->reclaimed++;
+        } else {
+            link = &snap->next;
+        }
+    }
+}
+
+/**
+ * @brief Builds and publishes a snapshot with the recorded changes, then frees the
+ * replaced snapshots no reader can hold any more. Writer only; does nothing without changes.
+ *
+ * @param t The index.
+ * @return int 0 on success, -1 if allocation failed (the previous snapshot stays current
+ *         and the changes are kept).
+ */
+int subtable_publish(subtable_t *t) {
+    if (t->change_count == 0) {
+        return 0;
+    }
+    subtable_snapshot_t *old = t->current;
+    size_t removals = 0;
+    size_t additions = 0;
+    for (size_t i = 0; i < t->change_count; i++) {
+        if (t->changes[i].add) {
+            additions++;
+        } else {
+            removals++;
+        }
+    }
+
+    uint32_t *removed = malloc((removals ? removals : 1) * sizeof(*removed));
+    subtable_pair_t *pairs = malloc((old->entry_count + additions ? old->entry_count + additions : 1) * sizeof(*pairs));
+    if (removed == NULL || pairs == NULL) {
+        log_error(LOG_MODULE_BROKER, "malloc subscription rebuild: %s", strerror(errno));
+        free(removed);
+        free(pairs);
+        return -1;
+    }
+    size_t r = 0;
+    for (size_t i = 0; i < t->change_count; i++) {
+        if (!t->changes[i].add) {
+            removed[r++] = t->changes[i].entry.conn_id;
+        }
+    }
+    qsort(removed, removals, sizeof(*removed), compare_conn_id);
+
+    size_t count = 0;
+    for (size_t i = 0; i < old->topic_count; i++) {
+        const subtable_topic_t *topic = &old->topics[i];
+        for (size_t j = 0; j < topic->count; j++) {
+            if (bsearch(&topic->entries[j].conn_id, removed, removals, sizeof(*removed), compare_conn_id) == NULL) {
+                pairs[count].topic = topic->topic;
+                pairs[count].entry = topic->entries[j];
+                count++;
+            }
+        }
+    }
+    for (size_t i = 0; i < t->change_count; i++) {
+        const subtable_change_t *change = &t->changes[i];
+        if (change->add &&
+            bsearch(&change->entry.conn_id, removed, removals, sizeof(*removed), compare_conn_id) == NULL) {
+            pairs[count].topic = change->topic;
+            pairs[count].entry = change->entry;
+            count++;
+        }
+    }
+    qsort(pairs, count, sizeof(*pairs), compare_pair);
+    subtable_snapshot_t *snap = build_snapshot(pairs, count);
+    free(removed);
+    free(pairs);
+    if (snap == NULL) {
+        return -1;
+    }
+
+    __atomic_store_n(&t->current, snap, __ATOMIC_SEQ_CST);
+    // The new epoch orders the swap before the reader states read by reclaim()
+    uint64_t epoch = __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+    if (old != &empty_snapshot) {
+        old->retired_epoch = epoch;
+        old->next = t->retired;
+        t->retired = old;
+    }
+    t->change_count = 0;
+    t->publishes++;
+    reclaim(t);
+    return 0;
+}
+
+/**
+ * @brief Returns the subscribers of a topic in a snapshot.
+ *
+ * @param snap The snapshot.
+ * @param topic The topic.
+ * @return const subtable_topic_t* The topic's entry, or NULL if it has no subscribers.
+ */
+const subtable_topic_t *subtable_lookup(const subtable_snapshot_t *snap, const char *topic) {
+    if (snap->topic_count == 0) {
+        return NULL;
+    }
+    size_t b = topic_hash(topic) & snap->bucket_mask;
+    while (snap->buckets[b] != 0) {
+        const subtable_topic_t *entry = &snap->topics[snap->buckets[b] - 1];
+        if (strcmp(entry->topic, topic) == 0) {
+            return entry;
+        }
+        b = (b + 1) & snap->bucket_mask;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Registers a reader thread, initially online. Writer only.
+ *
+ * @param t The index.
+ * @return subtable_reader_t* The registration, or NULL if SUBTABLE_MAX_READERS are registered.
+ */
+subtable_reader_t *subtable_register_reader(subtable_t *t) {
+    for (int i = 0; i < SUBTABLE_MAX_READERS; i++) {
+        subtable_reader_t *reader = &t->readers[i];
+        if (!reader->in_use) {
+            __atomic_store_n(&reader->seen, __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+            reader->in_use = 1;
+            return reader;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Removes a reader registration. Writer only, after the reader thread has stopped.
+ *
+ * @param reader The registration.
+ */
+void subtable_unregister_reader(subtable_reader_t *reader) {
+    reader->in_use = 0;
+    __atomic_store_n(&reader->seen, UINT64_MAX, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Announces that the calling reader holds no snapshot.
+ *
+ * @param t The index.
+ * @param reader The reader's registration.
+ */
+void subtable_quiescent(subtable_t *t, subtable_reader_t *reader) {
+    __atomic_store_n(&reader->seen, __atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Announces that the calling reader will not read the index until subtable_online().
+ *
+ * @param reader The reader's registration.
+ */
+void subtable_offline(subtable_reader_t *reader) {
+    __atomic_store_n(&reader->seen, UINT64_MAX, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Announces that the calling reader is about to read the index again.
+ * The full fence keeps the writer from missing the announcement while this reader
+ * picks up a snapshot that is being replaced.
+ *
+ * @param t The index.
+ * @param reader The reader's registration.
+ */
+void subtable_online(subtable_t *t, subtable_reader_t *reader) {
+    __atomic_store_n(&reader->seen, __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,197 @@
+/**
+ * @file subtable.h
+ * @brief Declares the subscription index: topic to subscriber slots, published as immutable snapshots.
+ * @author Mohammed Uddin
+ *
+ * Fan-out reads the index for every message, while subscriptions change rarely. The
+ * index is therefore read-copy-update: readers follow the current snapshot with a
+ * single load and never write to shared memory, and the writer collects changes and
+ * builds a new snapshot the next time the index is read from its own thread. Changes
+ * between two publishes cost one rebuild, however many there are.
+ *
+ * A replaced snapshot is freed once every other thread reading the index has passed a
+ * quiescent state, a point where it holds no snapshot (quiescent-state-based
+ * reclamation). A reader thread registers once, calls subtable_quiescent() between
+ * reads, for example once per task, and goes offline while it sleeps so it does not
+ * hold up reclamation. The writer's own thread needs no registration.
+ *
+ * The index holds (slot, connection number) pairs, so an entry whose slot has since
+ * been reused by another connection is recognised as stale.
+ */
+
+#ifndef LITEMQ_SUBTABLE_H
+#define LITEMQ_SUBTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#define SUBTABLE_MAX_READERS 64
+
+/**
+ * @brief One subscriber in the index.
+ */
+typedef struct {
+    int slot;         ///< The subscriber's client slot.
+    uint32_t conn_id; ///< Connection number of the subscription.
+} subtable_entry_t;
+
+/**
+ * @brief The subscribers of one topic in a snapshot.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN];       ///< The topic.
+    const subtable_entry_t *entries; ///< Its subscribers, by ascending slot.
+    size_t count;                    ///< Number of entries.
+} subtable_topic_t;
+
+/**
+ * @brief An immutable version of the index. Allocated as one block.
+ */
+typedef struct subtable_snapshot {
+    size_t topic_count;             ///< Number of topics.
+    size_t entry_count;             ///< Number of subscribers over all topics.
+    size_t bucket_mask;             ///< Hash buckets minus one (a power of two minus one).
+    const uint32_t *buckets;        ///< Index + 1 into topics per bucket, 0 if empty.
+    const subtable_topic_t *topics; ///< The topics.
+    uint64_t retired_epoch;         ///< Epoch at which it was replaced (writer only).
+    struct subtable_snapshot *next; ///< Next replaced snapshot awaiting reclamation (writer only).
+} subtable_snapshot_t;
+
+/**
+ * @brief A thread that reads the index outside the writer's thread.
+ */
+typedef struct {
+    uint64_t seen; ///< Last epoch observed at a quiescent state, UINT64_MAX while offline.
+    int in_use;    ///< Registration flag (writer only).
+} subtable_reader_t;
+
+/**
+ * @brief A change not yet published.
+ */
+typedef struct {
+    char topic[MAX_TOPIC_LEN]; ///< The topic (additions only).
+    subtable_entry_t entry;    ///< The subscriber.
+    int add;                   ///< 1 to add the subscriber, 0 to remove it.
+} subtable_change_t;
+
+/**
+ * @brief The index and its writer-side state.
+ */
+typedef struct {
+    subtable_snapshot_t *current;                    ///< Snapshot readers see.
+    uint64_t epoch;                                  ///< Incremented each time a snapshot is replaced.
+    subtable_reader_t readers[SUBTABLE_MAX_READERS]; ///< Registered reader threads.
+    subtable_snapshot_t *retired;                    ///< Replaced snapshots not yet freed, newest first.
+    subtable_change_t *changes;                      ///< Changes since the last publish.
+    size_t change_count;                             ///< Number of changes.
+    size_t change_cap;                               ///< Allocated number of changes.
+    uint64_t publishes;                              ///< Snapshots built.
+    uint64_t reclaimed;                              ///< Replaced snapshots freed.
+} subtable_t;
+
+/**
+ * @brief Initialises an empty index.
+ *
+ * @param t The index.
+ */
+void subtable_init(subtable_t *t);
+
+/**
+ * @brief Frees the index and every snapshot. No reader may be using it.
+ *
+ * @param t The index.
+ */
+void subtable_free(subtable_t *t);
+
+/**
+ * @brief Records a new subscriber. Writer only; visible after the next subtable_publish().
+ *
+ * @param t The index.
+ * @param topic The topic.
+ * @param slot The subscriber's client slot.
+ * @param conn_id Its connection number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int subtable_add(subtable_t *t, const char *topic, int slot, uint32_t conn_id);
+
+/**
+ * @brief Records that a subscriber is gone. Writer only; visible after the next subtable_publish().
+ *
+ * @param t The index.
+ * @param slot The subscriber's client slot.
+ * @param conn_id Its connection number.
+ * @return int 0 on success, -1 if allocation failed.
+ */
+int subtable_remove(subtable_t *t, int slot, uint32_t conn_id);
+
+/**
+ * @brief Builds and publishes a snapshot with the recorded changes, then frees the
+ * replaced snapshots no reader can hold any more. Writer only; does nothing without changes.
+ *
+ * @param t The index.
+ * @return int 0 on success, -1 if allocation failed (the previous snapshot stays current
+ *         and the changes are kept).
+ */
+int subtable_publish(subtable_t *t);
+
+/**
+ * @brief Returns the current snapshot. Safe from any thread; a reader other than the
+ * writer must be registered and online, and must not use the snapshot after its next
+ * quiescent state.
+ *
+ * @param t The index.
+ * @return const subtable_snapshot_t* The snapshot.
+ */
+static inline const subtable_snapshot_t *subtable_current(const subtable_t *t) {
+    return __atomic_load_n(&t->current, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the subscribers of a topic in a snapshot.
+ *
+ * @param snap The snapshot.
+ * @param topic The topic.
+ * @return const subtable_topic_t* The topic's entry, or NULL if it has no subscribers.
+ */
+const subtable_topic_t *subtable_lookup(const subtable_snapshot_t *snap, const char *topic);
+
+/**
+ * @brief Registers a reader thread, initially online. Writer only.
+ *
+ * @param t The index.
+ * @return subtable_reader_t* The registration, or NULL if SUBTABLE_MAX_READERS are registered.
+ */
+subtable_reader_t *subtable_register_reader(subtable_t *t);
+
+/**
+ * @brief Removes a reader registration. Writer only, after the reader thread has stopped.
+ *
+ * @param reader The registration.
+ */
+void subtable_unregister_reader(subtable_reader_t *reader);
+
+/**
+ * @brief Announces that the calling reader holds no snapshot.
+ *
+ * @param t The index.
+ * @param reader The reader's registration.
+ */
+void subtable_quiescent(subtable_t *t, subtable_reader_t *reader);
+
+/**
+ * @brief Announces that the calling reader will not read the index until subtable_online().
+ *
+ * @param reader The reader's registration.
+ */
+void subtable_offline(subtable_reader_t *reader);
+
+/**
+ * @brief Announces that the calling reader is about to read the index again.
+ *
+ * @param t The index.
+ * @param reader The reader's registration.
+ */
+void subtable_online(subtable_t *t, subtable_reader_t *reader);
+
+#endif // LITEMQ_SUBTABLE_H
@@ -0,0 +1,130 @@
+/**
+ * @file test_admin.c
+ * @brief Unit tests for the admin HTTP helpers and the Prometheus exposition writer.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "../admin.h"
+
+/**
+ * @brief Tests request completeness detection and routing.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_admin_requests() {
+    const char *scrape = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    mu_assert("test_admin_requests: complete", admin_request_complete(scrape, strlen(scrape)));
+    mu_assert("test_admin_requests: headers not finished", !admin_request_complete(scrape, strlen(scrape) - 2));
+    mu_assert("test_admin_requests: bare newlines", admin_request_complete("GET / HTTP/1.0\n\n", 16));
+
+    mu_assert("test_admin_requests: metrics", admin_route(scrape, strlen(scrape)) == ADMIN_ROUTE_METRICS);
+    const char *query = "GET /metrics?name[]=x HTTP/1.1\r\n\r\n";
+    mu_assert("test_admin_requests: query ignored", admin_route(query, strlen(query)) == ADMIN_ROUTE_METRICS);
+    const char *other = "GET /metricsx HTTP/1.1\r\n\r\n";
+    mu_assert("test_admin_requests: other path", admin_route(other, strlen(other)) == ADMIN_ROUTE_NOT_FOUND);
+    const char *post = "POST /metrics HTTP/1.1\r\n\r\n";
+    mu_assert("test_admin_requests: method", admin_route(post, strlen(post)) == ADMIN_ROUTE_BAD_METHOD);
+    mu_assert("test_admin_requests: garbage", admin_route("hello\n\n", 7) == ADMIN_ROUTE_BAD_REQUEST);
+    return 0;
+}
+
+/**
+ * @brief Tests the HTTP response framing.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_admin_response() {
+    char *response;
+    size_t len;
+    mu_assert("test_admin_response: build", admin_build_response("200 OK", "up 1\n", 5, &response, &len) == 0);
+    mu_assert("test_admin_response: status line", strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    mu_assert("test_admin_response: content length", strstr(response, "Content-Length: 5\r\n") != NULL);
+    mu_assert("test_admin_response: body last", len > 5 && memcmp(response + len - 9, "\r\n\r\nup 1\n", 9) == 0);
+    free(response);
+    return 0;
+}
+
+/**
+ * @brief Tests that histograms are exported with cumulative buckets, sum and count.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_admin_histogram() {
+    histogram_t *h = malloc(sizeof(*h));
+    histogram_init(h);
+    histogram_record(h, 2000);      // 2 us
+    histogram_record(h, 3000000);   // 3 ms
+    histogram_record(h, 20000000000ULL); // 20 s, beyond the last bound
+
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text, &text_len);
+    admin_metric_histogram(out, "x_seconds", "Test.", h);
+    fclose(out);
+
+    mu_assert("test_admin_histogram: type", strstr(text, "# TYPE x_seconds histogram\n") != NULL);
+    mu_assert("test_admin_histogram: below first value", strstr(text, "x_seconds_bucket{le=\"1e-06\"} 0\n") != NULL);
+    mu_assert("test_admin_histogram: cumulative", strstr(text, "x_seconds_bucket{le=\"0.005\"} 2\n") != NULL);
+    mu_assert("test_admin_histogram: last bound", strstr(text, "x_seconds_bucket{le=\"10\"} 2\n") != NULL);
+    mu_assert("test_admin_histogram: +Inf", strstr(text, "x_seconds_bucket{le=\"+Inf\"} 3\n") != NULL);
+    mu_assert("test_admin_histogram: count", strstr(text, "x_seconds_count 3\n") != NULL);
+    mu_assert("test_admin_histogram: sum", strstr(text, "x_seconds_sum 20.003002000\n") != NULL);
+    free(text);
+    free(h);
+    return 0;
+}
+
+/**
+ * @brief Tests labelled histogram samples and histograms of counts.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_admin_labelled_histograms() {
+    histogram_t *h = malloc(sizeof(*h));
+    histogram_init(h);
+    histogram_record(h, 1);
+    histogram_record(h, 3);
+    histogram_record(h, 3);
+    histogram_record(h, 5000);
+
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = open_memstream(&text, &text_len);
+    admin_metric_histogram_samples(out, "h_seconds", "handler", "read", h);
+    admin_metric_count_histogram(out, "events", "Test.", h);
+    fclose(out);
+
+    mu_assert("test_admin_labelled_histograms: labelled bucket",
+              strstr(text, "h_seconds_bucket{handler=\"read\",le=\"1e-06\"} 3\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: labelled +Inf",
+              strstr(text, "h_seconds_bucket{handler=\"read\",le=\"+Inf\"} 4\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: labelled count",
+              strstr(text, "h_seconds_count{handler=\"read\"} 4\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: no TYPE line", strstr(text, "# TYPE h_seconds") == NULL);
+    mu_assert("test_admin_labelled_histograms: count type", strstr(text, "# TYPE events histogram\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: first count bucket", strstr(text, "events_bucket{le=\"1\"} 1\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: cumulative counts", strstr(text, "events_bucket{le=\"4\"} 3\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: last count bucket", strstr(text, "events_bucket{le=\"1024\"} 3\n") != NULL);
+    mu_assert("test_admin_labelled_histograms: count sum", strstr(text, "events_sum 5007\n") != NULL);
+    free(text);
+    free(h);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all admin tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_admin_tests() {
+    mu_run_test(test_admin_requests);
+    mu_run_test(test_admin_response);
+    mu_run_test(test_admin_histogram);
+    mu_run_test(test_admin_labelled_histograms);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/**
+ * @file test_bridge.c
+ * @brief Unit tests for broker-to-broker bridges, linking two brokers over socketpairs.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../broker.h"
+#include "../bridge.h"
+#include "../utils.h"
+
+#define TEST_BRIDGE_SLOTS 4
+
+void setup_log_dir();
+void teardown_log_dir();
+size_t recv_pending(int fd, char *buf, size_t cap);
+size_t describe_msgs(const char *buf, size_t len, char *out, size_t cap);
+
+/**
+ * @brief Connects `down` to `up` as a bridge over a new socketpair and runs the handshake.
+ *
+ * @param down The broker bridging topics.
+ * @param up The upstream broker.
+ * @param up_slot Receives the bridge's slot on the upstream broker.
+ * @return int The upstream connection's slot on `down`, or -1 on failure.
+ */
+static int link_brokers(broker_t *down, broker_t *up, int *up_slot) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return -1;
+    }
+    set_non_blocking(sv[0]);
+    set_non_blocking(sv[1]);
+    int down_slot = broker_bridge(down, sv[0]);
+    *up_slot = broker_add_client(up, sv[1]);
+    if (down_slot < 0 || *up_slot < 0) {
+        return -1;
+    }
+    broker_handle_writable(down, down_slot);
+    broker_handle_readable(up, *up_slot);
+    broker_handle_readable(down, down_slot);
+    return down_slot;
+}
+
+/**
+ * @brief Replay sink that keeps the origin of the last record.
+ *
+ * @param topic The topic being replayed (unused).
+ * @param message The record content (unused).
+ * @param len The length of the record (unused).
+ * @param seq The sequence number (unused).
+ * @param origin The broker the record originated on.
+ * @param ctx Pointer to a uint64_t receiving the origin.
+ */
+static void origin_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin, void *ctx) {
+    (void)topic;
+    (void)message;
+    (void)len;
+    (void)seq;
+    *(uint64_t *)ctx = origin;
+}
+
+/**
+ * @brief Tests pattern matching and the bookkeeping of filters and positions.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_bookkeeping() {
+    mu_assert("test_bridge_bookkeeping: match", bridge_match("orders.*", "orders.eu") && bridge_match("*", "x") &&
+              bridge_match("orders.*", "orders.") && bridge_match("a*b*c", "axxbyybc") && bridge_match("*.eu", "o.eu") &&
+              bridge_match("exact", "exact"));
+    mu_assert("test_bridge_bookkeeping: no match", !bridge_match("orders.*", "orders") && !bridge_match("a*b*c", "axxbyy") &&
+              !bridge_match("*.eu", "o.us") && !bridge_match("exact", "exact2") && !bridge_match("exact2", "exact"));
+
+    bridge_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    mu_assert("test_bridge_bookkeeping: parse", bridge_filter_parse(&filter, "orders.*,metrics") == 0 && filter.count == 2);
+    bridge_filter_t bad;
+    memset(&bad, 0, sizeof(bad));
+    mu_assert("test_bridge_bookkeeping: bad patterns", bridge_filter_parse(&bad, "a,,b") == -1 &&
+              bridge_filter_add(&bad, "a b", 0) == -1 && bridge_filter_add(&bad, ".x", 0) == -1 &&
+              bridge_filter_parse(&bad, "") == -1);
+    uint64_t from = 99;
+    mu_assert("test_bridge_bookkeeping: live start", bridge_filter_match(&filter, "orders.eu", &from) && from == 0 &&
+              !bridge_filter_match(&filter, "metric", NULL));
+    bridge_filter_add(&filter, "orders.*", 5);
+    bridge_filter_add(&filter, "*", 3);
+    mu_assert("test_bridge_bookkeeping: earliest start", bridge_filter_match(&filter, "orders.eu", &from) && from == 3 &&
+              filter.count == 3 && filter.items[0].from_seq == 5);
+
+    bridge_t state;
+    bridge_init(&state, 7);
+    mu_assert("test_bridge_bookkeeping: positions", bridge_position(&state, "t") == 0 &&
+              bridge_advance(&state, "t", 4) == 0 && bridge_advance(&state, "t", 2) == 0 &&
+              bridge_position(&state, "t") == 4);
+    bridge_free(&state);
+    return 0;
+}
+
+/**
+ * @brief Tests two brokers bridging a topic both ways: live messages cross the link once,
+ * messages are not sent back to the broker they came from, and after a lost connection
+ * the bridge resumes from its position without duplicates.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_link() {
+    teardown_log_dir();
+    setup_log_dir();
+    struct pollfd up_fds[TEST_BRIDGE_SLOTS + 1], down_fds[TEST_BRIDGE_SLOTS + 1];
+    client_t up_clients[TEST_BRIDGE_SLOTS + 1], down_clients[TEST_BRIDGE_SLOTS + 1];
+    broker_t up, down;
+    broker_init(&up, up_fds, up_clients, TEST_BRIDGE_SLOTS);
+    broker_init(&down, down_fds, down_clients, TEST_BRIDGE_SLOTS);
+    up.p_mode = PERSIST_ALL;
+    up.bridge.id = 1;
+    down.bridge.id = 2;
+    bridge_filter_parse(&down.bridge.imports, "br_orders.*");
+    bridge_filter_parse(&up.bridge.imports, "br_orders.*");
+
+    broker_publish(&up, "br_orders.eu", "a1", 2, 0);
+    broker_publish(&up, "br_orders.eu", "a2", 2, 0);
+    broker_publish(&up, "br_other", "o1", 2, 0);
+
+    // A new bridge starts with the next message and is told where that is
+    int up_slot;
+    int down_slot = link_brokers(&down, &up, &up_slot);
+    mu_assert("test_bridge_link: first handshake", down_slot > 0 && up_clients[up_slot].type == CLIENT_TYPE_BRIDGE &&
+              up.bridge.peer_count == 1 && up.bridge.peers[0].origin == 2 && up.bridge.catchups == 1 &&
+              up.bridge.records_sent == 0 && down.bridge.resuming && bridge_position(&down.bridge, "br_orders.eu") == 3 &&
+              bridge_position(&down.bridge, "br_other") == 0);
+
+    int sub[2];
+    mu_assert("test_bridge_link: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sub) == 0);
+    set_non_blocking(sub[0]);
+    int sub_slot = broker_add_client(&down, sub[0]);
+    mu_assert("test_bridge_link: subscribe", send(sub[1], "SUB br_orders.eu\n", 17, 0) == 17);
+    broker_handle_readable(&down, sub_slot);
+
+    // Messages published upstream reach the subscriber downstream
+    broker_publish(&up, "br_orders.eu", "live1", 5, 0);
+    broker_publish(&up, "br_other", "o2", 2, 0);
+    broker_handle_readable(&down, down_slot);
+    char buf[2048];
+    char seen[256];
+    size_t len = recv_pending(sub[1], buf, sizeof(buf));
+    mu_assert("test_bridge_link: live", describe_msgs(buf, len, seen, sizeof(seen)) == 1 &&
+              strcmp(seen, "br_orders.eu/0/live1") == 0 &&
+              up.bridge.exported == 1 && down.bridge.imported == 1 && bridge_position(&down.bridge, "br_orders.eu") == 4);
+
+    // The other direction: neither broker sends the other what came from it
+    int back_slot;
+    int back_down_slot = link_brokers(&up, &down, &back_slot);
+    mu_assert("test_bridge_link: reverse handshake", back_down_slot > 0 && down.bridge.peer_count == 1 && up.bridge.resuming);
+    broker_publish(&up, "br_orders.eu", "live2", 5, 0);
+    broker_handle_readable(&down, down_slot);
+    mu_assert("test_bridge_link: not sent back", down.bridge.imported == 2 && down.bridge.suppressed == 1 &&
+              down.bridge.exported == 0);
+    broker_publish(&down, "br_orders.eu", "fromD", 5, 0);
+    broker_handle_readable(&up, back_down_slot);
+    uint64_t origin = 0;
+    replay_persisted_messages("br_orders.eu", PERSIST_ALL, 0, 5, origin_sink, &origin);
+    mu_assert("test_bridge_link: imported upstream", up.bridge.imported == 1 && up.bridge.suppressed == 1 && origin == 2);
+    len = recv_pending(sub[1], buf, sizeof(buf));
+    mu_assert("test_bridge_link: delivered once", describe_msgs(buf, len, seen, sizeof(seen)) == 2 &&
+              strcmp(seen, "br_orders.eu/0/live2 br_orders.eu/0/fromD") == 0);
+
+    // After a lost connection the bridge resumes where it stopped
+    shutdown(up_fds[up_slot].fd, SHUT_RDWR);
+    broker_handle_readable(&up, up_slot);
+    broker_handle_readable(&down, down_slot);
+    mu_assert("test_bridge_link: disconnected", up.bridge.peer_count == 0 && down.bridge.upstream_slot == 0);
+    broker_publish(&up, "br_orders.eu", "gap1", 4, 0);
+    broker_publish(&up, "br_orders.us", "new1", 4, 0);
+    down_slot = link_brokers(&down, &up, &up_slot);
+    len = recv_pending(sub[1], buf, sizeof(buf));
+    mu_assert("test_bridge_link: resumed", down_slot > 0 && describe_msgs(buf, len, seen, sizeof(seen)) == 1 &&
+              strcmp(seen, "br_orders.eu/0/gap1") == 0 && up.bridge.records_sent == 2 && up.bridge.suppressed == 2 &&
+              bridge_position(&down.bridge, "br_orders.eu") == 7 && bridge_position(&down.bridge, "br_orders.us") == 2 &&
+              down.bridge.duplicates == 0);
+
+    // Records below the position and messages that went around a loop are dropped
+    const char *stale = "MSG br_orders.eu 3 seq=6 origin=1\nold";
+    const char *looped = "MSG br_orders.eu 3 seq=7 origin=2\nabc";
+    mu_assert("test_bridge_link: inject", send(up_fds[up_slot].fd, stale, strlen(stale), 0) == (ssize_t)strlen(stale) &&
+              send(up_fds[up_slot].fd, looped, strlen(looped), 0) == (ssize_t)strlen(looped));
+    broker_handle_readable(&down, down_slot);
+    mu_assert("test_bridge_link: dropped", down.bridge.duplicates == 1 && down.bridge.looped == 1 &&
+              bridge_position(&down.bridge, "br_orders.eu") == 8 && recv_pending(sub[1], buf, sizeof(buf)) == 0);
+
+    broker_free(&down);
+    broker_free(&up);
+    close(sub[1]);
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that a bridging broker resumes where it stopped after a restart, and
+ * still keeps bridged records from going back to the broker they came from.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_restart() {
+    teardown_log_dir();
+    setup_log_dir();
+    struct pollfd fds[TEST_BRIDGE_SLOTS + 1];
+    client_t clients[TEST_BRIDGE_SLOTS + 1];
+    broker_t down;
+    broker_init(&down, fds, clients, TEST_BRIDGE_SLOTS);
+    down.p_mode = PERSIST_ALL;
+    down.bridge.id = 2;
+    bridge_filter_parse(&down.bridge.imports, "rs_*");
+    int up[2];
+    mu_assert("test_bridge_restart: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, up) == 0);
+    set_non_blocking(up[0]);
+    int slot = broker_bridge(&down, up[0]);
+    broker_handle_writable(&down, slot);
+    char buf[2048];
+    recv_pending(up[1], buf, sizeof(buf));
+    const char *msgs = "MSG rs_t 3 seq=6 origin=1\nabcMSG rs_t 3 seq=7 origin=3\ndef";
+    mu_assert("test_bridge_restart: send", send(up[1], msgs, strlen(msgs), 0) == (ssize_t)strlen(msgs));
+    broker_handle_readable(&down, slot);
+    mu_assert("test_bridge_restart: imported", down.bridge.imported == 2 && bridge_position(&down.bridge, "rs_t") == 8);
+    // The position is saved once for the whole read
+    FILE *saved = fopen("logs/rs_t.log.bridge", "r");
+    unsigned long long on_disk = 0;
+    mu_assert("test_bridge_restart: saved", saved != NULL && fscanf(saved, "%llu", &on_disk) == 1 && on_disk == 8 &&
+              down.bridge.unsaved.count == 0);
+    fclose(saved);
+    broker_free(&down);
+    close(up[1]);
+
+    // After the restart the broker announces its position
+    broker_init(&down, fds, clients, TEST_BRIDGE_SLOTS);
+    down.p_mode = PERSIST_ALL;
+    down.bridge.id = 2;
+    bridge_filter_parse(&down.bridge.imports, "rs_*");
+    mu_assert("test_bridge_restart: socketpair again", socketpair(AF_UNIX, SOCK_STREAM, 0, up) == 0);
+    set_non_blocking(up[0]);
+    slot = broker_bridge(&down, up[0]);
+    broker_handle_writable(&down, slot);
+    recv_pending(up[1], buf, sizeof(buf));
+    mu_assert("test_bridge_restart: resumed", slot > 0 && down.bridge.resuming &&
+              bridge_position(&down.bridge, "rs_t") == 8 && strstr(buf, "BRIDGE rs_t from=8\n") != NULL);
+
+    // A bridge from broker 1 does not get back the record that came from it
+    int peer[2];
+    mu_assert("test_bridge_restart: peer socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, peer) == 0);
+    set_non_blocking(peer[0]);
+    int peer_slot = broker_add_client(&down, peer[0]);
+    const char *handshake = "BRIDGE rs_* origin=1 from=1\nBRIDGE\n";
+    mu_assert("test_bridge_restart: handshake", send(peer[1], handshake, strlen(handshake), 0) == (ssize_t)strlen(handshake));
+    broker_handle_readable(&down, peer_slot);
+    broker_handle_writable(&down, peer_slot);
+    char seen[256];
+    size_t len = recv_pending(peer[1], buf, sizeof(buf));
+    mu_assert("test_bridge_restart: loop prevented", down.bridge.suppressed == 1 && down.bridge.records_sent == 1 &&
+              describe_msgs(buf, len, seen, sizeof(seen)) == 1 && strcmp(seen, "rs_t/2/def") == 0);
+
+    broker_free(&down);
+    close(up[1]);
+    close(peer[1]);
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that malformed bridge handshakes, and bridges that then subscribe, are refused.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_handshake_errors() {
+    struct pollfd fds[TEST_BRIDGE_SLOTS + 1];
+    client_t clients[TEST_BRIDGE_SLOTS + 1];
+    broker_t broker;
+    broker_init(&broker, fds, clients, TEST_BRIDGE_SLOTS);
+    broker.bridge.id = 5;
+    const char *cases[] = {
+        "BRIDGE\n",                           // no patterns
+        "BRIDGE news* origin=5\nBRIDGE\n",    // this broker's own id
+        "BRIDGE news* origin=6\nBRIDGE\nBRIDGE news origin=6\n", // after the handshake
+        "BRIDGE ne*ws from=3\n",              // a position needs a topic
+        "BRIDGE .news origin=6\n",            // not a pattern
+        "BRIDGE news* origin=6\nBRIDGE\nSUB news\n" // a bridge cannot subscribe
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int sv[2];
+        mu_assert("test_bridge_handshake_errors: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        set_non_blocking(sv[0]);
+        int slot = broker_add_client(&broker, sv[0]);
+        mu_assert("test_bridge_handshake_errors: send", send(sv[1], cases[i], strlen(cases[i]), 0) == (ssize_t)strlen(cases[i]));
+        broker_handle_readable(&broker, slot);
+        mu_assert("test_bridge_handshake_errors: refused", fds[slot].fd == -1 && broker.bridge.peer_count == 0);
+        close(sv[1]);
+    }
+    broker_free(&broker);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all bridge tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_bridge_tests() {
+    mu_run_test(test_bridge_bookkeeping);
+    mu_run_test(test_bridge_link);
+    mu_run_test(test_bridge_restart);
+    mu_run_test(test_bridge_handshake_errors);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file test_broker.c
+ * @brief Unit tests for the broker core, driven over socketpairs without an event loop.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../broker.h"
+#include "../utils.h"
+
+#define TEST_BROKER_SLOTS 4
+
+/**
+ * @brief Sends a frame with the given header and payload to a peer.
+ *
+ * @param fd The sending end.
+ * @param type The frame type.
+ * @param topic The topic.
+ * @param payload The payload (ignored for FRAME_SUB).
+ * @param len The payload length.
+ * @return int 1 if the frame was sent completely, 0 otherwise.
+ */
+int send_frame(int fd, frame_type_t type, const char *topic, const char *payload, size_t len) {
+    char buf[FRAME_MAX_HEADER + 64];
+    int header_len = format_frame_header(buf, sizeof(buf), type, topic, len);
+    if (header_len < 0 || (size_t)header_len + len > sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf + header_len, payload, len);
+    return send(fd, buf, (size_t)header_len + len, 0) == (ssize_t)((size_t)header_len + len);
+}
+
+/**
+ * @brief Tests that a message from a publisher reaches only the subscribers of its topic.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_broker_routes_messages() {
+    struct pollfd fds[TEST_BROKER_SLOTS + 1];
+    client_t clients[TEST_BROKER_SLOTS + 1];
+    broker_t broker;
+    int sub[2], other[2], pub[2];
+    mu_assert("test_broker_routes_messages: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, sub) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, other) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, pub) == 0);
+    set_non_blocking(sub[0]);
+    set_non_blocking(other[0]);
+    set_non_blocking(pub[0]);
+
+    broker_init(&broker, fds, clients, TEST_BROKER_SLOTS);
+    int sub_slot = broker_add_client(&broker, sub[0]);
+    int other_slot = broker_add_client(&broker, other[0]);
+    int pub_slot = broker_add_client(&broker, pub[0]);
+    mu_assert("test_broker_routes_messages: slots", sub_slot == 1 && other_slot == 2 && pub_slot == 3);
+
+    mu_assert("test_broker_routes_messages: send SUB", send_frame(sub[1], FRAME_SUB, "weather", NULL, 0) &&
+              send_frame(other[1], FRAME_SUB, "sports", NULL, 0));
+    broker_handle_readable(&broker, sub_slot);
+    broker_handle_readable(&broker, other_slot);
+    mu_assert("test_broker_routes_messages: subscribed", clients[sub_slot].type == CLIENT_TYPE_SUBSCRIBER &&
+              broker_count_subscribers(&broker, "weather") == 1 && broker_count_subscribers(&broker, NULL) == 2);
+
+    mu_assert("test_broker_routes_messages: send PUB", send_frame(pub[1], FRAME_PUB, "weather", "sunny", 5));
+    broker_handle_readable(&broker, pub_slot);
+    mu_assert("test_broker_routes_messages: publisher", clients[pub_slot].type == CLIENT_TYPE_PUBLISHER);
+    mu_assert("test_broker_routes_messages: counters", broker.stats.messages_in == 1 &&
+              broker.stats.messages_out == 1 && broker.stats.frames_in == 3);
+
+    char buf[256];
+    ssize_t n = recv(sub[1], buf, sizeof(buf), MSG_DONTWAIT);
+    frame_t frame;
+    size_t consumed;
+    mu_assert("test_broker_routes_messages: delivered", n > 0 &&
+              parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK && consumed == (size_t)n);
+    mu_assert("test_broker_routes_messages: frame", frame.type == FRAME_MSG && strcmp(frame.topic, "weather") == 0 &&
+              frame.payload_len == 5 && memcmp(frame.payload, "sunny", 5) == 0);
+    mu_assert("test_broker_routes_messages: other topic untouched", recv(other[1], buf, sizeof(buf), MSG_DONTWAIT) < 0);
+
+    // A direct publish reaches the same subscriber
+    mu_assert("test_broker_routes_messages: broker_publish", broker_publish(&broker, "weather", "rain", 4, 0) == 1);
+
+    broker_free(&broker);
+    close(sub[1]);
+    close(other[1]);
+    close(pub[1]);
+    return 0;
+}
+
+/**
+ * @brief Tests that a malformed frame and a disconnect free the client slot.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_broker_closes_clients() {
+    struct pollfd fds[TEST_BROKER_SLOTS + 1];
+    client_t clients[TEST_BROKER_SLOTS + 1];
+    broker_t broker;
+    int bad[2], gone[2];
+    mu_assert("test_broker_closes_clients: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, bad) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, gone) == 0);
+    set_non_blocking(bad[0]);
+    set_non_blocking(gone[0]);
+
+    broker_init(&broker, fds, clients, TEST_BROKER_SLOTS);
+    int bad_slot = broker_add_client(&broker, bad[0]);
+    int gone_slot = broker_add_client(&broker, gone[0]);
+
+    mu_assert("test_broker_closes_clients: send garbage", send(bad[1], "NOPE\n", 5, 0) == 5);
+    broker_handle_readable(&broker, bad_slot);
+    mu_assert("test_broker_closes_clients: malformed", fds[bad_slot].fd == -1 && clients[bad_slot].fd == -1);
+
+    close(gone[1]);
+    broker_handle_readable(&broker, gone_slot);
+    mu_assert("test_broker_closes_clients: disconnected", fds[gone_slot].fd == -1);
+    mu_assert("test_broker_closes_clients: slot reused", broker_add_client(&broker, dup(bad[1])) == bad_slot);
+
+    broker_free(&broker);
+    close(bad[1]);
+    return 0;
+}
+
+/**
+ * @brief Tests that injected input is reassembled across calls and dispatched like socket input.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_broker_handle_input() {
+    struct pollfd fds[TEST_BROKER_SLOTS + 1];
+    client_t clients[TEST_BROKER_SLOTS + 1];
+    broker_t broker;
+    int sub[2], pub[2];
+    mu_assert("test_broker_handle_input: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, sub) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, pub) == 0);
+    set_non_blocking(sub[0]);
+    set_non_blocking(pub[0]);
+
+    broker_init(&broker, fds, clients, TEST_BROKER_SLOTS);
+    int sub_slot = broker_add_client(&broker, sub[0]);
+    int pub_slot = broker_add_client(&broker, pub[0]);
+    char buf[256];
+    int sub_len = format_frame_header(buf, sizeof(buf), FRAME_SUB, "news", 0);
+    mu_assert("test_broker_handle_input: SUB", broker_handle_input(&broker, sub_slot, buf, (size_t)sub_len) == 0 &&
+              broker_count_subscribers(&broker, "news") == 1);
+
+    // Two PUB frames fed one byte at a time
+    int n = format_frame_header(buf, sizeof(buf), FRAME_PUB, "news", 3);
+    memcpy(buf + n, "abc", 3);
+    size_t frame_len = (size_t)n + 3;
+    memcpy(buf + frame_len, buf, frame_len);
+    for (size_t i = 0; i < 2 * frame_len; i++) {
+        mu_assert("test_broker_handle_input: byte", broker_handle_input(&broker, pub_slot, buf + i, 1) == 0);
+        if (i == frame_len - 2) {
+            mu_assert("test_broker_handle_input: partial frame held", broker.stats.messages_in == 0);
+        }
+    }
+    mu_assert("test_broker_handle_input: published", broker.stats.messages_in == 2 && broker.stats.messages_out == 2 &&
+              broker.stats.bytes_read == (uint64_t)sub_len + 2 * frame_len);
+
+    char out[256];
+    ssize_t got = recv(sub[1], out, sizeof(out), MSG_DONTWAIT);
+    frame_t frame;
+    size_t consumed;
+    mu_assert("test_broker_handle_input: delivered", got > 0 &&
+              parse_frame(out, (size_t)got, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_MSG && memcmp(frame.payload, "abc", 3) == 0 && (size_t)got == 2 * consumed);
+
+    mu_assert("test_broker_handle_input: malformed closes", broker_handle_input(&broker, pub_slot, "BAD\n", 4) < 0 &&
+              fds[pub_slot].fd == -1);
+
+    broker_free(&broker);
+    close(sub[1]);
+    close(pub[1]);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all broker core tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_broker_tests() {
+    mu_run_test(test_broker_routes_messages);
+    mu_run_test(test_broker_closes_clients);
+    mu_run_test(test_broker_handle_input);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file test_capture.c
+ * @brief Unit tests for the ingress capture file.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "minunit.h"
+#include "../capture.h"
+
+#define TEST_CAPTURE_PATH "test_capture.lmqcap"
+
+/**
+ * @brief Tests that records read back with their connection, bytes and cumulative times.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_capture_roundtrip() {
+    capture_t c;
+    mu_assert("test_capture_roundtrip: open", capture_open(&c, TEST_CAPTURE_PATH, 1000) == 0);
+    capture_record(&c, 1500, 1, "PUB a 1\nx", 9);
+    capture_record(&c, 1500, 2, "PUB b 2\nyz", 10);
+    capture_record(&c, 400000, 1, "PUB a 1\nw", 9);
+    mu_assert("test_capture_roundtrip: counted", c.frames == 3);
+    mu_assert("test_capture_roundtrip: close", capture_close(&c) == 0);
+
+    // Three 1- to 3-byte varints per record
+    struct stat st;
+    mu_assert("test_capture_roundtrip: compact", stat(TEST_CAPTURE_PATH, &st) == 0 &&
+              (uint64_t)st.st_size == c.bytes && st.st_size <= CAPTURE_MAGIC_LEN + 28 + 3 * 5);
+
+    capture_reader_t r;
+    capture_record_t rec;
+    mu_assert("test_capture_roundtrip: reader", capture_reader_open(&r, TEST_CAPTURE_PATH) == 0);
+    mu_assert("test_capture_roundtrip: first", capture_next(&r, &rec) == 1 && rec.offset_ns == 500 &&
+              rec.conn == 1 && rec.len == 9 && memcmp(rec.data, "PUB a 1\nx", 9) == 0);
+    mu_assert("test_capture_roundtrip: second", capture_next(&r, &rec) == 1 && rec.offset_ns == 500 &&
+              rec.conn == 2 && rec.len == 10 && memcmp(rec.data, "PUB b 2\nyz", 10) == 0);
+    mu_assert("test_capture_roundtrip: third", capture_next(&r, &rec) == 1 && rec.offset_ns == 399000 &&
+              rec.conn == 1 && memcmp(rec.data, "PUB a 1\nw", 9) == 0);
+    mu_assert("test_capture_roundtrip: end", capture_next(&r, &rec) == 0);
+    capture_reader_close(&r);
+    unlink(TEST_CAPTURE_PATH);
+    return 0;
+}
+
+/**
+ * @brief Tests that files without the magic and truncated records are rejected.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_capture_rejects_bad_files() {
+    FILE *f = fopen(TEST_CAPTURE_PATH, "wb");
+    mu_assert("test_capture_rejects_bad_files: create", f != NULL);
+    fputs("PUB a 1\nx", f);
+    fclose(f);
+    capture_reader_t r;
+    mu_assert("test_capture_rejects_bad_files: magic", capture_reader_open(&r, TEST_CAPTURE_PATH) < 0);
+
+    capture_t c;
+    mu_assert("test_capture_rejects_bad_files: open", capture_open(&c, TEST_CAPTURE_PATH, 0) == 0);
+    capture_record(&c, 10, 1, "PUB a 1\nx", 9);
+    capture_close(&c);
+    mu_assert("test_capture_rejects_bad_files: truncate", truncate(TEST_CAPTURE_PATH, (off_t)c.bytes - 2) == 0);
+
+    capture_record_t rec;
+    mu_assert("test_capture_rejects_bad_files: reader", capture_reader_open(&r, TEST_CAPTURE_PATH) == 0);
+    mu_assert("test_capture_rejects_bad_files: truncated", capture_next(&r, &rec) == -1);
+    capture_reader_close(&r);
+    unlink(TEST_CAPTURE_PATH);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all capture tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_capture_tests() {
+    mu_run_test(test_capture_roundtrip);
+    mu_run_test(test_capture_rejects_bad_files);
+    return 0;
+}
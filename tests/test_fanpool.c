@@ -0,0 +1,144 @@
+/**
+ * @file test_fanpool.c
+ * @brief Unit tests for the work-stealing fan-out pool and pool fan-out in the broker.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../broker.h"
+#include "../fanpool.h"
+#include "../utils.h"
+
+#define TEST_FANPOOL_ITEMS 10000
+#define TEST_FANPOOL_SUBS 8
+
+/**
+ * @brief Context of test_fanpool_runs_every_item().
+ */
+typedef struct {
+    int hits[TEST_FANPOOL_ITEMS]; ///< Times each item was processed.
+    int lanes_used[4];            ///< Chunks run per lane.
+} test_fanpool_ctx_t;
+
+/**
+ * @brief Counts each item of a chunk.
+ */
+static void count_items(void *ctx, size_t begin, size_t end, int lane) {
+    test_fanpool_ctx_t *t = ctx;
+    for (size_t i = begin; i < end; i++) {
+        __atomic_add_fetch(&t->hits[i], 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&t->lanes_used[lane], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Tests that a run processes every item exactly once, repeatedly, and that an empty run is a no-op.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_fanpool_runs_every_item() {
+    static test_fanpool_ctx_t ctx;
+    fanpool_t pool;
+    mu_assert("test_fanpool_runs_every_item: init", fanpool_init(&pool, 3, NULL) == 0 && pool.threads == 3);
+    for (int round = 1; round <= 3; round++) {
+        fanpool_run(&pool, TEST_FANPOOL_ITEMS, 7, count_items, &ctx);
+        for (int i = 0; i < TEST_FANPOOL_ITEMS; i++) {
+            mu_assert("test_fanpool_runs_every_item: exactly once", ctx.hits[i] == round);
+        }
+    }
+    int chunks = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        chunks += ctx.lanes_used[lane];
+    }
+    mu_assert("test_fanpool_runs_every_item: chunks", chunks == 3 * ((TEST_FANPOOL_ITEMS + 6) / 7));
+    mu_assert("test_fanpool_runs_every_item: empty", fanpool_run(&pool, 0, 7, count_items, &ctx) == 0);
+    fanpool_free(&pool);
+    mu_assert("test_fanpool_runs_every_item: bad size", fanpool_init(&pool, 0, NULL) < 0);
+    return 0;
+}
+
+/**
+ * @brief Tests that the broker splits a large fan-out over the pool, delivers to every
+ * subscriber in publish order, and keeps small topics on its own thread.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_fanpool_broker_fanout() {
+    struct pollfd fds[TEST_FANPOOL_SUBS + 2];
+    client_t clients[TEST_FANPOOL_SUBS + 2];
+    broker_t broker;
+    fanpool_t pool;
+    int peers[TEST_FANPOOL_SUBS];
+    char frame[FRAME_MAX_HEADER];
+
+    broker_init(&broker, fds, clients, TEST_FANPOOL_SUBS + 1);
+    mu_assert("test_fanpool_broker_fanout: pool", fanpool_init(&pool, 2, &broker.subs) == 0 &&
+              broker_set_fanout_pool(&broker, &pool, TEST_FANPOOL_SUBS) == 0);
+    for (int i = 0; i < TEST_FANPOOL_SUBS; i++) {
+        int sv[2];
+        mu_assert("test_fanpool_broker_fanout: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        set_non_blocking(sv[0]);
+        int slot = broker_add_client(&broker, sv[0]);
+        int len = format_frame_header(frame, sizeof(frame), FRAME_SUB, i == 0 ? "small" : "big", 0);
+        mu_assert("test_fanpool_broker_fanout: SUB", slot > 0 && send(sv[1], frame, (size_t)len, 0) == len);
+        broker_handle_readable(&broker, slot);
+        peers[i] = sv[1];
+    }
+
+    // Seven subscribers stay below the threshold; the eighth joins "big" through a second topic switch
+    mu_assert("test_fanpool_broker_fanout: below threshold", broker_publish(&broker, "big", "a", 1, 0) == TEST_FANPOOL_SUBS - 1 &&
+              broker.stats.parallel_fanouts == 0);
+    broker_close_client(&broker, 1);
+    close(peers[0]);
+    int sv[2];
+    mu_assert("test_fanpool_broker_fanout: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    set_non_blocking(sv[0]);
+    int slot = broker_add_client(&broker, sv[0]);
+    int len = format_frame_header(frame, sizeof(frame), FRAME_SUB, "big", 0);
+    mu_assert("test_fanpool_broker_fanout: resubscribe", slot == 1 && send(sv[1], frame, (size_t)len, 0) == len);
+    broker_handle_readable(&broker, slot);
+    peers[0] = sv[1];
+
+    mu_assert("test_fanpool_broker_fanout: parallel", broker_publish(&broker, "big", "b", 1, 0) == TEST_FANPOOL_SUBS &&
+              broker_publish(&broker, "big", "c", 1, 0) == TEST_FANPOOL_SUBS && broker.stats.parallel_fanouts == 2);
+    mu_assert("test_fanpool_broker_fanout: counters", broker.stats.messages_out == TEST_FANPOOL_SUBS - 1 + 2 * TEST_FANPOOL_SUBS);
+
+    for (int i = 0; i < TEST_FANPOOL_SUBS; i++) {
+        char buf[256];
+        ssize_t n = recv(peers[i], buf, sizeof(buf), MSG_DONTWAIT);
+        frame_t f;
+        size_t consumed;
+        size_t offset = 0;
+        const char *expect = i == 0 ? "bc" : "abc";
+        for (const char *e = expect; *e != '\0'; e++) {
+            mu_assert("test_fanpool_broker_fanout: in order", n > 0 &&
+                      parse_frame(buf + offset, (size_t)n - offset, &f, &consumed) == FRAME_OK &&
+                      f.type == FRAME_MSG && f.payload_len == 1 && f.payload[0] == *e);
+            offset += consumed;
+        }
+        mu_assert("test_fanpool_broker_fanout: nothing else", offset == (size_t)n);
+    }
+
+    fanpool_free(&pool);
+    broker_free(&broker);
+    for (int i = 0; i < TEST_FANPOOL_SUBS; i++) {
+        close(peers[i]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all fan-out pool tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_fanpool_tests() {
+    mu_run_test(test_fanpool_runs_every_item);
+    mu_run_test(test_fanpool_broker_fanout);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file test_histogram.c
+ * @brief Unit tests for the log-linear latency histogram.
+ * @author Mohammed Uddin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "minunit.h"
+#include "../histogram.h"
+
+/**
+ * @brief Tests that every value falls inside the bucket it is counted in.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_histogram_buckets() {
+    uint64_t values[] = { 0, 1, 255, 256, 257, 1000, 123456, 999999999, 68719476735ULL };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        int index = histogram_bucket_index(values[i]);
+        mu_assert("test_histogram_buckets: value above its bucket", values[i] <= histogram_bucket_upper(index));
+        mu_assert("test_histogram_buckets: value below its bucket",
+                  index == 0 || values[i] > histogram_bucket_upper(index - 1));
+    }
+    mu_assert("test_histogram_buckets: oversized values are clamped",
+              histogram_bucket_index(UINT64_MAX) == HIST_BUCKETS - 1);
+    return 0;
+}
+
+/**
+ * @brief Tests percentile accuracy on a uniform distribution.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_histogram_percentiles() {
+    histogram_t *h = malloc(sizeof(*h));
+    histogram_init(h);
+    mu_assert("test_histogram_percentiles: empty histogram", histogram_percentile(h, 50) == 0);
+
+    for (uint64_t v = 1; v <= 100000; v++) {
+        histogram_record(h, v * 1000);
+    }
+    uint64_t p50 = histogram_percentile(h, 50);
+    uint64_t p99 = histogram_percentile(h, 99);
+    mu_assert("test_histogram_percentiles: p50 within 1%", p50 >= 50000000ULL && p50 <= 50500000ULL);
+    mu_assert("test_histogram_percentiles: p99 within 1%", p99 >= 99000000ULL && p99 <= 99990000ULL);
+    mu_assert("test_histogram_percentiles: p100 is the max", histogram_percentile(h, 100) == 100000000ULL);
+    mu_assert("test_histogram_percentiles: min", h->min == 1000);
+    mu_assert("test_histogram_percentiles: mean", histogram_mean(h) > 50000000.0 && histogram_mean(h) < 50001000.0);
+    free(h);
+    return 0;
+}
+
+/**
+ * @brief Tests merging two histograms.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_histogram_merge() {
+    histogram_t *a = malloc(sizeof(*a));
+    histogram_t *b = malloc(sizeof(*b));
+    histogram_init(a);
+    histogram_init(b);
+    histogram_record(a, 10);
+    histogram_record(b, 5000);
+    histogram_record(b, 7);
+    histogram_merge(a, b);
+    mu_assert("test_histogram_merge: total", a->total == 3);
+    mu_assert("test_histogram_merge: min and max", a->min == 7 && a->max == 5000);
+    mu_assert("test_histogram_merge: median", histogram_percentile(a, 50) == 10);
+    free(a);
+    free(b);
+    return 0;
+}
+
+/**
+ * @brief Tests counting the values at or below a bound.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_histogram_count_le() {
+    histogram_t *h = malloc(sizeof(*h));
+    histogram_init(h);
+    mu_assert("test_histogram_count_le: empty", histogram_count_le(h, 1000) == 0);
+    for (uint64_t v = 1; v <= 1000; v++) {
+        histogram_record(h, v * 1000);
+    }
+    mu_assert("test_histogram_count_le: below min", histogram_count_le(h, 999) == 0);
+    mu_assert("test_histogram_count_le: at max", histogram_count_le(h, 1000000) == 1000);
+    uint64_t half = histogram_count_le(h, 500000);
+    mu_assert("test_histogram_count_le: within 1% and never over", half <= 500 && half >= 495);
+    free(h);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all histogram tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_histogram_tests() {
+    mu_run_test(test_histogram_buckets);
+    mu_run_test(test_histogram_percentiles);
+    mu_run_test(test_histogram_merge);
+    mu_run_test(test_histogram_count_le);
+    return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file test_log.c
+ * @brief Unit tests for the asynchronous leveled logger.
+ * @author Mohammed Uddin
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include "minunit.h"
+#include "../log.h"
+
+/**
+ * @brief Captures a call into a record and renders it back, as the writer thread would.
+ *
+ * @param out Destination buffer.
+ * @param cap Capacity of the destination buffer.
+ * @param fmt The format string.
+ * @return size_t The rendered length.
+ */
+static size_t capture_render(char *out, size_t cap, const char *fmt, ...) {
+    log_record_t rec;
+    va_list ap;
+    va_start(ap, fmt);
+    log_capture(&rec, LOG_LEVEL_INFO, LOG_MODULE_BROKER, fmt, ap);
+    va_end(ap);
+    return log_render(&rec, out, cap);
+}
+
+/**
+ * @brief Tests that deferred formatting matches printf for the supported conversions.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_log_render() {
+    char out[256];
+    char expected[256];
+    char topic[16] = "news";
+
+    capture_render(out, sizeof(out), "fd %d subscribed to '%s'", 7, topic);
+    // The string was copied at capture time
+    strcpy(topic, "gone");
+    mu_assert("test_log_render: int and string", strcmp(out, "fd 7 subscribed to 'news'") == 0);
+
+    capture_render(out, sizeof(out), "%zu bytes, %llu seq, %ld, %u%%, %c, %5.2f, %x, %-4s|",
+                   (size_t)123, 9000000000ULL, -5L, 42u, 'q', 3.14159, 255u, "ab");
+    snprintf(expected, sizeof(expected), "%zu bytes, %llu seq, %ld, %u%%, %c, %5.2f, %x, %-4s|",
+             (size_t)123, 9000000000ULL, -5L, 42u, 'q', 3.14159, 255u, "ab");
+    mu_assert("test_log_render: mixed conversions", strcmp(out, expected) == 0);
+
+    size_t len = capture_render(out, 8, "%s", "a long message");
+    mu_assert("test_log_render: truncated to buffer", len == 7 && strcmp(out, "a long ") == 0);
+
+    capture_render(out, sizeof(out), "%d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+    mu_assert("test_log_render: too many arguments", strcmp(out, "1 2 3 4 5 6 7 8  [...]") == 0);
+    return 0;
+}
+
+/**
+ * @brief Tests parsing of level filter specifications.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_log_configure() {
+    unsigned char saved[LOG_MODULE_COUNT];
+    memcpy(saved, log_module_levels, sizeof(saved));
+
+    mu_assert("test_log_configure: valid", log_configure("warn,broker=debug,admin=off") == 0);
+    mu_assert("test_log_configure: module override", log_module_levels[LOG_MODULE_BROKER] == LOG_LEVEL_DEBUG);
+    mu_assert("test_log_configure: default level", log_module_levels[LOG_MODULE_PERSIST] == LOG_LEVEL_WARN);
+    mu_assert("test_log_configure: off", log_module_levels[LOG_MODULE_ADMIN] == LOG_LEVEL_OFF);
+
+    mu_assert("test_log_configure: bad level", log_configure("info,broker=loud") < 0);
+    mu_assert("test_log_configure: bad module", log_configure("nosuch=info") < 0);
+    mu_assert("test_log_configure: unchanged on error", log_module_levels[LOG_MODULE_PERSIST] == LOG_LEVEL_WARN);
+
+    memcpy(log_module_levels, saved, sizeof(saved));
+    return 0;
+}
+
+/**
+ * @brief Tests that a rate-limited call site lets a burst through per window.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_log_ratelimit() {
+    unsigned char saved = log_module_levels[LOG_MODULE_BROKER];
+    // Silence the "suppressed" report this test triggers
+    log_set_level(LOG_MODULE_BROKER, LOG_LEVEL_OFF);
+
+    log_ratelimit_t rl;
+    memset(&rl, 0, sizeof(rl));
+    int allowed = 0;
+    for (int i = 0; i < LOG_RATE_BURST + 5; i++) {
+        allowed += log_ratelimit_allow(&rl, LOG_LEVEL_ERROR, LOG_MODULE_BROKER);
+    }
+    mu_assert("test_log_ratelimit: burst", allowed == LOG_RATE_BURST && rl.suppressed == 5);
+
+    // Move the window back: the next call starts a new window
+    rl.window_start -= 2000000000ULL;
+    mu_assert("test_log_ratelimit: new window", log_ratelimit_allow(&rl, LOG_LEVEL_ERROR, LOG_MODULE_BROKER) == 1);
+    mu_assert("test_log_ratelimit: reset", rl.count == 1 && rl.suppressed == 0);
+
+    log_module_levels[LOG_MODULE_BROKER] = saved;
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all logger tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_log_tests() {
+    mu_run_test(test_log_render);
+    mu_run_test(test_log_configure);
+    mu_run_test(test_log_ratelimit);
+    return 0;
+}
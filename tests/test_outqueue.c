@@ -0,0 +1,205 @@
+/**
+ * @file test_outqueue.c
+ * @brief Unit tests for the output queue and shared payloads.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../outqueue.h"
+#include "../utils.h"
+
+/**
+ * @brief Reads exactly `len` bytes from a blocking descriptor.
+ *
+ * @param fd The descriptor.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return int 1 if all bytes were read, 0 otherwise.
+ */
+static int read_exact(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0) {
+            return 0;
+        }
+        got += (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * @brief Tests that byte and payload segments are sent in order and payloads are released.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_outqueue_order() {
+    int sv[2];
+    mu_assert("test_outqueue_order: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    set_non_blocking(sv[0]);
+
+    out_queue_t q;
+    outq_init(&q);
+    payload_t *payload = payload_create("shared", 6);
+    mu_assert("test_outqueue_order: append", outq_append_bytes(&q, "MSG a 6\n", 8) == 0 &&
+              outq_append_payload(&q, payload, 0) == 0 &&
+              outq_append_bytes(&q, "MSG a 2\n", 8) == 0 &&
+              outq_append_bytes(&q, "hi", 2) == 0);
+    mu_assert("test_outqueue_order: adjacent bytes merge", q.seg_len == 3);
+    mu_assert("test_outqueue_order: queue holds a reference", payload->refs == 2);
+    mu_assert("test_outqueue_order: pending", q.pending == 24);
+
+    mu_assert("test_outqueue_order: send", outq_send(&q, sv[0]) == 24);
+    mu_assert("test_outqueue_order: drained", q.pending == 0 && q.seg_len == 0);
+    mu_assert("test_outqueue_order: reference dropped once sent", payload->refs == 1);
+
+    char buf[32];
+    mu_assert("test_outqueue_order: receive", read_exact(sv[1], buf, 24));
+    mu_assert("test_outqueue_order: content", memcmp(buf, "MSG a 6\nsharedMSG a 2\nhi", 24) == 0);
+
+    payload_release(payload);
+    outq_free(&q);
+    close(sv[0]);
+    close(sv[1]);
+    return 0;
+}
+
+/**
+ * @brief Tests partial sends when the socket fills up, then draining the rest.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_outqueue_partial() {
+    int sv[2];
+    mu_assert("test_outqueue_partial: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    set_non_blocking(sv[0]);
+
+    static char big[1024 * 1024];
+    for (size_t i = 0; i < sizeof(big); i++) {
+        big[i] = (char)(i % 251);
+    }
+    out_queue_t q;
+    outq_init(&q);
+    payload_t *payload = payload_create(big, sizeof(big));
+    outq_append_bytes(&q, "head", 4);
+    outq_append_payload(&q, payload, 0);
+    payload_release(payload);
+
+    ssize_t sent = outq_send(&q, sv[0]);
+    mu_assert("test_outqueue_partial: socket fills before 1 MB", sent > 0 && (size_t)sent < sizeof(big) + 4);
+    mu_assert("test_outqueue_partial: remainder pending", q.pending == sizeof(big) + 4 - (size_t)sent);
+
+    // Drain the reader side until the whole frame has arrived
+    static char got[1024 * 1024 + 4];
+    size_t received = 0;
+    while (received < sizeof(got)) {
+        ssize_t n = read(sv[1], got + received, sizeof(got) - received);
+        mu_assert("test_outqueue_partial: read", n > 0);
+        received += (size_t)n;
+        if (q.pending > 0) {
+            mu_assert("test_outqueue_partial: resend", outq_send(&q, sv[0]) >= 0);
+        }
+    }
+    mu_assert("test_outqueue_partial: drained", q.pending == 0);
+    mu_assert("test_outqueue_partial: content", memcmp(got, "head", 4) == 0 && memcmp(got + 4, big, sizeof(big)) == 0);
+
+    outq_free(&q);
+    close(sv[0]);
+    close(sv[1]);
+    return 0;
+}
+
+/**
+ * @brief Tests that clearing a queue releases its payload references.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_outqueue_clear() {
+    out_queue_t q;
+    outq_init(&q);
+    payload_t *payload = payload_create("xyz", 3);
+    outq_append_bytes(&q, "MSG", 3);
+    outq_append_payload(&q, payload, 0);
+    outq_append_payload(&q, payload, 0);
+    mu_assert("test_outqueue_clear: two references", payload->refs == 3);
+    outq_clear(&q);
+    mu_assert("test_outqueue_clear: references released", payload->refs == 1);
+    mu_assert("test_outqueue_clear: queue empty", q.pending == 0 && q.seg_len == 0 && q.bytes_len == 0);
+    payload_release(payload);
+    outq_free(&q);
+    return 0;
+}
+
+/**
+ * @brief Tests that compacting the byte area behind a partly sent queue keeps the output intact.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_outqueue_compaction() {
+    int sv[2];
+    mu_assert("test_outqueue_compaction: socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    set_non_blocking(sv[0]);
+
+    static char big[1024 * 1024];
+    static char tail[65536 - 200 + 1];
+    memset(big, 'p', sizeof(big));
+    memset(tail, 't', sizeof(tail));
+
+    // The large payload stalls the first send after the leading bytes have gone out
+    out_queue_t q;
+    outq_init(&q);
+    payload_t *payload = payload_create(big, sizeof(big));
+    char head[100];
+    memset(head, 'h', sizeof(head));
+    outq_append_bytes(&q, head, sizeof(head));
+    outq_append_payload(&q, payload, 0);
+    payload_release(payload);
+    outq_append_bytes(&q, head, sizeof(head));
+    ssize_t sent = outq_send(&q, sv[0]);
+    mu_assert("test_outqueue_compaction: partial send", sent > 100 && q.pending > 0);
+    mu_assert("test_outqueue_compaction: head bytes released", q.bytes_head == 100);
+
+    // This append only fits once the sent bytes are dropped from the byte area
+    size_t cap = q.bytes_cap;
+    outq_append_bytes(&q, tail, sizeof(tail));
+    mu_assert("test_outqueue_compaction: compacted instead of growing", q.bytes_cap == cap && q.bytes_head == 0);
+
+    size_t total = 100 + sizeof(big) + 100 + sizeof(tail);
+    static char got[100 + 1024 * 1024 + 100 + 65536 - 200 + 1];
+    size_t received = 0;
+    while (received < total) {
+        ssize_t n = read(sv[1], got + received, total - received);
+        mu_assert("test_outqueue_compaction: read", n > 0);
+        received += (size_t)n;
+        if (q.pending > 0) {
+            mu_assert("test_outqueue_compaction: resend", outq_send(&q, sv[0]) >= 0);
+        }
+    }
+    mu_assert("test_outqueue_compaction: leading bytes", memcmp(got, head, 100) == 0);
+    mu_assert("test_outqueue_compaction: payload", memcmp(got + 100, big, sizeof(big)) == 0);
+    mu_assert("test_outqueue_compaction: moved bytes", memcmp(got + 100 + sizeof(big), head, 100) == 0);
+    mu_assert("test_outqueue_compaction: appended bytes", memcmp(got + 200 + sizeof(big), tail, sizeof(tail)) == 0);
+
+    outq_free(&q);
+    close(sv[0]);
+    close(sv[1]);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all output queue tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_outqueue_tests() {
+    mu_run_test(test_outqueue_order);
+    mu_run_test(test_outqueue_partial);
+    mu_run_test(test_outqueue_clear);
+    mu_run_test(test_outqueue_compaction);
+    return 0;
+}
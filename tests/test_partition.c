@@ -0,0 +1,251 @@
+/**
+ * @file test_partition.c
+ * @brief Unit tests for partitioned topics and consumer groups.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../broker.h"
+#include "../partition.h"
+#include "../utils.h"
+
+#define TEST_PART_SLOTS 6
+
+void setup_log_dir();
+void teardown_log_dir();
+size_t recv_pending(int fd, char *buf, size_t cap);
+size_t describe_msgs(const char *buf, size_t len, char *out, size_t cap);
+
+/**
+ * @brief Sends a string to the broker end of a socketpair and lets the broker read it.
+ *
+ * @param broker The broker.
+ * @param slot The client's slot.
+ * @param fd The peer's end.
+ * @param text The bytes to send.
+ * @return int 1 if everything was sent.
+ */
+static int send_to(broker_t *broker, int slot, int fd, const char *text) {
+    int sent = send(fd, text, strlen(text), 0) == (ssize_t)strlen(text);
+    broker_handle_readable(broker, slot);
+    return sent;
+}
+
+/**
+ * @brief Tests parsing of partition specifications and partition names.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_partition_table() {
+    partition_table_t table;
+    memset(&table, 0, sizeof(table));
+    mu_assert("test_partition_table: add", partition_table_add(&table, "orders=4") == 0 &&
+              partition_table_add(&table, "clicks=1") == 0 && table.count == 2);
+    mu_assert("test_partition_table: duplicate", partition_table_add(&table, "orders=2") == -1 && table.count == 2);
+    mu_assert("test_partition_table: malformed", partition_table_add(&table, "orders") == -1 &&
+              partition_table_add(&table, "x=") == -1 && partition_table_add(&table, "x=0") == -1 &&
+              partition_table_add(&table, "x=257") == -1 && partition_table_add(&table, "x=3y") == -1 &&
+              partition_table_add(&table, "=3") == -1 && partition_table_add(&table, "a b=3") == -1);
+
+    const partition_spec_t *orders = partition_find(&table, "orders");
+    mu_assert("test_partition_table: find", orders != NULL && orders->count == 4 &&
+              partition_find(&table, "order") == NULL && partition_find(NULL, "orders") == NULL);
+
+    unsigned index = 99;
+    mu_assert("test_partition_table: partition of", partition_of(&table, "orders:3", &index) == orders && index == 3);
+    mu_assert("test_partition_table: not a partition", partition_of(&table, "orders:4", &index) == NULL &&
+              partition_of(&table, "orders:03", &index) == NULL && partition_of(&table, "orders:", &index) == NULL &&
+              partition_of(&table, "orders:1x", &index) == NULL && partition_of(&table, "orders", &index) == NULL &&
+              partition_of(&table, "other:1", &index) == NULL && partition_of(NULL, "orders:1", &index) == NULL);
+
+    char name[MAX_TOPIC_LEN];
+    partition_name(name, sizeof(name), orders, 2);
+    mu_assert("test_partition_table: name", strcmp(name, "orders:2") == 0);
+    return 0;
+}
+
+/**
+ * @brief Tests that keyed messages always land in the same partition and others go round-robin.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_partition_pick() {
+    partition_table_t table;
+    memset(&table, 0, sizeof(table));
+    partition_table_add(&table, "a=3");
+    partition_table_add(&table, "b=2");
+    partition_state_t state;
+    partition_state_init(&state, &table);
+    const partition_spec_t *a = partition_find(&table, "a");
+    const partition_spec_t *b = partition_find(&table, "b");
+
+    uint64_t key = frame_key_hash("customer-17", 11);
+    unsigned first = partition_pick(&state, a, key);
+    mu_assert("test_partition_pick: keyed", first == key % 3 && partition_pick(&state, a, key) == first &&
+              state.keyed == 2);
+    mu_assert("test_partition_pick: round-robin", partition_pick(&state, a, 0) == 0 && partition_pick(&state, a, 0) == 1 &&
+              partition_pick(&state, b, 0) == 0 && partition_pick(&state, a, 0) == 2 &&
+              partition_pick(&state, a, 0) == 0 && partition_pick(&state, b, 0) == 1 && state.round_robin == 6);
+    partition_state_free(&state);
+    return 0;
+}
+
+/**
+ * @brief Tests how a group deals its partitions out as members join and leave.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_partition_groups() {
+    partition_table_t table;
+    memset(&table, 0, sizeof(table));
+    partition_table_add(&table, "t=4");
+    const partition_spec_t *spec = partition_find(&table, "t");
+    partition_state_t state;
+    partition_state_init(&state, &table);
+    uint64_t start[4] = { 5, 5, 5, 5 };
+    unsigned char moved[PARTITION_MAX];
+
+    partition_group_t *g = partition_group_join(&state, spec, 7, 1, 100, start, moved);
+    mu_assert("test_partition_groups: first member", g != NULL && g->member_count == 1 && g->next_seq[3] == 5 &&
+              moved[0] && moved[1] && moved[2] && moved[3] && partition_group_owner(g, 3)->slot == 1);
+
+    g = partition_group_join(&state, spec, 7, 2, 101, NULL, moved);
+    mu_assert("test_partition_groups: second member", g != NULL && state.group_count == 1 && g->member_count == 2 &&
+              !moved[0] && !moved[1] && moved[2] && moved[3] && partition_group_owner(g, 1)->slot == 1 &&
+              partition_group_owner(g, 2)->slot == 2);
+
+    g = partition_group_join(&state, spec, 7, 3, 102, NULL, moved);
+    mu_assert("test_partition_groups: third member", g->member_count == 3 && partition_group_owner(g, 0)->slot == 1 &&
+              partition_group_owner(g, 1)->slot == 1 && partition_group_owner(g, 2)->slot == 2 &&
+              partition_group_owner(g, 3)->slot == 3 && !moved[0] && !moved[1] && !moved[2] && moved[3]);
+
+    // Leaving marks the group stale; the partitions are dealt out on the next rebalance
+    mu_assert("test_partition_groups: leave", partition_group_leave(&state, 1, 100) == 1 && g->stale &&
+              partition_group_leave(&state, 1, 100) == 0 && partition_group_leave(&state, 2, 999) == 0);
+    mu_assert("test_partition_groups: rebalance", partition_group_rebalance(g, moved) == 1 && !g->stale &&
+              partition_group_owner(g, 0)->slot == 2 && partition_group_owner(g, 1)->slot == 2 &&
+              partition_group_owner(g, 2)->slot == 3 && partition_group_owner(g, 3)->slot == 3 &&
+              moved[0] && moved[1] && moved[2] && !moved[3] && partition_group_rebalance(g, moved) == 0);
+
+    // Plain subscriptions get a group each, dropped once empty; named groups are kept
+    partition_group_t *own = partition_group_join(&state, spec, 0, 4, 103, start, moved);
+    mu_assert("test_partition_groups: own group", own != NULL && state.group_count == 2 && own->id == 0);
+    partition_group_join(&state, spec, 0, 5, 104, start, moved);
+    mu_assert("test_partition_groups: another own group", state.group_count == 3);
+    partition_group_leave(&state, 4, 103);
+    partition_group_leave(&state, 2, 101);
+    partition_group_leave(&state, 3, 102);
+    partition_group_prune(&state);
+    g = &state.groups[0];
+    mu_assert("test_partition_groups: prune", state.group_count == 2 && g->id == 7 && g->member_count == 0 &&
+              state.groups[1].id == 0 && state.groups[1].member_count == 1);
+    mu_assert("test_partition_groups: no members", partition_group_rebalance(g, moved) == 1 &&
+              partition_group_owner(g, 0) == NULL && !moved[0]);
+
+    partition_state_free(&state);
+    mu_assert("test_partition_groups: freed", state.group_count == 0 && state.groups == NULL);
+    return 0;
+}
+
+/**
+ * @brief Tests a broker with a partitioned topic: keyed and round-robin placement, a
+ * consumer group sharing the partitions, a member taking over the partitions of one
+ * that left without duplicates, and a plain subscription replaying every partition.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_partition_broker() {
+    teardown_log_dir();
+    setup_log_dir();
+    struct pollfd fds[TEST_PART_SLOTS + 1];
+    client_t clients[TEST_PART_SLOTS + 1];
+    broker_t broker;
+    partition_table_t table;
+    memset(&table, 0, sizeof(table));
+    partition_table_add(&table, "part_orders=2");
+    int a[2], b[2], c[2], pub[2];
+    mu_assert("test_partition_broker: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, c) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, pub) == 0);
+    set_non_blocking(a[0]);
+    set_non_blocking(b[0]);
+    set_non_blocking(c[0]);
+    set_non_blocking(pub[0]);
+
+    broker_init(&broker, fds, clients, TEST_PART_SLOTS);
+    broker.p_mode = PERSIST_ALL;
+    broker.parts.table = &table;
+    int a_slot = broker_add_client(&broker, a[0]);
+    int b_slot = broker_add_client(&broker, b[0]);
+    int c_slot = broker_add_client(&broker, c[0]);
+    int p_slot = broker_add_client(&broker, pub[0]);
+
+    // Two members of group 5: partition 0 goes to the first, partition 1 to the second
+    mu_assert("test_partition_broker: join", send_to(&broker, a_slot, a[1], "SUB part_orders group=5\n") &&
+              send_to(&broker, b_slot, b[1], "SUB part_orders group=5\n") && broker.parts.group_count == 1 &&
+              broker.parts.groups[0].member_count == 2 && clients[a_slot].type == CLIENT_TYPE_SUBSCRIBER);
+
+    mu_assert("test_partition_broker: publish", send_to(&broker, p_slot, pub[1],
+              "PUB part_orders 2 key=2\nk0PUB part_orders 2 key=3\nk1PUB part_orders 2\nr0PUB part_orders 2\nr1"));
+    mu_assert("test_partition_broker: placement", broker.parts.keyed == 2 && broker.parts.round_robin == 2);
+    char buf[2048];
+    char seen[512];
+    size_t len = recv_pending(a[1], buf, sizeof(buf));
+    mu_assert("test_partition_broker: first member", describe_msgs(buf, len, seen, sizeof(seen)) == 2 &&
+              strcmp(seen, "part_orders:0/1/k0 part_orders:0/2/r0") == 0);
+    len = recv_pending(b[1], buf, sizeof(buf));
+    mu_assert("test_partition_broker: second member", describe_msgs(buf, len, seen, sizeof(seen)) == 2 &&
+              strcmp(seen, "part_orders:1/1/k1 part_orders:1/2/r1") == 0);
+
+    // The second member leaves; the first takes partition 1 over from where the group was
+    close(b[1]);
+    broker_handle_readable(&broker, b_slot);
+    mu_assert("test_partition_broker: left", broker.parts.groups[0].member_count == 1 && fds[b_slot].fd == -1);
+    mu_assert("test_partition_broker: publish after leave", send_to(&broker, p_slot, pub[1],
+              "PUB part_orders 2 key=3\nk2"));
+    len = recv_pending(a[1], buf, sizeof(buf));
+    mu_assert("test_partition_broker: taken over", describe_msgs(buf, len, seen, sizeof(seen)) == 1 &&
+              strcmp(seen, "part_orders:1/3/k2") == 0 && broker.parts.groups[0].next_seq[1] == 4);
+
+    // A partition can be published to and subscribed to by name
+    mu_assert("test_partition_broker: direct publish", send_to(&broker, p_slot, pub[1], "PUB part_orders:0 2\nd0"));
+    len = recv_pending(a[1], buf, sizeof(buf));
+    mu_assert("test_partition_broker: direct delivery", describe_msgs(buf, len, seen, sizeof(seen)) == 1 &&
+              strcmp(seen, "part_orders:0/3/d0") == 0);
+
+    // A plain subscription is sent every partition's stored messages, partition by partition
+    mu_assert("test_partition_broker: plain subscription", send_to(&broker, c_slot, c[1], "SUB part_orders\n") &&
+              broker.parts.group_count == 2);
+    len = recv_pending(c[1], buf, sizeof(buf));
+    mu_assert("test_partition_broker: every partition", describe_msgs(buf, len, seen, sizeof(seen)) == 6 &&
+              strcmp(seen, "part_orders:0/1/k0 part_orders:0/2/r0 part_orders:0/3/d0 "
+                     "part_orders:1/1/k1 part_orders:1/2/r1 part_orders:1/3/k2") == 0);
+    close(c[1]);
+    broker_handle_readable(&broker, c_slot);
+    mu_assert("test_partition_broker: publish after unsubscribe", send_to(&broker, p_slot, pub[1],
+              "PUB part_orders 2 key=2\nk3") && broker.parts.group_count == 1);
+
+    broker_free(&broker);
+    close(a[1]);
+    close(pub[1]);
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all partition tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_partition_tests() {
+    mu_run_test(test_partition_table);
+    mu_run_test(test_partition_pick);
+    mu_run_test(test_partition_groups);
+    mu_run_test(test_partition_broker);
+    return 0;
+}
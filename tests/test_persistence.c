@@ -80,9 +80,20 @@ char * test_persist_message_all() {
     mu_assert("test_persist_message_all: Log file should exist", fp != NULL);
 
     char buffer[BUFFER_SIZE];
+    long timestamp;
+    unsigned long long seq;
+    size_t len;
+    fgets(buffer, sizeof(buffer), fp);
+    mu_assert("test_persist_message_all: First header incorrect",
+              sscanf(buffer, "%ld %llu %zu", &timestamp, &seq, &len) == 3 && seq == 1 && len == 14);
     fgets(buffer, sizeof(buffer), fp);
     mu_assert("test_persist_message_all: First message incorrect", strcmp(buffer, "message_all_1\n") == 0);
     fgets(buffer, sizeof(buffer), fp);
+    mu_assert("test_persist_message_all: First record unterminated", strcmp(buffer, "\n") == 0);
+    fgets(buffer, sizeof(buffer), fp);
+    mu_assert("test_persist_message_all: Second header incorrect",
+              sscanf(buffer, "%ld %llu %zu", &timestamp, &seq, &len) == 3 && seq == 2 && len == 14);
+    fgets(buffer, sizeof(buffer), fp);
     mu_assert("test_persist_message_all: Second message incorrect", strcmp(buffer, "message_all_2\n") == 0);
 
     fclose(fp);
@@ -107,16 +118,22 @@ char * test_persist_message_timed() {
     mu_assert("test_persist_message_timed: Log file should exist", fp != NULL);
 
     char buffer[BUFFER_SIZE];
-    long timestamp1, timestamp2;
+    long timestamp1 = 0, timestamp2 = 0;
+    size_t len1 = 0, len2 = 0;
     char msg1[BUFFER_SIZE], msg2[BUFFER_SIZE];
 
     fgets(buffer, sizeof(buffer), fp);
-    sscanf(buffer, "%ld %s", &timestamp1, msg1);
-    mu_assert("test_persist_message_timed: First message content incorrect", strcmp(msg1, "message_timed_1") == 0);
+    sscanf(buffer, "%ld %*u %zu", &timestamp1, &len1);
+    fgets(msg1, sizeof(msg1), fp);
+    mu_assert("test_persist_message_timed: First message content incorrect",
+              len1 == 16 && strcmp(msg1, "message_timed_1\n") == 0);
 
+    fgets(buffer, sizeof(buffer), fp); // record terminator
     fgets(buffer, sizeof(buffer), fp);
-    sscanf(buffer, "%ld %s", &timestamp2, msg2);
-    mu_assert("test_persist_message_timed: Second message content incorrect", strcmp(msg2, "message_timed_2") == 0);
+    sscanf(buffer, "%ld %*u %zu", &timestamp2, &len2);
+    fgets(msg2, sizeof(msg2), fp);
+    mu_assert("test_persist_message_timed: Second message content incorrect",
+              len2 == 16 && strcmp(msg2, "message_timed_2\n") == 0);
     mu_assert("test_persist_message_timed: Timestamps should be different", timestamp1 != timestamp2);
 
     fclose(fp);
@@ -179,11 +196,12 @@ char * test_send_persisted_messages_all() {
 
     send_persisted_messages(1, "topic_send_all", PERSIST_ALL, 0);
 
-    printf("\nExpected: \"%s\"\n", "msg1\nmsg2\n");
+    const char *expected = "MSG topic_send_all 5\nmsg1\nMSG topic_send_all 5\nmsg2\n";
+    printf("\nExpected: \"%s\"\n", expected);
     printf("Actual:   \"%s\"\n", mock_write_buffer);
 
-    mu_assert("test_send_persisted_messages_all: Should send all messages",
-              strcmp(mock_write_buffer, "msg1\nmsg2\n") == 0);
+    mu_assert("test_send_persisted_messages_all: Should send all messages as MSG frames",
+              strcmp(mock_write_buffer, expected) == 0);
 
     teardown_log_dir();
     return 0;
@@ -200,7 +218,7 @@ char * test_send_persisted_messages_timed_valid() {
     char filepath[256];
     snprintf(filepath, sizeof(filepath), "%s/topic_send_timed_valid.log", LOG_DIR);
     FILE *fp = fopen(filepath, "w");
-    fprintf(fp, "%ld msg_valid\n", time(NULL));
+    fprintf(fp, "%ld 1 9\nmsg_valid\n", time(NULL));
     fclose(fp);
 
     mock_write_pos = 0;
@@ -208,15 +226,16 @@ char * test_send_persisted_messages_timed_valid() {
 
     send_persisted_messages(1, "topic_send_timed_valid", PERSIST_TIMED, 10);
 
-    mu_assert("test_send_persisted_messages_timed_valid: Should send valid message",
-              strcmp(mock_write_buffer, "msg_valid\n") == 0);
+    mu_assert("test_send_persisted_messages_timed_valid: Should send valid message as a MSG frame",
+              strcmp(mock_write_buffer, "MSG topic_send_timed_valid 9\nmsg_valid") == 0);
 
     // Verify log file content after cleanup (should still contain the valid message)
     fp = fopen(filepath, "r");
     mu_assert("test_send_persisted_messages_timed_valid: Log file should exist after cleanup", fp != NULL);
     char buffer[BUFFER_SIZE];
-    fgets(buffer, sizeof(buffer), fp);
-    mu_assert("test_send_persisted_messages_timed_valid: Log file content incorrect after cleanup", strstr(buffer, "msg_valid\n") != NULL);
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    buffer[n] = '\0';
+    mu_assert("test_send_persisted_messages_timed_valid: Log file content incorrect after cleanup", strstr(buffer, " 1 9\nmsg_valid\n") != NULL);
     fclose(fp);
 
     teardown_log_dir();
@@ -234,7 +253,7 @@ char * test_send_persisted_messages_timed_expired() {
     char filepath[256];
     snprintf(filepath, sizeof(filepath), "%s/topic_send_timed_expired.log", LOG_DIR);
     FILE *fp = fopen(filepath, "w");
-    fprintf(fp, "%ld msg_expired\n", time(NULL) - 100);
+    fprintf(fp, "%ld 1 11\nmsg_expired\n", time(NULL) - 100);
     fclose(fp);
 
     mock_write_pos = 0;
@@ -257,6 +276,330 @@ char * test_send_persisted_messages_timed_expired() {
     return 0;
 }
 
+// --- Test Cases for sequence numbers and resumed replay ---
+
+/**
+ * @brief Collects the sequence numbers and messages seen by a replay.
+ */
+typedef struct {
+    uint64_t seqs[8];        ///< Sequence numbers in replay order.
+    char messages[8][32];    ///< Messages in replay order, NUL-terminated.
+    size_t lens[8];          ///< Message lengths in replay order.
+    uint64_t origins[8];     ///< Origins in replay order.
+    int count;               ///< Number of records replayed.
+} replay_capture_t;
+
+/**
+ * @brief Replay sink that records each message into a replay_capture_t.
+ *
+ * @param topic The topic being replayed (unused).
+ * @param message The message content.
+ * @param len The length of the message in bytes.
+ * @param seq The sequence number of the record.
+ * @param origin The broker the record originated on.
+ * @param ctx Pointer to a replay_capture_t.
+ */
+static void capture_sink(const char *topic, const char *message, size_t len, uint64_t seq, uint64_t origin, void *ctx) {
+    replay_capture_t *capture = ctx;
+    (void)topic;
+    if (capture->count < 8) {
+        size_t keep = len < sizeof(capture->messages[0]) ? len : sizeof(capture->messages[0]) - 1;
+        capture->seqs[capture->count] = seq;
+        capture->lens[capture->count] = len;
+        capture->origins[capture->count] = origin;
+        memcpy(capture->messages[capture->count], message, keep);
+        capture->messages[capture->count][keep] = '\0';
+        capture->count++;
+    }
+}
+
+/**
+ * @brief Tests that persisted messages get consecutive sequence numbers and that a replay
+ * can start from a given sequence number.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replay_from_sequence() {
+    setup_log_dir();
+    uint64_t first = persist_message_len("topic_seq", "one", 3, PERSIST_ALL);
+    uint64_t second = persist_message_len("topic_seq", "two", 3, PERSIST_ALL);
+    uint64_t third = persist_message_len("topic_seq", "three", 5, PERSIST_ALL);
+    mu_assert("test_replay_from_sequence: sequence numbers should start at 1 and increase",
+              first == 1 && second == 2 && third == 3);
+    mu_assert("test_replay_from_sequence: unpersisted messages have no sequence number",
+              persist_message_len("topic_seq", "none", 4, PERSIST_NONE) == 0);
+
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_seq", PERSIST_ALL, 0, 2, capture_sink, &capture);
+    mu_assert("test_replay_from_sequence: replay should start at the requested sequence number",
+              capture.count == 2 && capture.seqs[0] == 2 && strcmp(capture.messages[0], "two") == 0 &&
+              capture.seqs[1] == 3 && strcmp(capture.messages[1], "three") == 0);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that messages containing newlines or other bytes are stored as one record
+ * each, keep one sequence number each and replay unchanged, also when resuming.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replay_binary_payloads() {
+    setup_log_dir();
+    uint64_t first = persist_message_len("topic_binary", "a\nb", 3, PERSIST_ALL);
+    uint64_t second = persist_message_len("topic_binary", "tail\n", 5, PERSIST_ALL);
+    uint64_t third = persist_message_len("topic_binary", "x\0y", 3, PERSIST_ALL);
+    uint64_t fourth = persist_message_len("topic_binary", "", 0, PERSIST_ALL);
+    mu_assert("test_replay_binary_payloads: one sequence number per message",
+              first == 1 && second == 2 && third == 3 && fourth == 4);
+
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_binary", PERSIST_ALL, 0, 0, capture_sink, &capture);
+    mu_assert("test_replay_binary_payloads: replayed unchanged", capture.count == 4 &&
+              capture.lens[0] == 3 && strcmp(capture.messages[0], "a\nb") == 0 &&
+              capture.lens[1] == 5 && strcmp(capture.messages[1], "tail\n") == 0 &&
+              capture.lens[2] == 3 && memcmp(capture.messages[2], "x\0y", 3) == 0 &&
+              capture.lens[3] == 0 && capture.seqs[3] == 4);
+
+    // Resuming after the first message must not start inside it
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_binary", PERSIST_ALL, 0, 2, capture_sink, &capture);
+    mu_assert("test_replay_binary_payloads: resumed", capture.count == 3 && capture.seqs[0] == 2 &&
+              strcmp(capture.messages[0], "tail\n") == 0);
+
+    // A line that looks like a timestamp is part of the message
+    persist_message_len("topic_binary_timed", "a\n17 b", 6, PERSIST_TIMED);
+    persist_message_len("topic_binary_timed", "c", 1, PERSIST_TIMED);
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_binary_timed", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_replay_binary_payloads: timed", capture.count == 2 && capture.lens[0] == 6 &&
+              strcmp(capture.messages[0], "a\n17 b") == 0 && capture.seqs[1] == 2);
+    mu_assert("test_replay_binary_payloads: numbering continues",
+              persist_message_len("topic_binary", "more", 4, PERSIST_ALL) == 5);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that a record cut short by a crash is dropped and appending continues.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_torn_record() {
+    setup_log_dir();
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/topic_torn.log", LOG_DIR);
+    FILE *fp = fopen(filepath, "w");
+    fprintf(fp, "%ld 1 3\none\n%ld 2 10\ntw", time(NULL), time(NULL));
+    fclose(fp);
+
+    mu_assert("test_torn_record: numbering continues after the last whole record",
+              persist_message_len("topic_torn", "two", 3, PERSIST_ALL) == 2);
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_torn", PERSIST_ALL, 0, 0, capture_sink, &capture);
+    mu_assert("test_torn_record: torn record dropped", capture.count == 2 &&
+              strcmp(capture.messages[0], "one") == 0 && strcmp(capture.messages[1], "two") == 0 && capture.seqs[1] == 2);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Returns the size of a file.
+ *
+ * @param filepath The file.
+ * @return long The size in bytes, or -1 if the file does not exist.
+ */
+static long file_size(const char *filepath) {
+    struct stat st;
+    return stat(filepath, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/**
+ * @brief Tests that a log with a malformed record is neither appended to, cut short nor
+ * compacted, wherever the record is.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_malformed_log_kept() {
+    setup_log_dir();
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/topic_bad_start.log", LOG_DIR);
+    FILE *fp = fopen(filepath, "w");
+    fprintf(fp, "1700000000 old message one\n1700000001 old message two\n");
+    fclose(fp);
+    long size = file_size(filepath);
+    mu_assert("test_malformed_log_kept: not appended at the start",
+              persist_message_len("topic_bad_start", "new", 3, PERSIST_ALL) == 0 && file_size(filepath) == size);
+
+    snprintf(filepath, sizeof(filepath), "%s/topic_bad_middle.log", LOG_DIR);
+    fp = fopen(filepath, "w");
+    fprintf(fp, "%ld 1 3\none\n%ld 2 3\ntwoX%ld 3 5\nthree\n", time(NULL), time(NULL), time(NULL));
+    fclose(fp);
+    size = file_size(filepath);
+    mu_assert("test_malformed_log_kept: not appended in the middle",
+              persist_message_len("topic_bad_middle", "four", 4, PERSIST_ALL) == 0 && file_size(filepath) == size);
+    persist_reset_stats();
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_bad_middle", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    snprintf(filepath, sizeof(filepath), "%s/topic_bad_middle.log.tmp", LOG_DIR);
+    mu_assert("test_malformed_log_kept: not compacted", capture.count == 1 && persist_get_stats()->compactions == 0 &&
+              file_size(filepath) == -1);
+    snprintf(filepath, sizeof(filepath), "%s/topic_bad_middle.log", LOG_DIR);
+    mu_assert("test_malformed_log_kept: kept whole", file_size(filepath) == size);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that logs from before the record format are converted and then appended to.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_upgrade_legacy_logs() {
+    setup_log_dir();
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/topic_legacy.log", LOG_DIR);
+    FILE *fp = fopen(filepath, "w");
+    fprintf(fp, "%ld old one\n%ld 42 old two\n", time(NULL), time(NULL));
+    fclose(fp);
+    snprintf(filepath, sizeof(filepath), "%s/topic_current.log", LOG_DIR);
+    fp = fopen(filepath, "w");
+    fprintf(fp, "%ld 1 3\none\n", time(NULL));
+    fclose(fp);
+
+    mu_assert("test_upgrade_legacy_logs: converted one", persist_upgrade_logs(PERSIST_TIMED) == 1);
+    snprintf(filepath, sizeof(filepath), "%s/topic_legacy.log.legacy", LOG_DIR);
+    mu_assert("test_upgrade_legacy_logs: original kept", file_size(filepath) > 0);
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_legacy", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_upgrade_legacy_logs: records", capture.count == 2 && capture.seqs[0] == 1 &&
+              strcmp(capture.messages[0], "old one") == 0 && capture.seqs[1] == 2 &&
+              strcmp(capture.messages[1], "42 old two") == 0);
+    mu_assert("test_upgrade_legacy_logs: appended", persist_message_len("topic_legacy", "new", 3, PERSIST_TIMED) == 3);
+    mu_assert("test_upgrade_legacy_logs: nothing left", persist_upgrade_logs(PERSIST_TIMED) == 0);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Receives the saved bridge position of topic_origin.
+ *
+ * @param topic The topic.
+ * @param next_seq Its position.
+ * @param ctx Pointer to a uint64_t receiving the position.
+ */
+static void position_sink(const char *topic, uint64_t next_seq, void *ctx) {
+    if (strcmp(topic, "topic_origin") == 0) {
+        *(uint64_t *)ctx = next_seq;
+    }
+}
+
+/**
+ * @brief Tests that the origin of bridged records, a bridge's positions and the broker id
+ * are kept on disk, so they are found again after a restart.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_state_on_disk() {
+    setup_log_dir();
+    persist_message_len("topic_origin", "local", 5, PERSIST_TIMED);
+    persist_message_origin("topic_origin", "bridged\n", 8, PERSIST_TIMED, 18446744073709551615ULL);
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_origin", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_bridge_state_on_disk: origins", capture.count == 2 && capture.origins[0] == 0 &&
+              capture.origins[1] == 18446744073709551615ULL && strcmp(capture.messages[1], "bridged\n") == 0);
+    // The compacted log keeps them
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_origin", PERSIST_ALL, 0, 2, capture_sink, &capture);
+    mu_assert("test_bridge_state_on_disk: origin after compaction", capture.count == 1 && capture.seqs[0] == 2 &&
+              capture.origins[0] == 18446744073709551615ULL);
+
+    uint64_t position = 0;
+    mu_assert("test_bridge_state_on_disk: no position", persist_load_bridge_positions(position_sink, &position) == 0);
+    mu_assert("test_bridge_state_on_disk: position saved", persist_save_bridge_position("topic_origin", 42) == 0 &&
+              persist_save_bridge_position("topic_origin", 43) == 0 &&
+              persist_load_bridge_positions(position_sink, &position) == 1 && position == 43 &&
+              access("logs/topic_origin.log.bridge.tmp", F_OK) != 0);
+
+    mu_assert("test_bridge_state_on_disk: id kept", persist_broker_id(7) == 7 && persist_broker_id(9) == 7);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that dropping expired records from a timed log keeps the numbering of the rest.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_timed_replay_keeps_sequence() {
+    setup_log_dir();
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/topic_seq_timed.log", LOG_DIR);
+    FILE *fp = fopen(filepath, "w");
+    fprintf(fp, "%ld 1 3\nold\n%ld 2 3\nnew\n", time(NULL) - 100, time(NULL));
+    fclose(fp);
+
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_seq_timed", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_timed_replay_keeps_sequence: expired record should be skipped",
+              capture.count == 1 && capture.seqs[0] == 2 && strcmp(capture.messages[0], "new") == 0);
+
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_seq_timed", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_timed_replay_keeps_sequence: numbering should survive log compaction",
+              capture.count == 1 && capture.seqs[0] == 2);
+    mu_assert("test_timed_replay_keeps_sequence: next message continues the numbering",
+              persist_message_len("topic_seq_timed", "later", 5, PERSIST_TIMED) == 3);
+
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that appends, fsyncs, retention and replays are counted.
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_persist_stats() {
+    setup_log_dir();
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), "%s/topic_stats.log", LOG_DIR);
+    FILE *fp = fopen(filepath, "w");
+    fprintf(fp, "%ld 1 3\nold\n", time(NULL) - 100);
+    fclose(fp);
+
+    persist_reset_stats();
+    persist_set_timing(1);
+    persist_set_fsync(1);
+    persist_message_len("topic_stats", "abc", 3, PERSIST_TIMED);
+    persist_set_fsync(0);
+    persist_message_len("topic_stats", "de\n", 3, PERSIST_TIMED);
+
+    const persist_stats_t *ps = persist_get_stats();
+    mu_assert("test_persist_stats: appends", ps->appends == 2 && ps->append_errors == 0);
+    mu_assert("test_persist_stats: bytes include timestamps", ps->bytes_written > 7);
+    mu_assert("test_persist_stats: one fsync", ps->fsyncs == 1 && ps->fsync_ns.total == 1);
+    mu_assert("test_persist_stats: append latency", ps->append_ns.total == 2);
+    mu_assert("test_persist_stats: files closed", ps->open_files == 0 && ps->log_files >= 1);
+
+    replay_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    replay_persisted_messages("topic_stats", PERSIST_TIMED, 10, 0, capture_sink, &capture);
+    mu_assert("test_persist_stats: replayed", capture.count == 2 && ps->replays == 1 && ps->replay_records == 3);
+    mu_assert("test_persist_stats: compaction", ps->compactions == 1 && ps->records_expired == 1 &&
+              ps->bytes_expired > 4 && ps->replay_bytes == ps->bytes_expired + ps->bytes_rewritten);
+    mu_assert("test_persist_stats: open files", ps->open_files == 0);
+    persist_set_timing(0);
+
+    teardown_log_dir();
+    return 0;
+}
+
 /**
  * @brief Aggregates and runs all persistence tests.
  *
@@ -269,5 +612,13 @@ char * all_persistence_tests() {
     mu_run_test(test_send_persisted_messages_all);
     mu_run_test(test_send_persisted_messages_timed_valid);
     mu_run_test(test_send_persisted_messages_timed_expired);
+    mu_run_test(test_replay_from_sequence);
+    mu_run_test(test_replay_binary_payloads);
+    mu_run_test(test_torn_record);
+    mu_run_test(test_malformed_log_kept);
+    mu_run_test(test_upgrade_legacy_logs);
+    mu_run_test(test_bridge_state_on_disk);
+    mu_run_test(test_timed_replay_keeps_sequence);
+    mu_run_test(test_persist_stats);
     return 0;
 }
@@ -0,0 +1,70 @@
+/**
+ * @file test_prof.c
+ * @brief Unit tests for the phase profiler.
+ * @author Mohammed Uddin
+ */
+
+#include <string.h>
+#include "minunit.h"
+#include "../prof.h"
+
+/**
+ * @brief Tests that laps charge consecutive intervals to their phases.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_prof_lap() {
+    prof_counters_t counters;
+    memset(&counters, 0, sizeof(counters));
+    uint64_t start = prof_now();
+    uint64_t mark = start;
+    prof_lap(&counters, PROF_PARSE, &mark);
+    volatile uint64_t spin = 0;
+    for (int i = 0; i < 100000; i++) {
+        spin += (uint64_t)i;
+    }
+    prof_lap(&counters, PROF_FANOUT, &mark);
+    prof_lap(&counters, PROF_PARSE, &mark);
+
+    mu_assert("test_prof_lap: calls", counters.calls[PROF_PARSE] == 2 && counters.calls[PROF_FANOUT] == 1);
+    mu_assert("test_prof_lap: untouched phase", counters.calls[PROF_PERSIST] == 0 && counters.ticks[PROF_PERSIST] == 0);
+    mu_assert("test_prof_lap: laps cover the interval",
+              counters.ticks[PROF_PARSE] + counters.ticks[PROF_FANOUT] == mark - start);
+    mu_assert("test_prof_lap: busy phase measured", counters.ticks[PROF_FANOUT] > 0);
+    return 0;
+}
+
+/**
+ * @brief Tests merging, phase names and tick calibration.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_prof_merge() {
+    prof_counters_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.ticks[PROF_SEND] = 10;
+    a.calls[PROF_SEND] = 1;
+    b.ticks[PROF_SEND] = 5;
+    b.calls[PROF_SEND] = 2;
+    b.ticks[PROF_READ] = 7;
+    prof_merge(&a, &b);
+    mu_assert("test_prof_merge: sums", a.ticks[PROF_SEND] == 15 && a.calls[PROF_SEND] == 3 && a.ticks[PROF_READ] == 7);
+
+    mu_assert("test_prof_merge: names", strcmp(prof_phase_name(PROF_PERSIST), "persist") == 0 &&
+                                        strcmp(prof_phase_name(PROF_ITERATION), "iteration") == 0);
+    prof_calibrate();
+    mu_assert("test_prof_merge: tick length", prof_ns_per_tick() > 0.0 && prof_ns_per_tick() < 1000.0);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all profiler tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_prof_tests() {
+    mu_run_test(test_prof_lap);
+    mu_run_test(test_prof_merge);
+    return 0;
+}
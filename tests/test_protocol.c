@@ -0,0 +1,355 @@
+/**
+ * @file test_protocol.c
+ * @brief Unit tests for the wire protocol frame parser and encoder.
+ * @author Mohammed Uddin
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "../protocol.h"
+
+/**
+ * @brief Tests parsing of complete SUB and PUB frames.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_parse_complete_frames() {
+    frame_t frame;
+    size_t consumed;
+
+    const char *sub = "SUB my_topic\n";
+    mu_assert("test_parse_complete_frames: SUB should parse",
+              parse_frame(sub, strlen(sub), &frame, &consumed) == FRAME_OK);
+    mu_assert("test_parse_complete_frames: SUB type", frame.type == FRAME_SUB);
+    mu_assert("test_parse_complete_frames: SUB topic", strcmp(frame.topic, "my_topic") == 0);
+    mu_assert("test_parse_complete_frames: SUB consumed", consumed == strlen(sub));
+
+    const char *pub = "PUB news 5\nhello";
+    mu_assert("test_parse_complete_frames: PUB should parse",
+              parse_frame(pub, strlen(pub), &frame, &consumed) == FRAME_OK);
+    mu_assert("test_parse_complete_frames: PUB type", frame.type == FRAME_PUB);
+    mu_assert("test_parse_complete_frames: PUB topic", strcmp(frame.topic, "news") == 0);
+    mu_assert("test_parse_complete_frames: PUB payload",
+              frame.payload_len == 5 && memcmp(frame.payload, "hello", 5) == 0);
+    mu_assert("test_parse_complete_frames: PUB consumed", consumed == strlen(pub));
+
+    return 0;
+}
+
+/**
+ * @brief Tests that frames split at every possible boundary are reassembled.
+ *
+ * Feeds two back-to-back frames one byte at a time and checks that each is reported
+ * as incomplete until its last byte arrives.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_parse_split_frames() {
+    const char *stream = "PUB a 3\nx\nyMSG b 0\n";
+    size_t total = strlen(stream);
+    size_t first_len = strlen("PUB a 3\nx\ny");
+    frame_t frame;
+    size_t consumed;
+
+    for (size_t avail = 0; avail < first_len; avail++) {
+        mu_assert("test_parse_split_frames: partial frame should be incomplete",
+                  parse_frame(stream, avail, &frame, &consumed) == FRAME_INCOMPLETE);
+    }
+    mu_assert("test_parse_split_frames: first frame should parse",
+              parse_frame(stream, total, &frame, &consumed) == FRAME_OK);
+    mu_assert("test_parse_split_frames: payload may contain newlines",
+              frame.payload_len == 3 && memcmp(frame.payload, "x\ny", 3) == 0);
+    mu_assert("test_parse_split_frames: first frame length", consumed == first_len);
+
+    mu_assert("test_parse_split_frames: empty payload frame should parse",
+              parse_frame(stream + consumed, total - consumed, &frame, &consumed) == FRAME_OK);
+    mu_assert("test_parse_split_frames: second frame type", frame.type == FRAME_MSG && frame.payload_len == 0);
+
+    return 0;
+}
+
+/**
+ * @brief Tests parsing of a BATCH frame and the PUB frames it encloses.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_parse_batch_frame() {
+    char buf[128];
+    const char *inner = "PUB a 2\nhiPUB b 3\nyo!";
+    int n = format_batch_header(buf, sizeof(buf), 2, strlen(inner));
+    mu_assert("test_parse_batch_frame: header text", n > 0 && strcmp(buf, "BATCH 2 21\n") == 0);
+    memcpy(buf + n, inner, strlen(inner));
+
+    frame_t frame;
+    size_t consumed;
+    mu_assert("test_parse_batch_frame: batch should parse",
+              parse_frame(buf, n + strlen(inner), &frame, &consumed) == FRAME_OK);
+    mu_assert("test_parse_batch_frame: batch type and count", frame.type == FRAME_BATCH && frame.count == 2);
+    mu_assert("test_parse_batch_frame: batch payload", frame.payload_len == strlen(inner));
+
+    frame_t pub;
+    size_t inner_consumed;
+    mu_assert("test_parse_batch_frame: first enclosed frame",
+              parse_frame(frame.payload, frame.payload_len, &pub, &inner_consumed) == FRAME_OK &&
+              pub.type == FRAME_PUB && strcmp(pub.topic, "a") == 0);
+    mu_assert("test_parse_batch_frame: second enclosed frame",
+              parse_frame(frame.payload + inner_consumed, frame.payload_len - inner_consumed, &pub, &inner_consumed) == FRAME_OK &&
+              strcmp(pub.topic, "b") == 0 && pub.payload_len == 3);
+    mu_assert("test_parse_batch_frame: truncated batch is incomplete",
+              parse_frame(buf, n + 5, &frame, &consumed) == FRAME_INCOMPLETE);
+
+    return 0;
+}
+
+/**
+ * @brief Tests rejection of malformed frames.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_parse_malformed_frames() {
+    frame_t frame;
+    size_t consumed;
+    char long_header[FRAME_MAX_HEADER + 1];
+
+    mu_assert("test_parse_malformed_frames: unknown verb",
+              parse_frame("FOO bar\n", 8, &frame, &consumed) == FRAME_ERROR);
+    mu_assert("test_parse_malformed_frames: PUB without length",
+              parse_frame("PUB bar\n", 8, &frame, &consumed) == FRAME_ERROR);
+    mu_assert("test_parse_malformed_frames: topic with path separator",
+              parse_frame("SUB ../etc\n", 11, &frame, &consumed) == FRAME_ERROR);
+    mu_assert("test_parse_malformed_frames: non-numeric length",
+              parse_frame("PUB bar 1x\n", 11, &frame, &consumed) == FRAME_ERROR);
+
+    memset(long_header, 'A', sizeof(long_header));
+    mu_assert("test_parse_malformed_frames: unterminated oversized header",
+              parse_frame(long_header, sizeof(long_header), &frame, &consumed) == FRAME_ERROR);
+
+    return 0;
+}
+
+/**
+ * @brief Tests that encoded headers round-trip through the parser.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_format_frame_header() {
+    char buf[FRAME_MAX_HEADER + 4];
+    frame_t frame;
+    size_t consumed;
+
+    int n = format_frame_header(buf, FRAME_MAX_HEADER, FRAME_MSG, "weather", 4);
+    mu_assert("test_format_frame_header: header text", n > 0 && strcmp(buf, "MSG weather 4\n") == 0);
+    memcpy(buf + n, "rain", 4);
+    mu_assert("test_format_frame_header: round trip",
+              parse_frame(buf, n + 4, &frame, &consumed) == FRAME_OK && consumed == (size_t)n + 4);
+    mu_assert("test_format_frame_header: too small buffer",
+              format_frame_header(buf, 4, FRAME_SUB, "weather", 0) == -1);
+
+    return 0;
+}
+
+/**
+ * @brief Tests that optional key=value header fields are encoded, parsed and skipped correctly.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_frame_fields() {
+    char buf[FRAME_MAX_HEADER];
+    frame_t frame;
+    size_t consumed;
+    frame_fields_t fields = { 1234567890123ULL, 0, 0, 0, 0, 0, 0, 0 };
+
+    int n = format_frame_header_fields(buf, sizeof(buf), FRAME_MSG, "t", 2, &fields);
+    mu_assert("test_frame_fields: absent fields are omitted", n > 0 && strcmp(buf, "MSG t 2 ti=1234567890123\n") == 0);
+    fields.persist_ns = 42;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_MSG, "t", 2, &fields);
+    memcpy(buf + n, "ok", 2);
+    mu_assert("test_frame_fields: fields round trip",
+              parse_frame(buf, n + 2, &frame, &consumed) == FRAME_OK &&
+              frame.fields.ingress_ns == 1234567890123ULL && frame.fields.persist_ns == 42 &&
+              frame.payload_len == 2 && consumed == (size_t)n + 2);
+
+    const char *plain = "MSG t 2 future=x\nok";
+    mu_assert("test_frame_fields: unknown fields are ignored",
+              parse_frame(plain, strlen(plain), &frame, &consumed) == FRAME_OK &&
+              frame.fields.ingress_ns == 0 && frame.fields.persist_ns == 0);
+    fields.persist_ns = 0;
+    fields.ingress_ns = 0;
+    fields.seq = 7;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_MSG, "t", 0, &fields);
+    mu_assert("test_frame_fields: sequence number", n > 0 && strcmp(buf, "MSG t 0 seq=7\n") == 0);
+    fields.seq = 0;
+    fields.from_seq = 8;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_SUB, "t", 0, &fields);
+    mu_assert("test_frame_fields: SUB with resume point",
+              n > 0 && strcmp(buf, "SUB t from=8\n") == 0 &&
+              parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_SUB && frame.fields.from_seq == 8);
+    mu_assert("test_frame_fields: malformed known field",
+              parse_frame("MSG t 2 ti=12a\nok", 17, &frame, &consumed) == FRAME_ERROR);
+
+    return 0;
+}
+
+/**
+ * @brief Tests parsing of STATS requests and replies.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_stats_frames() {
+    char buf[FRAME_MAX_HEADER + 16];
+    frame_t frame;
+    size_t consumed;
+
+    mu_assert("test_stats_frames: request should parse", parse_frame("STATS\n", 6, &frame, &consumed) == FRAME_OK);
+    mu_assert("test_stats_frames: request has no payload",
+              frame.type == FRAME_STATS && frame.payload == NULL && consumed == 6);
+
+    int n = format_stats_header(buf, FRAME_MAX_HEADER, 11);
+    mu_assert("test_stats_frames: reply header", n > 0 && strcmp(buf, "STATS 11\n") == 0);
+    memcpy(buf + n, "messages 1\n", 11);
+    mu_assert("test_stats_frames: partial reply", parse_frame(buf, (size_t)n + 5, &frame, &consumed) == FRAME_INCOMPLETE);
+    mu_assert("test_stats_frames: reply should parse", parse_frame(buf, (size_t)n + 11, &frame, &consumed) == FRAME_OK);
+    mu_assert("test_stats_frames: reply payload",
+              frame.payload_len == 11 && memcmp(frame.payload, "messages 1\n", 11) == 0);
+    mu_assert("test_stats_frames: bad length", parse_frame("STATS x\n", 8, &frame, &consumed) == FRAME_ERROR);
+    return 0;
+}
+
+/**
+ * @brief Tests ACK and REPL frames, including the "ack" field of a PUB.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replication_frames() {
+    char buf[FRAME_MAX_HEADER];
+    frame_t frame;
+    size_t consumed;
+    frame_fields_t fields;
+
+    memset(&fields, 0, sizeof(fields));
+    fields.seq = 42;
+    int n = format_frame_header_fields(buf, sizeof(buf), FRAME_ACK, "news", 0, &fields);
+    mu_assert("test_replication_frames: ACK header", n > 0 && strcmp(buf, "ACK news seq=42\n") == 0);
+    mu_assert("test_replication_frames: ACK parses", parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_ACK && strcmp(frame.topic, "news") == 0 && frame.fields.seq == 42 &&
+              frame.payload == NULL && consumed == (size_t)n);
+
+    memset(&fields, 0, sizeof(fields));
+    fields.from_seq = 7;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_REPL, "news", 0, &fields);
+    mu_assert("test_replication_frames: REPL position", n > 0 && strcmp(buf, "REPL news from=7\n") == 0 &&
+              parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK && frame.type == FRAME_REPL &&
+              frame.fields.from_seq == 7);
+    n = format_repl_start(buf, sizeof(buf));
+    mu_assert("test_replication_frames: bare REPL", n == 5 && parse_frame(buf, 5, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_REPL && frame.topic[0] == '\0' && consumed == 5);
+
+    memset(&fields, 0, sizeof(fields));
+    fields.ack = 1;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_PUB, "news", 2, &fields);
+    mu_assert("test_replication_frames: PUB ack", n > 0 && strcmp(buf, "PUB news 2 ack=1\n") == 0);
+    memcpy(buf + n, "hi", 2);
+    mu_assert("test_replication_frames: PUB ack parses", parse_frame(buf, (size_t)n + 2, &frame, &consumed) == FRAME_OK &&
+              frame.fields.ack == 1 && frame.payload_len == 2);
+    mu_assert("test_replication_frames: ACK needs a topic", parse_frame("ACK\n", 4, &frame, &consumed) == FRAME_ERROR);
+    return 0;
+}
+
+/**
+ * @brief Tests the key and group fields of partitioned topics and the key hash.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_partition_fields() {
+    char buf[FRAME_MAX_HEADER];
+    frame_t frame;
+    size_t consumed;
+    frame_fields_t fields;
+
+    memset(&fields, 0, sizeof(fields));
+    fields.key = 12345;
+    int n = format_frame_header_fields(buf, sizeof(buf), FRAME_PUB, "orders", 2, &fields);
+    mu_assert("test_partition_fields: PUB key", n > 0 && strcmp(buf, "PUB orders 2 key=12345\n") == 0);
+    memcpy(buf + n, "hi", 2);
+    mu_assert("test_partition_fields: PUB key parses", parse_frame(buf, (size_t)n + 2, &frame, &consumed) == FRAME_OK &&
+              frame.fields.key == 12345 && frame.fields.group == 0);
+
+    fields.key = UINT64_MAX;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_PUB, "orders", 0, &fields);
+    mu_assert("test_partition_fields: largest key", n > 0 && parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.fields.key == UINT64_MAX);
+    mu_assert("test_partition_fields: key overflow", parse_frame("PUB orders 0 key=18446744073709551616\n", 38, &frame,
+              &consumed) == FRAME_ERROR);
+
+    memset(&fields, 0, sizeof(fields));
+    fields.group = 9;
+    fields.from_seq = 3;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_SUB, "orders", 0, &fields);
+    mu_assert("test_partition_fields: SUB group", n > 0 && parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_SUB && frame.fields.group == 9 && frame.fields.from_seq == 3);
+
+    // FNV-1a of "a"; equal keys hash equally and no key hashes to 0 ("no key")
+    mu_assert("test_partition_fields: key hash", frame_key_hash("a", 1) == 0xaf63dc4c8601ec8cULL &&
+              frame_key_hash("user-1", 6) == frame_key_hash("user-1", 6) &&
+              frame_key_hash("user-1", 6) != frame_key_hash("user-2", 6) && frame_key_hash("", 0) != 0);
+    return 0;
+}
+
+/**
+ * @brief Tests BRIDGE frames, topic patterns and the "origin" field.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_bridge_frames() {
+    char buf[FRAME_MAX_HEADER];
+    frame_t frame;
+    size_t consumed;
+    frame_fields_t fields;
+
+    memset(&fields, 0, sizeof(fields));
+    fields.from_seq = 1;
+    fields.origin = 41;
+    int n = format_frame_header_fields(buf, sizeof(buf), FRAME_BRIDGE, "orders.*", 0, &fields);
+    mu_assert("test_bridge_frames: pattern line", n > 0 && strcmp(buf, "BRIDGE orders.* from=1 origin=41\n") == 0);
+    mu_assert("test_bridge_frames: pattern parses", parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_BRIDGE && strcmp(frame.topic, "orders.*") == 0 && frame.fields.origin == 41 &&
+              frame.fields.from_seq == 1 && consumed == (size_t)n);
+
+    n = format_bridge_start(buf, sizeof(buf));
+    mu_assert("test_bridge_frames: bare", n == 7 && parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK &&
+              frame.type == FRAME_BRIDGE && frame.topic[0] == '\0');
+
+    mu_assert("test_bridge_frames: patterns only in BRIDGE", parse_frame("SUB orders.*\n", 13, &frame, &consumed) == FRAME_ERROR &&
+              parse_frame("BRIDGE .orders\n", 15, &frame, &consumed) == FRAME_ERROR &&
+              is_valid_pattern("*", 1) && !is_valid_pattern("a b", 3) && !is_valid_pattern("", 0));
+
+    memset(&fields, 0, sizeof(fields));
+    fields.seq = 7;
+    fields.origin = 41;
+    n = format_frame_header_fields(buf, sizeof(buf), FRAME_MSG, "orders.eu", 2, &fields);
+    memcpy(buf + n, "hi", 2);
+    mu_assert("test_bridge_frames: MSG origin", n > 0 && parse_frame(buf, (size_t)n + 2, &frame, &consumed) == FRAME_OK &&
+              frame.fields.seq == 7 && frame.fields.origin == 41 && frame.payload_len == 2);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all protocol tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_protocol_tests() {
+    mu_run_test(test_parse_complete_frames);
+    mu_run_test(test_parse_split_frames);
+    mu_run_test(test_parse_batch_frame);
+    mu_run_test(test_parse_malformed_frames);
+    mu_run_test(test_format_frame_header);
+    mu_run_test(test_frame_fields);
+    mu_run_test(test_stats_frames);
+    mu_run_test(test_replication_frames);
+    mu_run_test(test_partition_fields);
+    mu_run_test(test_bridge_frames);
+    return 0;
+}
@@ -0,0 +1,273 @@
+/**
+ * @file test_replication.c
+ * @brief Unit tests for leader-follower replication, driving both ends over socketpairs.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../broker.h"
+#include "../utils.h"
+
+#define TEST_REPL_SLOTS 4
+
+void setup_log_dir();
+void teardown_log_dir();
+
+/**
+ * @brief Reads everything a peer has received so far, NUL-terminated.
+ *
+ * @param fd The receiving end.
+ * @param buf Destination buffer.
+ * @param cap Capacity of the buffer.
+ * @return size_t The number of bytes read.
+ */
+size_t recv_pending(int fd, char *buf, size_t cap) {
+    size_t len = 0;
+    ssize_t n;
+    while (len + 1 < cap && (n = recv(fd, buf + len, cap - 1 - len, MSG_DONTWAIT)) > 0) {
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Parses the MSG frames in a buffer and writes "<topic>/<seq>/<payload>" for each, space-separated.
+ *
+ * @param buf The received bytes.
+ * @param len Their length.
+ * @param out Destination buffer.
+ * @param cap Capacity of the destination buffer.
+ * @return size_t The number of MSG frames found, stopping at the first other frame.
+ */
+size_t describe_msgs(const char *buf, size_t len, char *out, size_t cap) {
+    size_t count = 0;
+    size_t offset = 0;
+    size_t used = 0;
+    frame_t frame;
+    size_t consumed;
+    out[0] = '\0';
+    while (offset < len && parse_frame(buf + offset, len - offset, &frame, &consumed) == FRAME_OK &&
+           frame.type == FRAME_MSG) {
+        int n = snprintf(out + used, cap - used, "%s%s/%llu/%.*s", count > 0 ? " " : "", frame.topic,
+                         (unsigned long long)frame.fields.seq, (int)frame.payload_len, frame.payload);
+        if (n > 0 && (size_t)n < cap - used) {
+            used += (size_t)n;
+        }
+        offset += consumed;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Tests that the leader catches a follower up from its position, streams new
+ * messages, and holds a synchronous publisher's ACK until the follower acknowledges.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replication_leader() {
+    teardown_log_dir();
+    setup_log_dir();
+    struct pollfd fds[TEST_REPL_SLOTS + 1];
+    client_t clients[TEST_REPL_SLOTS + 1];
+    broker_t broker;
+    int follower[2], pub[2];
+    mu_assert("test_replication_leader: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, follower) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, pub) == 0);
+    set_non_blocking(follower[0]);
+    set_non_blocking(pub[0]);
+
+    broker_init(&broker, fds, clients, TEST_REPL_SLOTS);
+    broker.p_mode = PERSIST_ALL;
+    broker.repl.ack_mode = REPL_ACK_SYNC;
+    broker_publish(&broker, "repl_lead", "one", 3, 0);
+    broker_publish(&broker, "repl_lead", "two", 3, 0);
+    broker_publish(&broker, "repl_lead", "three", 5, 0);
+
+    // The follower has record 1 and catches up from 2
+    int f_slot = broker_add_client(&broker, follower[0]);
+    int p_slot = broker_add_client(&broker, pub[0]);
+    const char *hello = "REPL repl_lead from=2\nREPL\n";
+    mu_assert("test_replication_leader: handshake", send(follower[1], hello, strlen(hello), 0) == (ssize_t)strlen(hello));
+    broker_handle_readable(&broker, f_slot);
+    char buf[1024];
+    size_t len = recv_pending(follower[1], buf, sizeof(buf));
+    mu_assert("test_replication_leader: follower", clients[f_slot].type == CLIENT_TYPE_FOLLOWER &&
+              broker.repl.follower_count == 1 && broker.repl.catchups == 1);
+    char seen[256];
+    mu_assert("test_replication_leader: catch-up", describe_msgs(buf, len, seen, sizeof(seen)) == 2 &&
+              strcmp(seen, "repl_lead/2/two repl_lead/3/three") == 0 && broker.repl.records_sent == 2);
+
+    // A confirmed publish reaches the follower, but its ACK waits for the follower's
+    const char *publish = "PUB repl_lead 4 ack=1\nlive";
+    mu_assert("test_replication_leader: publish", send(pub[1], publish, strlen(publish), 0) == (ssize_t)strlen(publish));
+    broker_handle_readable(&broker, p_slot);
+    len = recv_pending(follower[1], buf, sizeof(buf));
+    mu_assert("test_replication_leader: streamed", describe_msgs(buf, len, seen, sizeof(seen)) == 1 &&
+              strcmp(seen, "repl_lead/4/live") == 0);
+    mu_assert("test_replication_leader: held", recv_pending(pub[1], buf, sizeof(buf)) == 0 &&
+              repl_pending(&broker.repl) == 1);
+
+    const char *ack = "ACK repl_lead seq=4\n";
+    mu_assert("test_replication_leader: follower ACK", send(follower[1], ack, strlen(ack), 0) == (ssize_t)strlen(ack));
+    broker_handle_readable(&broker, f_slot);
+    len = recv_pending(pub[1], buf, sizeof(buf));
+    mu_assert("test_replication_leader: confirmed", strcmp(buf, "ACK repl_lead seq=4\n") == 0 &&
+              repl_pending(&broker.repl) == 0 && repl_acked(&broker.repl, "repl_lead") == 4);
+
+    // Asynchronous acknowledgement confirms right away
+    broker.repl.ack_mode = REPL_ACK_ASYNC;
+    const char *publish_async = "PUB repl_lead 4 ack=1\nfast";
+    mu_assert("test_replication_leader: publish async", send(pub[1], publish_async, strlen(publish_async), 0) ==
+              (ssize_t)strlen(publish_async));
+    broker_handle_readable(&broker, p_slot);
+    recv_pending(pub[1], buf, sizeof(buf));
+    mu_assert("test_replication_leader: confirmed async", strcmp(buf, "ACK repl_lead seq=5\n") == 0 &&
+              broker.repl.confirms == 2);
+
+    // A follower cannot turn itself into a subscriber and leave its entry behind
+    const char *sub = "SUB repl_lead\n";
+    mu_assert("test_replication_leader: follower SUB", send(follower[1], sub, strlen(sub), 0) == (ssize_t)strlen(sub));
+    broker_handle_readable(&broker, f_slot);
+    mu_assert("test_replication_leader: follower gone", broker.repl.follower_count == 0 && fds[f_slot].fd == -1);
+
+    // A new connection reusing the slot does not receive the old follower's stream
+    int reuse[2];
+    mu_assert("test_replication_leader: reuse socketpair", socketpair(AF_UNIX, SOCK_STREAM, 0, reuse) == 0);
+    set_non_blocking(reuse[0]);
+    mu_assert("test_replication_leader: slot reused", broker_add_client(&broker, reuse[0]) == f_slot);
+    broker_publish(&broker, "repl_lead", "after", 5, 0);
+    mu_assert("test_replication_leader: nothing streamed", recv_pending(reuse[1], buf, sizeof(buf)) == 0);
+
+    broker_free(&broker);
+    close(follower[1]);
+    close(reuse[1]);
+    close(pub[1]);
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that a follower announces its positions, stores the leader's records
+ * under the leader's numbers, skips duplicates, acknowledges, and refuses publishers.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replication_follower() {
+    teardown_log_dir();
+    setup_log_dir();
+    persist_message_len("repl_follow", "one", 3, PERSIST_ALL);
+    persist_message_len("repl_follow", "two", 3, PERSIST_ALL);
+
+    struct pollfd fds[TEST_REPL_SLOTS + 1];
+    client_t clients[TEST_REPL_SLOTS + 1];
+    broker_t broker;
+    int leader[2], sub[2], pub[2];
+    mu_assert("test_replication_follower: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, leader) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, sub) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, pub) == 0);
+    set_non_blocking(leader[0]);
+    set_non_blocking(sub[0]);
+    set_non_blocking(pub[0]);
+
+    broker_init(&broker, fds, clients, TEST_REPL_SLOTS);
+    broker.p_mode = PERSIST_ALL;
+    int l_slot = broker_follow(&broker, leader[0]);
+    mu_assert("test_replication_follower: follow", l_slot > 0 && clients[l_slot].type == CLIENT_TYPE_LEADER &&
+              broker.repl.upstream_slot == l_slot && (fds[l_slot].events & POLLOUT));
+    char buf[1024];
+    mu_assert("test_replication_follower: not sent before connected", recv_pending(leader[1], buf, sizeof(buf)) == 0);
+    broker_handle_writable(&broker, l_slot);
+    recv_pending(leader[1], buf, sizeof(buf));
+    mu_assert("test_replication_follower: handshake", strcmp(buf, "REPL repl_follow from=3\nREPL\n") == 0);
+
+    int s_slot = broker_add_client(&broker, sub[0]);
+    const char *subscribe = "SUB repl_follow from=3\n";
+    mu_assert("test_replication_follower: subscribe", send(sub[1], subscribe, strlen(subscribe), 0) ==
+              (ssize_t)strlen(subscribe));
+    broker_handle_readable(&broker, s_slot);
+
+    // Record 2 is already stored; 3 and 4 are new; a new topic starts at the leader's number
+    const char *records = "MSG repl_follow 3 seq=2\ntwoMSG repl_follow 5 seq=3\nthreeMSG repl_follow 4 seq=4\nfour"
+                          "MSG repl_gap 3 seq=10\nten";
+    mu_assert("test_replication_follower: apply", broker_handle_input(&broker, l_slot, records, strlen(records)) == 0);
+    recv_pending(leader[1], buf, sizeof(buf));
+    mu_assert("test_replication_follower: acknowledged", strcmp(buf, "ACK repl_follow seq=2\nACK repl_follow seq=3\n"
+              "ACK repl_follow seq=4\nACK repl_gap seq=10\n") == 0);
+    mu_assert("test_replication_follower: counters", broker.repl.duplicates == 1 && broker.repl.records_applied == 3 &&
+              broker.repl.diverged == 0);
+    mu_assert("test_replication_follower: stored", persist_next_seq("repl_follow") == 5 &&
+              persist_next_seq("repl_gap") == 11);
+    size_t len = recv_pending(sub[1], buf, sizeof(buf));
+    char seen[256];
+    mu_assert("test_replication_follower: fanned out", describe_msgs(buf, len, seen, sizeof(seen)) == 2 &&
+              strcmp(seen, "repl_follow/3/three repl_follow/4/four") == 0);
+
+    int p_slot = broker_add_client(&broker, pub[0]);
+    const char *publish = "PUB repl_follow 1\nx";
+    mu_assert("test_replication_follower: publish", send(pub[1], publish, strlen(publish), 0) == (ssize_t)strlen(publish));
+    broker_handle_readable(&broker, p_slot);
+    mu_assert("test_replication_follower: publisher refused", fds[p_slot].fd == -1 && persist_next_seq("repl_follow") == 5);
+
+    close(leader[1]);
+    broker_handle_readable(&broker, l_slot);
+    mu_assert("test_replication_follower: leader gone", broker.repl.upstream_slot == 0 && broker.repl.following);
+
+    broker_free(&broker);
+    close(sub[1]);
+    close(pub[1]);
+    teardown_log_dir();
+    return 0;
+}
+
+/**
+ * @brief Tests that held confirmations are released in publish order, and dropped for
+ * publishers that have gone.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_replication_confirm_order() {
+    repl_t r;
+    repl_init(&r);
+    mu_assert("test_replication_confirm_order: hold", repl_hold_confirm(&r, 1, 10, "a", 5) == 0 &&
+              repl_hold_confirm(&r, 2, 20, "b", 1) == 0 && repl_hold_confirm(&r, 1, 10, "a", 6) == 0);
+    repl_confirm_t c;
+    // b is acknowledged, but waits behind a's first message
+    repl_acknowledge(&r, "b", 1);
+    mu_assert("test_replication_confirm_order: blocked", repl_next_confirm(&r, &c) == 0 && repl_pending(&r) == 3);
+    repl_acknowledge(&r, "a", 5);
+    mu_assert("test_replication_confirm_order: first", repl_next_confirm(&r, &c) == 1 && c.seq == 5 && c.slot == 1);
+    mu_assert("test_replication_confirm_order: second", repl_next_confirm(&r, &c) == 1 && strcmp(c.topic, "b") == 0);
+    mu_assert("test_replication_confirm_order: third waits", repl_next_confirm(&r, &c) == 0);
+    repl_acknowledge(&r, "a", 4);
+    mu_assert("test_replication_confirm_order: acks only advance", repl_acked(&r, "a") == 5);
+    repl_acknowledge(&r, "a", 6);
+    mu_assert("test_replication_confirm_order: third", repl_next_confirm(&r, &c) == 1 && c.seq == 6 &&
+              repl_pending(&r) == 0);
+
+    char host[64];
+    int port;
+    mu_assert("test_replication_confirm_order: address", repl_parse_address("127.0.0.1:8080", host, sizeof(host), &port) == 0 &&
+              strcmp(host, "127.0.0.1") == 0 && port == 8080);
+    mu_assert("test_replication_confirm_order: bad address", repl_parse_address("localhost", host, sizeof(host), &port) < 0 &&
+              repl_parse_address("h:0", host, sizeof(host), &port) < 0);
+    repl_free(&r);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all replication tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_replication_tests() {
+    mu_run_test(test_replication_leader);
+    mu_run_test(test_replication_follower);
+    mu_run_test(test_replication_confirm_order);
+    return 0;
+}
@@ -11,6 +11,22 @@
 extern char * test_set_non_blocking();
 extern char * all_message_parsing_tests();
 extern char * all_persistence_tests();
+extern char * all_protocol_tests();
+extern char * all_histogram_tests();
+extern char * all_outqueue_tests();
+extern char * all_splicefan_tests();
+extern char * all_stats_tests();
+extern char * all_admin_tests();
+extern char * all_log_tests();
+extern char * all_prof_tests();
+extern char * all_broker_tests();
+extern char * all_capture_tests();
+extern char * all_shard_tests();
+extern char * all_subtable_tests();
+extern char * all_fanpool_tests();
+extern char * all_replication_tests();
+extern char * all_partition_tests();
+extern char * all_bridge_tests();
 
 /**
  * @brief Global counter for the number of tests run.
@@ -28,6 +44,22 @@ static char * all_tests() {
     mu_run_test(test_set_non_blocking);
     mu_run_test(all_message_parsing_tests);
     mu_run_test(all_persistence_tests);
+    mu_run_test(all_protocol_tests);
+    mu_run_test(all_histogram_tests);
+    mu_run_test(all_outqueue_tests);
+    mu_run_test(all_splicefan_tests);
+    mu_run_test(all_stats_tests);
+    mu_run_test(all_admin_tests);
+    mu_run_test(all_log_tests);
+    mu_run_test(all_prof_tests);
+    mu_run_test(all_broker_tests);
+    mu_run_test(all_capture_tests);
+    mu_run_test(all_shard_tests);
+    mu_run_test(all_subtable_tests);
+    mu_run_test(all_fanpool_tests);
+    mu_run_test(all_replication_tests);
+    mu_run_test(all_partition_tests);
+    mu_run_test(all_bridge_tests);
     return 0;
 }
 
@@ -0,0 +1,209 @@
+/**
+ * @file test_shard.c
+ * @brief Unit tests for topic ownership between broker cores, driven on one thread.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../shard.h"
+#include "../utils.h"
+
+#define TEST_SHARD_SLOTS 4
+
+int send_frame(int fd, frame_type_t type, const char *topic, const char *payload, size_t len);
+
+/**
+ * @brief One broker core of a test group.
+ */
+typedef struct {
+    struct pollfd fds[TEST_SHARD_SLOTS + 1];
+    client_t clients[TEST_SHARD_SLOTS + 1];
+    broker_t broker;
+} test_core_t;
+
+/**
+ * @brief Connects a socketpair to a core and returns the peer end.
+ *
+ * @param core The core.
+ * @param slot Receives the client slot.
+ * @return int The test's end of the connection, or -1 on failure.
+ */
+static int connect_client(test_core_t *core, int *slot) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return -1;
+    }
+    set_non_blocking(sv[0]);
+    *slot = broker_add_client(&core->broker, sv[0]);
+    return sv[1];
+}
+
+/**
+ * @brief Returns a topic owned by the given core.
+ *
+ * @param group The group.
+ * @param owner The wanted owner.
+ * @param buf Receives the topic.
+ * @param size Size of buf.
+ */
+static void topic_owned_by(const shard_group_t *group, int owner, char *buf, size_t size) {
+    for (int i = 0;; i++) {
+        snprintf(buf, size, "topic%d", i);
+        if (shard_owner(group, buf) == owner) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Tests that the inbox returns messages in order and is empty afterwards.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_shard_inbox_order() {
+    shard_group_t group;
+    mu_assert("test_shard_inbox_order: init", shard_group_init(&group, 2) == 0);
+    shard_inbox_t *inbox = &group.shards[0].inbox;
+    mu_assert("test_shard_inbox_order: empty", shard_inbox_pop(inbox) == NULL);
+
+    for (int i = 0; i < 3; i++) {
+        shard_msg_t *msg = calloc(1, sizeof(*msg));
+        mu_assert("test_shard_inbox_order: alloc", msg != NULL);
+        msg->slot = i;
+        // Only the first post finds the consumer idle
+        mu_assert("test_shard_inbox_order: wake once", shard_inbox_push(inbox, msg) == (i == 0));
+    }
+    for (int i = 0; i < 3; i++) {
+        shard_msg_t *msg = shard_inbox_pop(inbox);
+        mu_assert("test_shard_inbox_order: in order", msg != NULL && msg->slot == i);
+        free(msg);
+    }
+    mu_assert("test_shard_inbox_order: drained", shard_inbox_pop(inbox) == NULL);
+
+    // A message left behind is freed with the group
+    mu_assert("test_shard_inbox_order: leftover", shard_inbox_push(inbox, calloc(1, sizeof(shard_msg_t))) == 0);
+    shard_group_free(&group);
+    return 0;
+}
+
+/**
+ * @brief Records the cores a posted function ran on.
+ *
+ * @param shard The core, or NULL if the call was discarded.
+ * @param arg An int array: calls so far, then the index of each core (-1 for discarded).
+ */
+static void record_call(shard_t *shard, void *arg) {
+    int *calls = arg;
+    calls[++calls[0]] = shard != NULL ? shard->index : -1;
+}
+
+/**
+ * @brief Tests that a posted function runs once on the receiving core when it drains its
+ * inbox, and once with no core when the group is freed first.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_shard_call() {
+    shard_group_t group;
+    mu_assert("test_shard_call: init", shard_group_init(&group, 2) == 0);
+    int calls[4] = { 0, 0, 0, 0 };
+    mu_assert("test_shard_call: post", shard_call(&group, 1, record_call, calls) == 0);
+    mu_assert("test_shard_call: not yet", calls[0] == 0);
+    mu_assert("test_shard_call: drained", shard_drain(&group.shards[1]) == 1 && calls[0] == 1 && calls[1] == 1 &&
+              group.shards[1].received == 0);
+
+    mu_assert("test_shard_call: post again", shard_call(&group, 0, record_call, calls) == 0);
+    shard_group_free(&group);
+    mu_assert("test_shard_call: discarded", calls[0] == 2 && calls[2] == -1);
+    return 0;
+}
+
+/**
+ * @brief Tests that a publish is routed through the owner and reaches subscribers on both cores,
+ * and that a subscriber on another core receives nothing live until the owner confirms it.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_shard_routes_through_owner() {
+    static test_core_t cores[2];
+    shard_group_t group;
+    mu_assert("test_shard_routes_through_owner: init", shard_group_init(&group, 2) == 0);
+    for (int i = 0; i < 2; i++) {
+        broker_init(&cores[i].broker, cores[i].fds, cores[i].clients, TEST_SHARD_SLOTS);
+        shard_attach(&group.shards[i], &cores[i].broker);
+    }
+    char topic[MAX_TOPIC_LEN];
+    topic_owned_by(&group, 1, topic, sizeof(topic));
+
+    int owner_slot, remote_slot, pub_slot;
+    int owner_sub = connect_client(&cores[1], &owner_slot);
+    int remote_sub = connect_client(&cores[0], &remote_slot);
+    int pub = connect_client(&cores[0], &pub_slot);
+    mu_assert("test_shard_routes_through_owner: connect", owner_sub >= 0 && remote_sub >= 0 && pub >= 0);
+
+    mu_assert("test_shard_routes_through_owner: send SUB", send_frame(owner_sub, FRAME_SUB, topic, NULL, 0) &&
+              send_frame(remote_sub, FRAME_SUB, topic, NULL, 0));
+    broker_handle_readable(&cores[1].broker, owner_slot);
+    broker_handle_readable(&cores[0].broker, remote_slot);
+    mu_assert("test_shard_routes_through_owner: pending", cores[0].clients[remote_slot].sub_pending == 1 &&
+              cores[1].clients[owner_slot].sub_pending == 0);
+
+    // The publish goes to the owner; nothing is delivered on the publishing core yet
+    mu_assert("test_shard_routes_through_owner: send PUB", send_frame(pub, FRAME_PUB, topic, "one", 3));
+    broker_handle_readable(&cores[0].broker, pub_slot);
+    mu_assert("test_shard_routes_through_owner: forwarded", cores[0].broker.stats.messages_out == 0 &&
+              group.shards[0].posted == 2);
+
+    // The owner confirms the subscription before it sees the publish, then fans it out
+    mu_assert("test_shard_routes_through_owner: owner drain", shard_drain(&group.shards[1]) == 2);
+    mu_assert("test_shard_routes_through_owner: owner delivered", cores[1].broker.stats.messages_out == 1);
+    mu_assert("test_shard_routes_through_owner: remote drain", shard_drain(&group.shards[0]) == 2);
+    mu_assert("test_shard_routes_through_owner: confirmed", cores[0].clients[remote_slot].sub_pending == 0 &&
+              cores[0].broker.stats.messages_out == 1);
+
+    char buf[256];
+    frame_t frame;
+    size_t consumed;
+    int subs[2] = { owner_sub, remote_sub };
+    for (int i = 0; i < 2; i++) {
+        ssize_t n = recv(subs[i], buf, sizeof(buf), MSG_DONTWAIT);
+        mu_assert("test_shard_routes_through_owner: received", n > 0 &&
+                  parse_frame(buf, (size_t)n, &frame, &consumed) == FRAME_OK && consumed == (size_t)n &&
+                  frame.type == FRAME_MSG && strcmp(frame.topic, topic) == 0 &&
+                  frame.payload_len == 3 && memcmp(frame.payload, "one", 3) == 0);
+    }
+
+    // Once the remote subscriber is gone, the next delivery withdraws the core's interest
+    close(remote_sub);
+    broker_handle_readable(&cores[0].broker, remote_slot);
+    mu_assert("test_shard_routes_through_owner: owner publish", broker_publish(&cores[1].broker, topic, "two", 3, 0) == 1);
+    mu_assert("test_shard_routes_through_owner: stale deliver", shard_drain(&group.shards[0]) == 1);
+    mu_assert("test_shard_routes_through_owner: unsubscribe", shard_drain(&group.shards[1]) == 1 &&
+              group.shards[1].topic_count == 0);
+
+    for (int i = 0; i < 2; i++) {
+        broker_free(&cores[i].broker);
+    }
+    shard_group_free(&group);
+    close(owner_sub);
+    close(pub);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all shard tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_shard_tests() {
+    mu_run_test(test_shard_inbox_order);
+    mu_run_test(test_shard_routes_through_owner);
+    mu_run_test(test_shard_call);
+    return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file test_splicefan.c
+ * @brief Unit tests for the tee/splice fan-out engine.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../splicefan.h"
+#include "../utils.h"
+
+/**
+ * @brief Tests that one loaded payload reaches several sockets intact and can be replaced.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_splice_fanout() {
+    splice_fanout_t sf;
+    if (splice_fanout_init(&sf, 64 * 1024) < 0) {
+        printf("splice fan-out not supported here, skipping\n");
+        return 0;
+    }
+    mu_assert("test_splice_fanout: capacity", sf.capacity >= 4096);
+
+    int a[2], b[2];
+    mu_assert("test_splice_fanout: socketpairs", socketpair(AF_UNIX, SOCK_STREAM, 0, a) == 0 &&
+              socketpair(AF_UNIX, SOCK_STREAM, 0, b) == 0);
+    set_non_blocking(a[0]);
+    set_non_blocking(b[0]);
+
+    static char payload[4000];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (char)('a' + i % 26);
+    }
+    mu_assert("test_splice_fanout: load", splice_fanout_load(&sf, payload, sizeof(payload)) == 0);
+    mu_assert("test_splice_fanout: first socket", splice_fanout_send(&sf, a[0]) == (ssize_t)sizeof(payload));
+    mu_assert("test_splice_fanout: second socket", splice_fanout_send(&sf, b[0]) == (ssize_t)sizeof(payload));
+
+    static char got[4000];
+    mu_assert("test_splice_fanout: read first", read(a[1], got, sizeof(got)) == (ssize_t)sizeof(got) &&
+              memcmp(got, payload, sizeof(got)) == 0);
+    mu_assert("test_splice_fanout: read second", read(b[1], got, sizeof(got)) == (ssize_t)sizeof(got) &&
+              memcmp(got, payload, sizeof(got)) == 0);
+
+    // A new payload replaces the old one rather than being appended to it
+    mu_assert("test_splice_fanout: reload", splice_fanout_load(&sf, "next", 4) == 0);
+    mu_assert("test_splice_fanout: send reloaded", splice_fanout_send(&sf, a[0]) == 4);
+    mu_assert("test_splice_fanout: read reloaded", read(a[1], got, sizeof(got)) == 4 && memcmp(got, "next", 4) == 0);
+
+    mu_assert("test_splice_fanout: oversized payload rejected", splice_fanout_load(&sf, payload, sf.capacity + 1) < 0);
+
+    splice_fanout_free(&sf);
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all splice fan-out tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_splicefan_tests() {
+    mu_run_test(test_splice_fanout);
+    return 0;
+}
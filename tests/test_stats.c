@@ -0,0 +1,80 @@
+/**
+ * @file test_stats.c
+ * @brief Unit tests for the broker's runtime counters.
+ * @author Mohammed Uddin
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "../stats.h"
+
+/**
+ * @brief Tests that topic counters are found again by name and new topics start at zero.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_stats_topic() {
+    stats_shard_t shard;
+    stats_shard_init(&shard);
+    topic_stats_t *news = stats_topic(&shard, "news");
+    mu_assert("test_stats_topic: new topic", news != NULL && news->msgs_in == 0 && strcmp(news->topic, "news") == 0);
+    news->msgs_in = 3;
+    // Enough topics to force the table to grow
+    char name[16];
+    for (int i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        mu_assert("test_stats_topic: add", stats_topic(&shard, name) != NULL);
+    }
+    mu_assert("test_stats_topic: topic count", shard.topic_count == 41);
+    mu_assert("test_stats_topic: lookup keeps counters", stats_topic(&shard, "news")->msgs_in == 3);
+    stats_shard_free(&shard);
+    return 0;
+}
+
+/**
+ * @brief Tests that merging shards sums global and per-topic counters.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_stats_merge() {
+    stats_shard_t a, b, total;
+    stats_shard_init(&a);
+    stats_shard_init(&b);
+    stats_shard_init(&total);
+    a.messages_in = 2;
+    b.messages_in = 5;
+    b.slow_disconnects = 1;
+    stats_topic(&a, "x")->bytes_in = 10;
+    stats_topic(&b, "x")->bytes_in = 7;
+    stats_topic(&b, "y")->msgs_out = 4;
+    a.slow_iterations = 1;
+    histogram_record(&a.loop_ns, 1000);
+    histogram_record(&b.loop_ns, 3000);
+    histogram_record(&b.handler_ns[STATS_HANDLER_READ], 500);
+
+    mu_assert("test_stats_merge: merge a", stats_merge(&total, &a) == 0);
+    mu_assert("test_stats_merge: merge b", stats_merge(&total, &b) == 0);
+    mu_assert("test_stats_merge: global counters", total.messages_in == 7 && total.slow_disconnects == 1);
+    mu_assert("test_stats_merge: topics", total.topic_count == 2);
+    mu_assert("test_stats_merge: shared topic summed", stats_topic(&total, "x")->bytes_in == 17);
+    mu_assert("test_stats_merge: topic from one shard", stats_topic(&total, "y")->msgs_out == 4);
+    mu_assert("test_stats_merge: loop health", total.slow_iterations == 1 && total.loop_ns.total == 2 &&
+              total.handler_ns[STATS_HANDLER_READ].total == 1 && total.handler_ns[STATS_HANDLER_WRITE].total == 0);
+    mu_assert("test_stats_merge: handler names", strcmp(stats_handler_name(STATS_HANDLER_ADMIN), "admin") == 0);
+    stats_shard_free(&a);
+    stats_shard_free(&b);
+    stats_shard_free(&total);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all stats tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_stats_tests() {
+    mu_run_test(test_stats_topic);
+    mu_run_test(test_stats_merge);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file test_subtable.c
+ * @brief Unit tests for the subscription index and its snapshot reclamation.
+ * @author Mohammed Uddin
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "../subtable.h"
+
+#define TEST_SUBTABLE_ROUNDS 200
+
+/**
+ * @brief Tests that changes become visible together on publish, with subscribers by slot.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_subtable_publish_batches() {
+    subtable_t t;
+    subtable_init(&t);
+    mu_assert("test_subtable_publish_batches: empty", subtable_lookup(subtable_current(&t), "news") == NULL);
+
+    mu_assert("test_subtable_publish_batches: add", subtable_add(&t, "news", 3, 30) == 0 &&
+              subtable_add(&t, "news", 1, 10) == 0 && subtable_add(&t, "sport", 2, 20) == 0);
+    mu_assert("test_subtable_publish_batches: not yet visible", subtable_lookup(subtable_current(&t), "news") == NULL);
+    mu_assert("test_subtable_publish_batches: publish", subtable_publish(&t) == 0 && t.publishes == 1);
+
+    const subtable_topic_t *news = subtable_lookup(subtable_current(&t), "news");
+    mu_assert("test_subtable_publish_batches: news", news != NULL && news->count == 2 &&
+              news->entries[0].slot == 1 && news->entries[1].slot == 3 && news->entries[1].conn_id == 30);
+    mu_assert("test_subtable_publish_batches: sport", subtable_lookup(subtable_current(&t), "sport")->count == 1);
+
+    // A slot reused within one batch keeps only the new connection
+    mu_assert("test_subtable_publish_batches: reuse", subtable_remove(&t, 1, 10) == 0 &&
+              subtable_add(&t, "sport", 1, 40) == 0 && subtable_remove(&t, 2, 20) == 0);
+    mu_assert("test_subtable_publish_batches: republish", subtable_publish(&t) == 0 && t.publishes == 2);
+    news = subtable_lookup(subtable_current(&t), "news");
+    const subtable_topic_t *sport = subtable_lookup(subtable_current(&t), "sport");
+    mu_assert("test_subtable_publish_batches: after", news != NULL && news->count == 1 && news->entries[0].slot == 3 &&
+              sport != NULL && sport->count == 1 && sport->entries[0].conn_id == 40);
+
+    // Nothing to publish, nothing rebuilt; without readers every replaced snapshot is freed
+    mu_assert("test_subtable_publish_batches: idle", subtable_publish(&t) == 0 && t.publishes == 2);
+    mu_assert("test_subtable_publish_batches: reclaimed", t.retired == NULL && t.reclaimed == 1);
+    subtable_free(&t);
+    return 0;
+}
+
+/**
+ * @brief Tests that a replaced snapshot survives until every online reader is quiescent.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_subtable_reclaims_after_quiescence() {
+    subtable_t t;
+    subtable_init(&t);
+    subtable_reader_t *busy = subtable_register_reader(&t);
+    subtable_reader_t *idle = subtable_register_reader(&t);
+    mu_assert("test_subtable_reclaims_after_quiescence: register", busy != NULL && idle != NULL && busy != idle);
+    subtable_offline(idle);
+
+    subtable_add(&t, "news", 1, 1);
+    subtable_publish(&t);
+    const subtable_snapshot_t *held = subtable_current(&t);
+    subtable_add(&t, "news", 2, 2);
+    subtable_publish(&t);
+    mu_assert("test_subtable_reclaims_after_quiescence: held", t.retired == held && t.reclaimed == 0);
+    mu_assert("test_subtable_reclaims_after_quiescence: still readable", subtable_lookup(held, "news")->count == 1);
+
+    subtable_quiescent(&t, busy);
+    subtable_add(&t, "news", 3, 3);
+    subtable_publish(&t);
+    mu_assert("test_subtable_reclaims_after_quiescence: freed", t.reclaimed == 1 && t.retired != NULL &&
+              t.retired->next == NULL);
+
+    subtable_unregister_reader(busy);
+    subtable_unregister_reader(idle);
+    subtable_free(&t);
+    return 0;
+}
+
+/**
+ * @brief State shared with the reader thread of test_subtable_concurrent_readers().
+ */
+typedef struct {
+    subtable_t *t;              ///< The index.
+    subtable_reader_t *reader;  ///< The reader's registration.
+    int done;                   ///< Set by the writer when it has finished.
+    int errors;                 ///< Snapshots the reader found inconsistent.
+    size_t last;                ///< Subscribers in the newest snapshot the reader saw.
+} test_subtable_reader_ctx_t;
+
+/**
+ * @brief Reads the index until the writer is done, checking that snapshots only grow.
+ *
+ * @param arg The test_subtable_reader_ctx_t.
+ * @return void* NULL.
+ */
+static void *test_subtable_reader(void *arg) {
+    test_subtable_reader_ctx_t *ctx = arg;
+    while (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE)) {
+        const subtable_topic_t *topic = subtable_lookup(subtable_current(ctx->t), "load");
+        size_t count = topic != NULL ? topic->count : 0;
+        for (size_t i = 0; i < count; i++) {
+            if (topic->entries[i].slot != (int)i + 1 || topic->entries[i].conn_id != i + 1) {
+                ctx->errors++;
+            }
+        }
+        if (count < ctx->last) {
+            ctx->errors++;
+        }
+        ctx->last = count;
+        subtable_quiescent(ctx->t, ctx->reader);
+    }
+    subtable_offline(ctx->reader);
+    return NULL;
+}
+
+/**
+ * @brief Tests that a reader thread sees only complete snapshots while the writer replaces them.
+ *
+ * @return char* NULL if the test passes, otherwise an error message.
+ */
+char * test_subtable_concurrent_readers() {
+    subtable_t t;
+    subtable_init(&t);
+    test_subtable_reader_ctx_t ctx = { &t, subtable_register_reader(&t), 0, 0, 0 };
+    pthread_t thread;
+    mu_assert("test_subtable_concurrent_readers: start", pthread_create(&thread, NULL, test_subtable_reader, &ctx) == 0);
+    for (int i = 1; i <= TEST_SUBTABLE_ROUNDS; i++) {
+        subtable_add(&t, "load", i, (uint32_t)i);
+        subtable_add(&t, "noise", i, (uint32_t)(TEST_SUBTABLE_ROUNDS + i));
+        subtable_publish(&t);
+    }
+    __atomic_store_n(&ctx.done, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    mu_assert("test_subtable_concurrent_readers: consistent", ctx.errors == 0);
+    mu_assert("test_subtable_concurrent_readers: published", t.publishes == TEST_SUBTABLE_ROUNDS &&
+              subtable_lookup(subtable_current(&t), "load")->count == TEST_SUBTABLE_ROUNDS);
+    subtable_unregister_reader(ctx.reader);
+    subtable_free(&t);
+    return 0;
+}
+
+/**
+ * @brief Aggregates and runs all subscription index tests.
+ *
+ * @return char* NULL if all tests pass, otherwise an error message from a failed test.
+ */
+char * all_subtable_tests() {
+    mu_run_test(test_subtable_publish_batches);
+    mu_run_test(test_subtable_reclaims_after_quiescence);
+    mu_run_test(test_subtable_concurrent_readers);
+    return 0;
+}
@@ -4,8 +4,10 @@
  * @author Mohammed Uddin
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <fcntl.h>
 #include <stdio.h>
+#include <time.h>
 #include "utils.h"
 
 /**
@@ -26,3 +28,14 @@ void set_non_blocking(int fd) {
         perror("fcntl(F_SETFL)");
     }
 }
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch (CLOCK_MONOTONIC).
+ */
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
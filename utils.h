@@ -7,6 +7,8 @@
 #ifndef LITEMQ_UTILS_H
 #define LITEMQ_UTILS_H
 
+#include <stdint.h>
+
 /**
  * @brief Sets a given file descriptor to non-blocking mode.
  *
@@ -14,4 +16,11 @@
  */
 void set_non_blocking(int fd);
 
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch (CLOCK_MONOTONIC).
+ */
+uint64_t monotonic_ns(void);
+
 #endif // LITEMQ_UTILS_H